@@ -0,0 +1,279 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+
+/* Non-interactive checking of many MIDI files at once.  Files are
+ * handed out to worker threads one at a time; each thread loads its
+ * file with its own exception recovery point, so a broken file is
+ * reported instead of ending the program.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "batch.h"
+#include "jpmidi.h"
+#include "songstats.h"
+#include "json.h"
+#include "except.h"
+
+#define BATCH_MAX_THREADS 64
+
+typedef struct batch
+{
+    GPtrArray* files;               /**< char* paths, in the order they are reported. */
+    GString** results;              /**< Result line per file, NULL until it is done. */
+    guint next_file;                /**< Next file to hand out. */
+    guint next_print;               /**< Next result to print. */
+    guint failed;
+    pthread_mutex_t lock;
+
+    jack_nframes_t sample_rate;
+    const char* cache_dir;
+    export_format_t format;
+} batch_t;
+
+/** A file being loaded by batch_load(). */
+typedef struct batch_load
+{
+    char* path;
+    jack_nframes_t sample_rate;
+    jpmidi_root_t* root;
+} batch_load_t;
+
+static const char* cache_extensions[] = { ".csv", ".jsonl", ".jpev" };
+
+static int batch_is_midi_name( const char* name)
+{
+    const char* dot = strrchr( name, '.');
+    return dot && (strcasecmp( dot, ".mid") == 0 || strcasecmp( dot, ".midi") == 0 ||
+                   strcasecmp( dot, ".kar") == 0 || strcasecmp( dot, ".smf") == 0);
+}
+
+static gint batch_compare_names( gconstpointer a, gconstpointer b)
+{
+    return strcmp( *(char* const*)a, *(char* const*)b);
+}
+
+/** Add path to files, the MIDI files below it if it is a directory.
+ *  Paths given on the command line are added whatever their name, so
+ *  one that can not be read is reported.
+ */
+static void batch_add_path( GPtrArray* files, const char* path, int named)
+{
+    struct stat st;
+    DIR* dir;
+    struct dirent* entry;
+    GPtrArray* names;
+    int i;
+
+    if (stat( path, &st) != 0) {
+        if (named) g_ptr_array_add( files, g_strdup( path));
+        return;
+    }
+    if (!S_ISDIR( st.st_mode)) {
+        if (named || (S_ISREG( st.st_mode) && batch_is_midi_name( path)))
+            g_ptr_array_add( files, g_strdup( path));
+        return;
+    }
+
+    if ((dir = opendir( path)) == NULL) {
+        fprintf( stderr, "Can't read directory %s: %s\n", path, strerror( errno));
+        return;
+    }
+    names = g_ptr_array_new();
+    while ((entry = readdir( dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        g_ptr_array_add( names, g_strdup_printf( "%s/%s", path, entry->d_name));
+    }
+    closedir( dir);
+
+    // Sorted so the report is the same from one run to the next.
+    g_ptr_array_sort( names, batch_compare_names);
+    for (i = 0; i < names->len; i++) {
+        batch_add_path( files, g_ptr_array_index( names, i), 0);
+        g_free( g_ptr_array_index( names, i));
+    }
+    g_ptr_array_free( names, TRUE);
+}
+
+/** Name of the cache file of path, the path flattened into one file name. */
+static char* batch_cache_name( batch_t* batch, const char* path)
+{
+    char* name;
+    char* p;
+
+    while (path[0] == '.' && path[1] == '/') path += 2;
+    while (path[0] == '/') path++;
+    name = g_strdup_printf( "%s/%s%s", batch->cache_dir, path, cache_extensions[batch->format]);
+    for (p = name + strlen( batch->cache_dir) + 1; *p; p++)
+        if (*p == '/') *p = '_';
+    return name;
+}
+
+/** except_catch() function loading one file. */
+static void batch_load( void* arg)
+{
+    batch_load_t* load = (batch_load_t*)arg;
+    load->root = jpmidi_loadfile( load->path, load->sample_rate);
+}
+
+/** Load one file and describe the outcome in line.  Returns 1 on success. */
+static int batch_check_file( batch_t* batch, char* path, GString* line)
+{
+    batch_load_t load = { path, batch->sample_rate, NULL };
+    struct except* e;
+    char message[256];
+    struct timespec start, end;
+    char* cache = NULL;
+    int ok = 1;
+
+    clock_gettime( CLOCK_MONOTONIC, &start);
+    e = except_catch( batch_load, &load, message, sizeof( message));
+    clock_gettime( CLOCK_MONOTONIC, &end);
+
+    if (e == NULL && load.root == NULL) {
+        e = ioError;
+        g_strlcpy( message, "Could not read file", sizeof( message));
+    }
+
+    g_string_append( line, "{\"file\":");
+    json_append_string( line, path);
+
+    if (e != NULL) {
+        g_string_append_printf( line, ",\"ok\":false,\"error\":\"%s\",\"message\":",
+                                e == formatError ? "format" : e == ioError ? "io" : "internal");
+        json_append_string( line, message);
+        g_string_append( line, "}\n");
+        return 0;
+    }
+
+    if (batch->cache_dir) {
+        uint64_t count;
+        cache = batch_cache_name( batch, path);
+        if (export_song( load.root, cache, batch->format, 1, &count)) {
+            g_string_append( line, ",\"ok\":false,\"error\":\"cache\",\"message\":");
+            json_append_string( line, strerror( errno));
+            ok = 0;
+        }
+    }
+    if (ok) g_string_append( line, ",\"ok\":true");
+
+    g_string_append_printf( line, ",\"ms\":%.3f,\"song\":",
+                            (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0);
+    songstats_json( line, load.root);
+    if (cache) {
+        g_string_append( line, ",\"cache\":");
+        json_append_string( line, cache);
+        g_free( cache);
+    }
+    g_string_append( line, "}\n");
+
+    jpmidi_root_free( load.root);
+    return ok;
+}
+
+/** Worker thread, takes files until there are none left.  Results are
+ *  printed as soon as those of all earlier files are.
+ */
+static void* batch_worker( void* arg)
+{
+    batch_t* batch = (batch_t*)arg;
+    GString* line;
+    guint i;
+    int ok;
+
+    for (;;) {
+        pthread_mutex_lock( &batch->lock);
+        i = batch->next_file++;
+        pthread_mutex_unlock( &batch->lock);
+        if (i >= batch->files->len) break;
+
+        line = g_string_new( NULL);
+        ok = batch_check_file( batch, g_ptr_array_index( batch->files, i), line);
+
+        pthread_mutex_lock( &batch->lock);
+        if (!ok) batch->failed++;
+        batch->results[i] = line;
+        while (batch->next_print < batch->files->len && batch->results[batch->next_print]) {
+            line = batch->results[batch->next_print];
+            fwrite( line->str, 1, line->len, stdout);
+            g_string_free( line, TRUE);
+            batch->next_print++;
+        }
+        fflush( stdout);
+        pthread_mutex_unlock( &batch->lock);
+    }
+    return NULL;
+}
+
+int batch_run( char** paths, int count, int threads, jack_nframes_t sample_rate,
+               const char* cache_dir, export_format_t format)
+{
+    batch_t batch;
+    pthread_t tids[BATCH_MAX_THREADS];
+    struct timespec start, end;
+    int i, started;
+
+    if (cache_dir && mkdir( cache_dir, 0755) != 0 && errno != EEXIST) {
+        fprintf( stderr, "Can't create %s: %s\n", cache_dir, strerror( errno));
+        return 1;
+    }
+
+    memset( &batch, 0, sizeof( batch));
+    batch.files = g_ptr_array_new();
+    batch.sample_rate = sample_rate;
+    batch.cache_dir = cache_dir;
+    batch.format = format;
+    pthread_mutex_init( &batch.lock, NULL);
+
+    clock_gettime( CLOCK_MONOTONIC, &start);
+    for (i = 0; i < count; i++)
+        batch_add_path( batch.files, paths[i], 1);
+    batch.results = g_new0( GString*, batch.files->len + 1);
+
+    if (threads <= 0) threads = sysconf( _SC_NPROCESSORS_ONLN);
+    if (threads > BATCH_MAX_THREADS) threads = BATCH_MAX_THREADS;
+    if (threads > (int)batch.files->len) threads = batch.files->len;
+    if (threads < 1) threads = 1;
+
+    for (started = 0; started < threads; started++)
+        if (pthread_create( &tids[started], NULL, batch_worker, &batch) != 0) break;
+    // Without any thread the work is done here.
+    if (started == 0) batch_worker( &batch);
+    for (i = 0; i < started; i++)
+        pthread_join( tids[i], NULL);
+    clock_gettime( CLOCK_MONOTONIC, &end);
+
+    fprintf( stderr, "%u files, %u failed, %d threads, %.1f seconds\n",
+             batch.files->len, batch.failed, started ? started : 1,
+             (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+    for (i = 0; i < batch.files->len; i++)
+        g_free( g_ptr_array_index( batch.files, i));
+    g_ptr_array_free( batch.files, TRUE);
+    g_free( batch.results);
+    pthread_mutex_destroy( &batch.lock);
+
+    return batch.failed ? 1 : 0;
+}
@@ -0,0 +1,46 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+
+#ifndef __batch_h__
+#define __batch_h__
+
+/* Definitions generated by autotools. */
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <jack/jack.h>
+#include "export.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Load every MIDI file named by paths, directories searched
+ *  recursively for .mid, .midi, .kar and .smf files, on a pool of
+ *  threads (0 for one per CPU).  One JSON line per file is printed to
+ *  stdout in path order, holding the statistics of the song or the
+ *  reason it failed to load.  When cache_dir is not NULL every song
+ *  that loads is also exported to it in the given format.  Returns 0
+ *  when all files loaded, 1 otherwise.
+ */
+int batch_run( char** paths, int count, int threads, jack_nframes_t sample_rate,
+               const char* cache_dir, export_format_t format);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __batch_h__ */
@@ -0,0 +1,191 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+
+/* Capture of the events received on the input port.  The process
+ * thread writes them into a lock-free ring, a low priority thread moves
+ * them into memory where the command side can get at them.
+ */
+
+#include <glib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <jack/ringbuffer.h>
+
+#include "capture.h"
+
+#define RING_SIZE (256 * 1024)
+#define DRAIN_USECS 20000
+
+/** Header of one message in the ring, the data bytes follow. */
+typedef struct capture_record
+{
+    jpmidi_frame_t frame;
+    uint32_t       len;
+} capture_record_t;
+
+/** A captured message.  The bytes are stored in capture_data. */
+typedef struct captured
+{
+    jpmidi_frame_t frame;
+    uint32_t       offset;
+    uint32_t       len;
+} captured_t;
+
+static jack_ringbuffer_t* ring = NULL;
+static pthread_t drain_thread;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int running = 0;
+static int enabled = 0;
+static int overruns = 0;
+
+static GArray* captured = NULL;         /* captured_t */
+static GByteArray* capture_data = NULL;
+
+void* capture_drain( void* arg);
+void capture_drain_ring();
+
+int capture_init()
+{
+    ring = jack_ringbuffer_create( RING_SIZE);
+    if (ring == NULL) {
+        fprintf( stderr, "cannot allocate capture ring\n");
+        return 1;
+    }
+    jack_ringbuffer_mlock( ring);
+
+    captured = g_array_new( FALSE, FALSE, sizeof( captured_t));
+    capture_data = g_byte_array_new();
+
+    __atomic_store_n( &running, 1, __ATOMIC_RELEASE);
+    if (pthread_create( &drain_thread, NULL, capture_drain, NULL)) {
+        fprintf( stderr, "cannot start capture thread\n");
+        __atomic_store_n( &running, 0, __ATOMIC_RELEASE);
+        return 1;
+    }
+    return 0;
+}
+
+void capture_shutdown()
+{
+    if (!__atomic_load_n( &running, __ATOMIC_ACQUIRE)) return;
+
+    __atomic_store_n( &running, 0, __ATOMIC_RELEASE);
+    pthread_join( drain_thread, NULL);
+
+    jack_ringbuffer_free( ring);
+    ring = NULL;
+    g_array_free( captured, TRUE);
+    g_byte_array_free( capture_data, TRUE);
+}
+
+void capture_set_enabled( int enable)
+{
+    __atomic_store_n( &enabled, enable, __ATOMIC_RELEASE);
+}
+
+int capture_is_enabled()
+{
+    return ring != NULL && __atomic_load_n( &enabled, __ATOMIC_ACQUIRE);
+}
+
+void capture_write( jpmidi_frame_t frame, const unsigned char* data, size_t len)
+{
+    capture_record_t record = { frame, (uint32_t)len };
+
+    if (jack_ringbuffer_write_space( ring) < sizeof(record) + len) {
+        __atomic_fetch_add( &overruns, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    // The reader waits until the data following a header is complete.
+    jack_ringbuffer_write( ring, (const char*)&record, sizeof(record));
+    jack_ringbuffer_write( ring, (const char*)data, len);
+}
+
+int capture_get_count()
+{
+    pthread_mutex_lock( &lock);
+    int count = captured ? captured->len : 0;
+    pthread_mutex_unlock( &lock);
+    return count;
+}
+
+int capture_get_overruns()
+{
+    return __atomic_load_n( &overruns, __ATOMIC_RELAXED);
+}
+
+void capture_clear()
+{
+    pthread_mutex_lock( &lock);
+    g_array_set_size( captured, 0);
+    g_byte_array_set_size( capture_data, 0);
+    pthread_mutex_unlock( &lock);
+    __atomic_store_n( &overruns, 0, __ATOMIC_RELAXED);
+}
+
+int capture_save( const char* filename)
+{
+    FILE* fp = fopen( filename, "w");
+    if (fp == NULL) return 1;
+
+    pthread_mutex_lock( &lock);
+    int i;
+    for (i = 0; i < captured->len; i++) {
+        captured_t* c = &g_array_index( captured, captured_t, i);
+        int j;
+        fprintf( fp, "%10llu ", (unsigned long long)c->frame);
+        for (j = 0; j < c->len; j++)
+            fprintf( fp, " %02x", capture_data->data[c->offset + j]);
+        fprintf( fp, "\n");
+    }
+    pthread_mutex_unlock( &lock);
+
+    return fclose( fp) != 0;
+}
+
+/////////// INTERNAL USE ONLY ///////////////////
+
+/** Move everything in the ring into the captured array. */
+void capture_drain_ring()
+{
+    capture_record_t record;
+
+    while (jack_ringbuffer_read_space( ring) >= sizeof(record))
+    {
+        jack_ringbuffer_peek( ring, (char*)&record, sizeof(record));
+        if (jack_ringbuffer_read_space( ring) < sizeof(record) + record.len) break;
+        jack_ringbuffer_read_advance( ring, sizeof(record));
+
+        pthread_mutex_lock( &lock);
+        captured_t c = { record.frame, capture_data->len, record.len };
+        g_byte_array_set_size( capture_data, capture_data->len + record.len);
+        jack_ringbuffer_read( ring, (char*)capture_data->data + c.offset, record.len);
+        g_array_append_val( captured, c);
+        pthread_mutex_unlock( &lock);
+    }
+}
+
+/** Drain thread. */
+void* capture_drain( void* arg)
+{
+    while (__atomic_load_n( &running, __ATOMIC_ACQUIRE))
+    {
+        capture_drain_ring();
+        usleep( DRAIN_USECS);
+    }
+    capture_drain_ring();
+    return NULL;
+}
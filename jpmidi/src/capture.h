@@ -0,0 +1,68 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+#ifndef __capture_h__
+#define __capture_h__
+
+/* Definitions generated by autotools. */
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <jack/jack.h>
+#include <jack/types.h>
+#include "jpmidi.h"
+
+/** Create the capture ring and start the thread that drains it.
+ * Returns 0 on success, 1 otherwise.
+ */
+int capture_init();
+
+/** Stop the drain thread and free everything captured. */
+void capture_shutdown();
+
+/** Start/stop recording events received on the input port. */
+void capture_set_enabled( int enabled);
+
+/** Returns true while recording. */
+int capture_is_enabled();
+
+/** Queue one received message for capture.  Process thread only, never blocks. */
+void capture_write( jpmidi_frame_t frame, const unsigned char* data, size_t len);
+
+/** Returns the number of messages captured so far. */
+int capture_get_count();
+
+/** Returns the number of messages lost because the ring was full. */
+int capture_get_overruns();
+
+/** Forget everything captured so far. */
+void capture_clear();
+
+/** Write the captured messages to a file, one per line with the song
+ * frame followed by the message bytes in hex.  Returns 0 on success.
+ */
+int capture_save( const char* filename);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __capture_h__ */
+    
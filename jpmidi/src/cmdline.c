@@ -24,6 +24,7 @@
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
+#include <poll.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 #include <jack/jack.h>
@@ -38,6 +39,7 @@
 
 static char *package = "jpmidi";				/* program name */
 int done = 0;
+static int wake_pipe[2] = { -1, -1 };	/* written by cmdline_quit() */
 
 void signal_handler(int sig)
 {
@@ -67,10 +69,41 @@ char *stripwhite(char *string)
      
 /*--------------CMDLINE-----------------------*/
 
+/* Called by readline for each complete line, NULL on EOF. */
+static void line_handler(char *line)
+{
+	char *cmd;
+
+	if (line == NULL) {	/* EOF? */
+		printf("\n");	/* close out prompt */
+		done = 1;
+		return;
+	}
+
+	/* Remove leading and trailing whitespace from the line. */
+	cmd = stripwhite(line);
+
+	/* If anything left, add to history and execute it. */
+	if (*cmd)
+	{
+		add_history(cmd);
+		if(execute_command(cmd))
+		{
+		  done = 1;
+		}
+	}
+
+	free(line);		/* readline() called malloc() */
+}
+
+/* Readline is driven through its callback interface so the loop can
+ * also be woken up by cmdline_quit() from another thread, for instance
+ * when a TCP client shuts the server down.
+ */
 void command_loop()
 {
-	char *line, *cmd;
 	char prompt[32];
+	struct pollfd fds[2];
 
 	snprintf(prompt, sizeof(prompt), "%s> ", package);
 
@@ -80,32 +113,35 @@ void command_loop()
 	/* Define a custom completion function. */
 	rl_completion_entry_function = command_generator;
 
+	rl_callback_handler_install(prompt, line_handler);
+
+	fds[0].fd = fileno(rl_instream ? rl_instream : stdin);
+	fds[0].events = POLLIN;
+	fds[1].fd = wake_pipe[0];
+	fds[1].events = POLLIN;
+
 	/* Read and execute commands until the user quits. */
 	while (!done) {
 
-		line = readline(prompt);
-     
-		if (line == NULL) {	/* EOF? */
-			printf("\n");	/* close out prompt */
-			done = 1;
+		if (poll(fds, wake_pipe[0] >= 0 ? 2 : 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
 			break;
 		}
-     
-		/* Remove leading and trailing whitespace from the line. */
-		cmd = stripwhite(line);
 
-		/* If anything left, add to history and execute it. */
-		if (*cmd)
-		{
-			add_history(cmd);
-			if(execute_command(cmd))
-			{
-			  done = 1;
-			}
-		}
-     
-		free(line);		/* readline() called malloc() */
+		if (fds[0].revents)
+			rl_callback_read_char();
 	}
+
+	rl_callback_handler_remove();
+}
+
+void cmdline_quit()
+{
+	done = 1;
+	if (wake_pipe[1] >= 0 && write(wake_pipe[1], "q", 1) < 0)
+		perror("write");
 }
 
 void cmdline()
@@ -116,6 +152,9 @@ void cmdline()
 	signal(SIGHUP, signal_handler);
 	signal(SIGINT, signal_handler);
 
+	if (pipe(wake_pipe) < 0)
+		perror("pipe");
+
 	/* execute commands until done */
 	command_loop();
 
@@ -28,6 +28,9 @@ extern "C" {
 #endif
 
 void cmdline();
+
+/** Make cmdline() return.  May be called from any thread. */
+void cmdline_quit();
 char *stripwhite(char *string);
     
 #ifdef __cplusplus
@@ -7,6 +7,8 @@
 #include <readline/readline.h>
 #include <readline/history.h>
 #include <string.h>
+#include <stdarg.h>
+#include <pthread.h>
 #include <jack/jack.h>
 #include <jack/transport.h>
 
@@ -14,6 +16,20 @@
 #include "jpmidi.h"
 #include "main.h"
 #include "jackclient.h"
+#include "lookahead.h"
+#include "capture.h"
+#include "scene.h"
+#include "tempomap.h"
+#include "export.h"
+#include "songstats.h"
+#include "eventindex.h"
+#include "smfwrite.h"
+#include "memstats.h"
+#include "reload.h"
+#include "transform.h"
+#include "setlist.h"
+#include "slot.h"
+#include "json.h"
 #include "commands.h"
 #include "elements.h"
 
@@ -22,45 +38,126 @@ static int64_t last_dump_count = -1;
 
 static char* client_disabled_message = "Jack client disabled.";
 
+/* Commands arrive from the console and from the TCP server thread, only
+ * one of them runs at a time. */
+static pthread_mutex_t dispatch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Where command output goes while a result is being captured, NULL
+ * means the console.  Only touched with dispatch_lock held. */
+static FILE* output = NULL;
+static FILE* data_output = NULL;
+static int command_failed = 0;
+
 /* forward declarations */
 void com_help(char *);
 void com_exit(char *arg);
 void com_channels(char* arg);
 void com_status(char* arg);
+void com_stats(char* arg);
+void com_analyze(char* arg);
+void com_memory(char* arg);
+void com_reload(char* arg);
+void com_setlist(char* arg);
+void com_slot(char* arg);
 void com_sysex(char* arg);
 void com_solo(char* arg);
 void com_mute(char* arg);
 void com_unmute(char* arg);
+void com_transpose(char* arg);
+void com_transform(char* arg);
+void com_scene(char* arg);
+void com_at(char* arg);
 void com_dump(char* arg);
-void connect_util( char* arg, int disconnect, char* verb, char* direction);
+void com_export(char* arg);
+void com_save(char* arg);
+void com_query(char* arg);
+static int parse_channels( char* list, uint32_t* mask);
+void connect_util( char* arg, jack_port_t* port, int disconnect, char* verb, char* direction);
 void com_connect( char* arg);
 void com_disconnect( char* arg);
+void com_input( char* arg);
+void com_noinput( char* arg);
+void com_capture( char* arg);
 void com_play(char *arg);
 void com_stop(char *arg);
 void com_locate(char *arg);
+void com_latency(char *arg);
 command_t *find_command(char *name);
 
-/* command table must be in alphabetical order */
+/* A prefix runs the first command it matches, unless the next one
+   matches too, so the order decides the abbreviations.  Commands that
+   share a prefix with an older one go after quit, leaving the short
+   forms people type (s, m, l, e, q...) as they were. */
 command_t commands[] = {
     {"connect",     com_connect,    "Connect to port [port num].  List if no arg is given"},
     {"disconnect",  com_disconnect, "Disconnect from port [port num]"},
+    {"input",       com_input,      "Connect input from port [port num].  List if no arg is given"},
+    {"noinput",     com_noinput,    "Disconnect input from port [port num]"},
+    {"capture",     com_capture,    "Capture input events [start | stop | clear | save <file>]"},
     {"status",      com_status,     "Display status"},
+    {"analyze",     com_analyze,    "Find the busiest windows of 64 to 4096 frames"},
     {"channels",    com_channels,   "Display channel info"},
     {"sysex",       com_sysex,      "Enable or disable sending of sysex messages <0|1>"},
     {"solo",        com_solo,       "Solo channel <0 | 1-16>.  0 disables solo"},
     {"mute",        com_mute,       "Mute channel <1-16>"},
     {"unmute",      com_unmute,     "Unmute channel <1-16>"},
+    {"transpose",   com_transpose,  "Transpose channel <1-16> by <semitones>"},
+    {"transform",   com_transform,  "Channel transforms [<channels | all> <settings> | reset [channels]]"},
+    {"scene",       com_scene,      "Scenes [store <name> [settings] | recall <name> | apply <settings> | show <name> | delete <name>]"},
+    {"at",          com_at,         "Run a command at <beat | bar | marker | tick <n>> <command>.  [clear] cancels"},
     {"play",        com_play,       "Start transport rolling"},
     {"start",       com_play,       "Start transport rolling"},
     {"stop",        com_stop,       "Stop transport"},
-    {"locate",      com_locate,     "Locate to frame <position>"},
+    {"locate",      com_locate,     "Locate to <frame | <n>t | bar|beat[|tick] | <n>s | [hh:]mm:ss[.ms] | @marker>"},
     {"dump",        com_dump,       "Dump event info [tick count] [start tick]"},
+    {"save",        com_save,       "Write the song as heard now to a MIDI file <file> [0|1]"},
+    {"reload",      com_reload,     "Load the changed file again, keeping the position"},
+    {"setlist",     com_setlist,    "Setlist [add <file> | next | goto <n> | arm <n> | auto <0|1>]"},
+    {"slot",        com_slot,       "Songs next to the main one [load <file> [offset] | <n> <offset <position> | mute <ch> | unmute <ch> | solo <ch> | connect [port num] | disconnect [port num] | unload>]"},
     {"exit",        com_exit,       "Exit jpmidi"},
     {"quit",        com_exit,       "Quit jpmidi"},
+    {"stats",       com_stats,      "Display process() performance counters [reset]"},
+    {"latency",     com_latency,    "Display output latency [auto <0|1>] [offset <frames>]"},
+    {"export",      com_export,     "Write all events to a file <csv | jsonl | binary> <file> [threads]"},
+    {"query",       com_query,      "Find events [ch <list>] [type <list>] [note <n[-n]>] [from <position>] [to <position>] [limit <n>]"},
+    {"memory",      com_memory,     "Display memory used per data structure"},
     {"help",        com_help,       "Display help text [<command>]"},
     {(char *)NULL, (cmd_function_t *)NULL, (char *)NULL }
 };
 
+/* ---- Command output ---- */
+
+FILE* cmd_output()
+{
+    return output ? output : stdout;
+}
+
+void cmd_printf(const char* format, ...)
+{
+    va_list ap;
+    va_start( ap, format);
+    vfprintf( cmd_output(), format, ap);
+    va_end( ap);
+}
+
+void cmd_error(const char* format, ...)
+{
+    va_list ap;
+    command_failed = 1;
+    va_start( ap, format);
+    vfprintf( output ? output : stderr, format, ap);
+    va_end( ap);
+}
+
+void cmd_data(const char* format, ...)
+{
+    va_list ap;
+    if (data_output == NULL) return;
+    va_start( ap, format);
+    vfprintf( data_output, format, ap);
+    va_end( ap);
+}
+
 /* ---- Command functions ---- */
 
 void com_help(char *arg)
@@ -71,30 +168,30 @@ void com_help(char *arg)
 	if (!*arg) {
 		/* print help for all commands */
 		for (i = 0; commands[i].name; i++) {
-			printf("%-12s\t%s.\n", commands[i].name,
+			cmd_printf("%-12s\t%s.\n", commands[i].name,
 			       commands[i].doc);
 		}
 
 	} else if ((cmd = find_command(arg))) {
-		printf("-12%s\t%s.\n", cmd->name, cmd->doc);
+		cmd_printf("%-12s\t%s.\n", cmd->name, cmd->doc);
 
 	} else {
 		int printed = 0;
 
-		printf("No `%s' command.  Valid command names are:\n", arg);
+		cmd_error("No `%s' command.  Valid command names are:\n", arg);
 
 		for (i = 0; commands[i].name; i++) {
 			/* Print in six columns. */
 			if (printed == 6) {
 				printed = 0;
-				printf ("\n");
+				cmd_printf("\n");
 			}
 
-			printf ("%s\t", commands[i].name);
+			cmd_printf("%s\t", commands[i].name);
 			printed++;
 		}
 
-		printf("\n\nTry `help [command]\' for more information.\n");
+		cmd_printf("\n\nTry `help [command]\' for more information.\n");
 	}
 }
 
@@ -110,53 +207,55 @@ void com_channels(char* arg)
     jpmidi_root_t* root = main_get_jpmidi_root();
     if (arg == NULL) arg = "";
 
-    printf("%sSolo: ", arg);
-    if (jpmidi_get_solo_channel( root) == -1) printf("off\n");
-    else printf("channel %d\n", jpmidi_get_solo_channel( root)+1);
+    cmd_printf("%sSolo: ", arg);
+    if (jpmidi_get_solo_channel( root) == -1) cmd_printf("off\n");
+    else cmd_printf("channel %d\n", jpmidi_get_solo_channel( root)+1);
     for (i = 0; i < 16; i++) {
         if (!jpmidi_channel_has_data( root, i)) continue;
-        printf("%schannel %2d, muted: %d, program: %s\n",
+        cmd_printf("%schannel %2d, muted: %d, transpose: %d, program: %s\n",
                arg,
                jpmidi_channel_get_number( root, i),
                jpmidi_channel_is_muted( root, i),
+               jpmidi_channel_get_transpose( root, i),
                jpmidi_channel_get_program( root,i));
     }
 }
 
 void com_status(char* arg)
 {
-    // Display some statistics
+    // The song statistics were collected when it was loaded.
     jpmidi_root_t* root = main_get_jpmidi_root();
-    jpmidi_time_t* node = jpmidi_get_time_head( root);
-    uint32_t ecount = 0;
-    uint32_t tcount = 0;
-    while (node) {
-        ecount += jpmidi_time_get_event_count(node);
-        tcount += 1;
-        node = jpmidi_time_get_next(node);
-    }
-
-    printf("MIDI file: %s\n", jpmidi_get_filename( root));
-    printf("   SMF timebase: %u\n", jpmidi_get_smf_timebase(root));
-    printf("%u events, %u time records\n", ecount, tcount);
-    printf("Channels:\n");
+    GString* json = g_string_new( "{\"file\":");
+
+    json_append_string( json, jpmidi_get_filename( root));
+    g_string_append( json, ",\"song\":");
+    songstats_json( json, root);
+
+    cmd_printf("MIDI file: %s\n", jpmidi_get_filename( root));
+    cmd_printf("   SMF timebase: %u\n", jpmidi_get_smf_timebase(root));
+    songstats_print( cmd_output(), root, "   ");
+    cmd_printf("Channels:\n");
     com_channels("   ");
-    printf("Send sysex:   %s\n", jpmidi_is_send_sysex_enabled( root) ? "on" : "off");
+    cmd_printf("Send sysex:   %s\n", jpmidi_is_send_sysex_enabled( root) ? "on" : "off");
     
     if (main_is_jack_client()) {
-        printf("JACK port: %s\n", jack_port_name ( jackclient_get_port()));
-        printf("   %d connections", jack_port_connected (jackclient_get_port()));
+        cmd_printf("JACK port: %s\n", jack_port_name ( jackclient_get_port()));
+        cmd_printf("   %d connections", jack_port_connected (jackclient_get_port()));
         const char** conns = jack_port_get_connections (jackclient_get_port());
         if (conns) {
             int i;
             for (i = 0; conns[i]; i++) {
-                if (i == 0) printf(": ");
-                else printf(", ");
-                printf("%s", conns[i]);
+                if (i == 0) cmd_printf(": ");
+                else cmd_printf(", ");
+                cmd_printf("%s", conns[i]);
             }
             free( conns);
         }
-        printf("\n");
+        cmd_printf("\n");
+        cmd_printf("   latency: %u frames reported, compensation %s, offset %d frames\n",
+               jackclient_get_playback_latency(),
+               jackclient_get_latency_compensation() ? "on" : "off",
+               jackclient_get_latency_offset());
         
         jack_position_t transport_pos;
         jack_transport_state_t state = jack_transport_query (jackclient_get_client(), &transport_pos);
@@ -180,10 +279,223 @@ void com_status(char* arg)
             break;
         }
         
-        printf("Transport state: %s\n", state_str);
-        printf("Transport position, frame: %u\n", transport_pos.frame);
+        cmd_printf("Transport state: %s\n", state_str);
+        unsigned long long song_frame = jackclient_get_song_frame();
+        cmd_printf("Transport position, frame: %u, song frame: %llu\n", transport_pos.frame, song_frame);
+        g_string_append_printf( json, ",\"state\":\"%s\",\"frame\":%llu,\"transport_frame\":%u,\"frame_rate\":%u",
+                                state_str, song_frame, transport_pos.frame, transport_pos.frame_rate);
+
+        if (lookahead_is_enabled()) cmd_printf("Lookahead: worker thread pre-rendering\n");
+
+        char stats[256];
+        jackclient_format_stats( stats, sizeof(stats));
+        cmd_printf("Performance: %s\n", stats);
+    }
+    else cmd_printf("%s\n", client_disabled_message);
+
+    g_string_append( json, "}");
+    cmd_data( "%s", json->str);
+    g_string_free( json, TRUE);
+}
+
+void com_stats(char* arg)
+{
+    if (!main_is_jack_client()) {
+        cmd_error("%s\n", client_disabled_message);
+        return;
+    }
+
+    if (strcmp( arg, "reset") == 0) {
+        jackclient_reset_stats();
+        return;
+    }
+
+    jackclient_stats_t s;
+    jackclient_get_stats( &s);
+
+    cmd_printf("Process cycles:     %llu\n", (unsigned long long)s.cycles);
+    cmd_printf("Cycle time (usecs): min %u, avg %u, max %u, p99 %u\n", s.usecs_min, s.usecs_avg, s.usecs_max, s.usecs_p99);
+    cmd_printf("Events sent:        %llu, max %u per cycle\n", (unsigned long long)s.events, s.events_max);
+    cmd_printf("Bytes sent:         %llu, max %u per cycle\n", (unsigned long long)s.bytes, s.bytes_max);
+    cmd_printf("Seeks:              %llu\n", (unsigned long long)s.seeks);
+    cmd_printf("Deferred events:    %llu\n", (unsigned long long)s.deferred);
+    cmd_printf("Dropped events:     %llu\n", (unsigned long long)s.dropped);
+    cmd_printf("Xruns:              %llu\n", (unsigned long long)s.xruns);
+
+    cmd_data("{\"cycles\":%llu,\"usecs_min\":%u,\"usecs_avg\":%u,\"usecs_max\":%u,\"usecs_p99\":%u,"
+             "\"events\":%llu,\"events_max\":%u,\"bytes\":%llu,\"bytes_max\":%u,"
+             "\"seeks\":%llu,\"deferred\":%llu,\"dropped\":%llu,\"xruns\":%llu}",
+             (unsigned long long)s.cycles, s.usecs_min, s.usecs_avg, s.usecs_max, s.usecs_p99,
+             (unsigned long long)s.events, s.events_max, (unsigned long long)s.bytes, s.bytes_max,
+             (unsigned long long)s.seeks, (unsigned long long)s.deferred,
+             (unsigned long long)s.dropped, (unsigned long long)s.xruns);
+}
+
+void com_reload(char* arg)
+{
+    reload_song();
+}
+
+void com_setlist(char* arg)
+{
+    int n;
+    int offset = 0;
+
+    if (*arg == '\0')
+        setlist_print();
+    else if (strncmp( arg, "add ", 4) == 0 && arg[4] != '\0')
+        setlist_add( arg + 4);
+    else if (strcmp( arg, "next") == 0)
+        setlist_next();
+    else if (sscanf( arg, "goto %d %n", &n, &offset) == 1 && arg[offset] == '\0')
+        setlist_goto( n - 1);
+    else if (sscanf( arg, "arm %d %n", &n, &offset) == 1 && arg[offset] == '\0') {
+        if (setlist_arm( n - 1)) cmd_error("No song %d in the setlist\n", n);
+    }
+    else if (sscanf( arg, "auto %d %n", &n, &offset) == 1 && arg[offset] == '\0')
+        setlist_set_auto( n != 0);
+    else
+        cmd_error("Invalid argument.  Usage: setlist [add <file> | next | goto <n> | arm <n> | auto <0|1>]\n");
+}
+
+void com_slot(char* arg)
+{
+    char filename[1024];
+    char verb[16];
+    int number, channel, i;
+    int offset = 0;
+    jpmidi_frame_t frame = 0;
+    slot_t* slot;
+
+    if (*arg == '\0') {
+        cmd_printf(" 1  %-10s %s (main song)\n", jack_port_short_name( jackclient_get_port()),
+                   jpmidi_get_filename( main_get_jpmidi_root()));
+        for (number = 2; number < SLOT_MAX + 2; number++) {
+            if ((slot = slot_get( number)) == NULL) continue;
+            cmd_printf("%2d  %-10s %s, offset %lld", number, jack_port_short_name( slot->port),
+                       jpmidi_get_filename( slot->root), (long long)slot->offset);
+            if (__atomic_load_n( &slot->dropped, __ATOMIC_RELAXED))
+                cmd_printf(", %llu events dropped", (unsigned long long)__atomic_load_n( &slot->dropped, __ATOMIC_RELAXED));
+            if (jpmidi_get_solo_channel( slot->root) >= 0)
+                cmd_printf(", solo %d", jpmidi_get_solo_channel( slot->root) + 1);
+            for (i = 1; i <= 16; i++)
+                if (jpmidi_channel_is_muted( slot->root, i - 1)) cmd_printf(", mute %d", i);
+            cmd_printf("\n");
+        }
+        return;
+    }
+
+    if (sscanf( arg, "load %1023s %n", filename, &offset) == 1) {
+        if (arg[offset] != '\0' && tempomap_parse_position( main_get_jpmidi_root(), arg + offset, &frame)) {
+            cmd_error("Invalid offset\n");
+            return;
+        }
+        if ((number = slot_load( filename, frame)) > 0) cmd_printf("Loaded %s into slot %d\n", filename, number);
+        return;
+    }
+
+    if (sscanf( arg, "%d %15s %n", &number, verb, &offset) != 2) {
+        cmd_error("Invalid argument.  Usage: slot [load <file> [offset] | <n> <offset <position> | mute <ch> | unmute <ch> | solo <ch> | connect [port num] | disconnect [port num] | unload>]\n");
+        return;
     }
-    else printf("%s\n", client_disabled_message);
+    if ((slot = slot_get( number)) == NULL) {
+        cmd_error("No slot %d\n", number);
+        return;
+    }
+
+    if (strcmp( verb, "offset") == 0) {
+        if (tempomap_parse_position( main_get_jpmidi_root(), arg + offset, &frame)) {
+            cmd_error("Invalid offset\n");
+            return;
+        }
+        slot_set_offset( slot, frame);
+    }
+    else if (strcmp( verb, "mute") == 0 || strcmp( verb, "unmute") == 0 || strcmp( verb, "solo") == 0) {
+        int mute = strcmp( verb, "solo") == 0 ? -1 : strcmp( verb, "mute") == 0;
+        if (sscanf( arg + offset, "%d", &channel) != 1 || slot_set_mute( slot, channel, mute))
+            cmd_error("Invalid channel\n");
+    }
+    else if (strcmp( verb, "connect") == 0)
+        connect_util( arg + offset, slot->port, 0, "connect", "to");
+    else if (strcmp( verb, "disconnect") == 0)
+        connect_util( arg + offset, slot->port, 1, "disconnect", "from");
+    else if (strcmp( verb, "unload") == 0)
+        slot_unload( number);
+    else
+        cmd_error("Unknown slot command %s\n", verb);
+}
+
+void com_memory(char* arg)
+{
+    GString* json = g_string_new( "");
+    uint64_t objects, bytes;
+    uint64_t total = 0;
+    int c;
+
+    cmd_printf("%-16s %10s %12s\n", "Structure", "Objects", "Bytes");
+    for (c = 0; c < MEMSTATS_CATEGORIES; c++) {
+        memstats_get( c, &objects, &bytes);
+        total += bytes;
+        cmd_printf("%-16s %10llu %12llu\n", memstats_category_name( c),
+                   (unsigned long long)objects, (unsigned long long)bytes);
+    }
+    cmd_printf("%-16s %10s %12llu\n", "total", "", (unsigned long long)total);
+    cmd_printf("%-16s %10s %12llu\n", "resident", "", (unsigned long long)memstats_resident());
+
+    memstats_json( json);
+    cmd_data("%s", json->str);
+    g_string_free( json, TRUE);
+}
+
+/* Append a song frame as frame and bar|beat|tick. */
+static void print_location( GString* text, jpmidi_root_t* root, jpmidi_frame_t frame)
+{
+    int bar, beat, tick;
+    tempomap_tick_to_bbt( root, tempomap_frame_to_tick( root, frame), &bar, &beat, &tick);
+    g_string_append_printf( text, "%10llu %4d|%d|%-4d", (unsigned long long)frame, bar, beat, tick);
+}
+
+void com_analyze(char* arg)
+{
+    songstats_window_t windows[SONGSTATS_WINDOWS];
+    jpmidi_root_t* root = main_get_jpmidi_root();
+    GString* line = g_string_new( "");
+    GString* json = g_string_new( "{\"windows\":[");
+    int recommended = 0;
+    int w;
+
+    songstats_analyze( root, windows);
+
+    cmd_printf("%6s %7s %21s %7s %21s %13s\n", "FRAMES", "EVENTS", "AT", "BYTES", "AT", "BUFFER");
+    for (w = 0; w < SONGSTATS_WINDOWS; w++)
+    {
+        songstats_window_t* win = &windows[w];
+        int fits = win->buffer_need <= win->buffer_size;
+
+        g_string_printf( line, "%6d %7u ", win->frames, win->events);
+        print_location( line, root, win->events_at);
+        g_string_append_printf( line, " %7u ", win->bytes);
+        print_location( line, root, win->bytes_at);
+        g_string_append_printf( line, " %6u/%-6u%s", win->buffer_need, win->buffer_size, fits ? "" : " overflow");
+        cmd_printf("%s\n", line->str);
+
+        if (fits && recommended == 0) recommended = win->frames;
+
+        g_string_append_printf( json, "%s{\"frames\":%d,\"events\":%u,\"events_at\":%llu,\"bytes\":%u,\"bytes_at\":%llu,"
+                                "\"buffer_need\":%u,\"buffer_size\":%u,\"fits\":%s}",
+                                w ? "," : "", win->frames, win->events, (unsigned long long)win->events_at,
+                                win->bytes, (unsigned long long)win->bytes_at,
+                                win->buffer_need, win->buffer_size, fits ? "true" : "false");
+    }
+
+    if (recommended) cmd_printf("Smallest period whose MIDI port buffer holds the busiest window: %d frames\n", recommended);
+    else cmd_printf("The busiest windows overflow the MIDI port buffer at every period size up to %d frames\n",
+                    windows[SONGSTATS_WINDOWS - 1].frames);
+    g_string_append_printf( json, "],\"recommended_period\":%d}", recommended);
+    cmd_data( "%s", json->str);
+
+    g_string_free( line, TRUE);
+    g_string_free( json, TRUE);
 }
 
 void com_sysex(char* arg)
@@ -194,11 +506,12 @@ void com_sysex(char* arg)
     if (strlen(arg) > 0) sscanf( arg, "%d", &enable);
     if (enable == -1)
     {
-        printf("Invalid argument.  Usage: sysex <0|1>.  Use '0' to disable sending of system exclusive messages.\n");
+        cmd_error("Invalid argument.  Usage: sysex <0|1>.  Use '0' to disable sending of system exclusive messages.\n");
         return;
     }
 
     jpmidi_set_send_sysex_enabled( root, enable != 0);
+    lookahead_invalidate();
 }
 
 void com_solo(char* arg)
@@ -209,11 +522,12 @@ void com_solo(char* arg)
     if (strlen(arg) > 0) sscanf( arg, "%d", &sc);
     if (sc < 0 || sc > 16)
     {
-        printf("Invalid argument.  Usage: solo <0 | 1-16>.  Use '0' to disable solo\n");
+        cmd_error("Invalid argument.  Usage: solo <0 | 1-16>.  Use '0' to disable solo\n");
         return;
     }
 
     jpmidi_solo_channel( root, sc);
+    lookahead_invalidate();
 
     if (sc == 0) return;
 
@@ -247,11 +561,12 @@ void com_mute(char* arg)
     if (strlen(arg) > 0) sscanf( arg, "%d", &mc);
     if (mc < 1 || mc > 16)
     {
-        printf("Invalid argument.  Usage: mute <1-16>\n");
+        cmd_error("Invalid argument.  Usage: mute <1-16>\n");
         return;
     }
 
     jpmidi_mute_channel( root, mc);
+    lookahead_invalidate();
 
     // Arrange for all sound off controller messages to be sent on the channel just muted.
     mc = mc - 1;
@@ -272,11 +587,268 @@ void com_unmute(char* arg)
     if (strlen(arg) > 0) sscanf( arg, "%d", &mc);
     if (mc < 1 || mc > 16)
     {
-        printf("Invalid argument.  Usage: unmute <1-16>\n");
+        cmd_error("Invalid argument.  Usage: unmute <1-16>\n");
         return;
     }
     
     jpmidi_unmute_channel( root, mc);
+    lookahead_invalidate();
+}
+
+void com_transpose(char* arg)
+{
+    int channel = -1;
+    int semitones = 0;
+    jpmidi_scene_t scene;
+    jpmidi_root_t* root = main_get_jpmidi_root();
+
+    if (sscanf( arg, "%d %d", &channel, &semitones) != 2 || channel < 1 || channel > 16 ||
+        semitones < -127 || semitones > 127)
+    {
+        cmd_error("Invalid argument.  Usage: transpose <1-16> <semitones>\n");
+        return;
+    }
+
+    // Through a scene so the notes sounding at the old pitch are released.
+    jpmidi_scene_get( root, &scene);
+    scene.transpose[channel-1] = semitones;
+    if (scene_apply( &scene)) cmd_error("Transpose not applied, is jack running?\n");
+}
+
+void com_transform(char* arg)
+{
+    transform_settings_t settings;
+    uint32_t mask = 0;
+    char channels[64];
+    int offset = 0;
+    int channel;
+
+    transform_get( &settings);
+
+    if (*arg == '\0') {
+        int shown = 0;
+        for (channel = 0; channel < 16; channel++) {
+            if (transform_is_default( &settings.channel[channel], channel)) continue;
+            cmd_printf("%2d  ", channel + 1);
+            transform_print( cmd_output(), &settings.channel[channel]);
+            cmd_printf("\n");
+            shown = 1;
+        }
+        if (!shown) cmd_printf("No channel transforms\n");
+        return;
+    }
+
+    if (sscanf( arg, "%63s %n", channels, &offset) == 1 && strcmp( channels, "reset") == 0) {
+        if (arg[offset] == '\0') mask = 0xFFFF;
+        else if (sscanf( arg + offset, "%63s", channels) != 1 || parse_channels( channels, &mask)) {
+            cmd_error("Invalid channels\n");
+            return;
+        }
+        for (channel = 0; channel < 16; channel++)
+            if (mask & (1u << channel)) transform_channel_default( &settings.channel[channel], channel);
+    }
+    else if (offset > 0 && arg[offset] != '\0') {
+        if (strcmp( channels, "all") == 0) mask = 0xFFFF;
+        else if (parse_channels( channels, &mask)) {
+            cmd_error("Invalid channels\n");
+            return;
+        }
+        for (channel = 0; channel < 16; channel++) {
+            if (!(mask & (1u << channel))) continue;
+            char* copy = g_strdup( arg + offset);
+            int bad = transform_parse( copy, &settings.channel[channel]);
+            g_free( copy);
+            if (bad) {
+                cmd_error("Invalid transform settings\n");
+                return;
+            }
+        }
+    }
+    else {
+        cmd_error("Invalid argument.  Usage: transform [<channels | all> <settings> | reset [channels]]\n"
+                  "Settings: velocity=<percent> curve=<exponent> channel=<1-16> notes=<low>-<high> noteoff=<0|1> cc=<from:to|off,...|none>\n");
+        return;
+    }
+
+    if (transform_apply_settings( &settings)) cmd_error("Transform not applied, is jack running?\n");
+}
+
+void com_scene(char* arg)
+{
+    char name[64];
+    int offset = 0;
+    jpmidi_scene_t scene;
+    const jpmidi_scene_t* stored;
+    jpmidi_root_t* root = main_get_jpmidi_root();
+
+    if (*arg == '\0') {
+        GList* names = scene_names();
+        GList* l;
+        if (names == NULL) cmd_printf("No scenes stored\n");
+        for (l = names; l; l = l->next) {
+            cmd_printf("%-16s ", (char*)l->data);
+            scene_print( cmd_output(), scene_lookup( l->data));
+            cmd_printf("\n");
+        }
+        g_list_free( names);
+        return;
+    }
+
+    if (sscanf( arg, "store %63s %n", name, &offset) == 1 && offset > 0) {
+        jpmidi_scene_get( root, &scene);
+        if (scene_parse( arg + offset, &scene)) {
+            cmd_error("Invalid scene settings\n");
+            return;
+        }
+        scene_store( name, &scene);
+    }
+    else if (sscanf( arg, "recall %63s", name) == 1) {
+        if ((stored = scene_lookup( name)) == NULL) {
+            cmd_error("No scene %s\n", name);
+            return;
+        }
+        if (scene_apply( stored)) cmd_error("Scene not applied, is jack running?\n");
+    }
+    else if (strncmp( arg, "apply ", 6) == 0) {
+        jpmidi_scene_get( root, &scene);
+        if (scene_parse( arg + 6, &scene)) {
+            cmd_error("Invalid scene settings\n");
+            return;
+        }
+        if (scene_apply( &scene)) cmd_error("Scene not applied, is jack running?\n");
+    }
+    else if (sscanf( arg, "show %63s", name) == 1) {
+        if ((stored = scene_lookup( name)) == NULL) {
+            cmd_error("No scene %s\n", name);
+            return;
+        }
+        scene_print( cmd_output(), stored);
+        cmd_printf("\n");
+    }
+    else if (sscanf( arg, "delete %63s", name) == 1) {
+        if (scene_delete( name)) cmd_error("No scene %s\n", name);
+    }
+    else {
+        cmd_error("Invalid argument.  Usage: scene [store <name> [settings] | recall <name> | apply <settings> | show <name> | delete <name>]\n"
+                  "Settings: mute=<ch,...|none> solo=<ch|0> sysex=<0|1> transpose=<n | ch:n,...>\n");
+    }
+}
+
+/* Parse the command part of an at command into an rt command.
+ * Returns 1 if it is not one that can be scheduled.
+ */
+static int at_parse_command( char* arg, jackclient_rt_command_t* command)
+{
+    char name[64];
+    int offset = 0;
+    const jpmidi_scene_t* stored;
+
+    if (strcmp( arg, "stop") == 0) {
+        command->type = RT_COMMAND_STOP;
+        return 0;
+    }
+    if (strncmp( arg, "locate ", 7) == 0) {
+        command->type = RT_COMMAND_LOCATE;
+        return tempomap_parse_position( main_get_jpmidi_root(), arg + 7, &command->frame);
+    }
+    if (sscanf( arg, "mute %d", &command->channel) == 1) {
+        command->type = RT_COMMAND_MUTE;
+        return command->channel < 1 || command->channel > 16;
+    }
+    if (sscanf( arg, "unmute %d", &command->channel) == 1) {
+        command->type = RT_COMMAND_UNMUTE;
+        return command->channel < 1 || command->channel > 16;
+    }
+    if (sscanf( arg, "solo %d", &command->channel) == 1) {
+        command->type = RT_COMMAND_SOLO;
+        return command->channel < 0 || command->channel > 16;
+    }
+    if (sscanf( arg, "transpose %d %d", &command->channel, &command->value) == 2) {
+        command->type = RT_COMMAND_TRANSPOSE;
+        return command->channel < 1 || command->channel > 16 || command->value < -127 || command->value > 127;
+    }
+    if (sscanf( arg, "scene recall %63s", name) == 1) {
+        // The scene as stored now, later changes to it do not count.
+        if ((stored = scene_lookup( name)) == NULL) return 1;
+        command->type = RT_COMMAND_SCENE;
+        command->scene = *stored;
+        return 0;
+    }
+    if (sscanf( arg, "scene apply %n", &offset) == 0 && offset > 0) {
+        command->type = RT_COMMAND_SCENE;
+        jpmidi_scene_get( main_get_jpmidi_root(), &command->scene);
+        return scene_parse( arg + offset, &command->scene);
+    }
+    return 1;
+}
+
+void com_at(char* arg)
+{
+    jpmidi_root_t* root = main_get_jpmidi_root();
+    jackclient_rt_command_t command;
+    uint32_t now_tick, smf_time;
+    int64_t now;
+    int offset = 0;
+    int bar, beat, tick;
+
+    if (!main_is_jack_client()) {
+        cmd_error("%s\n", client_disabled_message);
+        return;
+    }
+
+    memset( &command, 0, sizeof(command));
+
+    if (*arg == '\0') {
+        cmd_printf("%d commands scheduled\n", jackclient_get_scheduled_count());
+        return;
+    }
+    if (strcmp( arg, "clear") == 0) {
+        command.type = RT_COMMAND_CLEAR;
+        if (jackclient_rt_command_send( &command)) cmd_error("Command queue full\n");
+        return;
+    }
+
+    // The song frame being sent out right now is ahead of the transport
+    // by the output latency.
+    now = (int64_t)jackclient_get_song_frame() + jackclient_get_total_latency();
+    if (now < 0) now = 0;
+    now_tick = tempomap_frame_to_tick( root, (jpmidi_frame_t)now);
+
+    if (sscanf( arg, "beat %n", &offset) == 0 && offset > 0)
+        smf_time = tempomap_next_beat( root, now_tick);
+    else if (sscanf( arg, "bar %n", &offset) == 0 && offset > 0)
+        smf_time = tempomap_next_bar( root, now_tick);
+    else if (sscanf( arg, "marker %n", &offset) == 0 && offset > 0) {
+        jpmidi_text_t* marker = jpmidi_find_next_marker( root, (jpmidi_frame_t)now + 1);
+        if (marker == NULL) {
+            cmd_error("No marker after the current position\n");
+            return;
+        }
+        smf_time = marker->smf_time;
+    }
+    else if (sscanf( arg, "tick %u %n", &smf_time, &offset) == 1 && offset > 0)
+        ;
+    else offset = 0;
+
+    if (offset == 0 || at_parse_command( arg + offset, &command)) {
+        cmd_error("Invalid argument.  Usage: at <beat | bar | marker | tick <n>> <command>\n"
+                  "Commands: stop, locate <position>, mute <1-16>, unmute <1-16>, solo <0-16>,\n"
+                  "transpose <1-16> <semitones>, scene recall <name>, scene apply <settings>\n");
+        return;
+    }
+
+    command.scheduled = 1;
+    command.at = tempomap_tick_to_frame( root, smf_time);
+    if (jackclient_rt_command_send( &command)) {
+        cmd_error("Command queue full\n");
+        return;
+    }
+
+    tempomap_tick_to_bbt( root, smf_time, &bar, &beat, &tick);
+    cmd_printf("Scheduled at bar %d beat %d tick %d, smf tick %u, frame %llu\n", bar, beat, tick, smf_time,
+               (unsigned long long)command.at);
+    cmd_data("{\"bar\":%d,\"beat\":%d,\"tick\":%d,\"smf_time\":%u,\"frame\":%llu}", bar, beat, tick, smf_time,
+             (unsigned long long)command.at);
 }
 
 void com_dump(char* arg)
@@ -288,7 +860,7 @@ void com_dump(char* arg)
 
     if (strlen(arg) > 0) sscanf( arg, "%ld %ld", &count, &tick);
 
-    // printf("count: %lld, tick: %lld\n", count, tick);
+    // cmd_printf("count: %lld, tick: %lld\n", count, tick);
     
     if (count < 0) {
         if (last_dump_count > 0) count = last_dump_count;
@@ -309,20 +881,170 @@ void com_dump(char* arg)
     }
     else time = last_dump_time;
 
-    last_dump_time = jpmidi_dump( time, (uint32_t)count, 0);
+    last_dump_time = jpmidi_dump( cmd_output(), time, (uint32_t)count, 0);
+}
+
+/* Parse a list of channels such as 1,3-5 into a mask of bits 0-15. */
+static int parse_channels( char* list, uint32_t* mask)
+{
+    char* save;
+    char* item;
+    int low, high, end;
+
+    for (item = strtok_r( list, ",", &save); item; item = strtok_r( NULL, ",", &save)) {
+        end = 0;
+        if (sscanf( item, "%d-%d%n", &low, &high, &end) == 2 && item[end] == '\0') ;
+        else if (sscanf( item, "%d%n", &low, &end) == 1 && item[end] == '\0') high = low;
+        else return 1;
+        if (low < 1 || high > 16 || low > high) return 1;
+        for (; low <= high; low++) *mask |= 1u << (low - 1);
+    }
+    return 0;
+}
+
+void com_query(char* arg)
+{
+    jpmidi_root_t* root = main_get_jpmidi_root();
+    eventindex_query_t query;
+    GArray* found;
+    GString* json;
+    char* copy = g_strdup( arg);
+    char* save;
+    char* key;
+    char* value;
+    char* item;
+    int limit = 1000;
+    int bad = 0;
+    guint i;
+
+    memset( &query, 0, sizeof(query));
+    query.note_low = query.note_high = -1;
+    query.until = UINT64_MAX;
+
+    for (key = strtok_r( copy, " \t", &save); key && !bad; key = strtok_r( NULL, " \t", &save))
+    {
+        if ((value = strtok_r( NULL, " \t", &save)) == NULL) {
+            bad = 1;
+            break;
+        }
+        if (strcmp( key, "ch") == 0 || strcmp( key, "channel") == 0)
+            bad = parse_channels( value, &query.channels);
+        else if (strcmp( key, "type") == 0) {
+            char* type_save;
+            for (item = strtok_r( value, ",", &type_save); item && !bad; item = strtok_r( NULL, ",", &type_save)) {
+                uint32_t type = eventindex_type_by_name( item);
+                if (type == 0) bad = 1;
+                query.types |= type;
+            }
+        }
+        else if (strcmp( key, "note") == 0) {
+            int end = 0;
+            if (sscanf( value, "%d-%d%n", &query.note_low, &query.note_high, &end) == 2 && value[end] == '\0') ;
+            else if (sscanf( value, "%d%n", &query.note_low, &end) == 1 && value[end] == '\0') query.note_high = query.note_low;
+            else bad = 1;
+            if (query.note_low < 0 || query.note_high > 127 || query.note_low > query.note_high) bad = 1;
+        }
+        else if (strcmp( key, "from") == 0) bad = tempomap_parse_position( root, value, &query.from);
+        else if (strcmp( key, "to") == 0) bad = tempomap_parse_position( root, value, &query.until);
+        else if (strcmp( key, "limit") == 0) bad = sscanf( value, "%d", &limit) != 1 || limit < 0;
+        else bad = 1;
+    }
+    g_free( copy);
+
+    if (bad) {
+        cmd_error("Invalid argument.  Usage: query [ch <1-16,...>] [type <note,noteoff,keypressure,cc,program,pressure,pitch,sysex>]\n"
+                  "   [note <n[-n]>] [from <position>] [to <position>] [limit <n>]\n");
+        return;
+    }
+
+    // Channels alone mean the channel messages only.
+    if (query.channels && query.types == 0) query.types = 0x7F;
+
+    found = eventindex_query( root, &query);
+    json = g_string_new( "");
+    g_string_append_printf( json, "{\"count\":%u,\"events\":[", found->len);
+
+    if (found->len > 0)
+        cmd_printf("%10s %10s %4s %4s   %s\n", "TICK", "FRAME", "CHAN", "DLEN", "DESCRIPTION");
+    for (i = 0; i < found->len && i < (guint)limit; i++) {
+        eventindex_posting_t* posting = &g_array_index( found, eventindex_posting_t, i);
+        unsigned char* data = jpmidi_event_get_data( posting->event);
+        int len = jpmidi_event_get_data_length( posting->event);
+        int j;
+
+        dump_event( cmd_output(), posting->time, posting->event);
+        cmd_printf("\n");
+
+        g_string_append_printf( json, "%s{\"tick\":%u,\"frame\":%llu,\"data\":\"", i ? "," : "",
+                                jpmidi_time_get_smf_time( posting->time), (unsigned long long)posting->frame);
+        for (j = 0; j < len; j++) g_string_append_printf( json, "%02x", data[j]);
+        g_string_append( json, "\"}");
+    }
+    cmd_printf("%u events", found->len);
+    if (found->len > (guint)limit) cmd_printf(", first %d shown", limit);
+    cmd_printf("\n");
+
+    g_string_append( json, "]}");
+    cmd_data( "%s", json->str);
+    g_string_free( json, TRUE);
+    g_array_free( found, TRUE);
+}
+
+void com_save(char* arg)
+{
+    char filename[256];
+    int format = 1;
+
+    if (sscanf( arg, "%255s %d", filename, &format) < 1 || (format != 0 && format != 1)) {
+        cmd_error("Invalid argument.  Usage: save <file> [0|1].  The number is the MIDI file format, 1 by default\n");
+        return;
+    }
+
+    if (smfwrite_song( main_get_jpmidi_root(), filename, format))
+        cmd_error("Failed to save %s: %s\n", filename, strerror( errno));
+    else
+        cmd_printf("Saved %s as a format %d MIDI file\n", filename, format);
+}
+
+void com_export(char* arg)
+{
+    char format_name[16];
+    char filename[256];
+    int threads = 0;
+    int format;
+    uint64_t count;
+
+    if (sscanf( arg, "%15s %255s %d", format_name, filename, &threads) < 2 ||
+        (format = export_format_by_name( format_name)) < 0)
+    {
+        cmd_error("Invalid argument.  Usage: export <csv | jsonl | binary> <file> [threads]\n");
+        return;
+    }
+
+    if (export_song( main_get_jpmidi_root(), filename, format, threads, &count))
+        cmd_error("Failed to export %s: %s\n", filename, strerror( errno));
+    else
+        cmd_printf("Exported %llu events to %s\n", (unsigned long long)count, filename);
 }
 
-void connect_util( char* arg, int disconnect, char* verb, char* direction)
+void connect_util( char* arg, jack_port_t* port, int disconnect, char* verb, char* direction)
 {
     if (!main_is_jack_client()) {
-        printf("%s\n", client_disabled_message);
+        cmd_error("%s\n", client_disabled_message);
         return;
     }
+    if (port == NULL) {
+        cmd_error("No input port.  Start jpmidi with the -i option.\n");
+        return;
+    }
+
+    // Our input port connects from other clients' outputs.
+    int is_input = (port == jackclient_get_input_port());
         
-    const char** ports = jack_get_ports (jackclient_get_client(), NULL, JACK_DEFAULT_MIDI_TYPE, JackPortIsInput);
+    const char** ports = jack_get_ports (jackclient_get_client(), NULL, JACK_DEFAULT_MIDI_TYPE, is_input ? JackPortIsOutput : JackPortIsInput);
     if (ports == NULL) return;
 
-    const char** conns = jack_port_get_connections (jackclient_get_port());
+    const char** conns = jack_port_get_connections (port);
     
     int index = -1;
 
@@ -330,17 +1052,17 @@ void connect_util( char* arg, int disconnect, char* verb, char* direction)
 
     if (index == -1)
     {
-        printf("Destination ports:\n");
+        cmd_printf("%s ports:\n", is_input ? "Source" : "Destination");
         int i;
         for (i = 0; ports[i]; ++i) {
-            printf("%d) %s ", i+1, ports[i]);
+            cmd_printf("%d) %s ", i+1, ports[i]);
             if (conns) {
                 int j;
                 for (j = 0; conns[j]; j++) {
-                    if (strcmp( conns[j], ports[i]) == 0) printf(" (connection established)");
+                    if (strcmp( conns[j], ports[i]) == 0) cmd_printf(" (connection established)");
                 }
             }
-            printf("\n");
+            cmd_printf("\n");
         }
     }
     else {
@@ -350,38 +1072,76 @@ void connect_util( char* arg, int disconnect, char* verb, char* direction)
         }
 
         if (index < 1 || index > i) {
-            printf("Usage: %s <port number>\n", verb);
+            cmd_error("Usage: %s <port number>\n", verb);
             free(ports);
             return;
         }
 
         int result;
+        const char* src = is_input ? ports[index-1] : jack_port_name (port);
+        const char* dst = is_input ? jack_port_name (port) : ports[index-1];
 
-        if (disconnect) result = jack_disconnect( jackclient_get_client(), jack_port_name (jackclient_get_port()), ports[index-1]);
-        else result = jack_connect( jackclient_get_client(), jack_port_name (jackclient_get_port()), ports[index-1]);
+        if (disconnect) result = jack_disconnect( jackclient_get_client(), src, dst);
+        else result = jack_connect( jackclient_get_client(), src, dst);
         if (result)
-            printf("Failed to %s %s %s\n", verb, direction, ports[index-1]);
+            cmd_error("Failed to %s %s %s\n", verb, direction, ports[index-1]);
         else
-            printf("Successfully %sed %s %s\n", verb, direction, ports[index-1]);
+            cmd_printf("Successfully %sed %s %s\n", verb, direction, ports[index-1]);
     }
         
     free( ports);
+    if (conns) free( conns);
 }
 
 void com_connect( char* arg)
 {
-    connect_util( arg, 0, "connect", "to");
+    connect_util( arg, jackclient_get_port(), 0, "connect", "to");
 }
 
 void com_disconnect( char* arg)
 {
-    connect_util( arg, 1, "disconnect", "from");
+    connect_util( arg, jackclient_get_port(), 1, "disconnect", "from");
+}
+
+void com_input( char* arg)
+{
+    connect_util( arg, jackclient_get_input_port(), 0, "connect", "from");
+}
+
+void com_noinput( char* arg)
+{
+    connect_util( arg, jackclient_get_input_port(), 1, "disconnect", "from");
+}
+
+void com_capture( char* arg)
+{
+    char filename[256];
+
+    if (!main_is_jack_client() || jackclient_get_input_port() == NULL) {
+        cmd_error("No input port.  Start jpmidi with the -i option.\n");
+        return;
+    }
+
+    if (*arg == '\0') {
+        cmd_printf("Capture %s, %d events captured, %d lost\n",
+               capture_is_enabled() ? "on" : "off", capture_get_count(), capture_get_overruns());
+    }
+    else if (strcmp( arg, "start") == 0) capture_set_enabled( 1);
+    else if (strcmp( arg, "stop") == 0) capture_set_enabled( 0);
+    else if (strcmp( arg, "clear") == 0) capture_clear();
+    else if (sscanf( arg, "save %255s", filename) == 1) {
+        if (capture_save( filename))
+            cmd_error("Failed to save %s: %s\n", filename, strerror( errno));
+        else
+            cmd_printf("Saved %d events to %s\n", capture_get_count(), filename);
+    }
+    else cmd_error("Invalid argument.  Usage: capture [start | stop | clear | save <file>]\n");
 }
 
 void com_play(char *arg)
 {
     if (!main_is_jack_client()) {
-        printf("%s\n", client_disabled_message);
+        cmd_error("%s\n", client_disabled_message);
         return;
     }
 	jack_transport_start(jackclient_get_client());
@@ -390,7 +1150,7 @@ void com_play(char *arg)
 void com_stop(char *arg)
 {
     if (!main_is_jack_client()) {
-        printf("%s\n", client_disabled_message);
+        cmd_error("%s\n", client_disabled_message);
         return;
     }
 	jack_transport_stop(jackclient_get_client());
@@ -399,15 +1159,57 @@ void com_stop(char *arg)
 void com_locate(char *arg)
 {
     if (!main_is_jack_client()) {
-        printf("%s\n", client_disabled_message);
+        cmd_error("%s\n", client_disabled_message);
         return;
     }
-	jack_nframes_t frame = 0;
+	jpmidi_frame_t frame = 0;
 
-	if (*arg != '\0')
-		frame = atoi(arg);
+	if (*arg != '\0' && tempomap_parse_position( main_get_jpmidi_root(), arg, &frame)) {
+		cmd_error("Invalid position.  Usage: locate <frame | <n>t | bar|beat[|tick] | <n>s | [hh:]mm:ss[.ms] | @marker>\n");
+		return;
+	}
 
-	jack_transport_locate(jackclient_get_client(), frame);
+	jackclient_locate(frame);
+}
+
+void com_latency(char *arg)
+{
+    if (!main_is_jack_client()) {
+        cmd_error("%s\n", client_disabled_message);
+        return;
+    }
+
+    int value;
+    if (sscanf( arg, "auto %d", &value) == 1) {
+        jackclient_set_latency_compensation( value != 0);
+        return;
+    }
+    if (sscanf( arg, "offset %d", &value) == 1) {
+        jackclient_set_latency_offset( value);
+        return;
+    }
+    if (*arg != '\0') {
+        cmd_error("Invalid argument.  Usage: latency [auto <0|1>] [offset <frames>]\n");
+        return;
+    }
+
+    cmd_printf("Compensation: %s\n", jackclient_get_latency_compensation() ? "on" : "off");
+    cmd_printf("Reported playback latency: %u frames\n", jackclient_get_playback_latency());
+    cmd_printf("Manual offset: %d frames\n", jackclient_get_latency_offset());
+    cmd_printf("Events are sent %d frames ahead\n", jackclient_get_total_latency());
+
+    const char** conns = jack_port_get_connections (jackclient_get_port());
+    if (conns) {
+        int i;
+        for (i = 0; conns[i]; i++) {
+            jack_port_t* port = jack_port_by_name( jackclient_get_client(), conns[i]);
+            if (port == NULL) continue;
+            jack_latency_range_t range;
+            jack_port_get_latency_range( port, JackPlaybackLatency, &range);
+            cmd_printf("   %s: %u-%u frames\n", conns[i], range.min, range.max);
+        }
+        free( conns);
+    }
 }
 
 /* ---- Command utility functions ---- */
@@ -419,6 +1221,11 @@ command_t *find_command(char *name)
 	if ((name == NULL) || (*name == '\0'))
 		return ((command_t *)NULL);
 
+	/* a full name always runs its command */
+	for (i = 0; commands[i].name; i++)
+		if (strcmp(name, commands[i].name) == 0)
+			return (&commands[i]);
+
 	namelen = strlen(name);
 	for (i = 0; commands[i].name; i++)
 		if (strncmp(name, commands[i].name, namelen) == 0) {
@@ -434,7 +1241,8 @@ command_t *find_command(char *name)
 	return ((command_t *)NULL);
 }
 
-int execute_command(char *line)
+/* Parse and run one line, called with dispatch_lock held. */
+static int dispatch(char *line)
 {
 	register int i;
 	command_t *command;
@@ -455,13 +1263,13 @@ int execute_command(char *line)
 	command = find_command(word);
      
 	if (!command) {
-		fprintf(stderr, "%s: No such command.  There is `help\'.\n",
+		cmd_error("%s: No such command.  There is `help\'.\n",
 			word);
 		return 0;
 	}
 
 	/* Return 1 to exit command line mode */
-	if ((strcmp(word,"quit") && strcmp(word,"exit")==0)) {
+	if (command->func == com_exit) {
 		return 1;
 	}
      
@@ -477,6 +1285,65 @@ int execute_command(char *line)
 	return 0;
 }
 
+int execute_command(char *line)
+{
+	int result;
+
+	pthread_mutex_lock(&dispatch_lock);
+	result = dispatch(line);
+	pthread_mutex_unlock(&dispatch_lock);
+
+	return result;
+}
+
+void execute_locked(void (*func)(void *), void *arg)
+{
+	pthread_mutex_lock(&dispatch_lock);
+	func(arg);
+	pthread_mutex_unlock(&dispatch_lock);
+}
+
+int execute_command_captured(char *line, command_result_t *result)
+{
+	int ret;
+	size_t len;
+
+	result->ok = 1;
+	result->output = NULL;
+	result->data = NULL;
+
+	pthread_mutex_lock(&dispatch_lock);
+
+	output = open_memstream(&result->output, &len);
+	data_output = open_memstream(&result->data, &len);
+	command_failed = 0;
+
+	ret = dispatch(line);
+
+	if (output) fclose(output);
+	if (data_output) fclose(data_output);
+	output = NULL;
+	data_output = NULL;
+	result->ok = !command_failed;
+
+	pthread_mutex_unlock(&dispatch_lock);
+
+	if (result->data && result->data[0] == '\0') {
+		free(result->data);
+		result->data = NULL;
+	}
+
+	return ret;
+}
+
+void command_result_free(command_result_t *result)
+{
+	free(result->output);
+	free(result->data);
+	result->output = NULL;
+	result->data = NULL;
+}
+
 char *dupstr(char *s)
 {
 	char *r = malloc(strlen(s) + 1);
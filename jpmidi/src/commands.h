@@ -2,6 +2,8 @@
 #ifndef __commands_h__
 #define __commands_h__
 
+#include <stdio.h>
+
 /* Command parsing based on GNU readline info examples. */
 typedef void cmd_function_t(char *);	/* command function type */
 
@@ -18,9 +20,42 @@ functions */
 extern "C" {
 #endif
 
+/** Run one command line.  Safe to call from several threads, commands
+ * are serialized.  Returns 1 if the line asks to exit.
+ */
 extern int execute_command(char *line);
+
+/** Run func(arg) while no command runs, for threads that replace or
+ * free what commands use.
+ */
+extern void execute_locked(void (*func)(void *), void *arg);
 extern char *command_generator (const char *text, int state);
 
+/* What a command printed, for replies to remote clients. */
+typedef struct {
+	int ok;				/* 0 if the command reported an error */
+	char *output;			/* text printed by the command, malloc()ed */
+	char *data;			/* JSON value set with cmd_data(), or NULL */
+} command_result_t;
+
+/** Run one command line like execute_command() but collect what it
+ * prints into result instead of writing to the console.  Release the
+ * result with command_result_free().
+ */
+extern int execute_command_captured(char *line, command_result_t *result);
+extern void command_result_free(command_result_t *result);
+
+/** Output helpers for command functions.  cmd_printf() writes to the
+ * console or the captured result, cmd_error() does the same and marks
+ * the command as failed, cmd_data() sets the structured reply and is
+ * ignored on the console.  cmd_output() is the stream to write to
+ * directly.
+ */
+extern FILE *cmd_output();
+extern void cmd_printf(const char *format, ...);
+extern void cmd_error(const char *format, ...);
+extern void cmd_data(const char *format, ...);
+
 #ifdef __cplusplus
 }
 #endif
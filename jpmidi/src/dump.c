@@ -26,19 +26,19 @@ static int dump_inited = 0;
 
 
 /** Dump events. */
-jpmidi_time_t*  jpmidi_dump( jpmidi_time_t* from_time, uint32_t count, uint32_t flags)
+jpmidi_time_t*  jpmidi_dump( FILE* out, jpmidi_time_t* from_time, uint32_t count, uint32_t flags)
 {
     jpmidi_time_t* time = from_time;
 
-    printf("%10s %10s %4s %4s   %s\n", "TICK", "FRAME", "CHAN", "DLEN", "DESCRIPTION");
+    fprintf( out, "%10s %10s %4s %4s   %s\n", "TICK", "FRAME", "CHAN", "DLEN", "DESCRIPTION");
     while (time && count-- > 0)
     {
         int i;
         for (i = 0; i < jpmidi_time_get_event_count( time); i++)
         {
             jpmidi_event_t* event = jpmidi_time_get_event( time, i);
-            dump_event( time, event);
-            printf("\n");
+            dump_event( out, time, event);
+            fprintf( out, "\n");
         }
 
         time = jpmidi_time_get_next( time);
@@ -46,44 +46,44 @@ jpmidi_time_t*  jpmidi_dump( jpmidi_time_t* from_time, uint32_t count, uint32_t
     return time;
 }
 
-void dump_event( jpmidi_time_t* time, jpmidi_event_t* event)
+void dump_event( FILE* out, jpmidi_time_t* time, jpmidi_event_t* event)
 {
-    printf("%10u %10u %4d %4d   ", jpmidi_time_get_smf_time(time), jpmidi_time_get_frame(time), jpmidi_event_get_channel( event), jpmidi_event_get_data_length(event));
+    fprintf( out, "%10u %10llu %4d %4d   ", jpmidi_time_get_smf_time(time), (unsigned long long)jpmidi_time_get_frame(time), jpmidi_event_get_channel( event), jpmidi_event_get_data_length(event));
     unsigned char* data = jpmidi_event_get_data( event);
     switch (jpmidi_event_get_status( event))
     {
     case 0x80: // Note off
-        printf("note off: %hhu, vel: %hhu", data[1], data[2]);
+        fprintf( out, "note off: %hhu, vel: %hhu", data[1], data[2]);
         break;
     case 0x90: // Note on
-        printf("note on: %hhu, vel: %hhu", data[1], data[2]);
+        fprintf( out, "note on: %hhu, vel: %hhu", data[1], data[2]);
         break;
     case 0xA0: // Key after touch
-        printf("after touch: %hhu, vel: %hhu", data[1], data[2]);
+        fprintf( out, "after touch: %hhu, vel: %hhu", data[1], data[2]);
         break;
     case 0xB0: // Controller
-        printf("controller: %s, val: %hhu", controllers[data[1]], data[2]);
+        fprintf( out, "controller: %s, val: %hhu", controllers[data[1]], data[2]);
         break;
     case 0xC0: // Program change
-        printf("program change: %s", dump_get_program_description(data[1]));
+        fprintf( out, "program change: %s", dump_get_program_description(data[1]));
         break;
     case 0xD0: // Channel aftertouch
-        printf("channel pressure: %hhu", data[1]);
+        fprintf( out, "channel pressure: %hhu", data[1]);
         break;
     case 0xE0: // Pitch wheel
     {
         int val = data[1];
         val |= (data[2] << 7);
         val -= 0x2000;
-        printf("pitch wheel: %d", val);
+        fprintf( out, "pitch wheel: %d", val);
         break;
     }
     case 0xF0: // Sysex
     {
         int i;
-        printf("sysex: ");
+        fprintf( out, "sysex: ");
         for (i = 0; i < jpmidi_event_get_data_length( event); i++)
-            printf( "%02x ", data[i]);
+            fprintf( out, "%02x ", data[i]);
     }
     }
 }
@@ -20,6 +20,7 @@
 #  include <config.h>
 #endif /* HAVE_CONFIG_H */
 
+#include <stdio.h>
 #include "jpmidi.h"
 
 #ifdef __cplusplus
@@ -28,8 +29,8 @@ extern "C" {
 
 
 void dump_init();
-jpmidi_time_t* jpmidi_dump( jpmidi_time_t* from_time, uint32_t count, uint32_t flags);
-void dump_event( jpmidi_time_t* time, jpmidi_event_t* event);
+jpmidi_time_t* jpmidi_dump( FILE* out, jpmidi_time_t* from_time, uint32_t count, uint32_t flags);
+void dump_event( FILE* out, jpmidi_time_t* time, jpmidi_event_t* event);
     
 char* dump_get_program_description( uint8_t program);
 
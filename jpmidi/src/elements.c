@@ -22,8 +22,22 @@
 #include "except.h"
 
 #include "md.h"
+#include "memstats.h"
 
 static void md_container_init(struct containerElement *e);
+static size_t md_element_size(int type);
+
+/*
+ * Allocate a zeroed element, counting it in the memory statistics.
+ *  Arguments:
+ *    size      - Size of the element struct
+ */
+static void *
+md_alloc(size_t size)
+{
+	memstats_alloc(MEMSTATS_ELEMENTS, size);
+	return g_malloc0(size);
+}
 
 /*
  * Create and initialise a element element.
@@ -33,7 +47,7 @@ md_element_new()
 {
 	struct element *  new;
 
-	new = g_malloc0(sizeof(*new));
+	new = md_alloc(sizeof(*new));
 	MD_ELEMENT(new)->type = MD_TYPE_ELEMENT;
 	return new;
 }
@@ -46,7 +60,7 @@ md_container_new()
 {
 	struct containerElement *  new;
 
-	new = g_malloc0(sizeof(*new));
+	new = md_alloc(sizeof(*new));
 	MD_ELEMENT(new)->type = MD_TYPE_CONTAINER;
 	return new;
 }
@@ -62,6 +76,7 @@ md_container_init(struct containerElement *e)
 {
 
 	e->elements = g_ptr_array_new();
+	memstats_alloc(MEMSTATS_ELEMENT_ARRAYS, MEMSTATS_ARRAY_BYTES);
 }
 
 /*
@@ -74,7 +89,7 @@ md_root_new(void)
 {
 	struct rootElement *  new;
 
-	new = g_malloc0(sizeof(*new));
+	new = md_alloc(sizeof(*new));
 	MD_ELEMENT(new)->type = MD_TYPE_ROOT;
 	md_container_init(MD_CONTAINER(new));
 	return new;
@@ -90,7 +105,7 @@ md_track_new(void)
 {
 	struct trackElement *  new;
 
-	new = g_malloc0(sizeof(*new));
+	new = md_alloc(sizeof(*new));
 	MD_ELEMENT(new)->type = MD_TYPE_TRACK;
 	md_container_init(MD_CONTAINER(new));
 	return new;
@@ -104,7 +119,7 @@ md_tempomap_new()
 {
 	struct tempomapElement *  new;
 
-	new = g_malloc0(sizeof(*new));
+	new = md_alloc(sizeof(*new));
 	MD_ELEMENT(new)->type = MD_TYPE_TEMPOMAP;
 	md_container_init(MD_CONTAINER(new));
 	return new;
@@ -122,7 +137,7 @@ md_note_new(short note, short vel, int length)
 {
 	struct noteElement *  new;
 
-	new = g_malloc0(sizeof(*new));
+	new = md_alloc(sizeof(*new));
 	MD_ELEMENT(new)->type = MD_TYPE_NOTE;
 	new->note = note;
 	new->vel  = vel;
@@ -141,7 +156,7 @@ md_part_new(void)
 {
 	struct partElement *  new;
 
-	new = g_malloc0(sizeof(*new));
+	new = md_alloc(sizeof(*new));
 	MD_ELEMENT(new)->type = MD_TYPE_PART;
 	md_container_init(MD_CONTAINER(new));
 	return new;
@@ -158,7 +173,7 @@ md_control_new(short control, short value)
 {
 	struct controlElement *  new;
 
-	new = g_malloc0(sizeof(*new));
+	new = md_alloc(sizeof(*new));
 	MD_ELEMENT(new)->type = MD_TYPE_CONTROL;
 	new->control = control;
 	new->value = value;
@@ -175,7 +190,7 @@ md_program_new(int program)
 {
 	struct programElement *  new;
 
-	new = g_malloc0(sizeof(*new));
+	new = md_alloc(sizeof(*new));
 	MD_ELEMENT(new)->type = MD_TYPE_PROGRAM;
 	new->program = program;
 	return new;
@@ -192,7 +207,7 @@ md_keytouch_new(int note, int vel)
 {
 	struct keytouchElement *  new;
 
-	new = g_malloc0(sizeof(*new));
+	new = md_alloc(sizeof(*new));
 	MD_ELEMENT(new)->type = MD_TYPE_KEYTOUCH;
 	new->note = note;
 	new->velocity = vel;
@@ -209,7 +224,7 @@ md_pressure_new(int vel)
 {
 	struct pressureElement *  new;
 
-	new = g_malloc0(sizeof(*new));
+	new = md_alloc(sizeof(*new));
 	MD_ELEMENT(new)->type = MD_TYPE_PRESSURE;
 	new->velocity = vel;
 	return new;
@@ -223,7 +238,7 @@ md_pitch_new(int val)
 {
 	struct pitchElement *  new;
 
-	new = g_malloc0(sizeof(*new));
+	new = md_alloc(sizeof(*new));
 	MD_ELEMENT(new)->type = MD_TYPE_PITCH;
 	new->pitch = val;
 	return new;
@@ -237,11 +252,12 @@ md_sysex_new(int status, unsigned char *data, int len)
 {
 	struct sysexElement *  new;
 
-	new = g_malloc0(sizeof(*new));
+	new = md_alloc(sizeof(*new));
 	MD_ELEMENT(new)->type = MD_TYPE_SYSEX;
 	new->status = status;
 	new->data = data;
 	new->length = len;
+	memstats_alloc(MEMSTATS_ELEMENT_DATA, len);
 	return new;
 }
 
@@ -253,7 +269,7 @@ md_meta_new()
 {
 	struct metaElement *  new;
 
-	new = g_malloc0(sizeof(*new));
+	new = md_alloc(sizeof(*new));
 	MD_ELEMENT(new)->type = MD_TYPE_META;
 	return new;
 }
@@ -266,7 +282,7 @@ md_map_new()
 {
 	struct mapElement *  new;
 
-	new = g_malloc0(sizeof(*new));
+	new = md_alloc(sizeof(*new));
 	MD_ELEMENT(new)->type = MD_TYPE_MAP;
 	return new;
 }
@@ -279,7 +295,7 @@ md_keysig_new(short key, short minor)
 {
 	struct keysigElement *  new;
 
-	new = g_malloc0(sizeof(*new));
+	new = md_alloc(sizeof(*new));
 	MD_ELEMENT(new)->type = MD_TYPE_KEYSIG;
 	new->key = key;
 	new->minor = minor != 0? 1: 0;
@@ -294,7 +310,7 @@ md_timesig_new(short top, short bottom, short clocks, short n32pq)
 {
 	struct timesigElement *  new;
 
-	new = g_malloc0(sizeof(*new));
+	new = md_alloc(sizeof(*new));
 	MD_ELEMENT(new)->type = MD_TYPE_TIMESIG;
 	new->top = top;
 	new->bottom = bottom;
@@ -311,7 +327,7 @@ md_tempo_new(int m)
 {
 	struct tempoElement *  new;
 
-	new = g_malloc0(sizeof(*new));
+	new = md_alloc(sizeof(*new));
 	MD_ELEMENT(new)->type = MD_TYPE_TEMPO;
 	new->micro_tempo = m;
 	return new;
@@ -325,7 +341,7 @@ md_text_new(int type, char *text)
 {
 	struct textElement *  new;
 
-	new = g_malloc0(sizeof(*new));
+	new = md_alloc(sizeof(*new));
 	MD_ELEMENT(new)->type = MD_TYPE_TEXT;
 	{
 	static char *typenames[] = {
@@ -341,9 +357,10 @@ md_text_new(int type, char *text)
 	new->type = type;
 	new->name = typenames[type];
 	new->text = text;
-	if (text)
+	if (text) {
 		new->length = strlen(text);
-	else
+		memstats_alloc(MEMSTATS_ELEMENT_DATA, new->length + 1);
+	} else
 		new->length = 0;
 	}
 	return new;
@@ -358,7 +375,7 @@ md_smpteoffset_new(short hours, short minutes, short seconds, short frames,
 {
 	struct smpteoffsetElement *  new;
 
-	new = g_malloc0(sizeof(*new));
+	new = md_alloc(sizeof(*new));
 	MD_ELEMENT(new)->type = MD_TYPE_SMPTEOFFSET;
 	new->hours = hours;
 	new->minutes = minutes;
@@ -375,6 +392,7 @@ void
 md_add(struct containerElement *c, struct element *e)
 {
 	g_ptr_array_add(c->elements, e);
+	memstats_resize(MEMSTATS_ELEMENT_ARRAYS, sizeof(gpointer));
 }
 
 /*
@@ -390,22 +408,62 @@ md_free(struct element *el)
 		c = MD_CONTAINER(el);
 		for (i = 0; i < c->elements->len; i++) {
 			struct element *p = g_ptr_array_index(c->elements, i);
-			md_free(p);
+			if (p != NULL)	/* Detached, see midi_tracks_detach() */
+				md_free(p);
 		}
+		memstats_free(MEMSTATS_ELEMENT_ARRAYS,
+			MEMSTATS_ARRAY_BYTES + c->elements->len * sizeof(gpointer));
 		g_ptr_array_free(c->elements, 1);
 	}
 	switch (el->type) {
 	case MD_TYPE_TEXT:
+		if (MD_TEXT(el)->text)
+			memstats_free(MEMSTATS_ELEMENT_DATA, MD_TEXT(el)->length + 1);
 		g_free(MD_TEXT(el)->text);
 		break;
 	case MD_TYPE_SYSEX:
+		memstats_free(MEMSTATS_ELEMENT_DATA, MD_SYSEX(el)->length);
 		g_free(MD_SYSEX(el)->data);
 		break;
 	}
+	memstats_free(MEMSTATS_ELEMENTS, md_element_size(el->type));
 	g_free(el);
 
 }
 
+/*
+ * Size of the struct of an element type, as allocated by its
+ * constructor.
+ *  Arguments:
+ *    type      - Element type
+ */
+static size_t
+md_element_size(int type)
+{
+	switch (type) {
+	case MD_TYPE_ROOT:		return sizeof(struct rootElement);
+	case MD_TYPE_TRACK:		return sizeof(struct trackElement);
+	case MD_TYPE_TEMPOMAP:	return sizeof(struct tempomapElement);
+	case MD_TYPE_PART:		return sizeof(struct partElement);
+	case MD_TYPE_CONTAINER:	return sizeof(struct containerElement);
+	case MD_TYPE_NOTE:		return sizeof(struct noteElement);
+	case MD_TYPE_CONTROL:	return sizeof(struct controlElement);
+	case MD_TYPE_PROGRAM:	return sizeof(struct programElement);
+	case MD_TYPE_KEYTOUCH:	return sizeof(struct keytouchElement);
+	case MD_TYPE_PRESSURE:	return sizeof(struct pressureElement);
+	case MD_TYPE_PITCH:		return sizeof(struct pitchElement);
+	case MD_TYPE_SYSEX:		return sizeof(struct sysexElement);
+	case MD_TYPE_META:		return sizeof(struct metaElement);
+	case MD_TYPE_MAP:		return sizeof(struct mapElement);
+	case MD_TYPE_KEYSIG:	return sizeof(struct keysigElement);
+	case MD_TYPE_TIMESIG:	return sizeof(struct timesigElement);
+	case MD_TYPE_TEMPO:		return sizeof(struct tempoElement);
+	case MD_TYPE_TEXT:		return sizeof(struct textElement);
+	case MD_TYPE_SMPTEOFFSET:	return sizeof(struct smpteoffsetElement);
+	}
+	return sizeof(struct element);
+}
+
 /*
  * Check that the given element can be casted to the given type.
  * This is mainly for debugging as mismatches will not happen
@@ -0,0 +1,161 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+
+/* Posting lists of the song's events by channel and message type.  A
+ * query picks the lists it needs, finds the start of its time window in
+ * each with a binary search and reads only the window.
+ */
+
+#include <string.h>
+
+#include "eventindex.h"
+#include "memstats.h"
+
+static const struct {
+    const char* name;
+    int status;
+} type_names[] = {
+    { "noteoff",     0x80 },
+    { "note",        0x90 },
+    { "noteon",      0x90 },
+    { "keypressure", 0xA0 },
+    { "aftertouch",  0xA0 },
+    { "cc",          0xB0 },
+    { "controller",  0xB0 },
+    { "program",     0xC0 },
+    { "pressure",    0xD0 },
+    { "pitch",       0xE0 },
+    { "sysex",       0xF0 },
+    { NULL, 0 }
+};
+
+uint32_t eventindex_type_by_name( const char* name)
+{
+    int i;
+    for (i = 0; type_names[i].name; i++)
+        if (strcmp( name, type_names[i].name) == 0) return 1u << ((type_names[i].status >> 4) - 8);
+    return 0;
+}
+
+void eventindex_build( jpmidi_root_t* root)
+{
+    struct eventindex* index = g_new0( struct eventindex, 1);
+    jpmidi_time_t* time;
+    uint32_t seq = 0;
+    int i;
+
+    for (time = jpmidi_get_time_head( root); time; time = jpmidi_time_get_next( time))
+    {
+        for (i = 0; i < jpmidi_time_get_event_count( time); i++)
+        {
+            eventindex_posting_t posting;
+            unsigned char status = jpmidi_event_get_status( jpmidi_time_get_event( time, i));
+            int channel = status == 0xF0 ? EVENTINDEX_SYSTEM : jpmidi_event_get_channel( jpmidi_time_get_event( time, i));
+            GArray** list = &index->lists[channel][(status >> 4) - 8];
+
+            posting.seq = seq++;
+            posting.frame = jpmidi_time_get_frame( time);
+            posting.time = time;
+            posting.event = jpmidi_time_get_event( time, i);
+
+            if (*list == NULL) {
+                *list = g_array_new( FALSE, FALSE, sizeof(eventindex_posting_t));
+                memstats_alloc( MEMSTATS_INDEX, MEMSTATS_ARRAY_BYTES);
+            }
+            g_array_append_val( *list, posting);
+            memstats_resize( MEMSTATS_INDEX, sizeof(eventindex_posting_t));
+        }
+    }
+
+    if (root->index) eventindex_free( root->index);
+    root->index = index;
+}
+
+void eventindex_free( struct eventindex* index)
+{
+    int c, t;
+
+    if (index == NULL) return;
+    for (c = 0; c <= EVENTINDEX_SYSTEM; c++)
+        for (t = 0; t < EVENTINDEX_TYPES; t++)
+            if (index->lists[c][t]) {
+                memstats_free( MEMSTATS_INDEX, MEMSTATS_ARRAY_BYTES + index->lists[c][t]->len * sizeof(eventindex_posting_t));
+                g_array_free( index->lists[c][t], TRUE);
+            }
+    g_free( index);
+}
+
+/* Index of the first posting at or after frame. */
+static guint eventindex_search( GArray* list, jpmidi_frame_t frame)
+{
+    guint low = 0;
+    guint high = list->len;
+
+    while (low < high) {
+        guint mid = (low + high) / 2;
+        if (g_array_index( list, eventindex_posting_t, mid).frame < frame) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+static gint eventindex_seq_compare( gconstpointer a, gconstpointer b)
+{
+    uint32_t sa = ((const eventindex_posting_t*)a)->seq;
+    uint32_t sb = ((const eventindex_posting_t*)b)->seq;
+    return sa < sb ? -1 : sa > sb;
+}
+
+GArray* eventindex_query( jpmidi_root_t* root, const eventindex_query_t* query)
+{
+    GArray* result = g_array_new( FALSE, FALSE, sizeof(eventindex_posting_t));
+    uint32_t channels = (query->channels ? query->channels : 0xFFFF) | (1u << EVENTINDEX_SYSTEM);
+    uint32_t types = query->types ? query->types : (1u << EVENTINDEX_TYPES) - 1;
+    int lists = 0;
+    int c, t;
+
+    if (root->index == NULL) return result;
+
+    // A note range only makes sense for the messages that carry a note.
+    if (query->note_low >= 0) types &= 0x07;
+
+    for (c = 0; c <= EVENTINDEX_SYSTEM; c++)
+    {
+        if (!(channels & (1u << c))) continue;
+        for (t = 0; t < EVENTINDEX_TYPES; t++)
+        {
+            GArray* list = root->index->lists[c][t];
+            guint i;
+
+            if (!(types & (1u << t)) || list == NULL) continue;
+            lists++;
+
+            for (i = eventindex_search( list, query->from); i < list->len; i++)
+            {
+                eventindex_posting_t* posting = &g_array_index( list, eventindex_posting_t, i);
+                if (posting->frame >= query->until) break;
+                if (query->note_low >= 0) {
+                    int note = jpmidi_event_get_data( posting->event)[1];
+                    if (note < query->note_low || note > query->note_high) continue;
+                }
+                g_array_append_val( result, *posting);
+            }
+        }
+    }
+
+    // Each list is in order already, only results from several need sorting.
+    if (lists > 1) g_array_sort( result, eventindex_seq_compare);
+    return result;
+}
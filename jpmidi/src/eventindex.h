@@ -0,0 +1,82 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+#ifndef __eventindex_h__
+#define __eventindex_h__
+
+/* Definitions generated by autotools. */
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include "jpmidi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** One event in a posting list. */
+typedef struct eventindex_posting
+{
+    uint32_t        seq;        ///< Position of the event in the whole song.
+    jpmidi_frame_t  frame;
+    jpmidi_time_t*  time;
+    jpmidi_event_t* event;
+} eventindex_posting_t;
+
+#define EVENTINDEX_SYSTEM 16    ///< Channel slot of the system messages.
+#define EVENTINDEX_TYPES  8     ///< Status 0x80 to 0xF0.
+
+/** Posting lists of the events of a song, one per channel and message
+ *  type, each ordered by time.
+ */
+struct eventindex
+{
+    GArray* lists[EVENTINDEX_SYSTEM + 1][EVENTINDEX_TYPES];
+};
+
+/** What to look for with eventindex_query().  A zero mask selects all
+ *  channels or types.
+ */
+typedef struct eventindex_query
+{
+    uint32_t channels;          ///< Bit n for channel n (0-15), system messages are selected by type alone.
+    uint32_t types;             ///< Bit n for status 0x80 + (n << 4).
+    int note_low;               ///< Note range of note and key pressure events,
+    int note_high;              ///< -1 for any note.
+    jpmidi_frame_t from;        ///< Time window, from included,
+    jpmidi_frame_t until;       ///< until excluded.
+} eventindex_query_t;
+
+/** Build the posting lists of a loaded song into root->index. */
+void eventindex_build( jpmidi_root_t* root);
+
+/** Free the posting lists of a song. */
+void eventindex_free( struct eventindex* index);
+
+/** Returns the type bit of a name such as "note" or "program" for the
+ *  types mask of a query, or 0 if there is no such type.
+ */
+uint32_t eventindex_type_by_name( const char* name);
+
+/** Find the events matching query, in song order.  Returns a new array
+ *  of eventindex_posting_t, free it with g_array_free().
+ */
+GArray* eventindex_query( jpmidi_root_t* root, const eventindex_query_t* query);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __eventindex_h__ */
@@ -33,9 +33,45 @@ struct except *formatError = &format;	/* Bad file format */
 struct except *ioError = &io;	/* I/o error to file */
 struct except *debugError = &debug;	/* Debugging 'shouldn't happen' errors */
 
+/* Recovery point of the calling thread, set up by except_catch() */
+static __thread sigjmp_buf *recovery;
+static __thread struct except *caught;
+static __thread char caught_message[256];
+
+/*
+ * Run a function, returning from it when it throws an exception
+ * instead of exiting.  Each thread has its own recovery point, so
+ * several files can be read at the same time.  Memory allocated by
+ * the function before the exception is not freed.
+ *  Arguments:
+ *    func      - Function to run
+ *    arg       - Argument passed to func
+ *    message   - Buffer receiving the message of the exception
+ *    size      - Size of message
+ *  Returns the exception thrown or NULL if func returned normally.
+ */
+struct except *
+except_catch(void (*func)(void *), void *arg, char *message, int size)
+{
+	sigjmp_buf buf;
+	sigjmp_buf *outer = recovery;
+
+	if (sigsetjmp(buf, 0)) {
+		recovery = outer;
+		if (message != NULL && size > 0)
+			g_strlcpy(message, caught_message, size);
+		return caught;
+	}
+
+	recovery = &buf;
+	func(arg);
+	recovery = outer;
+	return NULL;
+}
+
 /*
- * Deal with errors. At present just exit, will allow error
- * recovery in the future.
+ * Deal with errors. Inside except_catch() the exception is passed
+ * back to its caller, otherwise just exit.
  *  Arguments:
  *    e         - Exception thrown
  *    message   - Message
@@ -46,6 +82,14 @@ except(struct except *e, char *message, ...)
 {
 	va_list ap;
 
+	if (recovery != NULL) {
+		va_start(ap, message);
+		vsnprintf(caught_message, sizeof(caught_message), message, ap);
+		va_end(ap);
+		caught = e;
+		siglongjmp(*recovery, 1);
+	}
+
 	va_start(ap, message);
 	vfprintf(stderr, message, ap);
 	va_end(ap);
@@ -31,5 +31,6 @@ extern struct except *ioError;	/* Error reading/writing file */
 extern struct except *debugError;	/* Debugging 'shouldn't happen' errors */
 
 void except(struct except *e, char *message, ...);
+struct except *except_catch(void (*func)(void *), void *arg, char *message, int size);
 
 #endif
@@ -0,0 +1,335 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+
+/* Export of the flattened event list for offline analysis.  Records are
+ * formatted by hand into large buffers and written with write(2); big
+ * songs are split by time into ranges formatted by worker threads and
+ * written out in order.
+ *
+ * The binary format is a 32 byte header followed by one record per
+ * event, all little endian:
+ *
+ *   header:  "JPMIDIEV", u32 version (3), u32 sample rate,
+ *            u16 SMF time base, u16 reserved, u64 event count,
+ *            u32 reserved
+ *   record:  u32 tick, u64 frame, u8 channel (0xFF for system
+ *            messages), u8 status, u32 length, then length data bytes
+ *
+ * Version 2 had a u16 length, too short for big sysex messages.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "export.h"
+
+#define EXPORT_BUFFER_SIZE (1024 * 1024)   /* flush threshold when streaming to the file */
+#define EXPORT_MAX_RECORD 128              /* largest record besides the data bytes */
+#define EXPORT_EVENTS_PER_THREAD 65536     /* fewer events than this are not worth a thread */
+#define EXPORT_MAX_THREADS 16
+
+/** Output buffer.  With fd >= 0 it is written out whenever it fills,
+ *  otherwise it grows to hold everything.
+ */
+typedef struct export_buffer
+{
+    char*  data;
+    size_t len;
+    size_t size;
+    int    fd;
+    int    error;       ///< errno of a failed write.
+} export_buffer_t;
+
+/** A range of time records formatted by one thread. */
+typedef struct export_range
+{
+    jpmidi_time_t** times;
+    int             count;
+    export_format_t format;
+    export_buffer_t buffer;
+    pthread_t       thread;
+} export_range_t;
+
+static const char hex_digits[] = "0123456789abcdef";
+
+int export_format_by_name( const char* name)
+{
+    if (strcmp( name, "csv") == 0) return EXPORT_CSV;
+    if (strcmp( name, "jsonl") == 0 || strcmp( name, "json") == 0) return EXPORT_JSONL;
+    if (strcmp( name, "binary") == 0 || strcmp( name, "bin") == 0) return EXPORT_BINARY;
+    return -1;
+}
+
+/* Write all of data to fd. */
+static int export_write( int fd, const char* data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write( fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void export_buffer_init( export_buffer_t* buffer, int fd)
+{
+    buffer->size = EXPORT_BUFFER_SIZE;
+    buffer->data = g_malloc( buffer->size);
+    buffer->len = 0;
+    buffer->fd = fd;
+    buffer->error = 0;
+}
+
+static void export_buffer_flush( export_buffer_t* buffer)
+{
+    if (buffer->fd < 0 || buffer->len == 0) return;
+    if (buffer->error == 0) buffer->error = export_write( buffer->fd, buffer->data, buffer->len);
+    buffer->len = 0;
+}
+
+/* Make room for need more bytes, returns where to put them. */
+static inline char* export_buffer_reserve( export_buffer_t* buffer, size_t need)
+{
+    if (buffer->len + need > buffer->size) {
+        if (buffer->fd >= 0) export_buffer_flush( buffer);
+        if (buffer->len + need > buffer->size) {
+            while (buffer->len + need > buffer->size) buffer->size *= 2;
+            buffer->data = g_realloc( buffer->data, buffer->size);
+        }
+    }
+    return buffer->data + buffer->len;
+}
+
+/* Decimal digits of value at p, returns the end. */
+static inline char* export_put_uint( char* p, uint64_t value)
+{
+    char digits[20];
+    int n = 0;
+
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    while (n) *p++ = digits[--n];
+    return p;
+}
+
+static inline char* export_put_hex( char* p, const unsigned char* data, int len)
+{
+    int i;
+    for (i = 0; i < len; i++) {
+        *p++ = hex_digits[data[i] >> 4];
+        *p++ = hex_digits[data[i] & 0x0F];
+    }
+    return p;
+}
+
+static inline char* export_put_str( char* p, const char* s, int len)
+{
+    memcpy( p, s, len);
+    return p + len;
+}
+
+static inline char* export_put_le( char* p, uint64_t value, int bytes)
+{
+    while (bytes--) {
+        *p++ = value & 0xFF;
+        value >>= 8;
+    }
+    return p;
+}
+
+/* Append one event in the given format. */
+static void export_event( export_buffer_t* buffer, export_format_t format, jpmidi_time_t* time, jpmidi_event_t* event)
+{
+    int len = jpmidi_event_get_data_length( event);
+    unsigned char* data = jpmidi_event_get_data( event);
+    unsigned char status = jpmidi_event_get_status( event);
+    int is_channel = status < 0xF0;
+    char* start = export_buffer_reserve( buffer, EXPORT_MAX_RECORD + 2 * len);
+    char* p = start;
+
+    switch (format) {
+    case EXPORT_CSV:
+        p = export_put_uint( p, jpmidi_time_get_smf_time( time));
+        *p++ = ',';
+        p = export_put_uint( p, jpmidi_time_get_frame( time));
+        *p++ = ',';
+        if (is_channel) p = export_put_uint( p, jpmidi_event_get_channel( event));
+        *p++ = ',';
+        p = export_put_uint( p, is_channel ? status : data[0]);
+        *p++ = ',';
+        p = export_put_uint( p, len);
+        *p++ = ',';
+        p = export_put_hex( p, data, len);
+        *p++ = '\n';
+        break;
+    case EXPORT_JSONL:
+        p = export_put_str( p, "{\"tick\":", 8);
+        p = export_put_uint( p, jpmidi_time_get_smf_time( time));
+        p = export_put_str( p, ",\"frame\":", 9);
+        p = export_put_uint( p, jpmidi_time_get_frame( time));
+        p = export_put_str( p, ",\"channel\":", 11);
+        if (is_channel) p = export_put_uint( p, jpmidi_event_get_channel( event));
+        else p = export_put_str( p, "null", 4);
+        p = export_put_str( p, ",\"status\":", 10);
+        p = export_put_uint( p, is_channel ? status : data[0]);
+        p = export_put_str( p, ",\"data\":\"", 9);
+        p = export_put_hex( p, data, len);
+        p = export_put_str( p, "\"}\n", 3);
+        break;
+    case EXPORT_BINARY:
+        p = export_put_le( p, jpmidi_time_get_smf_time( time), 4);
+        p = export_put_le( p, jpmidi_time_get_frame( time), 8);
+        *p++ = is_channel ? jpmidi_event_get_channel( event) : 0xFF;
+        *p++ = is_channel ? status : data[0];
+        p = export_put_le( p, len, 4);
+        p = export_put_str( p, (const char*)data, len);
+        break;
+    }
+    buffer->len += p - start;
+}
+
+/* Format the events of a run of time records. */
+static void export_times( export_buffer_t* buffer, export_format_t format, jpmidi_time_t** times, int count)
+{
+    int i, j;
+    for (i = 0; i < count; i++)
+        for (j = 0; j < jpmidi_time_get_event_count( times[i]); j++)
+            export_event( buffer, format, times[i], jpmidi_time_get_event( times[i], j));
+}
+
+static void* export_range_thread( void* arg)
+{
+    export_range_t* range = (export_range_t*)arg;
+    export_times( &range->buffer, range->format, range->times, range->count);
+    return NULL;
+}
+
+/* Append the file header. */
+static void export_header( export_buffer_t* buffer, jpmidi_root_t* root, export_format_t format, uint64_t events)
+{
+    char* start = export_buffer_reserve( buffer, EXPORT_MAX_RECORD);
+    char* p = start;
+
+    switch (format) {
+    case EXPORT_CSV:
+        p = export_put_str( p, "tick,frame,channel,status,length,data\n", 38);
+        break;
+    case EXPORT_JSONL:
+        break;
+    case EXPORT_BINARY:
+        p = export_put_str( p, "JPMIDIEV", 8);
+        p = export_put_le( p, 3, 4);
+        p = export_put_le( p, root->sample_rate, 4);
+        p = export_put_le( p, jpmidi_get_smf_timebase( root), 2);
+        p = export_put_le( p, 0, 2);
+        p = export_put_le( p, events, 8);
+        p = export_put_le( p, 0, 4);
+        break;
+    }
+    buffer->len += p - start;
+}
+
+int export_song( jpmidi_root_t* root, const char* filename, export_format_t format, int threads, uint64_t* count)
+{
+    GPtrArray* times = g_ptr_array_new();
+    export_range_t ranges[EXPORT_MAX_THREADS];
+    export_buffer_t out;
+    uint64_t events = 0;
+    jpmidi_time_t* time;
+    int fd, i, error = 0;
+
+    // Flatten the time records that have events, and count them.
+    for (time = jpmidi_get_time_head( root); time; time = jpmidi_time_get_next( time)) {
+        if (jpmidi_time_get_event_count( time) == 0) continue;
+        g_ptr_array_add( times, time);
+        events += jpmidi_time_get_event_count( time);
+    }
+
+    if (threads <= 0) {
+        long cpus = sysconf( _SC_NPROCESSORS_ONLN);
+        threads = events / EXPORT_EVENTS_PER_THREAD;
+        if (threads > cpus) threads = cpus;
+    }
+    if (threads > EXPORT_MAX_THREADS) threads = EXPORT_MAX_THREADS;
+    if (threads > (int)times->len) threads = times->len;
+    if (threads < 1) threads = 1;
+
+    if (strcmp( filename, "-") == 0) fd = STDOUT_FILENO;
+    else if ((fd = open( filename, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        g_ptr_array_free( times, TRUE);
+        return 1;
+    }
+
+    export_buffer_init( &out, fd);
+    export_header( &out, root, format, events);
+
+    if (threads == 1) export_times( &out, format, (jpmidi_time_t**)times->pdata, times->len);
+    else {
+        // Split into ranges of about the same number of events.
+        uint64_t per_range = events / threads + 1;
+        uint64_t in_range = 0;
+        int first = 0, n = 0;
+
+        for (i = 0; i < (int)times->len && n < threads; i++) {
+            in_range += jpmidi_time_get_event_count( g_ptr_array_index( times, i));
+            if (in_range < per_range && i < (int)times->len - 1) continue;
+
+            ranges[n].times = (jpmidi_time_t**)times->pdata + first;
+            ranges[n].count = (n == threads - 1) ? (int)times->len - first : i + 1 - first;
+            ranges[n].format = format;
+            export_buffer_init( &ranges[n].buffer, -1);
+            if (pthread_create( &ranges[n].thread, NULL, export_range_thread, &ranges[n])) {
+                // Format this range here instead.
+                export_range_thread( &ranges[n]);
+                ranges[n].thread = pthread_self();
+            }
+            first += ranges[n].count;
+            in_range = 0;
+            n++;
+            if (first == (int)times->len) break;
+        }
+
+        // Write each range as soon as it is done, in order.
+        export_buffer_flush( &out);
+        for (i = 0; i < n; i++) {
+            if (!pthread_equal( ranges[i].thread, pthread_self())) pthread_join( ranges[i].thread, NULL);
+            if (out.error == 0) out.error = export_write( fd, ranges[i].buffer.data, ranges[i].buffer.len);
+            g_free( ranges[i].buffer.data);
+        }
+    }
+
+    export_buffer_flush( &out);
+    error = out.error;
+    g_free( out.data);
+    g_ptr_array_free( times, TRUE);
+
+    if (fd != STDOUT_FILENO && close( fd) && error == 0) error = errno;
+    if (error) {
+        errno = error;
+        return 1;
+    }
+    *count = events;
+    return 0;
+}
@@ -0,0 +1,52 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+#ifndef __export_h__
+#define __export_h__
+
+/* Definitions generated by autotools. */
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include "jpmidi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Output formats of export_song(). */
+typedef enum export_format
+{
+    EXPORT_CSV,         ///< tick,frame,channel,status,length,data with a header line.
+    EXPORT_JSONL,       ///< One JSON object per event and line.
+    EXPORT_BINARY       ///< Fixed size little endian records, see export.c.
+} export_format_t;
+
+/** Returns the format called name ("csv", "jsonl" or "binary"), or -1. */
+int export_format_by_name( const char* name);
+
+/** Write every event of the song, in time order, to filename or to
+ * stdout if filename is "-".  Big songs are formatted by up to threads
+ * worker threads, each taking a range of time; 0 picks a number to
+ * suit the song and the machine.  The number of events written is
+ * stored in count.  Returns 0 on success, 1 with errno set otherwise.
+ */
+int export_song( jpmidi_root_t* root, const char* filename, export_format_t format, int threads, uint64_t* count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __export_h__ */
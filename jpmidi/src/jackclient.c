@@ -16,10 +16,19 @@
 #include <getopt.h>
 #include <errno.h>
 #include <unistd.h>
+#include <string.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+#include <jack/ringbuffer.h>
 
 #include "jackclient.h"
+#include "capture.h"
+#include "lookahead.h"
 #include "jpmidi.h"
 #include "main.h"
+#include "slot.h"
+#include "reclaim.h"
 
 static int warn_if_not_connected = 1;
 static jack_position_t transport_pos;
@@ -30,25 +39,212 @@ static jack_position_t transport_pos;
  */
 static jack_nframes_t expected_frame = UINT32_MAX;
 
+/* Transport position of the current cycle.  The JACK transport frame
+ * is 32 bits and wraps after 2^32 frames, about 6 hours at 192 kHz.
+ * transport_frame extends it to 64 bits: a locate made through
+ * jackclient_locate() arrives at its full target, rolling on carries
+ * across the wrap, and any other jump (another transport client
+ * locating) is taken as the 32 bit frame it is.
+ *
+ * song_origin is the transport frame the playing song started at.  It
+ * is 0 unless the song changed to the next one without locating, see
+ * jackclient_song_advance(), and goes back to 0 with the next jump of
+ * the transport.  song_frame is the position within the song, the
+ * difference, and 0 while the transport has not reached the origin
+ * yet.  transport_next is the transport frame the next cycle starts at
+ * unless the transport jumps.
+ */
+static jpmidi_frame_t transport_frame = 0;
+static jpmidi_frame_t song_origin = 0;
+static jpmidi_frame_t song_frame = 0;
+static jack_nframes_t transport_next = 0;
+static jpmidi_frame_t locate_target = 0;
+static int locate_pending = 0;
+
 /* Pointer to the next time/events to play. */
 static jpmidi_time_t* current_time = NULL;
 
 static jack_client_t *client;
 static jack_port_t *output_port;
+static jack_port_t *input_port = NULL;
+
+/* Events received on the input port during the current cycle, merged
+ * into the output in time order as the song events are written.
+ */
+static void* input_buf = NULL;
+static uint32_t input_count = 0;
+static uint32_t input_index = 0;
+
+
+/* Commands for the process thread, see jackclient_rt_command_send(). */
+#define RT_QUEUE_SIZE 256
+static jack_ringbuffer_t* rt_queue = NULL;
+static pthread_mutex_t rt_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Scheduled commands taken off the queue, ordered by the song frame
+ * they apply at.  Process thread only, except for the count.
+ */
+#define RT_SCHEDULE_SIZE 64
+static jackclient_rt_command_t rt_schedule[RT_SCHEDULE_SIZE];
+static int rt_schedule_count = 0;
+
+/* Song frame at offset 0 of the current cycle.  Events and scheduled
+ * commands go out at their frame less this.
+ */
+static int64_t window_origin = 0;
+
+/* A change handed to the process thread for the start of a cycle, see
+ * jackclient_handoff().  The process thread moves state from
+ * HANDOFF_QUEUED to HANDOFF_TAKEN before it applies the change and
+ * back to HANDOFF_IDLE, posting done, when it has.  A caller that
+ * gives up moves it from HANDOFF_QUEUED to HANDOFF_IDLE, so a change is
+ * either applied or withdrawn, never left behind.
+ */
+typedef struct handoff
+{
+    int state;
+    sem_t done;
+    pthread_mutex_t lock;   ///< One change at a time.
+} handoff_t;
+
+enum { HANDOFF_IDLE, HANDOFF_QUEUED, HANDOFF_TAKEN };
 
+/* Time a caller waits for the process thread to take a change. */
+#define HANDOFF_TIMEOUT_MSECS 1000
+
+/* Scene waiting to be applied at the start of the next cycle, see
+ * jackclient_apply_scene().
+ */
+static jpmidi_scene_t pending_scene;
+static handoff_t scene_handoff = { HANDOFF_IDLE };
+
+/* Song waiting to replace the playing one at the start of the next
+ * cycle, see jackclient_switch_song().
+ */
+static jpmidi_root_t* pending_song = NULL;
+static jpmidi_root_t* pending_song_replaces = NULL;
+static int song_rejected = 0;
+static handoff_t song_handoff = { HANDOFF_IDLE };
+
+/* Song to follow the playing one, see jackclient_set_next_song().  The
+ * process thread takes it out when it advances, and leaves the song it
+ * replaced in finished_song for another thread to free.
+ */
+static jpmidi_root_t* next_song = NULL;
+static jpmidi_root_t* finished_song = NULL;
+static int auto_advance = 0;
+static int advance_failed = 0;
+static handoff_t advance_handoff = { HANDOFF_IDLE };
+
+/* Channel transforms waiting to be applied at the start of the next
+ * cycle, with their tables compiled ahead, see
+ * jackclient_apply_transform().
+ */
+static transform_table_t pending_transform_table;
+static uint32_t pending_transform_release = 0;   ///< Channels whose transform changes, one bit each.
+static handoff_t transform_handoff = { HANDOFF_IDLE };
+static int transform_replaced = 0;
 
 // transport state during the previous cycle
 static jack_transport_state_t prev_state = JackTransportStopped;
 
 int process(jack_nframes_t nframes, void *arg); // forward declaration
+int xrun(void *arg);
+void latency(jack_latency_callback_mode_t mode, void *arg);
+void jackclient_process_cycle(jack_nframes_t nframes, void* port_buf, jack_transport_state_t state);
+void jackclient_merge_input( void* port_buf, jack_nframes_t time_in_cycle);
+void jackclient_read_input( jack_nframes_t nframes, jpmidi_frame_t frame);
+void jackclient_seek( jpmidi_root_t* root, jpmidi_frame_t frame);
+int jackclient_render_direct( jpmidi_root_t* root, void* port_buf, int64_t window_start, int64_t window_end);
+void jackclient_render_lookahead( jpmidi_root_t* root, void* port_buf, int64_t window_start, int64_t window_end);
 void jackclient_cm_setup();
+void jackclient_render( jpmidi_root_t* root, void* port_buf, int64_t window_start, int64_t window_end);
+void jackclient_rt_commands_process( void* port_buf);
+void jackclient_rt_command_apply( void* port_buf, const jackclient_rt_command_t* command, jack_nframes_t time_in_cycle);
+void jackclient_scene_process( void* port_buf);
+void jackclient_song_process( void* port_buf);
+void jackclient_transform_process( void* port_buf);
+void jackclient_advance_process( void* port_buf);
+void jackclient_song_advance( void* port_buf, jpmidi_root_t* next, int64_t shift, jack_nframes_t time_in_cycle);
+void jackclient_render_scheduled( jpmidi_root_t* root, void* port_buf, int64_t window_start, int64_t window_end);
+void jackclient_scene_switch( void* port_buf, const jpmidi_scene_t* scene, jack_nframes_t time_in_cycle);
 void jackclient_cm_process_init();
 void jackclient_control_message_return( control_message_t* message);
 control_message_t* jackclient_cm_process_next();
 
-int jackclient_new(const char* client_name)
+static void jackclient_handoff_init( handoff_t* handoff)
+{
+    sem_init( &handoff->done, 0, 0);
+    pthread_mutex_init( &handoff->lock, NULL);
+}
+
+/* Hand over the change the caller prepared, with handoff->lock held,
+ * and wait until the process thread has applied it.  Returns 1 if it
+ * did not take it within HANDOFF_TIMEOUT_MSECS; the change is
+ * withdrawn then.
+ */
+static int jackclient_handoff( handoff_t* handoff)
+{
+    struct timespec ts;
+    int expected = HANDOFF_QUEUED;
+
+    __atomic_store_n( &handoff->state, HANDOFF_QUEUED, __ATOMIC_RELEASE);
+
+    clock_gettime( CLOCK_REALTIME, &ts);
+    ts.tv_sec += HANDOFF_TIMEOUT_MSECS / 1000;
+    ts.tv_nsec += (HANDOFF_TIMEOUT_MSECS % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec += 1;
+        ts.tv_nsec -= 1000000000L;
+    }
+    for (;;) {
+        if (sem_timedwait( &handoff->done, &ts) == 0) return 0;
+        if (errno != EINTR) break;
+    }
+
+    if (__atomic_compare_exchange_n( &handoff->state, &expected, HANDOFF_IDLE, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return 1;
+
+    // Taken just now, it is applied within this cycle.
+    while (sem_wait( &handoff->done) == -1 && errno == EINTR)
+        ;
+    return 0;
+}
+
+/* Called by the process thread: returns 1 if a change is waiting, which
+ * it then applies and passes to jackclient_handoff_done().
+ */
+static int jackclient_handoff_take( handoff_t* handoff)
+{
+    int expected = HANDOFF_QUEUED;
+
+    if (__atomic_load_n( &handoff->state, __ATOMIC_RELAXED) != HANDOFF_QUEUED) return 0;
+    return __atomic_compare_exchange_n( &handoff->state, &expected, HANDOFF_TAKEN, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+static void jackclient_handoff_done( handoff_t* handoff)
+{
+    __atomic_store_n( &handoff->state, HANDOFF_IDLE, __ATOMIC_RELEASE);
+    sem_post( &handoff->done);
+}
+
+int jackclient_new(const char* client_name, int with_input)
 {
     jackclient_cm_setup();
+
+    jackclient_handoff_init( &scene_handoff);
+    jackclient_handoff_init( &song_handoff);
+    jackclient_handoff_init( &advance_handoff);
+    jackclient_handoff_init( &transform_handoff);
+
+    rt_queue = jack_ringbuffer_create( RT_QUEUE_SIZE * sizeof(jackclient_rt_command_t));
+    if (rt_queue == NULL) {
+        fprintf( stderr, "cannot allocate command queue\n");
+        return 1;
+    }
+    jack_ringbuffer_mlock( rt_queue);
     
     client = jack_client_open(client_name,JackNullOption,NULL);
     if(client == NULL)
@@ -57,6 +253,8 @@ int jackclient_new(const char* client_name)
         return 1;
     }
     jack_set_process_callback (client, process, 0);
+    jack_set_xrun_callback (client, xrun, 0);
+    jack_set_latency_callback (client, latency, 0);
     output_port = jack_port_register (client, "out", JACK_DEFAULT_MIDI_TYPE, JackPortIsOutput, 0);
 
     if (output_port == NULL) {
@@ -65,6 +263,15 @@ int jackclient_new(const char* client_name)
         return 1;
     }
 
+    if (with_input) {
+        input_port = jack_port_register (client, "in", JACK_DEFAULT_MIDI_TYPE, JackPortIsInput, 0);
+        if (input_port == NULL) {
+            fprintf( stderr, "failed to create input port");
+            jack_client_close(client);
+            return 1;
+        }
+    }
+
     return 0;
 }
 
@@ -94,6 +301,10 @@ int jackclient_close()
         fprintf( stderr, "cannot unregister port\n");
         return 1;
 	}
+    if (input_port && jack_port_unregister( client, input_port)) {
+        fprintf( stderr, "cannot unregister port\n");
+        return 1;
+    }
     if (jack_client_close(client)) {
         fprintf( stderr, "cannot close jack client\n");
         return 1;
@@ -101,15 +312,454 @@ int jackclient_close()
     return 0;
 }
 
+/* Performance counters.  Everything except the xrun count is written
+ * by the process thread only; other threads read relaxed atomic
+ * snapshots so the process thread never waits on a lock.
+ */
+#define STATS_HIST_BUCKETS 256  /* cycle time histogram size */
+#define STATS_HIST_USECS   4    /* width of a histogram bucket in microseconds */
+
+#define STAT_GET(f)    __atomic_load_n( &(f), __ATOMIC_RELAXED)
+#define STAT_SET(f, v) __atomic_store_n( &(f), (v), __ATOMIC_RELAXED)
+#define STAT_INC(f, v) STAT_SET( f, (f) + (v))
+
+static struct {
+    uint64_t cycles;
+    uint64_t usecs_total;
+    uint32_t usecs_min;
+    uint32_t usecs_max;
+    uint64_t events;
+    uint64_t bytes;
+    uint32_t events_max;
+    uint32_t bytes_max;
+    uint64_t seeks;
+    uint64_t deferred;
+    uint64_t dropped;
+    uint64_t xruns;
+    uint64_t hist[STATS_HIST_BUCKETS + 1]; /* last bucket collects everything longer */
+} stats = { .usecs_min = UINT32_MAX };
+
+static int stats_reset_requested = 0;
+
+/* Events and bytes written during the current cycle. */
+static uint32_t cycle_events;
+static uint32_t cycle_bytes;
+
+/* State published for the TCP server's subscriptions.  The process
+ * thread is the only writer; readers retry while the sequence number
+ * is odd or changes under them (a seqlock), so nothing ever blocks.
+ */
+static jackclient_snapshot_t snapshot;
+static uint32_t snapshot_seq = 0;
+
+/* Notes sent but not released yet, one bit per channel/note number. */
+static uint32_t sounding[16][4];
+
+/* Highest note-on velocity per channel since the last
+ * jackclient_take_peaks().
+ */
+static uint8_t peaks[16];
+
+/* Number of jumps in the playback position, never reset. */
+static uint32_t seek_count = 0;
+
+/* Index of the next event to send within current_time.  Non zero when
+ * the port buffer filled up part way through a time record.
+ */
+static int current_event = 0;
+
+/* Set when the port buffer filled up and events are waiting to go out
+ * late at the start of the next cycle.
+ */
+static int deferred_pending = 0;
+
+/* False while the lookahead ring is feeding the port and current_time
+ * is not kept up to date.
+ */
+static int cursor_valid = 1;
+
+/* Generation of lookahead ring records the process thread accepts. */
+static uint32_t rt_generation = 0;
+
+/* Output latency compensation.  port_latency is the downstream
+ * playback latency reported by jack, latency_offset is an extra manual
+ * adjustment in frames (positive values send events earlier).
+ */
+static int compensate_latency = 1;
+static jack_nframes_t port_latency = 0;
+static int latency_offset = 0;
+
+/** Called by jack when an xrun occurs. */
+int xrun(void *arg)
+{
+    __atomic_fetch_add( &stats.xruns, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/** Called by jack when the latency of the graph changes.  We pick up
+ *  the playback latency of everything downstream of our output port.
+ */
+void latency(jack_latency_callback_mode_t mode, void *arg)
+{
+    jack_latency_range_t range;
+
+    if (output_port == NULL) return;
+
+    if (mode == JackPlaybackLatency)
+    {
+        jack_port_get_latency_range( output_port, JackPlaybackLatency, &range);
+        __atomic_store_n( &port_latency, range.max, __ATOMIC_RELAXED);
+
+        // Input events are passed straight through to the output.
+        if (input_port) jack_port_set_latency_range( input_port, JackPlaybackLatency, &range);
+    }
+    else if (input_port)
+    {
+        jack_port_get_latency_range( input_port, JackCaptureLatency, &range);
+        jack_port_set_latency_range( output_port, JackCaptureLatency, &range);
+    }
+}
+
+/** Enable/disable compensation for the downstream playback latency. */
+void jackclient_set_latency_compensation( int enabled)
+{
+    __atomic_store_n( &compensate_latency, enabled, __ATOMIC_RELAXED);
+}
+
+/** Returns true if latency compensation is enabled. */
+int jackclient_get_latency_compensation()
+{
+    return __atomic_load_n( &compensate_latency, __ATOMIC_RELAXED);
+}
+
+/** Set the manual latency offset in frames. */
+void jackclient_set_latency_offset( int frames)
+{
+    __atomic_store_n( &latency_offset, frames, __ATOMIC_RELAXED);
+}
+
+/** Returns the manual latency offset in frames. */
+int jackclient_get_latency_offset()
+{
+    return __atomic_load_n( &latency_offset, __ATOMIC_RELAXED);
+}
+
+/** Returns the downstream playback latency reported by jack. */
+jack_nframes_t jackclient_get_playback_latency()
+{
+    return __atomic_load_n( &port_latency, __ATOMIC_RELAXED);
+}
+
+/** Returns the number of frames events are sent ahead of their song position. */
+int jackclient_get_total_latency()
+{
+    int total = jackclient_get_latency_offset();
+    if (jackclient_get_latency_compensation()) total += (int)jackclient_get_playback_latency();
+    return total;
+}
+
+/** Keep the sounding notes and the channel peaks up to date for a
+ *  message just written to the port.
+ */
+static inline void jackclient_track_event( const unsigned char* data, int len)
+{
+    if (len < 3) return;
+
+    int channel = data[0] & 0x0F;
+    int note = data[1] & 0x7F;
+
+    switch (data[0] & 0xF0) {
+    case 0x90:
+        if (data[2] > 0) {
+            sounding[channel][note >> 5] |= 1u << (note & 31);
+            if (data[2] > __atomic_load_n( &peaks[channel], __ATOMIC_RELAXED))
+                __atomic_store_n( &peaks[channel], data[2], __ATOMIC_RELAXED);
+            break;
+        }
+        // Note on with velocity 0 is a note off.
+    case 0x80:
+        sounding[channel][note >> 5] &= ~(1u << (note & 31));
+        break;
+    case 0xB0:
+        // All sound off, all notes off.
+        if (data[1] == 120 || data[1] == 123) memset( sounding[channel], 0, sizeof(sounding[channel]));
+        break;
+    }
+}
+
+/** Publish the transport position and sounding notes at the end of a
+ *  cycle.
+ */
+static void jackclient_publish_snapshot( jack_transport_state_t state)
+{
+    __atomic_store_n( &snapshot_seq, snapshot_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence( __ATOMIC_RELEASE);
+
+    snapshot.state = state;
+    snapshot.frame = song_frame;
+    snapshot.frame_rate = transport_pos.frame_rate;
+    snapshot.bbt_valid = (transport_pos.valid & JackPositionBBT) != 0;
+    if (snapshot.bbt_valid) {
+        snapshot.bar = transport_pos.bar;
+        snapshot.beat = transport_pos.beat;
+        snapshot.tick = transport_pos.tick;
+        snapshot.beats_per_bar = transport_pos.beats_per_bar;
+        snapshot.beats_per_minute = transport_pos.beats_per_minute;
+    }
+    snapshot.seek_count = seek_count;
+    memcpy( snapshot.notes, sounding, sizeof(sounding));
+
+    __atomic_store_n( &snapshot_seq, snapshot_seq + 1, __ATOMIC_RELEASE);
+}
+
+/** Copy the state last published by the process thread. */
+void jackclient_get_snapshot( jackclient_snapshot_t* s)
+{
+    uint32_t seq;
+
+    do {
+        seq = __atomic_load_n( &snapshot_seq, __ATOMIC_ACQUIRE);
+        memcpy( s, &snapshot, sizeof(snapshot));
+        __atomic_thread_fence( __ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n( &snapshot_seq, __ATOMIC_RELAXED));
+}
+
+/** Get and clear the per channel note-on peaks. */
+void jackclient_take_peaks( uint8_t* out)
+{
+    int i;
+    for (i = 0; i < 16; i++)
+        out[i] = __atomic_exchange_n( &peaks[i], 0, __ATOMIC_RELAXED);
+}
+
+void jackclient_count_dropped( int count)
+{
+    STAT_INC( stats.dropped, count);
+}
+
+/** Write one message to the port buffer, keeping the counters up to
+ *  date.  Returns 0 on success, 1 if the buffer is full.
+ */
+int jackclient_write_event( void* port_buf, jack_nframes_t time_in_cycle, unsigned char* data, int len)
+{
+    jackclient_merge_input( port_buf, time_in_cycle);
+
+    unsigned char* buffer = jack_midi_event_reserve(port_buf, time_in_cycle, len);
+    if (buffer == NULL) return 1;
+
+    int j;
+    for (j = 0; j < len; j++)
+        buffer[j] = data[j];
+
+    jackclient_track_event( data, len);
+    cycle_events += 1;
+    cycle_bytes += len;
+    return 0;
+}
+
+/** Write the received input events with a time up to and including
+ *  time_in_cycle to the output, so the merged stream stays in time
+ *  order.  Input events pass through the same filters as the song.
+ */
+void jackclient_merge_input( void* port_buf, jack_nframes_t time_in_cycle)
+{
+    jpmidi_root_t* root = main_get_jpmidi_root();
+
+    while (input_index < input_count)
+    {
+        jack_midi_event_t in;
+        if (jack_midi_event_get( &in, input_buf, input_index)) {
+            input_index++;
+            continue;
+        }
+        if (in.time > time_in_cycle) return;
+        input_index++;
+
+        if (!jpmidi_message_should_send( root, in.buffer, in.size)) continue;
+
+        unsigned char* buffer = jack_midi_event_reserve(port_buf, in.time, in.size);
+        if (buffer == NULL) {
+            STAT_INC( stats.dropped, 1);
+            continue;
+        }
+        memcpy( buffer, in.buffer, in.size);
+        jackclient_track_event( buffer, in.size);
+        cycle_events += 1;
+        cycle_bytes += in.size;
+    }
+}
+
+/** Get the events received on the input port this cycle, handing them
+ *  to the capture ring if recording.
+ */
+void jackclient_read_input( jack_nframes_t nframes, jpmidi_frame_t frame)
+{
+    input_index = 0;
+    input_count = 0;
+    if (input_port == NULL) return;
+
+    input_buf = jack_port_get_buffer(input_port, nframes);
+    input_count = jack_midi_get_event_count(input_buf);
+
+    if (!capture_is_enabled()) return;
+
+    uint32_t i;
+    for (i = 0; i < input_count; i++) {
+        jack_midi_event_t in;
+        if (jack_midi_event_get( &in, input_buf, i) == 0)
+            capture_write( frame + in.time, in.buffer, in.size);
+    }
+}
+
+/** Update the counters at the end of a cycle. */
+void jackclient_stats_cycle_end( jack_time_t start_usecs)
+{
+    uint32_t usecs = (uint32_t)(jack_get_time() - start_usecs);
+
+    STAT_INC( stats.cycles, 1);
+    STAT_INC( stats.usecs_total, usecs);
+    if (usecs < stats.usecs_min) STAT_SET( stats.usecs_min, usecs);
+    if (usecs > stats.usecs_max) STAT_SET( stats.usecs_max, usecs);
+
+    uint32_t bucket = usecs / STATS_HIST_USECS;
+    if (bucket > STATS_HIST_BUCKETS) bucket = STATS_HIST_BUCKETS;
+    STAT_INC( stats.hist[bucket], 1);
+
+    STAT_INC( stats.events, cycle_events);
+    STAT_INC( stats.bytes, cycle_bytes);
+    if (cycle_events > stats.events_max) STAT_SET( stats.events_max, cycle_events);
+    if (cycle_bytes > stats.bytes_max) STAT_SET( stats.bytes_max, cycle_bytes);
+}
+
+/** Zero the counters if another thread asked for it. Process thread only. */
+void jackclient_stats_cycle_begin()
+{
+    cycle_events = 0;
+    cycle_bytes = 0;
+
+    if (!__atomic_load_n( &stats_reset_requested, __ATOMIC_ACQUIRE)) return;
+
+    int i;
+    STAT_SET( stats.cycles, 0);
+    STAT_SET( stats.usecs_total, 0);
+    STAT_SET( stats.usecs_min, UINT32_MAX);
+    STAT_SET( stats.usecs_max, 0);
+    STAT_SET( stats.events, 0);
+    STAT_SET( stats.bytes, 0);
+    STAT_SET( stats.events_max, 0);
+    STAT_SET( stats.bytes_max, 0);
+    STAT_SET( stats.seeks, 0);
+    STAT_SET( stats.deferred, 0);
+    STAT_SET( stats.dropped, 0);
+    for (i = 0; i <= STATS_HIST_BUCKETS; i++) STAT_SET( stats.hist[i], 0);
+    __atomic_store_n( &stats_reset_requested, 0, __ATOMIC_RELEASE);
+}
+
+/* Largest transport move still taken as rolling on from the previous
+ * song frame, rather than as a jump.
+ */
+#define SONG_FRAME_CONTINUITY (1 << 24)
+
+/** Map a transport frame to the song frame, see song_frame. */
+static jpmidi_frame_t jackclient_map_frame( jack_nframes_t transport_frame, jpmidi_frame_t previous)
+{
+    int32_t delta = (int32_t)(transport_frame - (jack_nframes_t)previous);
+
+    if (delta > SONG_FRAME_CONTINUITY || delta < -SONG_FRAME_CONTINUITY) return transport_frame;
+    if (delta < 0 && (jpmidi_frame_t)-(int64_t)delta > previous) return transport_frame;
+    return previous + delta;
+}
+
+/** Locate the transport to a song frame.  JACK only takes the low 32
+ *  bits, the song frame picks up the rest when the transport gets
+ *  there.  May be called from any thread.
+ */
+void jackclient_locate( jpmidi_frame_t frame)
+{
+    __atomic_store_n( &locate_target, frame, __ATOMIC_RELAXED);
+    __atomic_store_n( &locate_pending, 1, __ATOMIC_RELEASE);
+    jack_transport_locate( client, (jack_nframes_t)frame);
+}
+
+/** Returns the song frame of the current transport position. */
+jpmidi_frame_t jackclient_get_song_frame()
+{
+    jpmidi_frame_t frame = jackclient_map_frame( jack_get_current_transport_frame( client),
+                                                 __atomic_load_n( &transport_frame, __ATOMIC_RELAXED));
+    jpmidi_frame_t origin = __atomic_load_n( &song_origin, __ATOMIC_RELAXED);
+    return frame > origin ? frame - origin : 0;
+}
+
+/* Position within the song of the current cycle, negative while the
+ * transport is behind the origin of the song.
+ */
+static inline int64_t jackclient_song_position()
+{
+    return (int64_t)(transport_frame - song_origin);
+}
+
+/** Update the transport and song frames from the transport position
+ *  of this cycle.
+ */
+static void jackclient_update_song_frame( jack_transport_state_t state, jack_nframes_t nframes)
+{
+    jpmidi_frame_t frame = jackclient_map_frame( transport_pos.frame, transport_frame);
+
+    if (__atomic_load_n( &locate_pending, __ATOMIC_ACQUIRE)) {
+        jpmidi_frame_t target = __atomic_load_n( &locate_target, __ATOMIC_RELAXED);
+        if ((jack_nframes_t)target == transport_pos.frame) {
+            frame = target;
+            __atomic_store_n( &locate_pending, 0, __ATOMIC_RELAXED);
+        }
+    }
+
+    // Positions count from the start of the transport again after a jump.
+    if (transport_pos.frame != transport_next) __atomic_store_n( &song_origin, 0, __ATOMIC_RELAXED);
+    transport_next = transport_pos.frame + (state == JackTransportRolling ? nframes : 0);
+
+    __atomic_store_n( &transport_frame, frame, __ATOMIC_RELAXED);
+    __atomic_store_n( &song_frame, jackclient_song_position() > 0 ? (jpmidi_frame_t)jackclient_song_position() : 0,
+                      __ATOMIC_RELAXED);
+}
+
 /** jpmidi's jack client process() thread logic. */
 int process(jack_nframes_t nframes, void *arg)
 {
-    jpmidi_root_t* root = main_get_jpmidi_root();
+    jack_time_t start_usecs = jack_get_time();
+
+    reclaim_enter( RECLAIM_PROCESS);
+    jackclient_stats_cycle_begin();
     
  	void* port_buf = jack_port_get_buffer(output_port, nframes);
 	jack_midi_clear_buffer(port_buf);
     
     jack_transport_state_t state = jack_transport_query (client, &transport_pos);
+    jackclient_update_song_frame( state, nframes);
+
+    jackclient_read_input( nframes, song_frame);
+
+    jackclient_process_cycle( nframes, port_buf, state);
+
+    slot_process( nframes, state, (int64_t)transport_frame, jackclient_get_total_latency(),
+                  transform_replaced ? &pending_transform_table : NULL);
+    if (transform_replaced) {
+        transform_replaced = 0;
+        jackclient_handoff_done( &transform_handoff);
+    }
+
+    // Whatever came in on the input port after the last song event.
+    jackclient_merge_input( port_buf, nframes);
+
+    jackclient_publish_snapshot( state);
+    jackclient_stats_cycle_end( start_usecs);
+    reclaim_leave( RECLAIM_PROCESS);
+    return 0;
+}
+
+/** Send the control messages and song events for one cycle. */
+void jackclient_process_cycle(jack_nframes_t nframes, void* port_buf, jack_transport_state_t state)
+{
+    jpmidi_root_t* root = main_get_jpmidi_root();
     
     if (state == JackTransportStopped) {
         warn_if_not_connected = 1;
@@ -130,11 +780,8 @@ int process(jack_nframes_t nframes, void *arg)
     control_message_t* cm = jackclient_cm_process_next();
     while (cm != NULL)
     {
-        unsigned char* buffer = jack_midi_event_reserve(port_buf, 0, cm->len);
-        int j;
-        for (j = 0; j < cm->len; j++) {
-            buffer[j] = cm->data[j];
-        }
+        if (jackclient_write_event( port_buf, 0, cm->data, cm->len))
+            STAT_INC( stats.dropped, 1);
         jackclient_control_message_return( cm);
         cm = jackclient_cm_process_next();
     }
@@ -146,72 +793,700 @@ int process(jack_nframes_t nframes, void *arg)
         // Send all sound off controller messages on every channel
         int i;
         for (i = 0; i < 16; i++) {
-            unsigned char* buffer = jack_midi_event_reserve(port_buf, 0, 3);
-            buffer[0] = 0xB0 | i;
-            buffer[1] = 120;
-            buffer[2] = 0;
+            unsigned char sound_off[3] = { 0xB0 | i, 120, 0 };
+            if (jackclient_write_event( port_buf, 0, sound_off, 3))
+                STAT_INC( stats.dropped, 1);
         }
     }
 
+    jackclient_song_process( port_buf);
+    jackclient_advance_process( port_buf);
+    jackclient_transform_process( port_buf);
+    jackclient_scene_process( port_buf);
+    jackclient_rt_commands_process( port_buf);
+
+    // The song may have been replaced above.
+    root = main_get_jpmidi_root();
+
     prev_state = state;
     
-    if (state != JackTransportRolling) return 0; // We don't do anything if the transport is not rolling.
+    if (state != JackTransportRolling) return; // We don't do anything if the transport is not rolling.
+
+    // Song frames played in this cycle.  With latency compensation
+    // the window runs ahead of the transport by the downstream
+    // playback latency so events reach the synths on time.
+    // Before the song starts (a negative offset, or near the start)
+    // only the seek and render start are clamped to 0; the events keep
+    // their offset from the unclamped start of the window.
+    int64_t compensation = jackclient_get_total_latency();
+    int64_t window_position = jackclient_song_position() + compensation;
+    int64_t window_start = window_position > 0 ? window_position : 0;
+    int64_t window_end = window_position + nframes;
 
     // Do we need to seek within our own midi data to sync the playback position?
-    if (current_time == NULL || expected_frame != transport_pos.frame)
+    if (expected_frame != transport_pos.frame)
     {
-        // We have an entry point every second.  Lookup time for the nearest previous second boundary.
-        current_time = jpmidi_lookup_entrypoint( root, transport_pos.frame);
+        // Events between the transport position and the compensated
+        // window are sent straight away rather than skipped, so the
+        // first beat is not lost when starting from a locate point.
+        jackclient_seek( root, (compensation > 0) ? song_frame : (jpmidi_frame_t)window_start);
+        STAT_INC( stats.seeks, 1);
+        seek_count++;
 
-        // Advance to the time greater than or equal to the transport frame time.
-        while (current_time && jpmidi_time_get_frame(current_time) < transport_pos.frame)
-            current_time = jpmidi_time_get_next( current_time);
+        if (lookahead_is_enabled()) {
+            lookahead_set_position( (jpmidi_frame_t)window_end);
+            rt_generation = lookahead_invalidate();
+        }
     }
 
-    if (current_time == NULL) return 0; // Transport is beyond the last time in our own midi data.
-
-    // Frame for the beginning of next cycle.  Events we send in this
-    // cycle must have a frame time less than this.
+    // Transport frame for the beginning of next cycle.
     expected_frame = transport_pos.frame + nframes;
 
-    if (jpmidi_time_get_frame(current_time) >= expected_frame) return 0; // no events to send this cycle
+    window_origin = window_position;
 
-    while (current_time && jpmidi_time_get_frame(current_time) < expected_frame)
+    // The song ends within this cycle and the next one is ready: play
+    // up to and including the end, then on into the next song from its
+    // start at the same offset in the cycle.
+    if (__atomic_load_n( &auto_advance, __ATOMIC_RELAXED) && window_end > (int64_t)root->end_frame &&
+        __atomic_load_n( &next_song, __ATOMIC_ACQUIRE) && !__atomic_load_n( &finished_song, __ATOMIC_ACQUIRE))
     {
-        int i;
-        for (i = 0; i < jpmidi_time_get_event_count(current_time); i++)
+        int64_t end = (int64_t)root->end_frame > window_start ? (int64_t)root->end_frame : window_start;
+        jpmidi_root_t* next;
+
+        jackclient_render_scheduled( root, port_buf, window_start, end + 1);
+        next = __atomic_exchange_n( &next_song, NULL, __ATOMIC_ACQ_REL);
+        if (next != NULL) {
+            jackclient_song_advance( port_buf, next, end, (jack_nframes_t)(end - window_origin));
+            root = next;
+            window_origin -= end;
+            window_start = 0;
+            window_end -= end;
+            jackclient_seek( root, 0);
+        }
+        else window_start = end + 1;
+    }
+
+    jackclient_render_scheduled( root, port_buf, window_start, window_end);
+
+    if (lookahead_is_enabled()) lookahead_set_position( (jpmidi_frame_t)window_end);
+}
+
+/** Render a window, splitting it at each scheduled command due in it,
+ *  so the command takes effect exactly between the song events before
+ *  and at its frame.
+ */
+void jackclient_render_scheduled( jpmidi_root_t* root, void* port_buf, int64_t window_start, int64_t window_end)
+{
+    while (rt_schedule_count > 0 && (int64_t)rt_schedule[0].at < window_end)
+    {
+        if ((int64_t)rt_schedule[0].at > window_start) {
+            jackclient_render( root, port_buf, window_start, rt_schedule[0].at);
+            window_start = rt_schedule[0].at;
+        }
+        jackclient_rt_command_apply( port_buf, &rt_schedule[0], (jack_nframes_t)(window_start - window_origin));
+
+        memmove( &rt_schedule[0], &rt_schedule[1], (rt_schedule_count - 1) * sizeof(rt_schedule[0]));
+        __atomic_store_n( &rt_schedule_count, rt_schedule_count - 1, __ATOMIC_RELAXED);
+    }
+    jackclient_render( root, port_buf, window_start, window_end);
+}
+
+/** Send the song events from window_start up to window_end, from the
+ *  lookahead ring if it is enabled.
+ */
+void jackclient_render( jpmidi_root_t* root, void* port_buf, int64_t window_start, int64_t window_end)
+{
+    if (lookahead_is_enabled()) jackclient_render_lookahead( root, port_buf, window_start, window_end);
+    else jackclient_render_direct( root, port_buf, window_start, window_end);
+}
+
+/** Point current_time at the first time record at or after frame. */
+void jackclient_seek( jpmidi_root_t* root, jpmidi_frame_t frame)
+{
+    // We have an entry point every second.  Lookup time for the nearest previous second boundary.
+    current_time = jpmidi_lookup_entrypoint( root, frame);
+    current_event = 0;
+    deferred_pending = 0;
+    cursor_valid = 1;
+
+    // Advance to the time greater than or equal to the seek frame time.
+    while (current_time && jpmidi_time_get_frame(current_time) < frame)
+        current_time = jpmidi_time_get_next( current_time);
+}
+
+/** Send the events of the time records from current_time up to
+ *  window_end, applying the filters as we go.  Events before
+ *  window_start are late and go out at its offset.  Returns 1 if the
+ *  port buffer filled up before we got there.
+ */
+int jackclient_render_direct( jpmidi_root_t* root, void* port_buf, int64_t window_start, int64_t window_end)
+{
+    // current_time is NULL when the transport is beyond the last time in our own midi data.
+    // Events we send in this cycle must have a frame time less than window_end.
+    while (current_time && jpmidi_time_get_frame(current_time) < window_end)
+    {
+        // Events left over from a previous cycle because the port
+        // buffer was full, or skipped over by a change in latency, go
+        // out at the start of this one.
+        jack_nframes_t time_in_cycle = window_start - window_origin;
+        if (jpmidi_time_get_frame(current_time) >= window_start) {
+            time_in_cycle = jpmidi_time_get_frame(current_time) - window_origin;
+            deferred_pending = 0;
+        }
+        else if (deferred_pending)
+            STAT_INC( stats.deferred, jpmidi_time_get_event_count(current_time) - current_event);
+
+        for (; current_event < jpmidi_time_get_event_count(current_time); current_event++)
         {
-            int j;
-            jpmidi_event_t* event = jpmidi_time_get_event(current_time, i);
+            jpmidi_event_t* event = jpmidi_time_get_event(current_time, current_event);
 
             // Apply sysex/solo/mute filters here
+            if (!jpmidi_event_should_send( root, event)) continue;
 
-            if (jpmidi_event_is_sysex(event))
-            {
-                if (!jpmidi_is_send_sysex_enabled(root)) continue;
+            int len = jpmidi_event_get_data_length(event);
+            unsigned char* data = jpmidi_event_get_data( event);
+            unsigned char message[3];
+            if (len <= 3) {
+                memcpy( message, data, len);
+                if (!jpmidi_message_transform( root, message, len)) continue;
+                data = message;
             }
-            else {
-                int channel = jpmidi_event_get_channel(event);
-                if (jpmidi_get_solo_channel(root) != -1 && channel != jpmidi_get_solo_channel(root)) continue;
-                if (jpmidi_channel_is_muted( root, channel)) continue;
 
-                if (jpmidi_event_get_status( event) == 0x80 && channel == 9) continue; // no note off on channel 10 (fluidsynth workaround)
-            }
+            if (jackclient_write_event( port_buf, time_in_cycle, data, len) == 0)
+                continue;
 
-            jack_nframes_t time_in_cycle = jpmidi_time_get_frame(current_time) - transport_pos.frame;
-            unsigned char* buffer = jack_midi_event_reserve(port_buf, time_in_cycle, jpmidi_event_get_data_length(event));
+            if (cycle_events == 0) {
+                // Will never fit, even in an empty buffer.
+                STAT_INC( stats.dropped, 1);
+                continue;
+            }
 
-            unsigned char* data = jpmidi_event_get_data( event);
-            for (j = 0; j < jpmidi_event_get_data_length(event); j++)
-                buffer[j] = data[j];
+            // The port buffer is full, pick up from here next cycle.
+            deferred_pending = 1;
+            return 1;
         }
 
+        current_event = 0;
         current_time = jpmidi_time_get_next( current_time);
     }
-    
     return 0;
 }
 
+/** Send the events for this cycle from the lookahead ring.  Until the
+ *  worker has caught up with the current generation the events are
+ *  rendered directly instead.
+ */
+void jackclient_render_lookahead( jpmidi_root_t* root, void* port_buf, int64_t window_start, int64_t window_end)
+{
+    jpmidi_frame_t from, until;
+    uint32_t generation = lookahead_get_generation();
+
+    if (generation != rt_generation) {
+        // Filters changed, what is in the ring is stale.
+        rt_generation = generation;
+        if (!cursor_valid) jackclient_seek( root, (jpmidi_frame_t)window_start);
+    }
+
+    int64_t direct_end = window_end;
+    if (lookahead_get_ready( rt_generation, &from, &until))
+    {
+        if ((int64_t)from < window_end && (int64_t)until < window_end) {
+            // The worker fell behind, render directly and let it start over.
+            rt_generation = lookahead_invalidate();
+            if (!cursor_valid) jackclient_seek( root, (jpmidi_frame_t)window_start);
+        }
+        else if ((int64_t)from < window_end) direct_end = from;
+    }
+
+    if (direct_end > window_start || deferred_pending)
+    {
+        if (jackclient_render_direct( root, port_buf, window_start, direct_end)) {
+            rt_generation = lookahead_invalidate();
+            return;
+        }
+    }
+
+    // From here on the ring has the events, our own cursor falls behind.
+    if (direct_end < window_end) cursor_valid = 0;
+
+    lookahead_record_t record;
+    while (lookahead_peek( &record))
+    {
+        if (record.generation != rt_generation || (int64_t)record.frame < window_start) {
+            // Stale, or already sent directly.
+            lookahead_skip( &record);
+            continue;
+        }
+        if ((int64_t)record.frame >= window_end) break;
+
+        jackclient_merge_input( port_buf, record.frame - window_origin);
+        unsigned char* buffer = jack_midi_event_reserve(port_buf, record.frame - window_origin, record.len);
+        if (buffer == NULL) {
+            if (cycle_events == 0) {
+                STAT_INC( stats.dropped, 1);
+                lookahead_skip( &record);
+                continue;
+            }
+
+            // The port buffer is full.  Resume from this event directly next
+            // cycle, the worker starts over behind us.
+            current_time = jpmidi_lookup_time( root, record.frame);
+            current_event = record.index;
+            deferred_pending = 1;
+            cursor_valid = 1;
+            rt_generation = lookahead_invalidate();
+            return;
+        }
+
+        lookahead_read( &record, buffer);
+        jackclient_track_event( buffer, record.len);
+        cycle_events += 1;
+        cycle_bytes += record.len;
+    }
+}
+
+/** Fill in a snapshot of the performance counters. */
+void jackclient_get_stats( jackclient_stats_t* s)
+{
+    int i;
+    uint64_t below = 0;
+    uint64_t total = 0;
+
+    s->cycles     = STAT_GET( stats.cycles);
+    s->usecs_min  = s->cycles ? STAT_GET( stats.usecs_min) : 0;
+    s->usecs_max  = STAT_GET( stats.usecs_max);
+    s->usecs_avg  = s->cycles ? (uint32_t)(STAT_GET( stats.usecs_total) / s->cycles) : 0;
+    s->events     = STAT_GET( stats.events);
+    s->bytes      = STAT_GET( stats.bytes);
+    s->events_max = STAT_GET( stats.events_max);
+    s->bytes_max  = STAT_GET( stats.bytes_max);
+    s->seeks      = STAT_GET( stats.seeks);
+    s->deferred   = STAT_GET( stats.deferred);
+    s->dropped    = STAT_GET( stats.dropped);
+    s->xruns      = STAT_GET( stats.xruns);
+
+    // The 99th percentile is the upper edge of the histogram bucket
+    // that takes the running count past 99% of the cycles.
+    for (i = 0; i <= STATS_HIST_BUCKETS; i++) total += STAT_GET( stats.hist[i]);
+    s->usecs_p99 = 0;
+    for (i = 0; i <= STATS_HIST_BUCKETS && total > 0; i++) {
+        below += STAT_GET( stats.hist[i]);
+        if (below * 100 >= total * 99) {
+            s->usecs_p99 = (i == STATS_HIST_BUCKETS) ? s->usecs_max : (uint32_t)(i + 1) * STATS_HIST_USECS;
+            break;
+        }
+    }
+}
+
+/** Ask the process thread to zero the counters. */
+void jackclient_reset_stats()
+{
+    __atomic_store_n( &stats_reset_requested, 1, __ATOMIC_RELEASE);
+    __atomic_store_n( &stats.xruns, 0, __ATOMIC_RELAXED);
+}
+
+/** Format the performance counters as a single line of text. */
+int jackclient_format_stats( char* buffer, int size)
+{
+    jackclient_stats_t s;
+    jackclient_get_stats( &s);
+
+    return snprintf( buffer, size,
+                     "cycles %llu usecs min %u avg %u max %u p99 %u"
+                     " events %llu (max %u/cycle) bytes %llu (max %u/cycle)"
+                     " seeks %llu deferred %llu dropped %llu xruns %llu",
+                     (unsigned long long)s.cycles, s.usecs_min, s.usecs_avg, s.usecs_max, s.usecs_p99,
+                     (unsigned long long)s.events, s.events_max,
+                     (unsigned long long)s.bytes, s.bytes_max,
+                     (unsigned long long)s.seeks, (unsigned long long)s.deferred,
+                     (unsigned long long)s.dropped, (unsigned long long)s.xruns);
+}
+
+/** Queue a command for the process thread.  Returns 1 if the queue is
+ *  full.
+ */
+int jackclient_rt_command_send( const jackclient_rt_command_t* command)
+{
+    int result = 1;
+
+    if (rt_queue == NULL) return 1;
+
+    // The ring has a single writer, senders on other threads take turns.
+    pthread_mutex_lock( &rt_queue_lock);
+    if (jack_ringbuffer_write_space( rt_queue) >= sizeof(*command)) {
+        jack_ringbuffer_write( rt_queue, (const char*)command, sizeof(*command));
+        result = 0;
+    }
+    pthread_mutex_unlock( &rt_queue_lock);
+    return result;
+}
+
+/** Returns the number of scheduled commands waiting for their frame. */
+int jackclient_get_scheduled_count()
+{
+    return __atomic_load_n( &rt_schedule_count, __ATOMIC_RELAXED);
+}
+
+/* Send all sound off on a channel. */
+static void jackclient_sound_off( void* port_buf, int channel, jack_nframes_t time_in_cycle)
+{
+    unsigned char sound_off[3] = { 0xB0 | channel, 120, 0 };
+    if (jackclient_write_event( port_buf, time_in_cycle, sound_off, 3))
+        STAT_INC( stats.dropped, 1);
+}
+
+/** Apply a whole mute/solo/sysex/transpose scene at the start of the
+ *  next cycle and wait until it has been applied.  Returns 1 if the
+ *  process thread did not get to it within a second; it is not
+ *  applied then.
+ */
+int jackclient_apply_scene( const jpmidi_scene_t* scene)
+{
+    int result;
+
+    pthread_mutex_lock( &scene_handoff.lock);
+    pending_scene = *scene;
+    result = jackclient_handoff( &scene_handoff);
+    pthread_mutex_unlock( &scene_handoff.lock);
+    return result;
+}
+
+/** Switch to the pending scene at the start of the cycle. */
+void jackclient_scene_process( void* port_buf)
+{
+    if (!jackclient_handoff_take( &scene_handoff)) return;
+
+    jackclient_scene_switch( port_buf, &pending_scene, 0);
+    jackclient_handoff_done( &scene_handoff);
+}
+
+/* Send a note-off for every note sounding on an output channel. */
+static void jackclient_release_notes( void* port_buf, int channel, jack_nframes_t time_in_cycle)
+{
+    int note;
+
+    for (note = 0; note < 128; note++) {
+        if (!(sounding[channel][note >> 5] & (1u << (note & 31)))) continue;
+        unsigned char note_off[3] = { 0x80 | channel, note, 0 };
+        if (jackclient_write_event( port_buf, time_in_cycle, note_off, 3))
+            STAT_INC( stats.dropped, 1);
+    }
+}
+
+/** Switch to a scene.  Notes sounding on channels the scene silences,
+ *  or whose transpose changes, get their note-off now since the song's
+ *  own note-offs will not match them any more.
+ */
+void jackclient_scene_switch( void* port_buf, const jpmidi_scene_t* scene, jack_nframes_t time_in_cycle)
+{
+    jpmidi_root_t* root = main_get_jpmidi_root();
+    int channel;
+
+    for (channel = 0; channel < 16; channel++)
+    {
+        if (jpmidi_scene_channel_audible( scene, channel) &&
+            scene->transpose[channel] == jpmidi_channel_get_transpose( root, channel))
+            continue;
+
+        jackclient_release_notes( port_buf, jpmidi_channel_get_output( root, channel), time_in_cycle);
+    }
+
+    jpmidi_scene_set( root, scene);
+    lookahead_invalidate();
+}
+
+/** Replace the playing song old at the start of the next cycle and
+ *  wait until it has been replaced.  Returns 2 if old was no longer
+ *  playing by then, and 1 if the process thread did not get to it
+ *  within a second; the switch is withdrawn then.  Unless 0 is
+ *  returned root was not used, the caller frees it.
+ */
+int jackclient_switch_song( jpmidi_root_t* old, jpmidi_root_t* root)
+{
+    int result;
+
+    pthread_mutex_lock( &song_handoff.lock);
+    pending_song = root;
+    pending_song_replaces = old;
+    song_rejected = 0;
+    result = jackclient_handoff( &song_handoff);
+    if (result == 0 && song_rejected) result = 2;
+    pthread_mutex_unlock( &song_handoff.lock);
+    return result;
+}
+
+/** Switch to the pending song at the start of the cycle.  It takes
+ *  over the scene of the old one, the notes still sounding are
+ *  released, and playback seeks into the new song at the same frame.
+ */
+void jackclient_song_process( void* port_buf)
+{
+    jpmidi_root_t* root = pending_song;
+    jpmidi_scene_t scene;
+    int channel;
+
+    if (!jackclient_handoff_take( &song_handoff)) return;
+
+    // The setlist moved on to another song meanwhile.
+    if (main_get_jpmidi_root() != pending_song_replaces) {
+        song_rejected = 1;
+        jackclient_handoff_done( &song_handoff);
+        return;
+    }
+
+    jpmidi_scene_get( main_get_jpmidi_root(), &scene);
+    jpmidi_scene_set( root, &scene);
+
+    // The tables of the playing song have the transforms applied last,
+    // root may have been compiled while they changed.
+    jpmidi_transform_replace( root, &main_get_jpmidi_root()->transform);
+
+    for (channel = 0; channel < 16; channel++)
+        jackclient_release_notes( port_buf, channel, 0);
+
+    main_set_jpmidi_root( root);
+    current_time = NULL;
+    expected_frame = UINT32_MAX;
+    lookahead_invalidate();
+
+    jackclient_handoff_done( &song_handoff);
+}
+
+/** Change the channel transforms at the start of the next cycle and
+ *  wait until they have been changed.  The tables are compiled here so
+ *  the process thread only copies them.  Returns 1 if the process
+ *  thread did not get to it within a second; they are not changed
+ *  then.
+ */
+int jackclient_apply_transform( const transform_settings_t* settings)
+{
+    static const int no_transpose[16];
+    transform_settings_t current;
+    int result, channel;
+
+    pthread_mutex_lock( &transform_handoff.lock);
+
+    // Only this side reads the settings, the process thread gets the
+    // tables and the channels to release.
+    transform_get( &current);
+    pending_transform_release = 0;
+    for (channel = 0; channel < 16; channel++)
+        if (!transform_channel_equal( &current.channel[channel], &settings->channel[channel]))
+            pending_transform_release |= 1u << channel;
+    transform_set( settings);
+
+    transform_compile( &pending_transform_table, settings, no_transpose);
+    result = jackclient_handoff( &transform_handoff);
+    if (result) transform_set( &current);
+
+    pthread_mutex_unlock( &transform_handoff.lock);
+    return result;
+}
+
+/** Switch to the pending transforms at the start of the cycle.  Notes
+ *  sounding from a channel whose transform changes are released on the
+ *  channel they were sent to, as their note-offs may now be changed or
+ *  dropped.
+ */
+void jackclient_transform_process( void* port_buf)
+{
+    jpmidi_root_t* root;
+    int channel;
+
+    if (!jackclient_handoff_take( &transform_handoff)) return;
+
+    root = main_get_jpmidi_root();
+    for (channel = 0; channel < 16; channel++) {
+        if (pending_transform_release & (1u << channel))
+            jackclient_release_notes( port_buf, jpmidi_channel_get_output( root, channel), 0);
+    }
+
+    jpmidi_transform_replace( root, &pending_transform_table);
+    lookahead_invalidate();
+
+    // The slots take the table too, it is released after them.
+    transform_replaced = 1;
+}
+
+/** Offer root as the song to follow the playing one, NULL for none.
+ *  Returns the song offered before if the process thread has not taken
+ *  it; nothing else has seen it, the caller frees it.
+ */
+jpmidi_root_t* jackclient_set_next_song( jpmidi_root_t* root)
+{
+    return __atomic_exchange_n( &next_song, root, __ATOMIC_ACQ_REL);
+}
+
+/** Returns the song offered by jackclient_set_next_song(), NULL once
+ *  it has been taken.
+ */
+jpmidi_root_t* jackclient_get_next_song()
+{
+    return __atomic_load_n( &next_song, __ATOMIC_ACQUIRE);
+}
+
+/** Returns the song the next one replaced, or NULL.  The caller frees
+ *  it once the other threads have let go of it.
+ */
+jpmidi_root_t* jackclient_take_finished_song()
+{
+    return __atomic_exchange_n( &finished_song, NULL, __ATOMIC_ACQ_REL);
+}
+
+void jackclient_set_auto_advance( int enabled)
+{
+    __atomic_store_n( &auto_advance, enabled, __ATOMIC_RELAXED);
+}
+
+int jackclient_get_auto_advance()
+{
+    return __atomic_load_n( &auto_advance, __ATOMIC_RELAXED);
+}
+
+/** Start the next song from its beginning at the start of the next
+ *  cycle and wait until it has started.  Returns 1 if there is no next
+ *  song, the song before is not freed yet, or the process thread did
+ *  not get to it within a second.
+ */
+int jackclient_advance()
+{
+    int result;
+
+    pthread_mutex_lock( &advance_handoff.lock);
+    advance_failed = 0;
+    result = jackclient_handoff( &advance_handoff) || advance_failed;
+    pthread_mutex_unlock( &advance_handoff.lock);
+    return result;
+}
+
+/** Start the next song at the start of the cycle, if asked to. */
+void jackclient_advance_process( void* port_buf)
+{
+    jpmidi_root_t* next;
+
+    if (!jackclient_handoff_take( &advance_handoff)) return;
+
+    if (__atomic_load_n( &finished_song, __ATOMIC_ACQUIRE) ||
+        (next = __atomic_exchange_n( &next_song, NULL, __ATOMIC_ACQ_REL)) == NULL)
+        advance_failed = 1;
+    else {
+        jackclient_song_advance( port_buf, next, (int64_t)song_frame, 0);
+        current_time = NULL;
+        expected_frame = UINT32_MAX;
+    }
+    jackclient_handoff_done( &advance_handoff);
+}
+
+/** Make next the playing song, with its frame 0 at frame shift of the
+ *  playing one.  The transport rolls on, the song frame is moved back
+ *  instead.  Notes still sounding are released at time_in_cycle.  The
+ *  new song keeps its own scene but follows the current transforms.
+ */
+void jackclient_song_advance( void* port_buf, jpmidi_root_t* next, int64_t shift, jack_nframes_t time_in_cycle)
+{
+    jpmidi_root_t* root = main_get_jpmidi_root();
+    int channel;
+
+    for (channel = 0; channel < 16; channel++)
+        jackclient_release_notes( port_buf, channel, time_in_cycle);
+
+    // Transforms changed after next was loaded are in the tables of root.
+    jpmidi_transform_replace( next, &root->transform);
+    main_set_jpmidi_root( next);
+    __atomic_store_n( &finished_song, root, __ATOMIC_RELEASE);
+
+    __atomic_store_n( &song_origin, song_origin + shift, __ATOMIC_RELAXED);
+    __atomic_store_n( &song_frame, jackclient_song_position() > 0 ? (jpmidi_frame_t)jackclient_song_position() : 0,
+                      __ATOMIC_RELAXED);
+
+    // Scheduled commands were meant for the old song.
+    __atomic_store_n( &rt_schedule_count, 0, __ATOMIC_RELAXED);
+    rt_generation = lookahead_invalidate();
+    seek_count++;
+}
+
+/** Take the queued commands off the ring at the start of a cycle.
+ *  Scheduled ones are put aside until the song reaches them, the
+ *  others are applied straight away.
+ */
+void jackclient_rt_commands_process( void* port_buf)
+{
+    jackclient_rt_command_t command;
+    int i;
+
+    while (jack_ringbuffer_read_space( rt_queue) >= sizeof(command))
+    {
+        jack_ringbuffer_read( rt_queue, (char*)&command, sizeof(command));
+
+        if (!command.scheduled) {
+            jackclient_rt_command_apply( port_buf, &command, 0);
+            continue;
+        }
+        if (rt_schedule_count == RT_SCHEDULE_SIZE) {
+            STAT_INC( stats.dropped, 1);
+            continue;
+        }
+
+        // Keep the schedule ordered, after commands due at the same frame.
+        for (i = rt_schedule_count; i > 0 && rt_schedule[i - 1].at > command.at; i--)
+            rt_schedule[i] = rt_schedule[i - 1];
+        rt_schedule[i] = command;
+        __atomic_store_n( &rt_schedule_count, rt_schedule_count + 1, __ATOMIC_RELAXED);
+    }
+}
+
+/** Apply one command, sending any sound off messages it needs at
+ *  time_in_cycle.
+ */
+void jackclient_rt_command_apply( void* port_buf, const jackclient_rt_command_t* command, jack_nframes_t time_in_cycle)
+{
+    jpmidi_root_t* root = main_get_jpmidi_root();
+    jpmidi_scene_t scene;
+    int i;
+
+    switch (command->type) {
+    case RT_COMMAND_PLAY:
+        jack_transport_start( client);
+        break;
+    case RT_COMMAND_STOP:
+        jack_transport_stop( client);
+        break;
+    case RT_COMMAND_LOCATE:
+        jackclient_locate( command->frame);
+        break;
+    case RT_COMMAND_MUTE:
+        if (jpmidi_mute_channel( root, command->channel)) break;
+        jackclient_sound_off( port_buf, jpmidi_channel_get_output( root, command->channel - 1), time_in_cycle);
+        lookahead_invalidate();
+        break;
+    case RT_COMMAND_UNMUTE:
+        if (jpmidi_unmute_channel( root, command->channel)) break;
+        lookahead_invalidate();
+        break;
+    case RT_COMMAND_SOLO:
+        if (jpmidi_solo_channel( root, command->channel)) break;
+        lookahead_invalidate();
+        if (command->channel == 0) break;
+        for (i = 0; i < 16; i++) {
+            if (i != command->channel - 1 && jpmidi_channel_has_data( root, i))
+                jackclient_sound_off( port_buf, jpmidi_channel_get_output( root, i), time_in_cycle);
+        }
+        break;
+    case RT_COMMAND_TRANSPOSE:
+        if (command->channel < 1 || command->channel > 16) break;
+        jpmidi_scene_get( root, &scene);
+        scene.transpose[command->channel - 1] = command->value;
+        jackclient_scene_switch( port_buf, &scene, time_in_cycle);
+        break;
+    case RT_COMMAND_SCENE:
+        jackclient_scene_switch( port_buf, &command->scene, time_in_cycle);
+        break;
+    case RT_COMMAND_CLEAR:
+        __atomic_store_n( &rt_schedule_count, 0, __ATOMIC_RELAXED);
+        break;
+    }
+}
+
 jack_client_t* jackclient_get_client()
 {
     return client;
@@ -220,6 +1495,10 @@ jack_port_t* jackclient_get_port()
 {
     return output_port;
 }
+jack_port_t* jackclient_get_input_port()
+{
+    return input_port;
+}
 
 #define CM_POOL_SIZE 16
 
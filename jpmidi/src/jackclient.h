@@ -27,7 +27,13 @@ extern "C" {
 #include <jack/jack.h>
 #include <jack/types.h>
 
-int jackclient_new(const char* client_name);
+#include "jpmidi.h"
+
+/** Open the jack client and register the output port.  If with_input
+ * is true an input port is registered too, events received on it are
+ * merged into the output in the same cycle.
+ */
+int jackclient_new(const char* client_name, int with_input);
 int jackclient_activate();
 int jackclient_deactivate();
 int jackclient_close();
@@ -36,6 +42,49 @@ jack_client_t* jackclient_get_client(); ///< The jack client object created by t
     
 jack_port_t* jackclient_get_port(); ///< The jack port object created by this program
 
+jack_port_t* jackclient_get_input_port(); ///< The input port, NULL unless requested
+
+
+/** Enable/disable shifting event scheduling earlier by the playback
+ * latency jack reports for the ports we are connected to.  Enabled by
+ * default.
+ */
+void jackclient_set_latency_compensation( int enabled);
+
+/** Returns true if latency compensation is enabled. */
+int jackclient_get_latency_compensation();
+
+/** Set a manual latency offset for the output port, in frames.
+ * Positive values send events earlier, negative values later.  The
+ * offset is applied on top of the compensation reported by jack.
+ */
+void jackclient_set_latency_offset( int frames);
+
+/** Returns the manual latency offset of the output port, in frames. */
+int jackclient_get_latency_offset();
+
+/** Returns the playback latency downstream of the output port, as last
+ * reported by jack's latency callback.
+ */
+jack_nframes_t jackclient_get_playback_latency();
+
+/** Returns the total number of frames events are currently sent ahead
+ * of their song position.
+ */
+int jackclient_get_total_latency();
+
+/** Count events the process thread could not write to an output port
+ * because its buffer was full, see jackclient_stats_t.dropped.
+ */
+void jackclient_count_dropped( int count);
+
+/** Locate the transport to a song frame, which may be beyond the 32
+ *  bit JACK transport frame.
+ */
+void jackclient_locate( jpmidi_frame_t frame);
+
+/** Returns the song frame of the current transport position. */
+jpmidi_frame_t jackclient_get_song_frame();
 
 /** Message struct used to send unscheduled midi control messages.
  * Messages sent in this manner are not guaranteed to be sent in any
@@ -57,8 +106,167 @@ control_message_t* jackclient_control_message_reserve();
 /** Schedules the control message to be sent on frame 0 of the next
  * process cycle and returns the message to the pool.
  */
-void jackclient_control_message_queue( control_message_t* message);    
-    
+void jackclient_control_message_queue( control_message_t* message);
+
+/** Snapshot of the performance counters maintained by the process()
+ * callback.  Cycle times are wall clock microseconds measured with
+ * jack_get_time().
+ */
+typedef struct jackclient_stats
+{
+    uint64_t cycles;          ///< Number of process cycles measured.
+    uint32_t usecs_min;       ///< Shortest process() run.
+    uint32_t usecs_avg;       ///< Average process() run.
+    uint32_t usecs_max;       ///< Longest process() run.
+    uint32_t usecs_p99;       ///< 99th percentile process() run.
+    uint64_t events;          ///< Total MIDI events written to the port.
+    uint64_t bytes;           ///< Total MIDI bytes written to the port.
+    uint32_t events_max;      ///< Most events written in a single cycle.
+    uint32_t bytes_max;       ///< Most bytes written in a single cycle.
+    uint64_t seeks;           ///< Number of seeks within our own midi data.
+    uint64_t deferred;        ///< Events sent late because the port buffer was full.
+    uint64_t dropped;         ///< Events lost because they could not be sent at all.
+    uint64_t xruns;           ///< Number of xruns reported by jack.
+} jackclient_stats_t;
+
+/** Fill in a snapshot of the performance counters.  Safe to call from
+ * any thread, the process thread is never blocked.
+ */
+void jackclient_get_stats( jackclient_stats_t* stats);
+
+/** Ask the process thread to zero the performance counters at the
+ * start of its next cycle.
+ */
+void jackclient_reset_stats();
+
+/** Format the performance counters as a single line of text into
+ * buffer.  Returns the number of characters written, as snprintf().
+ */
+int jackclient_format_stats( char* buffer, int size);
+
+/** Commands the process thread applies at the start of its next
+ * cycle, for remote controls that need the lowest latency.  A
+ * scheduled command is held until the song reaches its frame instead,
+ * and is applied at that exact frame within the cycle.
+ */
+typedef enum jackclient_rt_command_type
+{
+    RT_COMMAND_PLAY,
+    RT_COMMAND_STOP,
+    RT_COMMAND_LOCATE,      ///< Locate the transport to frame.
+    RT_COMMAND_MUTE,        ///< Mute channel 1-16 and silence it.
+    RT_COMMAND_UNMUTE,      ///< Unmute channel 1-16.
+    RT_COMMAND_SOLO,        ///< Solo channel 1-16, 0 disables solo.
+    RT_COMMAND_TRANSPOSE,   ///< Transpose channel 1-16 by value semitones.
+    RT_COMMAND_SCENE,       ///< Switch to scene, as jackclient_apply_scene().
+    RT_COMMAND_CLEAR        ///< Forget the scheduled commands not applied yet.
+} jackclient_rt_command_type_t;
+
+typedef struct jackclient_rt_command
+{
+    jackclient_rt_command_type_t type;
+    int channel;
+    int value;
+    jpmidi_frame_t frame;
+    int scheduled;          ///< Non zero to hold the command until the song reaches at.
+    jpmidi_frame_t at;      ///< Song frame to apply a scheduled command at.
+    jpmidi_scene_t scene;
+} jackclient_rt_command_t;
+
+/** Queue a command for the process thread, without waiting for it.
+ * May be called from any non real-time thread.  Returns 1 if the queue
+ * is full.
+ */
+int jackclient_rt_command_send( const jackclient_rt_command_t* command);
+
+/** Returns the number of scheduled commands waiting for their frame.
+ * Scheduled commands wait while the transport is stopped.  One whose
+ * frame has already passed, after a locate for instance, is applied
+ * at the start of the next cycle the transport rolls.
+ */
+int jackclient_get_scheduled_count();
+
+/** Apply a complete mute/solo/sysex/transpose scene at the start of
+ * one process cycle, releasing exactly the sounding notes it silences
+ * or transposes in the same cycle.  Waits until the scene has been
+ * applied; returns 1, leaving the scene unchanged, if the process
+ * thread did not take it within a second.
+ */
+int jackclient_apply_scene( const jpmidi_scene_t* scene);
+
+/** Replace the song being played, old, with root at the start of one
+ * process cycle.  The transport keeps its position, root takes over
+ * the current scene and the sounding notes are released.  Waits until
+ * the song has been replaced; returns 1 if the process thread did not
+ * take it within a second, 2 if old had been replaced by another song
+ * meanwhile.  root is not used unless 0 is returned.
+ */
+int jackclient_switch_song( jpmidi_root_t* old, jpmidi_root_t* root);
+
+/** Offer root, loaded ahead, as the song to follow the playing one, or
+ * NULL to withdraw it.  Returns the song offered before when it was
+ * not taken, for the caller to free.
+ */
+jpmidi_root_t* jackclient_set_next_song( jpmidi_root_t* root);
+
+/** Returns the song offered to follow the playing one, NULL after the
+ * process thread has taken it.
+ */
+jpmidi_root_t* jackclient_get_next_song();
+
+/** Returns a song replaced by the next one, or NULL.  The caller frees
+ * it once no other thread can be using it any more.
+ */
+jpmidi_root_t* jackclient_take_finished_song();
+
+/** When enabled the next song starts at the end of the playing one,
+ * in the same cycle and without a gap.  The transport rolls on, song
+ * frames count from where the song started until the transport jumps.
+ */
+void jackclient_set_auto_advance( int enabled);
+int jackclient_get_auto_advance();
+
+/** Start the next song from its beginning at the start of one process
+ * cycle, releasing the sounding notes.  Waits until it has started;
+ * returns 1 if there is no next song or that took more than a second.
+ */
+int jackclient_advance();
+
+/** Replace the channel transforms at the start of one process cycle,
+ * releasing the notes sounding from the channels that change.  Waits
+ * until they have been replaced; returns 1, leaving them unchanged,
+ * if the process thread did not take them within a second.
+ */
+int jackclient_apply_transform( const transform_settings_t* settings);
+
+/** Transport position and playback state as of the end of the last
+ * process cycle.
+ */
+typedef struct jackclient_snapshot
+{
+    jack_transport_state_t state;
+    jpmidi_frame_t frame;           ///< Song frame of the transport position.
+    jack_nframes_t frame_rate;
+    int bbt_valid;                  ///< Non zero if a timebase master supplies bar/beat/tick.
+    int32_t bar;
+    int32_t beat;
+    int32_t tick;
+    float beats_per_bar;
+    double beats_per_minute;
+    uint32_t seek_count;            ///< Changes whenever the playback position jumps.
+    uint32_t notes[16][4];          ///< Sounding notes, bit n%32 of word n/32 for note n.
+} jackclient_snapshot_t;
+
+/** Copy the state published by the process thread.  Safe to call from
+ * any thread, the process thread is never blocked.
+ */
+void jackclient_get_snapshot( jackclient_snapshot_t* snapshot);
+
+/** Get the highest note-on velocity sent on each of the 16 channels
+ * since the previous call, and start over.
+ */
+void jackclient_take_peaks( uint8_t* peaks);
+
 #ifdef __cplusplus
 }
 #endif
@@ -18,13 +18,18 @@
 
 #include <glib.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 
 #include "jpmidi.h"
+#include "tempomap.h"
+#include "songstats.h"
+#include "eventindex.h"
 #include "dump.h"
 #include "elements.h"
 #include "except.h"
+#include "memstats.h"
 #include "md.h"
 #include "midi.h"
 
@@ -36,10 +41,15 @@ void jpmidi_process_element(jpmidi_root_t*, struct element *el);
 gboolean jpmidi_root_data_traverse(gpointer key, gpointer value, gpointer data);
 
 static GArray* listeners;
+static int compact = 0;
+
+static jpmidi_root_t* jpmidi_load( char* filename, jack_nframes_t sample_rate, struct midiTracks* previous);
+static jpmidi_frame_t jpmidi_tick_to_frame( jpmidi_root_t* root, uint32_t smf_time);
 
 int jpmidi_init()
 {
     dump_init();
+    transform_init();
     listeners = g_array_new( FALSE, FALSE, sizeof( jpmidi_loadfile_listener_t));
     return 1; // Success
 }
@@ -79,21 +89,39 @@ void jpmidi_remove_loadfile_listener( jpmidi_loadfile_listener_t callback)
  * Load/process a MIDI file and get ready to play it via Jack's MIDI API.
  */
 jpmidi_root_t* jpmidi_loadfile(char *filename, jack_nframes_t sample_rate)
+{
+    return jpmidi_load( filename, sample_rate, NULL);
+}
+
+/** Load a new version of the file of root, parsing only the tracks
+ *  that changed.  The others are shared with root, which must be
+ *  freed with jpmidi_root_release().
+ */
+jpmidi_root_t* jpmidi_reload( jpmidi_root_t* root)
+{
+    return jpmidi_load( root->filename, root->sample_rate, root->tracks);
+}
+
+/* Load a file, reusing the unchanged tracks of previous if given. */
+static jpmidi_root_t* jpmidi_load( char* filename, jack_nframes_t sample_rate, struct midiTracks* previous)
 {
     struct rootElement *proot;
     struct sequenceState *seq;
     struct element *el;
+    struct midiTracks* tracks = NULL;
 
     if (strcmp(filename, "-") == 0)
         proot = midi_read(stdin);
-    else
+    else if (compact)
         proot = midi_read_file(filename);
+    else
+        proot = midi_read_tracks(filename, previous, &tracks);
     if (!proot)
         return NULL;
 
 
-    /* FIXME - free this somewhere */
     jpmidi_root_t* root = jpmidi_root_new( filename, proot, sample_rate);
+    root->tracks = tracks;
     
     /* Process all the elements in the file. */
     seq = md_sequence_init(proot);
@@ -101,8 +129,16 @@ jpmidi_root_t* jpmidi_loadfile(char *filename, jack_nframes_t sample_rate)
         jpmidi_process_element(root, el);
     }
 
+    // The song lasts until the last end of track, which may come well
+    // after its last event.
+    root->end_frame = root->last_frame;
+    if (md_sequence_end_time(seq) > root->xtempo_tick &&
+        jpmidi_tick_to_frame( root, md_sequence_end_time(seq)) > root->end_frame)
+        root->end_frame = jpmidi_tick_to_frame( root, md_sequence_end_time(seq));
+    md_sequence_end(seq);
+
     // Add an entry point every second to reduce seek time
-    jack_nframes_t epframe;
+    jpmidi_frame_t epframe;
 
     for (epframe = 0; epframe < root->last_frame; epframe += root->sample_rate)
     {
@@ -110,6 +146,7 @@ jpmidi_root_t* jpmidi_loadfile(char *filename, jack_nframes_t sample_rate)
         if (time == NULL) {
             time = jpmidi_time_new( 0, epframe);
             g_tree_insert( root->data, &time->frame, time);
+            memstats_alloc( MEMSTATS_TIME_TREE, MEMSTATS_TREE_NODE_BYTES);
     }
     }
     
@@ -118,12 +155,35 @@ jpmidi_root_t* jpmidi_loadfile(char *filename, jack_nframes_t sample_rate)
     root->tail = NULL;
     g_tree_foreach( root->data, jpmidi_root_data_traverse, root);
 
+    songstats_collect( root);
+    eventindex_build( root);
+
+    // Playback only needs the flattened events from here on.
+    if (compact) {
+        jpmidi_time_t* time;
+        int i;
+        for (time = root->head; time; time = time->next_time)
+            for (i = 0; i < time->events->len; i++)
+                g_array_index( time->events, jpmidi_event_t*, i)->element = NULL;
+        md_free( MD_ELEMENT( root->pmidi_root));
+        root->pmidi_root = NULL;
+    }
 
     jpmidi_call_loadfile_listeners( root);
 
     return root;
 }
 
+void jpmidi_set_compact( int enabled)
+{
+    compact = enabled;
+}
+
+int jpmidi_is_compact()
+{
+    return compact;
+}
+
 /** Traversal function for g_tree_foreach().  This function links the
  *  time structs in root->data (GTree) into a list ordered by time.
  */
@@ -141,42 +201,87 @@ gboolean jpmidi_root_data_traverse(gpointer key, gpointer value, gpointer data)
     return FALSE;
 }
 
-/** GCompareFunc for comparing the jack_nframes_t* keys in the root data tree. */
+/** GCompareFunc for comparing the jpmidi_frame_t* keys in the root data
+ *  tree.  The keys are compared, not subtracted, a difference does not
+ *  fit in a gint.
+ */
 gint jpmidi_time_compare(gconstpointer  a, gconstpointer  b)
 {
-    guint64 ta = (gint64)*(jack_nframes_t*)a;
-    guint64 tb = (gint64)*(jack_nframes_t*)b;
+    jpmidi_frame_t ta = *(const jpmidi_frame_t*)a;
+    jpmidi_frame_t tb = *(const jpmidi_frame_t*)b;
 
-    return (gint)(ta - tb);
-    
+    return (ta > tb) - (ta < tb);
 }
 
 /** Create a new root data structure. */
 jpmidi_root_t* jpmidi_root_new( char* filename, struct rootElement* proot, jack_nframes_t sample_rate)
 {
     jpmidi_root_t* root = g_new0( jpmidi_root_t, 1);
+    int i;
+
     root->filename = strdup( filename);
     root->pmidi_root = proot;
     root->sample_rate = sample_rate;
     root->tempo_mpq = 500000;        /* 500K microseconds per quarter note = 120 BPM */
     root->data = g_tree_new( jpmidi_time_compare);
+    root->texts = g_array_new( FALSE, FALSE, sizeof( jpmidi_text_t));
+    root->markers = g_array_new( FALSE, FALSE, sizeof( int));
+    root->marker_names = g_hash_table_new( g_str_hash, g_str_equal);
+    root->tempos = g_array_new( FALSE, FALSE, sizeof( jpmidi_tempo_t));
+    root->meters = g_array_new( FALSE, FALSE, sizeof( jpmidi_meter_t));
+    for (i = 0; i < 3; i++)
+        memstats_alloc( MEMSTATS_MAPS, MEMSTATS_ARRAY_BYTES);
 
     root->send_sysex = 1;
     root->solo_channel = -1;
 
-    int i;
     for (i = 0; i < 16; i++) {
         root->channel[i].number = i+1;
     }
+    jpmidi_transform_update( root);
     return root;
 }
 
+/** Free a root replaced by a successor from jpmidi_reload(), leaving
+ *  the tracks they share to the successor.
+ */
+void jpmidi_root_release( jpmidi_root_t* root, jpmidi_root_t* successor)
+{
+    if (root->pmidi_root && successor->tracks)
+        midi_tracks_detach( root->pmidi_root, successor->tracks);
+    jpmidi_root_free( root);
+}
+
 /** Free the root data structure and everything in it. */
 void jpmidi_root_free( jpmidi_root_t* root)
 {
-    md_free(MD_ELEMENT(root->pmidi_root));
-    /** FIXME - free the time and event data. */
+    jpmidi_time_t* time;
+    jpmidi_time_t* next;
+    int i;
+
+    if (root->pmidi_root) md_free(MD_ELEMENT(root->pmidi_root));
+    midi_tracks_free( root->tracks);
     g_tree_destroy( root->data);
+    for (time = root->head; time; time = next) {
+        next = time->next_time;
+        memstats_free( MEMSTATS_TIME_TREE, MEMSTATS_TREE_NODE_BYTES);
+        jpmidi_time_free( time);
+    }
+    eventindex_free( root->index);
+    memstats_free( MEMSTATS_MAPS, MEMSTATS_ARRAY_BYTES + root->markers->len * sizeof(int));
+    memstats_free( MEMSTATS_MAPS, MEMSTATS_ARRAY_BYTES + root->tempos->len * sizeof(jpmidi_tempo_t));
+    memstats_free( MEMSTATS_MAPS, MEMSTATS_ARRAY_BYTES + root->meters->len * sizeof(jpmidi_meter_t));
+    g_array_free( root->markers, TRUE);
+    g_hash_table_destroy( root->marker_names);
+    for (i = 0; i < root->texts->len; i++) {
+        char* text = g_array_index( root->texts, jpmidi_text_t, i).text;
+        memstats_free( MEMSTATS_TEXTS, sizeof(jpmidi_text_t) + strlen( text) + 1);
+        g_free( text);
+    }
+    g_array_free( root->texts, TRUE);
+    g_array_free( root->tempos, TRUE);
+    g_array_free( root->meters, TRUE);
+    free( root->filename);
     g_free( root);
 
 }
@@ -184,7 +289,7 @@ void jpmidi_root_free( jpmidi_root_t* root)
 /** Solo the specified channel.  Returns 0 on success, 1 otherwise. */
 int jpmidi_solo_channel( jpmidi_root_t* root, int chan)
 {
-    if (root == NULL || chan < 0 || chan > 15) return 1;
+    if (root == NULL || chan < 0 || chan > 16) return 1;
     root->solo_channel = chan - 1;
     return 0;
 }
@@ -192,7 +297,7 @@ int jpmidi_solo_channel( jpmidi_root_t* root, int chan)
 /** Mute the specified channel.  Returns 0 on success, 1 otherwise. */
 int jpmidi_mute_channel( jpmidi_root_t* root, int chan)
 {
-    if (root == NULL || chan < 0 || chan > 15) return 1;
+    if (root == NULL || chan < 1 || chan > 16) return 1;
     root->channel[chan-1].muted = 1;
     return 0;
 }
@@ -200,30 +305,39 @@ int jpmidi_mute_channel( jpmidi_root_t* root, int chan)
 /** Unmute the specified channel.  Returns 0 on success, 1 otherwise. */
 int jpmidi_unmute_channel( jpmidi_root_t* root, int chan)
 {
-    if (root == NULL || chan < 0 || chan > 15) return 1;
+    if (root == NULL || chan < 1 || chan > 16) return 1;
     root->channel[chan-1].muted = 0;
     return 0;
 }
 
 /** Create a new jpmidi_time structure. */
-jpmidi_time_t* jpmidi_time_new( uint32_t smf_time, jack_nframes_t frame)
+jpmidi_time_t* jpmidi_time_new( uint32_t smf_time, jpmidi_frame_t frame)
 {
     jpmidi_time_t* time = g_new0( jpmidi_time_t, 1);
     time->smf_time = smf_time;
     time->frame = frame;
     time->events = g_array_new( FALSE, FALSE, sizeof( jpmidi_event_t*));
+    memstats_alloc( MEMSTATS_TIMES, sizeof(jpmidi_time_t));
+    memstats_alloc( MEMSTATS_EVENT_ARRAYS, MEMSTATS_ARRAY_BYTES);
     return time;
 }
 
+/* Frame of an SMF time at or after the last tempo change seen while loading. */
+static jpmidi_frame_t jpmidi_tick_to_frame( jpmidi_root_t* root, uint32_t smf_time)
+{
+    return root->xtempo_frame + (jpmidi_frame_t)(root->samples_per_tick * (smf_time - root->xtempo_tick));
+}
+
 /** Returns a jpmidi_time_t* for the given SMF time.  This method creates one if it does not already exist. */
 jpmidi_time_t* jpmidi_get_time( jpmidi_root_t* root, uint32_t smf_time)
 {
-    jack_nframes_t frame = root->xtempo_frame + (jack_nframes_t)(root->samples_per_tick * (smf_time - root->xtempo_tick));
+    jpmidi_frame_t frame = jpmidi_tick_to_frame( root, smf_time);
     jpmidi_time_t* time = (jpmidi_time_t*)g_tree_lookup( root->data, &frame);
     if (time == NULL) {
         if (root->last_frame < frame) root->last_frame = frame;
         time = jpmidi_time_new( smf_time, frame);
         g_tree_insert( root->data, &time->frame, time);
+        memstats_alloc( MEMSTATS_TIME_TREE, MEMSTATS_TREE_NODE_BYTES);
     }
     return time;
     
@@ -232,6 +346,7 @@ jpmidi_time_t* jpmidi_get_time( jpmidi_root_t* root, uint32_t smf_time)
 void jpmidi_time_add_event( jpmidi_time_t* time, jpmidi_event_t* event)
 {
     g_array_append_val( time->events, event);
+    memstats_resize( MEMSTATS_EVENT_ARRAYS, sizeof(jpmidi_event_t*));
 }
 
 void jpmidi_time_free( jpmidi_time_t* time)
@@ -242,6 +357,9 @@ void jpmidi_time_free( jpmidi_time_t* time)
         jpmidi_event_t* event = g_array_index(time->events, jpmidi_event_t*, i);
         jpmidi_event_free( event);
     }
+    memstats_free( MEMSTATS_EVENT_ARRAYS, MEMSTATS_ARRAY_BYTES + time->events->len * sizeof(jpmidi_event_t*));
+    memstats_free( MEMSTATS_TIMES, sizeof(jpmidi_time_t));
+    g_array_free( time->events, TRUE);
     g_free( time);
 }
 
@@ -249,12 +367,34 @@ jpmidi_event_t* jpmidi_event_new( struct element* element)
 {
     jpmidi_event_t* event = g_new0( jpmidi_event_t, 1);
     event->element = element;
+    event->port = element->device_channel >> 4;
     event->data = g_byte_array_new();
+    memstats_alloc( MEMSTATS_EVENTS, sizeof(jpmidi_event_t) + MEMSTATS_ARRAY_BYTES);
     return event;
 }
 
+/* Sysex bytes are counted apart from the short messages they outweigh. */
+static memstats_category_t jpmidi_event_data_category( jpmidi_event_t* event)
+{
+    return event->data->data[0] == 0xF0 ? MEMSTATS_SYSEX : MEMSTATS_EVENT_DATA;
+}
+
+/* Append message bytes to an event, counting them. */
+static void jpmidi_event_append( jpmidi_event_t* event, const guint8* data, guint len)
+{
+    int first = (event->data->len == 0);
+    g_byte_array_append( event->data, data, len);
+    if (first)
+        memstats_alloc( jpmidi_event_data_category( event), len);
+    else
+        memstats_resize( jpmidi_event_data_category( event), len);
+}
+
 void jpmidi_event_free( jpmidi_event_t* event)
 {
+    memstats_free( MEMSTATS_EVENTS, sizeof(jpmidi_event_t) + MEMSTATS_ARRAY_BYTES);
+    if (event->data->len)
+        memstats_free( jpmidi_event_data_category( event), event->data->len);
     g_byte_array_free( event->data, TRUE);
     g_free( event);
 }
@@ -269,15 +409,21 @@ void jpmidi_process_element(jpmidi_root_t* root, struct element *el)
 
         // ( sample rate * MPQ ) / ( 1000000 * TPQ ) 
         root->samples_per_tick = ((double)root->sample_rate * (double)root->tempo_mpq) / ( 1000000 * (double)root->time_base );
+        tempomap_add_tempo( root);
+        tempomap_add_meter( root, 0, 4, 4);
+        return;
+    case MD_TYPE_TIMESIG:
+        tempomap_add_meter( root, el->element_time, MD_TIMESIG(el)->top, MD_TIMESIG(el)->bottom);
         return;
     case MD_TYPE_TEMPO:
         // Remember where the tempo changes in terms of jack frame and smf tick.
-        root->xtempo_frame = root->xtempo_frame + (jack_nframes_t)(root->samples_per_tick * (el->element_time - root->xtempo_tick));
+        root->xtempo_frame = root->xtempo_frame + (jpmidi_frame_t)(root->samples_per_tick * (el->element_time - root->xtempo_tick));
         root->xtempo_tick = el->element_time;
 
         // Update the samples per tick value.
         root->tempo_mpq = MD_TEMPO(el)->micro_tempo;
         root->samples_per_tick = ((double)root->sample_rate * (double)root->tempo_mpq) / ( 1000000 * (double)root->time_base );
+        tempomap_add_tempo( root);
         return;
     case MD_TYPE_NOTE:
     {
@@ -291,7 +437,7 @@ void jpmidi_process_element(jpmidi_root_t* root, struct element *el)
         midi[1] = MD_NOTE(el)->note;
         midi[2] = MD_NOTE(el)->vel;
 
-        g_byte_array_append( on_event->data, midi, 3);
+        jpmidi_event_append( on_event, midi, 3);
 
         /* Create corresponding off event. */
         uint32_t off_tick = el->element_time + MD_NOTE(el)->length;
@@ -303,7 +449,7 @@ void jpmidi_process_element(jpmidi_root_t* root, struct element *el)
         midi[1] = MD_NOTE(el)->note;
         midi[2] = MD_NOTE(el)->offvel;
 
-        g_byte_array_append( off_event->data, midi, 3);
+        jpmidi_event_append( off_event, midi, 3);
 
         on_event->related = off_event;
         off_event->related = on_event;
@@ -322,7 +468,7 @@ void jpmidi_process_element(jpmidi_root_t* root, struct element *el)
         midi[1] = MD_KEYTOUCH(el)->note;
         midi[2] = MD_KEYTOUCH(el)->velocity;
 
-        g_byte_array_append( event->data, midi, 3);
+        jpmidi_event_append( event, midi, 3);
 
         return;
     }
@@ -338,7 +484,7 @@ void jpmidi_process_element(jpmidi_root_t* root, struct element *el)
         midi[1] = MD_CONTROL(el)->control; 
         midi[2] = MD_CONTROL(el)->value;
 
-        g_byte_array_append( event->data, midi, 3);
+        jpmidi_event_append( event, midi, 3);
 
         return;
                }
@@ -356,7 +502,7 @@ void jpmidi_process_element(jpmidi_root_t* root, struct element *el)
         midi[0] = 0xC0 | (0x0F & el->device_channel);
         midi[1] = MD_PROGRAM(el)->program;
 
-        g_byte_array_append( event->data, midi, 2);
+        jpmidi_event_append( event, midi, 2);
 
         return;
     }
@@ -371,7 +517,7 @@ void jpmidi_process_element(jpmidi_root_t* root, struct element *el)
         midi[0] = 0xD0 | (0x0F & el->device_channel);
         midi[1] = MD_PRESSURE(el)->velocity;
 
-        g_byte_array_append( event->data, midi, 2);
+        jpmidi_event_append( event, midi, 2);
 
         return;
     }
@@ -389,7 +535,7 @@ void jpmidi_process_element(jpmidi_root_t* root, struct element *el)
         midi[1] = (uint8_t)(val & 0x3F);
         midi[2] = (uint8_t)(val >> 7);
 
-        g_byte_array_append( event->data, midi, 3);
+        jpmidi_event_append( event, midi, 3);
 
         return;
     }
@@ -402,11 +548,37 @@ void jpmidi_process_element(jpmidi_root_t* root, struct element *el)
         jpmidi_time_add_event( time, event);
         uint8_t status = 0xF0;
         
-        g_byte_array_append( event->data, &status, 1);
-        g_byte_array_append( event->data, mdSysex->data, mdSysex->length);
+        jpmidi_event_append( event, &status, 1);
+        jpmidi_event_append( event, mdSysex->data, mdSysex->length);
         
         return;
     }
+    case MD_TYPE_TEXT:
+    {
+        // Keep the texts that mean something during playback.
+        int type = MD_TEXT(el)->type;
+        if (type != MIDI_META_TEXT && type != MIDI_META_LYRIC && type != MIDI_META_MARKER && type != MIDI_META_CUE)
+            return;
+        if (MD_TEXT(el)->text == NULL) return;
+
+        jpmidi_text_t text;
+        text.frame = jpmidi_tick_to_frame( root, el->element_time);
+        text.smf_time = el->element_time;
+        text.type = type;
+        text.text = g_strdup( MD_TEXT(el)->text);
+        g_array_append_val( root->texts, text);
+        memstats_alloc( MEMSTATS_TEXTS, sizeof(jpmidi_text_t) + strlen( text.text) + 1);
+
+        // Markers and cue points are places to locate to.
+        if (type == MIDI_META_MARKER || type == MIDI_META_CUE) {
+            int index = root->texts->len - 1;
+            g_array_append_val( root->markers, index);
+            memstats_resize( MEMSTATS_MAPS, sizeof(index));
+            if (g_hash_table_lookup( root->marker_names, text.text) == NULL)
+                g_hash_table_insert( root->marker_names, text.text, GINT_TO_POINTER( index + 1));
+        }
+        return;
+    }
     /* Ones that have no sequencer action */
     /*
     case MD_TYPE_TEXT:
@@ -455,17 +627,191 @@ uint16_t jpmidi_get_smf_timebase( jpmidi_root_t* root)
  *  specified frame. The return value may be NULL if the given frame is
  *  beyond the end of MIDI playback.
  */
-jpmidi_time_t* jpmidi_lookup_entrypoint( jpmidi_root_t* root, jack_nframes_t frame)
+jpmidi_time_t* jpmidi_lookup_entrypoint( jpmidi_root_t* root, jpmidi_frame_t frame)
 {
     // We have an entry point every second.  Calc the frame of the previous second boundary.
-    uint32_t seconds = frame / root->sample_rate;
-    jack_nframes_t seek_frame = seconds * root->sample_rate;
+    jpmidi_frame_t seek_frame = frame - frame % root->sample_rate;
     
     // Lookup the our time record
     return (jpmidi_time_t*)g_tree_lookup( root->data, &seek_frame);
 }
 
 
+/** Returns the time structure at exactly the specified frame, or NULL
+ *  if there is none.
+ */
+jpmidi_time_t* jpmidi_lookup_time( jpmidi_root_t* root, jpmidi_frame_t frame)
+{
+    return (jpmidi_time_t*)g_tree_lookup( root->data, &frame);
+}
+
+/** Returns true if the event passes the current sysex/solo/mute filters. */
+int jpmidi_event_should_send( jpmidi_root_t* root, jpmidi_event_t* event)
+{
+    // The note-offs on channel 10 are dropped by its default transform.
+    return jpmidi_message_should_send( root, jpmidi_event_get_data( event), jpmidi_event_get_data_length( event));
+}
+
+/** Returns true if a raw MIDI message passes the current sysex/solo/mute filters. */
+int jpmidi_message_should_send( jpmidi_root_t* root, unsigned char* data, int len)
+{
+    if (len < 1) return 0;
+    if (data[0] == 0xF0) return root->send_sysex;
+    if (data[0] >= 0xF0) return 1; // system common and real time messages have no channel
+
+    int channel = data[0] & 0x0F;
+    if (root->solo_channel != -1 && channel != root->solo_channel) return 0;
+    if (root->channel[channel].muted) return 0;
+
+    return 1;
+}
+
+/** Apply the channel's transpose and transform to a channel message in place. */
+int jpmidi_message_transform( jpmidi_root_t* root, unsigned char* data, int len)
+{
+    return transform_apply( &root->transform, data, len);
+}
+
+/** Compile the transforms and transposes into the root's tables. */
+void jpmidi_transform_update( jpmidi_root_t* root)
+{
+    transform_settings_t settings;
+    int transpose[16];
+    int i;
+
+    for (i = 0; i < 16; i++) transpose[i] = root->channel[i].transpose;
+    transform_get( &settings);
+    transform_compile( &root->transform, &settings, transpose);
+}
+
+/* Compile the note tables again after a change of transpose. */
+static void jpmidi_transform_notes( jpmidi_root_t* root)
+{
+    int transpose[16];
+    int i;
+
+    for (i = 0; i < 16; i++) transpose[i] = root->channel[i].transpose;
+    transform_compile_notes( &root->transform, transpose);
+}
+
+/** Take over tables compiled for the current transforms. */
+void jpmidi_transform_replace( jpmidi_root_t* root, const transform_table_t* table)
+{
+    root->transform = *table;
+    jpmidi_transform_notes( root);
+}
+
+/** Returns the channel (0-15) the messages of a channel go out on. */
+int jpmidi_channel_get_output( jpmidi_root_t* root, int channel)
+{
+    return root->transform.status[0x90 | channel] & 0x0F;
+}
+
+/** Set the transpose of a channel (1-16) in semitones. */
+int jpmidi_channel_set_transpose( jpmidi_root_t* root, int channel, int semitones)
+{
+    if (root == NULL || channel < 1 || channel > 16 || semitones < -127 || semitones > 127) return 1;
+    root->channel[channel-1].transpose = semitones;
+    jpmidi_transform_notes( root);
+    return 0;
+}
+
+/** Returns the transpose of a channel (0-15) in semitones. */
+int jpmidi_channel_get_transpose( jpmidi_root_t* root, int channel)
+{
+    return root->channel[channel].transpose;
+}
+
+/** Copy the current mute/solo/sysex/transpose state into scene. */
+void jpmidi_scene_get( jpmidi_root_t* root, jpmidi_scene_t* scene)
+{
+    int i;
+    for (i = 0; i < 16; i++) {
+        scene->muted[i] = root->channel[i].muted;
+        scene->transpose[i] = root->channel[i].transpose;
+    }
+    scene->solo_channel = root->solo_channel;
+    scene->send_sysex = root->send_sysex;
+}
+
+/** Replace the mute/solo/sysex/transpose state with scene. */
+void jpmidi_scene_set( jpmidi_root_t* root, const jpmidi_scene_t* scene)
+{
+    int i;
+    for (i = 0; i < 16; i++) {
+        root->channel[i].muted = scene->muted[i];
+        root->channel[i].transpose = scene->transpose[i];
+    }
+    root->solo_channel = scene->solo_channel;
+    root->send_sysex = scene->send_sysex;
+    jpmidi_transform_notes( root);
+}
+
+/** Returns true if a channel (0-15) is heard with the given scene. */
+int jpmidi_scene_channel_audible( const jpmidi_scene_t* scene, int channel)
+{
+    if (scene->solo_channel != -1 && channel != scene->solo_channel) return 0;
+    return !scene->muted[channel];
+}
+
+/** Returns the number of text events in the song. */
+int jpmidi_get_text_count( jpmidi_root_t* root)
+{
+    return root->texts->len;
+}
+
+/** Returns the text event at the given index. */
+jpmidi_text_t* jpmidi_get_text( jpmidi_root_t* root, int index)
+{
+    return &g_array_index( root->texts, jpmidi_text_t, index);
+}
+
+/** Returns the index of the first text event at or after frame. */
+int jpmidi_find_text( jpmidi_root_t* root, jpmidi_frame_t frame)
+{
+    int low = 0;
+    int high = root->texts->len;
+
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (jpmidi_get_text( root, mid)->frame < frame) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+/** Returns the first marker or cue point at or after frame. */
+jpmidi_text_t* jpmidi_find_next_marker( jpmidi_root_t* root, jpmidi_frame_t frame)
+{
+    int low = 0;
+    int high = root->markers->len;
+
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (jpmidi_get_text( root, g_array_index( root->markers, int, mid))->frame < frame) low = mid + 1;
+        else high = mid;
+    }
+    if (low == (int)root->markers->len) return NULL;
+    return jpmidi_get_text( root, g_array_index( root->markers, int, low));
+}
+
+/** Returns the first marker or cue point with the given name. */
+jpmidi_text_t* jpmidi_find_marker( jpmidi_root_t* root, const char* name)
+{
+    int index = GPOINTER_TO_INT( g_hash_table_lookup( root->marker_names, name));
+    return index > 0 ? jpmidi_get_text( root, index - 1) : NULL;
+}
+
+/** Returns a short name for a text event type. */
+const char* jpmidi_text_type_name( int type)
+{
+    switch (type) {
+    case MIDI_META_LYRIC:  return "lyric";
+    case MIDI_META_MARKER: return "marker";
+    case MIDI_META_CUE:    return "cue";
+    default:               return "text";
+    }
+}
 
 /** Returns true if sending of system exclusive messages is enabled. */
 int jpmidi_is_send_sysex_enabled( jpmidi_root_t* root)
@@ -521,7 +867,7 @@ char* jpmidi_channel_get_program( jpmidi_root_t* root, int channel)
 
 
 /** Returns the frame time of the given jpmidi_time object. */
-jack_nframes_t jpmidi_time_get_frame( jpmidi_time_t* time)
+jpmidi_frame_t jpmidi_time_get_frame( jpmidi_time_t* time)
 {
     return time->frame;
 }
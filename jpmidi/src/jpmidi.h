@@ -26,24 +26,74 @@
 #include <jack/midiport.h>
 
 #include "elements.h"
+#include "transform.h"
 
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/** A position in the song, in frames from its start.  64 bits wide so
+ *  long songs at high sample rates do not wrap, see jackclient.c for
+ *  how it maps to the 32 bit JACK transport frame.
+ */
+typedef uint64_t jpmidi_frame_t;
+
 typedef struct jpmidi_channel jpmidi_channel_t;    
 typedef struct jpmidi_root jpmidi_root_t;
 typedef struct jpmidi_time jpmidi_time_t;
 typedef struct jpmidi_event jpmidi_event_t;
+typedef struct jpmidi_text jpmidi_text_t;
+typedef struct jpmidi_tempo jpmidi_tempo_t;
+typedef struct jpmidi_meter jpmidi_meter_t;
 
 struct jpmidi_channel {
     char* program;
     int has_data;
     int number; 
     int muted;
+    int transpose;  /**< Semitones added to the notes of the channel. */
 };
+
+/** The complete mute/solo/sysex/transpose state, applied in one go. */
+typedef struct jpmidi_scene
+{
+    int muted[16];
+    int solo_channel;   /**< 0-15, or -1 for no solo. */
+    int send_sysex;
+    int transpose[16];
+} jpmidi_scene_t;
     
+#define JPMIDI_STATS_PORTS 16       /**< SMF ports counted separately, higher ones count as the last. */
+#define JPMIDI_STATS_PERIODS 6      /**< Period sizes of peak_events, 64 to 2048 frames. */
+
+/** Statistics of the song, collected once when it is loaded, see
+ *  songstats.h.
+ */
+typedef struct jpmidi_stats
+{
+    uint32_t time_records;              /**< Time records with events. */
+    uint32_t events;
+    uint64_t bytes;                     /**< MIDI data of all events. */
+    uint32_t channel_events[16];        /**< Channel messages per channel. */
+    uint32_t port_events[JPMIDI_STATS_PORTS];
+    uint32_t type_events[8];            /**< Events per status 0x80 to 0xF0, index (status >> 4) - 8. */
+    uint64_t sysex_bytes;
+    int note_low;                       /**< Lowest note played, -1 if there are no notes. */
+    int note_high;
+    int channel_note_low[16];
+    int channel_note_high[16];
+    uint32_t duration_ticks;            /**< Tick of the last event. */
+    jpmidi_frame_t duration_frames;     /**< Frame of the last event. */
+    uint32_t peak_events[JPMIDI_STATS_PERIODS]; /**< Most events due in one period of 64 << i frames. */
+    double tempo_min;                   /**< Beats per minute. */
+    double tempo_max;
+    uint32_t tempo_changes;
+    uint32_t meter_changes;
+    uint32_t texts;
+    uint32_t markers;                   /**< Markers and cue points. */
+} jpmidi_stats_t;
+
 /** Root data structure containing jpmidi data. */
 struct jpmidi_root
 {
@@ -53,18 +103,30 @@ struct jpmidi_root
     GTree* data;                    /**< jpmidi_time_t* indexed by jack frame, for sorting/searching data by time. */
 
     struct rootElement* pmidi_root; /**< Data created by the SMF parser. */
+    struct midiTracks* tracks;      /**< Track chunks of the file for jpmidi_reload(), NULL if not kept. */
     uint16_t time_base;             /**< Time base as specified in the SMF file header as ticks per quarter note. */
     
     jack_nframes_t sample_rate;     /**< Jack sample rate. */
-    jack_nframes_t last_frame;      /**< Frame of the last event. */
-    jack_nframes_t xtempo_frame;    /**< Jack frame of last tempo change. */
+    jpmidi_frame_t last_frame;      /**< Frame of the last event. */
+    jpmidi_frame_t end_frame;       /**< Frame of the end of the song, the last end of track. */
+    jpmidi_frame_t xtempo_frame;    /**< Jack frame of last tempo change. */
     uint32_t xtempo_tick;           /**< SMF tick at last tempo change. */
     uint32_t tempo_mpq;             /**< Current tempo in microseconds per quarter note. */
     double samples_per_tick;        /**< Current samples/tick value. */
 
+    GArray* texts;                  /**< jpmidi_text_t markers, lyrics, cues and text events ordered by frame. */
+    GArray* markers;                /**< Indexes into texts of the markers and cue points. */
+    GHashTable* marker_names;       /**< Index into texts plus one of the first marker or cue point with each name. */
+    GArray* tempos;                 /**< jpmidi_tempo_t tempo map ordered by time, see tempomap.h. */
+    GArray* meters;                 /**< jpmidi_meter_t time signatures ordered by time. */
+
+    jpmidi_stats_t stats;           /**< Collected by the loader. */
+    struct eventindex* index;       /**< Posting lists by channel and type, see eventindex.h. */
+
     int send_sysex;                 /**< Set to 0 to disable sending sysex messages. */
     int solo_channel;               /**< When soloing, this is a number between 0 and 15 inclusive. */
     jpmidi_channel_t channel[16];   /**< Channel descriptors. */
+    transform_table_t transform;    /**< The transforms and transposes compiled, see transform.h. */
 };
 
 /** Event data which occurs at a specific time.  This references data on all channels at the given time. */
@@ -72,24 +134,70 @@ struct jpmidi_time
 {
     jpmidi_time_t* next_time;/**< Pointer to data that is next in time. */
     uint32_t       smf_time; /**< Time as specified in the standard MIDI file. */
-    jack_nframes_t frame;    /**< Absolute frame for the associated events. Only usable for internal timing. */
+    jpmidi_frame_t frame;    /**< Absolute frame for the associated events. Only usable for internal timing. */
     GArray*        events;   /**< Array of jpmidi_event_t* containing the events for the given time. */
 };
 
 /** Data for one event. */
 struct jpmidi_event
 {
-    struct element* element; /**< The pmidi element structure created during SMF parse. */
+    struct element* element; /**< The pmidi element structure created during SMF parse, NULL in compact mode. */
+    uint8_t         port;    /**< MIDI port of the track the event was read from. */
     GByteArray*     data ;   /**< Raw midi data for this event.  Begins with a MIDI status byte. */
     jpmidi_event_t* related; /**< Experimental, references related note on/off event. */
 };
     
+/** A text meta event kept for reporting while the song plays. */
+struct jpmidi_text
+{
+    jpmidi_frame_t frame;    /**< Frame the text occurs at. */
+    uint32_t       smf_time; /**< Time as specified in the standard MIDI file. */
+    int            type;     /**< MIDI_META_TEXT, MIDI_META_LYRIC, MIDI_META_MARKER or MIDI_META_CUE. */
+    char*          text;     /**< The text, a copy owned by the root. */
+};
+
+/** A tempo change.  Frames are computed from it exactly as they are
+ *  for the time records, so lookups agree with the event frames.
+ */
+struct jpmidi_tempo
+{
+    uint32_t       smf_time;         /**< Tick the tempo starts at. */
+    jpmidi_frame_t frame;            /**< Frame of that tick. */
+    uint32_t       tempo_mpq;        /**< Microseconds per quarter note. */
+    double         samples_per_tick;
+};
+
+/** A time signature change. */
+struct jpmidi_meter
+{
+    uint32_t smf_time;               /**< Tick the time signature starts at, the start of a bar. */
+    uint32_t bar;                    /**< Zero based number of that bar. */
+    int      numerator;              /**< Beats per bar. */
+    int      denominator;            /**< Note value of a beat, 4 for quarter notes. */
+};
+
 /** Initialize this feature.  Must be called before anything else. Returns 1 on success, 0 on failure. */
 int jpmidi_init();
     
 /** Loads given the midi file. */
 jpmidi_root_t* jpmidi_loadfile(char *filename, jack_nframes_t sample_rate);
 
+/** Loads a new version of the file of root at the same sample rate,
+ *  parsing only the tracks whose bytes changed.  The others are shared
+ *  with root, so root must be freed with jpmidi_root_release().  Like
+ *  jpmidi_loadfile() this raises an exception for a bad file.
+ */
+jpmidi_root_t* jpmidi_reload( jpmidi_root_t* root);
+
+/** Enable or disable compact mode for files loaded from now on.  In
+ *  compact mode the SMF parse tree is freed once the song has been
+ *  flattened, pmidi_root and the element of every event are NULL.
+ */
+void jpmidi_set_compact( int enabled);
+
+/** Returns 1 if compact mode is enabled. */
+int jpmidi_is_compact();
+
 /** Callback type for listeners interested in file loaded/unloaded event notificaton. */
 typedef void (*jpmidi_loadfile_listener_t)(jpmidi_root_t* root);
 
@@ -108,6 +216,9 @@ jpmidi_root_t* jpmidi_root_new( char* filename, struct rootElement* proot, jack_
 /** Free the root data structure. */    
 void jpmidi_root_free( jpmidi_root_t* root);
 
+/** Free a root that successor, loaded from it by jpmidi_reload(), replaces. */
+void jpmidi_root_release( jpmidi_root_t* root, jpmidi_root_t* successor);
+
 /** Returns the pathname of the MIDI file that was loaded and processed. */
 char* jpmidi_get_filename( jpmidi_root_t* root);
 
@@ -132,7 +243,7 @@ int jpmidi_mute_channel( jpmidi_root_t* root, int channel);
 int jpmidi_unmute_channel( jpmidi_root_t* root, int channel);
     
 /** Create/init a new time struct. */
-jpmidi_time_t* jpmidi_time_new( uint32_t smf_time, jack_nframes_t frame);
+jpmidi_time_t* jpmidi_time_new( uint32_t smf_time, jpmidi_frame_t frame);
 
 /** Free a time struct. */    
 void jpmidi_time_free( jpmidi_time_t* time);
@@ -153,7 +264,84 @@ void jpmidi_event_free( jpmidi_event_t* event);
  *  specified frame. The return value may be NULL if the given frame is
  *  beyond the end of MIDI playback.
  */
-jpmidi_time_t* jpmidi_lookup_entrypoint( jpmidi_root_t* root, jack_nframes_t frame);
+jpmidi_time_t* jpmidi_lookup_entrypoint( jpmidi_root_t* root, jpmidi_frame_t frame);
+
+/** Returns the time structure at exactly the specified frame, or NULL
+ *  if there is none.
+ */
+jpmidi_time_t* jpmidi_lookup_time( jpmidi_root_t* root, jpmidi_frame_t frame);
+
+/** Returns true if the event passes the current sysex/solo/mute filters
+ *  and should be sent to the output port.
+ */
+int jpmidi_event_should_send( jpmidi_root_t* root, jpmidi_event_t* event);
+
+/** Returns true if a raw MIDI message, such as one received on the
+ *  input port, passes the current sysex/solo/mute filters.
+ */
+int jpmidi_message_should_send( jpmidi_root_t* root, unsigned char* data, int len);
+
+/** Apply the channel's transpose and transform to a channel message
+ *  in place.  Returns 0 if the message should not be sent (a note
+ *  moved out of range, a dropped controller or note-off), 1 otherwise.
+ */
+int jpmidi_message_transform( jpmidi_root_t* root, unsigned char* data, int len);
+
+/** Compile the current transforms of transform.h and the transposes
+ *  of root into root's tables again.
+ */
+void jpmidi_transform_update( jpmidi_root_t* root);
+
+/** Take over table, compiled from the current transforms, recompiling
+ *  its notes for the transposes of root.  Cheap enough for the process
+ *  thread.
+ */
+void jpmidi_transform_replace( jpmidi_root_t* root, const transform_table_t* table);
+
+/** Returns the channel (0-15) the messages of a channel go out on. */
+int jpmidi_channel_get_output( jpmidi_root_t* root, int channel);
+
+/** Set the number of semitones the notes of a channel (1-16) are
+ *  transposed by.  Returns 0 on success, 1 otherwise.
+ */
+int jpmidi_channel_set_transpose( jpmidi_root_t* root, int channel, int semitones);
+
+/** Returns the transpose of a channel (0-15) in semitones. */
+int jpmidi_channel_get_transpose( jpmidi_root_t* root, int channel);
+
+/** Copy the current mute/solo/sysex/transpose state into scene. */
+void jpmidi_scene_get( jpmidi_root_t* root, jpmidi_scene_t* scene);
+
+/** Replace the mute/solo/sysex/transpose state with scene.  Notes
+ *  sounding on channels that are silenced are not released, see
+ *  jackclient_apply_scene().
+ */
+void jpmidi_scene_set( jpmidi_root_t* root, const jpmidi_scene_t* scene);
+
+/** Returns true if a channel (0-15) is heard with the given scene. */
+int jpmidi_scene_channel_audible( const jpmidi_scene_t* scene, int channel);
+
+/** Returns the number of text events in the song. */
+int jpmidi_get_text_count( jpmidi_root_t* root);
+
+/** Returns the text event at the given index, they are ordered by frame. */
+jpmidi_text_t* jpmidi_get_text( jpmidi_root_t* root, int index);
+
+/** Returns the index of the first text event at or after frame, or the
+ *  text count if there is none.
+ */
+int jpmidi_find_text( jpmidi_root_t* root, jpmidi_frame_t frame);
+
+/** Returns the first marker or cue point at or after frame, or NULL. */
+jpmidi_text_t* jpmidi_find_next_marker( jpmidi_root_t* root, jpmidi_frame_t frame);
+
+/** Returns the first marker or cue point with the given name, or NULL. */
+jpmidi_text_t* jpmidi_find_marker( jpmidi_root_t* root, const char* name);
+
+/** Returns a short name for a text event type: "text", "lyric",
+ *  "marker" or "cue".
+ */
+const char* jpmidi_text_type_name( int type);
 
 /** Returns true if sending of system exclusive messages is enabled. */
 int jpmidi_is_send_sysex_enabled( jpmidi_root_t* root);
@@ -181,7 +369,7 @@ int jpmidi_channel_get_number( jpmidi_root_t* root, int channel);
 char* jpmidi_channel_get_program( jpmidi_root_t* root, int channel);
 
 /** Returns the frame time of the given jpmidi_time object. */
-jack_nframes_t jpmidi_time_get_frame( jpmidi_time_t* time);
+jpmidi_frame_t jpmidi_time_get_frame( jpmidi_time_t* time);
 
 /** Returns the event tick from the MIDI File (resolution specified in the file's MThd chunk). */
 uint32_t jpmidi_time_get_smf_time( jpmidi_time_t* time);
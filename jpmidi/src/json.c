@@ -0,0 +1,66 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+
+/* Helpers for the JSON replies and messages sent to TCP clients. */
+
+#include <stdio.h>
+#include <glib.h>
+
+#include "json.h"
+
+/* Escaped form of c, or NULL if it goes out as it is. */
+static const char* json_escape( unsigned char c, char* buffer)
+{
+    switch (c) {
+    case '"':  return "\\\"";
+    case '\\': return "\\\\";
+    case '\n': return "\\n";
+    case '\r': return "\\r";
+    case '\t': return "\\t";
+    }
+    if (c >= ' ') return NULL;
+    snprintf( buffer, 8, "\\u%04x", c);
+    return buffer;
+}
+
+/** Append text to a JSON document as a quoted string. */
+void json_append_string( GString* json, const char* text)
+{
+    const unsigned char* p;
+    char buffer[8];
+
+    g_string_append_c( json, '"');
+    for (p = (const unsigned char*)text; *p; p++) {
+        const char* escaped = json_escape( *p, buffer);
+        if (escaped) g_string_append( json, escaped);
+        else g_string_append_c( json, *p);
+    }
+    g_string_append_c( json, '"');
+}
+
+/** Write text to a stream as a quoted JSON string. */
+void json_print_string( FILE* out, const char* text)
+{
+    const unsigned char* p;
+    char buffer[8];
+
+    fputc( '"', out);
+    for (p = (const unsigned char*)text; *p; p++) {
+        const char* escaped = json_escape( *p, buffer);
+        if (escaped) fputs( escaped, out);
+        else fputc( *p, out);
+    }
+    fputc( '"', out);
+}
@@ -0,0 +1,40 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+#ifndef __json_h__
+#define __json_h__
+
+/* Definitions generated by autotools. */
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <glib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Append text to a JSON document as a quoted string. */
+void json_append_string( GString* json, const char* text);
+
+/** Write text to a stream as a quoted JSON string. */
+void json_print_string( FILE* out, const char* text);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __json_h__ */
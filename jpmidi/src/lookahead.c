@@ -0,0 +1,299 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+
+/* Lookahead pre-render thread.  A non real-time worker walks the time
+ * records ahead of the play position, applies the filters and copies
+ * the events into a lock-free ring so that process() only has to move
+ * bytes into the port buffer.
+ *
+ * Every event in the ring is tagged with a generation number.
+ * Invalidating the ring just bumps the generation; the process thread
+ * discards records of older generations as it meets them, and the
+ * worker starts over a little ahead of the play position.  Until the
+ * worker has caught up, process() renders directly from the time
+ * records as before.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <jack/ringbuffer.h>
+
+#include "lookahead.h"
+#include "jackclient.h"
+#include "jpmidi.h"
+#include "main.h"
+#include "reclaim.h"
+
+#define RING_SIZE (1024 * 1024)
+
+static jack_ringbuffer_t* ring = NULL;
+static pthread_t worker;
+static sem_t wakeup;
+static int running = 0;
+
+static jack_nframes_t lookahead_frames; ///< How far ahead of the play position to render.
+static jack_nframes_t margin_frames;    ///< Distance from the play position where rendering restarts.
+static long period_usecs;
+
+/* State shared with the process thread. */
+static uint32_t generation = 1;
+static jpmidi_frame_t position = 0;
+static uint32_t ready_generation = 0;
+static jpmidi_frame_t ready_from = 0;
+static jpmidi_frame_t ready_until = 0;
+
+void* lookahead_thread( void* arg);
+
+int lookahead_start( int periods)
+{
+    jack_client_t* client = jackclient_get_client();
+    jack_nframes_t period = jack_get_buffer_size( client);
+
+    if (periods < 2) periods = 2;
+    lookahead_frames = periods * period;
+    margin_frames = lookahead_frames / 2;
+    if (margin_frames < 2 * period) margin_frames = 2 * period;
+    period_usecs = (long)((uint64_t)period * 1000000 / jack_get_sample_rate( client));
+
+    ring = jack_ringbuffer_create( RING_SIZE);
+    if (ring == NULL) {
+        fprintf( stderr, "cannot allocate lookahead ring\n");
+        return 1;
+    }
+    jack_ringbuffer_mlock( ring);
+
+    sem_init( &wakeup, 0, 0);
+    __atomic_store_n( &running, 1, __ATOMIC_RELEASE);
+    if (pthread_create( &worker, NULL, lookahead_thread, NULL)) {
+        fprintf( stderr, "cannot start lookahead thread\n");
+        __atomic_store_n( &running, 0, __ATOMIC_RELEASE);
+        jack_ringbuffer_free( ring);
+        ring = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+void lookahead_stop()
+{
+    if (!lookahead_is_enabled()) return;
+
+    __atomic_store_n( &running, 0, __ATOMIC_RELEASE);
+    sem_post( &wakeup);
+    pthread_join( worker, NULL);
+    sem_destroy( &wakeup);
+
+    jack_ringbuffer_free( ring);
+    ring = NULL;
+}
+
+int lookahead_is_enabled()
+{
+    return __atomic_load_n( &running, __ATOMIC_ACQUIRE);
+}
+
+uint32_t lookahead_invalidate()
+{
+    uint32_t g = __atomic_add_fetch( &generation, 1, __ATOMIC_ACQ_REL);
+    if (lookahead_is_enabled()) sem_post( &wakeup);
+    return g;
+}
+
+uint32_t lookahead_get_generation()
+{
+    return __atomic_load_n( &generation, __ATOMIC_ACQUIRE);
+}
+
+void lookahead_set_position( jpmidi_frame_t frame)
+{
+    __atomic_store_n( &position, frame, __ATOMIC_RELEASE);
+}
+
+int lookahead_get_ready( uint32_t g, jpmidi_frame_t* from, jpmidi_frame_t* until)
+{
+    if (__atomic_load_n( &ready_generation, __ATOMIC_ACQUIRE) != g) return 0;
+    *from = __atomic_load_n( &ready_from, __ATOMIC_ACQUIRE);
+    *until = __atomic_load_n( &ready_until, __ATOMIC_ACQUIRE);
+
+    // The worker may have moved on to a new generation while we were reading.
+    return __atomic_load_n( &ready_generation, __ATOMIC_ACQUIRE) == g;
+}
+
+int lookahead_peek( lookahead_record_t* record)
+{
+    if (jack_ringbuffer_read_space( ring) < sizeof(lookahead_record_t)) return 0;
+    jack_ringbuffer_peek( ring, (char*)record, sizeof(lookahead_record_t));
+    return 1;
+}
+
+void lookahead_read( lookahead_record_t* record, unsigned char* buffer)
+{
+    jack_ringbuffer_read_advance( ring, sizeof(lookahead_record_t));
+    jack_ringbuffer_read( ring, (char*)buffer, record->len);
+}
+
+void lookahead_skip( lookahead_record_t* record)
+{
+    jack_ringbuffer_read_advance( ring, sizeof(lookahead_record_t) + record->len);
+}
+
+/////////// INTERNAL USE ONLY ///////////////////
+
+/** Copy len bytes into the ring at offset bytes past the write pointer,
+ *  without making them visible to the reader.
+ */
+void lookahead_ring_put( jack_ringbuffer_data_t* vec, size_t offset, const unsigned char* data, size_t len)
+{
+    while (len > 0) {
+        int part = (offset < vec[0].len) ? 0 : 1;
+        size_t at = part ? offset - vec[0].len : offset;
+        size_t n = vec[part].len - at;
+        if (n > len) n = len;
+        memcpy( vec[part].buf + at, data, n);
+        data += n;
+        offset += n;
+        len -= n;
+    }
+}
+
+/** Write a record header and its data as one unit.  Returns 0 if the
+ *  ring does not have room for it.
+ */
+int lookahead_ring_write( lookahead_record_t* record, const unsigned char* data)
+{
+    size_t total = sizeof(lookahead_record_t) + record->len;
+    if (jack_ringbuffer_write_space( ring) < total) return 0;
+
+    jack_ringbuffer_data_t vec[2];
+    jack_ringbuffer_get_write_vector( ring, vec);
+    lookahead_ring_put( vec, 0, (const unsigned char*)record, sizeof(lookahead_record_t));
+    lookahead_ring_put( vec, sizeof(lookahead_record_t), data, record->len);
+    jack_ringbuffer_write_advance( ring, total);
+    return 1;
+}
+
+/** Publish how far the ring is complete for the current generation. */
+void lookahead_publish_until( jpmidi_frame_t until)
+{
+    __atomic_store_n( &ready_until, until, __ATOMIC_RELEASE);
+}
+
+/** Sleep until woken by an invalidation or for about half a period. */
+void lookahead_wait()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_REALTIME, &ts);
+    ts.tv_nsec += (period_usecs / 2) * 1000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec += ts.tv_nsec / 1000000000;
+        ts.tv_nsec %= 1000000000;
+    }
+    while (sem_timedwait( &wakeup, &ts) == -1 && errno == EINTR)
+        ;
+}
+
+/** The worker thread. */
+void* lookahead_thread( void* arg)
+{
+    uint32_t gen = 0;
+    jpmidi_time_t* time = NULL;
+    int index = 0;
+    int warned = 0;
+
+    while (lookahead_is_enabled())
+    {
+        // Entering lets go of the song of the previous pass: a song is
+        // only freed after its switch invalidated, so the generation
+        // read below is new then and the cursor is dropped.
+        reclaim_enter( RECLAIM_LOOKAHEAD);
+
+        // Generation first: a song switch invalidates after replacing
+        // the song, so a new generation never goes with the old song.
+        uint32_t g = lookahead_get_generation();
+        jpmidi_root_t* root = main_get_jpmidi_root();
+
+        if (g != gen)
+        {
+            // Start over a safe distance ahead of the play position.  The
+            // process thread renders directly until it gets there.
+            gen = g;
+            jpmidi_frame_t from = __atomic_load_n( &position, __ATOMIC_ACQUIRE) + margin_frames;
+
+            time = jpmidi_lookup_entrypoint( root, from);
+            while (time && jpmidi_time_get_frame( time) < from)
+                time = jpmidi_time_get_next( time);
+            index = 0;
+
+            __atomic_store_n( &ready_generation, 0, __ATOMIC_RELEASE);
+            __atomic_store_n( &ready_from, from, __ATOMIC_RELEASE);
+            __atomic_store_n( &ready_until, from, __ATOMIC_RELEASE);
+            __atomic_store_n( &ready_generation, gen, __ATOMIC_RELEASE);
+        }
+
+        jpmidi_frame_t target = __atomic_load_n( &position, __ATOMIC_ACQUIRE) + lookahead_frames;
+
+        while (time && jpmidi_time_get_frame( time) < target && lookahead_get_generation() == gen)
+        {
+            int full = 0;
+            for (; index < jpmidi_time_get_event_count( time); index++)
+            {
+                jpmidi_event_t* event = jpmidi_time_get_event( time, index);
+                if (!jpmidi_event_should_send( root, event)) continue;
+
+                lookahead_record_t record;
+                record.generation = gen;
+                record.frame = jpmidi_time_get_frame( time);
+                record.index = index;
+                record.len = jpmidi_event_get_data_length( event);
+
+                if (sizeof(record) + record.len >= RING_SIZE) {
+                    // Stop here without publishing past it: process()
+                    // catches up with ready_until, renders directly and
+                    // sends the event itself.
+                    if (!warned) fprintf( stderr, "lookahead: %u byte event does not fit in the ring, sent directly\n", record.len);
+                    warned = 1;
+                    full = 1;
+                    break;
+                }
+                unsigned char* data = jpmidi_event_get_data( event);
+                unsigned char message[3];
+                if (record.len <= 3) {
+                    memcpy( message, data, record.len);
+                    if (!jpmidi_message_transform( root, message, record.len)) continue;
+                    data = message;
+                }
+
+                if (!lookahead_ring_write( &record, data)) {
+                    full = 1;
+                    break;
+                }
+            }
+            if (full) break;
+
+            index = 0;
+            time = jpmidi_time_get_next( time);
+            lookahead_publish_until( time ? jpmidi_time_get_frame( time) : UINT64_MAX);
+        }
+        if (time == NULL) lookahead_publish_until( UINT64_MAX);
+
+        lookahead_wait();
+    }
+    reclaim_leave( RECLAIM_LOOKAHEAD);
+    return NULL;
+}
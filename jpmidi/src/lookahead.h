@@ -0,0 +1,90 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+#ifndef __lookahead_h__
+#define __lookahead_h__
+
+/* Definitions generated by autotools. */
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <jack/jack.h>
+#include <jack/types.h>
+#include "jpmidi.h"
+
+/** Header of one pre-rendered event in the lookahead ring.  The MIDI
+ * data bytes follow the header in the ring.
+ */
+typedef struct lookahead_record
+{
+    jpmidi_frame_t frame;      ///< Song frame of the event.
+    uint32_t       generation; ///< Generation the event was rendered for.
+    uint32_t       index;      ///< Index of the event within its time record.
+    uint32_t       len;        ///< Number of data bytes following the header.
+} lookahead_record_t;
+
+/** Start the lookahead worker thread.  The worker keeps the given
+ * number of jack periods of filtered events ready in a ring buffer
+ * ahead of the play position.  Returns 0 on success, 1 otherwise.
+ */
+int lookahead_start( int periods);
+
+/** Stop the worker thread and free the ring. */
+void lookahead_stop();
+
+/** Returns true if the lookahead worker is running. */
+int lookahead_is_enabled();
+
+/** Throw away everything pre-rendered so far, the worker starts again
+ * from the current play position.  Called on relocate and whenever the
+ * filters change.  Safe to call from the process thread.  Returns the
+ * new generation number.
+ */
+uint32_t lookahead_invalidate();
+
+/** Returns the current generation number. */
+uint32_t lookahead_get_generation();
+
+/** Tell the worker how far the process thread has played.  Process thread only. */
+void lookahead_set_position( jpmidi_frame_t frame);
+
+/** Returns true if the worker is rendering the given generation.  The
+ * ring then holds every event from *from up to, but not including,
+ * *until.
+ */
+int lookahead_get_ready( uint32_t generation, jpmidi_frame_t* from, jpmidi_frame_t* until);
+
+/** Look at the next record without removing it.  Returns 0 if the ring
+ * is empty.  Process thread only.
+ */
+int lookahead_peek( lookahead_record_t* record);
+
+/** Remove the next record, copying its data bytes to buffer.  Process thread only. */
+void lookahead_read( lookahead_record_t* record, unsigned char* buffer);
+
+/** Remove the next record without reading it.  Process thread only. */
+void lookahead_skip( lookahead_record_t* record);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __lookahead_h__ */
+    
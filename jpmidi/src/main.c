@@ -13,6 +13,8 @@
  * 
  */
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <getopt.h>
 #include <errno.h>
 #include <unistd.h>
@@ -23,6 +25,14 @@
 #include "dump.h"
 #include "main.h"
 #include "jackclient.h"
+#include "lookahead.h"
+#include "capture.h"
+#include "osc.h"
+#include "export.h"
+#include "batch.h"
+#include "reload.h"
+#include "setlist.h"
+#include "slot.h"
 
 /* Options for the command */
 #define HAS_ARG 1
@@ -30,6 +40,19 @@ static struct option long_opts[] = {
     {"version", 0, NULL, 'v'},
     {"disable-client", 0, NULL, 'd'},
     {"server", 0, NULL, 's'},
+    {"lookahead", HAS_ARG, NULL, 'l'},
+    {"input", 0, NULL, 'i'},
+    {"osc", HAS_ARG, NULL, 'o'},
+    {"export", HAS_ARG, NULL, 'e'},
+    {"format", HAS_ARG, NULL, 'f'},
+    {"batch", 0, NULL, 'b'},
+    {"jobs", HAS_ARG, NULL, 'j'},
+    {"cache", HAS_ARG, NULL, 'c'},
+    {"compact", 0, NULL, 'C'},
+    {"watch", 0, NULL, 'w'},
+    {"setlist", HAS_ARG, NULL, 'L'},
+    {"auto-advance", 0, NULL, 'A'},
+    {"slot", HAS_ARG, NULL, 'S'},
     {0, 0, 0, 0},
 };
 
@@ -40,6 +63,19 @@ static struct option long_opts[] = {
 static int be_jack_client = 1;
 static int be_server = 0;
 static int TCPPORT = 2013;
+static int lookahead_periods = 0;
+static int with_input = 0;
+static int osc_port = 0;
+static char* export_file = NULL;
+static int export_format = -1;
+static int batch = 0;
+static int watch = 0;
+static char* setlist_file = NULL;
+static int auto_advance = 0;
+static char* slot_files[SLOT_MAX];
+static int slot_count = 0;
+static int batch_jobs = 0;
+static char* batch_cache = NULL;
 static jpmidi_root_t* root;
 
 int main_is_jack_client()
@@ -49,7 +85,12 @@ int main_is_jack_client()
 
 jpmidi_root_t* main_get_jpmidi_root()
 {
-    return root;
+    return __atomic_load_n( &root, __ATOMIC_ACQUIRE);
+}
+
+void main_set_jpmidi_root( jpmidi_root_t* new_root)
+{
+    __atomic_store_n( &root, new_root, __ATOMIC_RELEASE);
 }
 
 int main(int argc, char **argv)
@@ -84,19 +125,74 @@ int main(int argc, char **argv)
 	case 's':
 	    be_server = 1;
 	    break;
+        case 'l':
+            lookahead_periods = atoi(optarg);
+            break;
+        case 'i':
+            with_input = 1;
+            break;
+        case 'o':
+            osc_port = atoi(optarg);
+            break;
+        case 'e':
+            export_file = optarg;
+            be_jack_client = 0;
+            break;
+        case 'f':
+            export_format = export_format_by_name( optarg);
+            if (export_format < 0) {
+                main_showusage();
+                exit(1);
+            }
+            break;
+        case 'b':
+            batch = 1;
+            be_jack_client = 0;
+            break;
+        case 'j':
+            batch_jobs = atoi(optarg);
+            break;
+        case 'c':
+            batch_cache = optarg;
+            break;
+        case 'C':
+            jpmidi_set_compact( 1);
+            break;
+        case 'w':
+            watch = 1;
+            break;
+        case 'L':
+            setlist_file = optarg;
+            break;
+        case 'A':
+            auto_advance = 1;
+            break;
+        case 'S':
+            if (slot_count == SLOT_MAX) {
+                fprintf( stderr, "At most %d slots\n", SLOT_MAX);
+                exit(1);
+            }
+            slot_files[slot_count++] = optarg;
+            break;
         default:
             main_showusage();
             exit(1);
         }
     }
 
-    if (optind >= argc) {
+    /* the files given, or the list, make up the setlist */
+    if (setlist_file != NULL && setlist_read( setlist_file)) {
+        fprintf( stderr, "Cannot read setlist %s\n", setlist_file);
+        exit( 1);
+    }
+
+    if (optind >= argc && setlist_file == NULL) {
         printf("No input files!\n");
         main_showusage();
         exit( 1);
     }
 
-    if (optind < argc-1) {
+    if (optind < argc-1 && export_file != NULL) {
         printf("Too many input files!\n");
         main_showusage();
         exit( 1);
@@ -110,31 +206,87 @@ int main(int argc, char **argv)
     dump_init();
 
     jack_nframes_t jack_sample_rate = 44100;
+
+    /* batch mode checks all the files named and exits */
+    if (batch) {
+        jpmidi_set_compact( 1);
+        return batch_run( argv + optind, argc - optind, batch_jobs, jack_sample_rate,
+                          batch_cache, export_format < 0 ? EXPORT_BINARY : export_format);
+    }
     
     if (be_jack_client)
     {
-        if (jackclient_new( "jpmidi")) return 1;
+        if (jackclient_new( "jpmidi", with_input)) return 1;
+        if (with_input && capture_init()) return 1;
         
         jack_sample_rate = jack_get_sample_rate(jackclient_get_client());
     }
-    else printf("Not connecting to jack, assuming sample rate of %d\n", jack_sample_rate);
+    else if (export_file == NULL) printf("Not connecting to jack, assuming sample rate of %d\n", jack_sample_rate);
+
+
+    for (c = optind; c < argc; c++) setlist_add( argv[c]);
+    if (setlist_count() == 0) {
+        fprintf( stderr, "The setlist %s is empty\n", setlist_file);
+        return 1;
+    }
 
+    root = jpmidi_loadfile((char*)setlist_get( 0), jack_sample_rate);
+    if (root == NULL) {
+        fprintf( stderr, "Failed to load %s\n", setlist_get( 0));
+        return 1;
+    }
 
-    root = jpmidi_loadfile(argv[optind], jack_sample_rate);
+    /* export mode writes the events and exits, stdout may be the export */
+    if (export_file != NULL) {
+        uint64_t count;
+        if (export_song( root, export_file, export_format < 0 ? EXPORT_CSV : export_format, 0, &count)) {
+            fprintf( stderr, "Failed to export %s: %s\n", export_file, strerror( errno));
+            return 1;
+        }
+        return 0;
+    }
     printf("loaded %s\n", root->filename);
 
+    for (c = 0; c < slot_count; c++) {
+        int number = be_jack_client ? slot_load( slot_files[c], 0) : 0;
+        if (number == 0) {
+            fprintf( stderr, "Failed to load %s into a slot\n", slot_files[c]);
+            return 1;
+        }
+        printf("loaded %s into slot %d\n", slot_files[c], number);
+    }
+
     if (be_jack_client && jackclient_activate()) return 1;
+
+    if (be_jack_client && lookahead_periods > 0 && lookahead_start( lookahead_periods)) return 1;
     
-    /* launch either command line or server mode */
-    if (be_server)
+    /* the server runs next to the command line, without a terminal
+       it is the only source of commands */
+    if (be_server && tcpserver_start(TCPPORT)) return 1;
+
+    if (osc_port > 0 && osc_start(osc_port)) return 1;
+
+    if (watch && reload_start(root->filename)) return 1;
+
+    setlist_set_auto( auto_advance);
+    if (setlist_start( jack_sample_rate)) return 1;
+
+    if (!be_server || isatty(STDIN_FILENO))
     {
-	tcpserver(TCPPORT);
+	cmdline();
     }
     else
     {
-	cmdline();
+	tcpserver_wait();
     }
 
+    reload_stop();
+    setlist_stop();
+    tcpserver_stop();
+    osc_stop();
+
+    lookahead_stop();
+    capture_shutdown();
     if (be_jack_client && jackclient_deactivate()) return 1;
     if (be_jack_client && jackclient_close()) return 1;
     
@@ -148,11 +300,25 @@ void main_showusage()
 {
     char **cpp;
     static char *msg[] = {
-        "Usage: jpmidi [options] midi-file",
+        "Usage: jpmidi [options] midi-file...",
+        "       jpmidi --batch [options] file-or-directory...",
         "OPTIONS:",
         "    --version or -v               - Show program version",
         "    --disable-client or -d        - Dont connect as a jack client",
-	"    --server or -s                - wait commands on TCP port 2013",
+	"    --server or -s                - also wait commands on TCP port 2013",
+        "    --lookahead or -l <periods>   - Pre-render events this many periods ahead in a worker thread",
+        "    --input or -i                 - Register an input port merged into the output",
+        "    --osc or -o <port>            - Accept OSC messages on this UDP port",
+        "    --export or -e <file>         - Write all events to file (- for stdout) and exit",
+        "    --format or -f <format>       - Export format: csv, jsonl or binary",
+        "    --compact or -C               - Free the parsed file once it has been prepared for playback",
+        "    --watch or -w                 - Reload the file whenever it changes",
+        "    --setlist or -L <file>        - Play the files listed in file, one per line, before those given",
+        "    --auto-advance or -A          - Start the next song of the setlist when one ends",
+        "    --slot or -S <file>           - Also play file on a port of its own, may be repeated",
+        "    --batch or -b                 - Load all files and directories given, print statistics or errors and exit",
+        "    --jobs or -j <threads>        - Batch mode threads, one per CPU by default",
+        "    --cache or -c <directory>     - Batch mode: export each file to directory (binary unless -f is given)",
     };
 
     for (cpp = msg; cpp < msg+NELEM(msg); cpp++) {
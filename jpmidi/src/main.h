@@ -36,6 +36,8 @@ void main_showversion(void);
 
 jpmidi_root_t* main_get_jpmidi_root(); ///< The data created by loading and processing a MIDI file.
 
+void main_set_jpmidi_root( jpmidi_root_t* root); ///< Replace the song, see jackclient_switch_song().
+
 int main_is_jack_client();///< Returns true if the program connected to jack (-d switch disables jack)
     
 #ifdef __cplusplus
@@ -0,0 +1,95 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+
+/* Memory accounting.  The code allocating the song data counts what it
+ * allocates here, by category, so the memory a song takes can be
+ * reported without walking it.  Sizes are the bytes requested plus
+ * estimates for glib's array and tree headers; allocator overhead and
+ * the unused capacity of arrays are not included.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "memstats.h"
+
+typedef struct memstats_counter
+{
+    int64_t objects;
+    int64_t bytes;
+} memstats_counter_t;
+
+static memstats_counter_t counters[MEMSTATS_CATEGORIES];
+
+static const char* category_names[MEMSTATS_CATEGORIES] = {
+    "elements", "element_arrays", "element_data", "time_tree", "times",
+    "event_arrays", "events", "event_data", "sysex", "texts", "maps", "index"
+};
+
+void memstats_alloc( memstats_category_t category, size_t bytes)
+{
+    __atomic_add_fetch( &counters[category].objects, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch( &counters[category].bytes, bytes, __ATOMIC_RELAXED);
+}
+
+void memstats_free( memstats_category_t category, size_t bytes)
+{
+    __atomic_sub_fetch( &counters[category].objects, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch( &counters[category].bytes, bytes, __ATOMIC_RELAXED);
+}
+
+void memstats_resize( memstats_category_t category, ssize_t bytes)
+{
+    __atomic_add_fetch( &counters[category].bytes, bytes, __ATOMIC_RELAXED);
+}
+
+const char* memstats_category_name( memstats_category_t category)
+{
+    return category_names[category];
+}
+
+void memstats_get( memstats_category_t category, uint64_t* objects, uint64_t* bytes)
+{
+    *objects = __atomic_load_n( &counters[category].objects, __ATOMIC_RELAXED);
+    *bytes = __atomic_load_n( &counters[category].bytes, __ATOMIC_RELAXED);
+}
+
+uint64_t memstats_resident()
+{
+    unsigned long size, resident;
+    FILE* fp = fopen( "/proc/self/statm", "r");
+
+    if (fp == NULL) return 0;
+    if (fscanf( fp, "%lu %lu", &size, &resident) != 2) resident = 0;
+    fclose( fp);
+    return (uint64_t)resident * sysconf( _SC_PAGESIZE);
+}
+
+void memstats_json( GString* json)
+{
+    uint64_t objects, bytes, total = 0;
+    int i;
+
+    g_string_append( json, "{\"categories\":{");
+    for (i = 0; i < MEMSTATS_CATEGORIES; i++) {
+        memstats_get( i, &objects, &bytes);
+        total += bytes;
+        g_string_append_printf( json, "%s\"%s\":{\"objects\":%llu,\"bytes\":%llu}", i ? "," : "",
+                                category_names[i], (unsigned long long)objects, (unsigned long long)bytes);
+    }
+    g_string_append_printf( json, "},\"total\":%llu,\"resident\":%llu}",
+                            (unsigned long long)total, (unsigned long long)memstats_resident());
+}
@@ -0,0 +1,86 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+
+#ifndef __memstats_h__
+#define __memstats_h__
+
+/* Definitions generated by autotools. */
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <glib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** What the memory of the loaded songs is spent on. */
+typedef enum memstats_category
+{
+    MEMSTATS_ELEMENTS,          ///< Element structs of the SMF parse tree.
+    MEMSTATS_ELEMENT_ARRAYS,    ///< Child arrays of the tree's containers.
+    MEMSTATS_ELEMENT_DATA,      ///< Text and sysex payloads in the tree.
+    MEMSTATS_TIME_TREE,         ///< GTree nodes indexing the time records by frame.
+    MEMSTATS_TIMES,             ///< Time records.
+    MEMSTATS_EVENT_ARRAYS,      ///< Event pointer arrays of the time records.
+    MEMSTATS_EVENTS,            ///< Event structs.
+    MEMSTATS_EVENT_DATA,        ///< MIDI bytes of channel events.
+    MEMSTATS_SYSEX,             ///< MIDI bytes of sysex events.
+    MEMSTATS_TEXTS,             ///< Text events kept for playback.
+    MEMSTATS_MAPS,              ///< Tempo, time signature and marker tables.
+    MEMSTATS_INDEX,             ///< Posting lists of the event index.
+    MEMSTATS_CATEGORIES
+} memstats_category_t;
+
+/** Estimated size of the header of a GArray, GPtrArray or GByteArray. */
+#define MEMSTATS_ARRAY_BYTES 32
+
+/** Estimated size of a GTree node. */
+#define MEMSTATS_TREE_NODE_BYTES 40
+
+/** Count an allocated object of the given size.  Thread safe, like the
+ *  other counting functions.
+ */
+void memstats_alloc( memstats_category_t category, size_t bytes);
+
+/** Count a freed object of the given size. */
+void memstats_free( memstats_category_t category, size_t bytes);
+
+/** Change the bytes of a category without changing its objects, for
+ *  data appended to an object.
+ */
+void memstats_resize( memstats_category_t category, ssize_t bytes);
+
+/** Returns the short name of a category, such as "elements". */
+const char* memstats_category_name( memstats_category_t category);
+
+/** Get the current counts of a category. */
+void memstats_get( memstats_category_t category, uint64_t* objects, uint64_t* bytes);
+
+/** Returns the resident set size of the process in bytes, 0 if unknown. */
+uint64_t memstats_resident();
+
+/** Append all counts to a JSON document as an object. */
+void memstats_json( GString* json);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __memstats_h__ */
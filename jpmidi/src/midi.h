@@ -58,7 +58,21 @@
 #define MIDI_HEAD_MAGIC 0x4d546864
 #define MIDI_TRACK_MAGIC  0x4d54726b
 
+/*
+ * The track chunks of a file read by midi_read_tracks(), kept so that
+ * reading a new version of the file can reuse the tracks that did not
+ * change.  They point into the element tree that was read.
+ */
+struct midiTracks {
+	GArray *chunks;		/* struct trackChunk for each MTrk chunk */
+	int  parsed;		/* Chunks parsed, the others were reused */
+};
+
 struct rootElement *midi_read(FILE *fp);
 struct rootElement *midi_read_file(char *name);
+struct rootElement *midi_read_tracks(char *name, struct midiTracks *previous,
+	struct midiTracks **tracks);
+void midi_tracks_detach(struct rootElement *root, struct midiTracks *tracks);
+void midi_tracks_free(struct midiTracks *tracks);
 
 #endif
@@ -17,6 +17,7 @@
 
 #include <glib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "elements.h"
 #include "except.h"
@@ -36,10 +37,48 @@ struct midistate {
 	int  chunk_size;	/* Size of current chunk */
 	int  chunk_count;	/* Count within current chunk */
 	GPtrArray *notes;	/* Currently on notes */
+	struct trackElement *track;	/* Track being read */
 
 	struct tempomapElement *tempo_map;	/* The tempo map */
 };
 
+/*
+ * A track chunk as read by midi_read_tracks(). A chunk is reused
+ * when a chunk with the same bytes is read at the same port, and the
+ * same place with respect to a format 1 tempo track.
+ */
+struct trackChunk {
+	guint64 hash;		/* Hash of the chunk's bytes, header included */
+	guint32 length;		/* Length of the chunk's data */
+	int  port;		/* Port in effect at the start of the chunk */
+	int  end_port;		/* Port in effect at its end */
+	int  tempo_track;	/* First track of a format 1 file */
+	struct trackElement *track;	/* The track, NULL if it was dropped */
+	GPtrArray *maps;	/* Tempo map elements read from the chunk */
+};
+
+/*
+ * A file being read by midi_read_tracks().
+ */
+struct readTracks {
+	FILE *fp;		/* Memory stream over the file */
+	unsigned char *data;	/* The whole file */
+	gsize length;		/* Its length */
+	struct midiTracks *previous;	/* Chunks of the last read, or NULL */
+	gboolean *taken;	/* Previous chunks reused by this read */
+	struct midiTracks *tracks;	/* Chunks of this read */
+	struct midistate state;	/* Reading state, freed on an exception */
+	struct rootElement *root;	/* Result */
+};
+
+/*
+ * A file being read by midi_read_file().
+ */
+struct readFile {
+	FILE *fp;		/* Open file */
+	struct rootElement *root;	/* Result of midi_read() */
+};
+
 static struct rootElement *read_head(struct midistate *msp);
 static struct trackElement *read_track(struct midistate *msp);
 static void handle_status(struct midistate *msp, struct trackElement *track, 
@@ -53,6 +92,12 @@ static void put_back(struct midistate *msp, char c);
 static struct element *save_note(struct midistate *msp, int note, int vel);
 static void finish_note(struct midistate *msp, int note, int vel);
 static void skip_chunk(struct midistate *msp);
+static void read_file(void *arg);
+static void read_tracks(void *arg);
+static void read_tracks_free(struct readTracks *rt);
+static struct trackChunk *find_chunk(struct readTracks *rt,
+	struct trackChunk *chunk);
+static guint64 hash_bytes(const unsigned char *data, gsize length);
 
 /*
  * Read in a midi file from the specified open file pointer, fp
@@ -110,18 +155,336 @@ midi_read(FILE *fp)
 struct rootElement *
 midi_read_file(char *name)
 {
-	FILE *fp;
-	struct rootElement *root;
+	struct readFile rf;
+	struct except *e;
+	char  message[256];
 
-	fp = fopen(name, "rb");
-	if (fp == NULL)
+	rf.fp = fopen(name, "rb");
+	if (rf.fp == NULL)
 		except(ioError, "Could not open file %s", name);
 
-	root = midi_read(fp);
+	/* Close the file before passing an exception on */
+	e = except_catch(read_file, &rf, message, sizeof(message));
 
-	fclose(fp);
+	fclose(rf.fp);
 
-	return root;
+	if (e != NULL)
+		except(e, "%s", message);
+
+	return rf.root;
+}
+
+/*
+ * Read an open file for midi_read_file()
+ *
+ *  Arguments:
+ *    arg       - struct readFile with the file to read
+ */
+static void
+read_file(void *arg)
+{
+	struct readFile *rf = arg;
+
+	rf->root = midi_read(rf->fp);
+}
+
+/*
+ * Read in a midi file from the specified file name, reusing the
+ * tracks of a previous read of it whose bytes did not change.  The
+ * tracks that are reused are shared between the two element trees;
+ * midi_tracks_detach() must be called on the previous tree before it
+ * is freed.  The chunks of this read are returned in tracks.
+ * 
+ *  Arguments:
+ *    name      - File name to read
+ *    previous  - Chunks of the previous read, or NULL
+ *    tracks    - Returns the chunks of this read
+ */
+struct rootElement *
+midi_read_tracks(char *name, struct midiTracks *previous,
+	struct midiTracks **tracks)
+{
+	struct readTracks rt;
+	struct except *e;
+	char  message[256];
+	gchar *data;
+
+	if (!g_file_get_contents(name, &data, &rt.length, NULL))
+		except(ioError, "Could not open file %s", name);
+	if (rt.length == 0) {
+		g_free(data);
+		except(formatError, "Unexpected end of file");
+	}
+
+	rt.data = (unsigned char *)data;
+	rt.fp = fmemopen(data, rt.length, "rb");
+	if (rt.fp == NULL) {
+		g_free(data);
+		except(ioError, "Could not read file %s", name);
+	}
+	rt.previous = previous;
+	rt.taken = g_new0(gboolean, previous ? previous->chunks->len : 0);
+	rt.tracks = g_new0(struct midiTracks, 1);
+	rt.tracks->chunks = g_array_new(FALSE, FALSE, sizeof(struct trackChunk));
+	rt.state.notes = NULL;
+	rt.state.track = NULL;
+	rt.state.tempo_map = NULL;
+	rt.root = NULL;
+
+	/* Free the file before passing an exception on */
+	e = except_catch(read_tracks, &rt, message, sizeof(message));
+
+	fclose(rt.fp);
+	g_free(data);
+	g_free(rt.taken);
+
+	if (e != NULL) {
+		read_tracks_free(&rt);
+		midi_tracks_free(rt.tracks);
+		except(e, "%s", message);
+	}
+
+	*tracks = rt.tracks;
+	return rt.root;
+}
+
+/*
+ * Read the tracks of a file for midi_read_tracks(). This follows
+ * midi_read(), taking each track from the previous read when its
+ * chunk can be reused.
+ *
+ *  Arguments:
+ *    arg       - struct readTracks with the file to read
+ */
+static void
+read_tracks(void *arg)
+{
+	struct readTracks *rt = arg;
+	struct midistate *msp;
+	struct rootElement *root;
+	struct trackChunk chunk;
+	struct trackChunk *old;
+	struct element *el;
+	unsigned char *head;
+	long  offset;
+	int  maps;
+	int  i, j;
+
+	msp = &rt->state;
+	msp->fp = rt->fp;
+	msp->tempo_map = md_tempomap_new();
+	msp->notes = g_ptr_array_new();
+	msp->port = 0;
+	msp->track_count = 0;
+
+	root = read_head(msp);
+	md_add(MD_CONTAINER(root), NULL); /* Leave room for the tempo map */
+	rt->root = root;
+	for (i = 0; i < root->tracks; i++) {
+		offset = ftell(msp->fp);
+		head = rt->data + offset;
+
+		memset(&chunk, 0, sizeof(chunk));
+		chunk.port = msp->port;
+		chunk.tempo_track = (root->format == 1 && i == 0);
+
+		/* Compare the chunk's bytes, when it is all there */
+		old = NULL;
+		if (offset + 8 <= rt->length) {
+			chunk.length = ((guint32)head[4] << 24) | (head[5] << 16)
+				| (head[6] << 8) | head[7];
+			if (chunk.length <= rt->length - offset - 8) {
+				chunk.hash = hash_bytes(head, chunk.length + 8);
+				old = find_chunk(rt, &chunk);
+			}
+		}
+
+		if (old != NULL) {
+			chunk.end_port = old->end_port;
+			chunk.track = old->track;
+			chunk.maps = g_ptr_array_sized_new(old->maps->len);
+			for (j = 0; j < old->maps->len; j++) {
+				el = g_ptr_array_index(old->maps, j);
+				g_ptr_array_add(chunk.maps, el);
+				md_add(MD_CONTAINER(msp->tempo_map), el);
+			}
+			msp->port = chunk.end_port;
+			msp->track_count++;
+			fseek(msp->fp, offset + 8 + chunk.length, SEEK_SET);
+		} else {
+			maps = MD_CONTAINER(msp->tempo_map)->elements->len;
+			el = MD_ELEMENT(read_track(msp));
+			chunk.end_port = msp->port;
+			chunk.track = MD_TRACK(el);
+			chunk.maps = g_ptr_array_new();
+			for (j = maps; j < MD_CONTAINER(msp->tempo_map)->elements->len; j++)
+				g_ptr_array_add(chunk.maps,
+					g_ptr_array_index(MD_CONTAINER(msp->tempo_map)->elements, j));
+			rt->tracks->parsed++;
+
+			/* If format 1 then the first track is really the tempo map */
+			if (chunk.tempo_track
+					&& MD_CONTAINER(el)->elements->len == 0) {
+				md_free(el);
+				chunk.track = NULL;
+			}
+		}
+
+		g_array_append_val(rt->tracks->chunks, chunk);
+		if (chunk.track != NULL)
+			md_add(MD_CONTAINER(root), MD_ELEMENT(chunk.track));
+	}
+
+	g_ptr_array_index(MD_CONTAINER(root)->elements, 0) = msp->tempo_map;
+	msp->tempo_map = NULL;
+
+	g_ptr_array_free(msp->notes, 1);
+	msp->notes = NULL;
+}
+
+/*
+ * Free what read_tracks() had read when an exception stopped it.
+ * The elements it took from the previous read stay with that one.
+ *
+ *  Arguments:
+ *    rt        - The read that failed
+ */
+static void
+read_tracks_free(struct readTracks *rt)
+{
+	struct midistate *msp = &rt->state;
+
+	if (msp->track != NULL)
+		md_free(MD_ELEMENT(msp->track));
+	if (rt->root != NULL) {
+		g_ptr_array_index(MD_CONTAINER(rt->root)->elements, 0) = msp->tempo_map;
+		if (rt->previous != NULL)
+			midi_tracks_detach(rt->root, rt->previous);
+		md_free(MD_ELEMENT(rt->root));
+		rt->root = NULL;
+	} else if (msp->tempo_map != NULL) {
+		md_free(MD_ELEMENT(msp->tempo_map));
+	}
+	msp->tempo_map = NULL;
+	if (msp->notes != NULL)
+		g_ptr_array_free(msp->notes, 1);
+	msp->notes = NULL;
+}
+
+/*
+ * Find an unused chunk of a previous read that has the same bytes
+ * and would be read the same way.
+ *
+ *  Arguments:
+ *    rt        - The read, with the chunks of the previous one
+ *    chunk     - Chunk being read
+ */
+static struct trackChunk *
+find_chunk(struct readTracks *rt, struct trackChunk *chunk)
+{
+	struct trackChunk *old;
+	int  i;
+
+	if (rt->previous == NULL)
+		return NULL;
+
+	for (i = 0; i < rt->previous->chunks->len; i++) {
+		old = &g_array_index(rt->previous->chunks, struct trackChunk, i);
+		if (!rt->taken[i] && old->hash == chunk->hash
+				&& old->length == chunk->length
+				&& old->port == chunk->port
+				&& old->tempo_track == chunk->tempo_track) {
+			rt->taken[i] = TRUE;
+			return old;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * 64 bit FNV-1a hash of a chunk.
+ *
+ *  Arguments:
+ *    data      - Bytes to hash
+ *    length    - Number of bytes
+ */
+static guint64
+hash_bytes(const unsigned char *data, gsize length)
+{
+	guint64 hash = 14695981039346656037ULL;
+	gsize i;
+
+	for (i = 0; i < length; i++) {
+		hash ^= data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/*
+ * Take the elements that a later read reused out of the tree of a
+ * previous read, so that the tree can be freed while they live on in
+ * the later one.
+ *
+ *  Arguments:
+ *    root      - Tree of the previous read
+ *    tracks    - Chunks of the later read
+ */
+void
+midi_tracks_detach(struct rootElement *root, struct midiTracks *tracks)
+{
+	GHashTable *shared;
+	GPtrArray *elements;
+	struct trackChunk *chunk;
+	int  i, j;
+
+	shared = g_hash_table_new(g_direct_hash, g_direct_equal);
+	for (i = 0; i < tracks->chunks->len; i++) {
+		chunk = &g_array_index(tracks->chunks, struct trackChunk, i);
+		if (chunk->track != NULL)
+			g_hash_table_insert(shared, chunk->track, chunk->track);
+		for (j = 0; j < chunk->maps->len; j++)
+			g_hash_table_insert(shared, g_ptr_array_index(chunk->maps, j),
+				g_ptr_array_index(chunk->maps, j));
+	}
+
+	elements = MD_CONTAINER(root)->elements;
+	for (i = 0; i < elements->len; i++) {
+		if (g_hash_table_lookup(shared, g_ptr_array_index(elements, i)))
+			g_ptr_array_index(elements, i) = NULL;
+	}
+	if (elements->len > 0 && g_ptr_array_index(elements, 0) != NULL) {
+		elements = MD_CONTAINER(g_ptr_array_index(elements, 0))->elements;
+		for (i = 0; i < elements->len; i++) {
+			if (g_hash_table_lookup(shared, g_ptr_array_index(elements, i)))
+				g_ptr_array_index(elements, i) = NULL;
+		}
+	}
+
+	g_hash_table_destroy(shared);
+}
+
+/*
+ * Free the chunks of a read.  The elements they point to belong to
+ * the tree that was read.
+ *
+ *  Arguments:
+ *    tracks    - Chunks to free, may be NULL
+ */
+void
+midi_tracks_free(struct midiTracks *tracks)
+{
+	struct trackChunk *chunk;
+	int  i;
+
+	if (tracks == NULL)
+		return;
+	for (i = 0; i < tracks->chunks->len; i++) {
+		chunk = &g_array_index(tracks->chunks, struct trackChunk, i);
+		g_ptr_array_free(chunk->maps, 1);
+	}
+	g_array_free(tracks->chunks, 1);
+	g_free(tracks);
 }
 
 /*
@@ -135,10 +498,9 @@ read_head(struct midistate *msp)
 {
 	guint32  magic;
 	int  length;
+	int  format, tracks, time_base;
 	struct rootElement *root;
 
-	root = md_root_new();
-
 	/* The first word just identifies the file as a midi file */
 	magic = read_int(msp, 4);
 	if (magic != MIDI_HEAD_MAGIC)
@@ -150,9 +512,15 @@ read_head(struct midistate *msp)
 	if (length < 6)
 		except(formatError, "Bad header length, probably not a real midi file");
 
-	root->format = read_int(msp, 2);
-	root->tracks = read_int(msp, 2);
-	root->time_base = read_int(msp, 2);
+	/* Read it all before the root exists, so a short file leaks nothing */
+	format = read_int(msp, 2);
+	tracks = read_int(msp, 2);
+	time_base = read_int(msp, 2);
+
+	root = md_root_new();
+	root->format = format;
+	root->tracks = tracks;
+	root->time_base = time_base;
 
 	/* Should skip any extra bytes, (may not be seekable) */
 	while (length > 6) {
@@ -192,6 +560,7 @@ read_track(struct midistate *msp)
 	msp->chunk_count = 0;	/* nothing read yet */
 
 	track = md_track_new();
+	msp->track = track;
 
 	msp->current_time = 0;
 	while (msp->chunk_count < msp->chunk_size) {
@@ -226,6 +595,7 @@ printf("Left over note, finishing\n");
 	}
 
 	msp->track_count++;
+	msp->track = NULL;
 
 	return track;
 }
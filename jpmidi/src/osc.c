@@ -0,0 +1,274 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+
+/* OSC control over UDP.  Messages are decoded on their own thread and
+ * go straight to the process thread's command queue, so a command
+ * takes effect at the start of the next cycle without passing through
+ * the command line parser or its lock.
+ *
+ *   /jpmidi/play
+ *   /jpmidi/stop
+ *   /jpmidi/locate <frame:i | seconds:f>
+ *   /jpmidi/mute <channel:i> [<on:i>]
+ *   /jpmidi/unmute <channel:i>
+ *   /jpmidi/solo <channel:i>        0 disables solo
+ *
+ * Bundles are accepted, their time tags are ignored.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "osc.h"
+#include "jackclient.h"
+#include "main.h"
+
+#define OSC_MAX_PACKET 65536
+#define OSC_MAX_ARGS   4
+
+typedef struct osc_arg
+{
+    char type;      ///< 'i' or 'f', other types are skipped.
+    int32_t i;
+    float f;
+} osc_arg_t;
+
+static int sock = -1;
+static int wake_fd = -1;
+static pthread_t thread;
+static int running = 0;
+
+/* Read a padded OSC string at *pos.  Returns 1 if it runs past len. */
+static int osc_string( const unsigned char* buf, int len, int* pos, const char** out)
+{
+    const unsigned char* end = memchr( buf + *pos, 0, len - *pos);
+    if (end == NULL) return 1;
+    *out = (const char*)buf + *pos;
+    *pos += ((end - (buf + *pos)) + 4) & ~3;
+    return *pos > len;
+}
+
+/* Big endian 32 bit word at pos. */
+static uint32_t osc_word( const unsigned char* buf, int pos)
+{
+    return ((uint32_t)buf[pos] << 24) | ((uint32_t)buf[pos+1] << 16) | ((uint32_t)buf[pos+2] << 8) | buf[pos+3];
+}
+
+/* Integer value of an argument, def if it is missing. */
+static int osc_int( osc_arg_t* args, int count, int index, int def)
+{
+    if (index >= count) return def;
+    return args[index].type == 'f' ? (int)args[index].f : args[index].i;
+}
+
+static void osc_send( jackclient_rt_command_type_t type, int channel, jpmidi_frame_t frame)
+{
+    jackclient_rt_command_t command;
+    memset( &command, 0, sizeof(command));
+    command.type = type;
+    command.channel = channel;
+    command.frame = frame;
+    if (jackclient_rt_command_send( &command))
+        fprintf( stderr, "osc: command queue full, message dropped\n");
+}
+
+/* Decode one message and queue the command for it. */
+static int osc_message( const unsigned char* buf, int len)
+{
+    const char* address;
+    const char* types = ",";
+    osc_arg_t args[OSC_MAX_ARGS];
+    int count = 0;
+    int pos = 0;
+
+    if (osc_string( buf, len, &pos, &address)) return 1;
+    if (pos < len && buf[pos] == ',' && osc_string( buf, len, &pos, &types)) return 1;
+
+    for (types++; *types; types++) {
+        switch (*types) {
+        case 'i':
+        case 'f':
+            if (pos + 4 > len) return 1;
+            if (count < OSC_MAX_ARGS) {
+                uint32_t word = osc_word( buf, pos);
+                args[count].type = *types;
+                args[count].i = (int32_t)word;
+                memcpy( &args[count].f, &word, sizeof(float));
+                count++;
+            }
+            pos += 4;
+            break;
+        case 'h':
+        case 'd':
+        case 't':
+            if (pos + 8 > len) return 1;
+            pos += 8;
+            break;
+        case 's':
+        case 'S':
+        {
+            const char* skip;
+            if (osc_string( buf, len, &pos, &skip)) return 1;
+            break;
+        }
+        case 'b':
+        {
+            uint32_t size;
+            if (pos + 4 > len) return 1;
+            size = osc_word( buf, pos);
+            // The size comes from the packet, check it before rounding it up.
+            if (size > (uint32_t)(len - pos - 4)) return 1;
+            pos += 4 + size;
+            pos = pos + 3 < len ? (pos + 3) & ~3 : len;
+            break;
+        }
+        }
+    }
+
+    if (strncmp( address, "/jpmidi/", 8) != 0) return 1;
+    address += 8;
+
+    if (strcmp( address, "play") == 0) osc_send( RT_COMMAND_PLAY, 0, 0);
+    else if (strcmp( address, "stop") == 0) osc_send( RT_COMMAND_STOP, 0, 0);
+    else if (strcmp( address, "locate") == 0) {
+        jpmidi_frame_t frame = 0;
+        if (count > 0 && args[0].type == 'f')
+            frame = args[0].f > 0 ? (jpmidi_frame_t)((double)args[0].f * jack_get_sample_rate( jackclient_get_client())) : 0;
+        else if (count > 0 && args[0].i > 0)
+            frame = args[0].i;
+        osc_send( RT_COMMAND_LOCATE, 0, frame);
+    }
+    else if (strcmp( address, "mute") == 0 || strcmp( address, "unmute") == 0) {
+        int channel = osc_int( args, count, 0, 0);
+        int on = (address[0] == 'm') ? osc_int( args, count, 1, 1) : 0;
+        if (channel < 1 || channel > 16) return 1;
+        osc_send( on ? RT_COMMAND_MUTE : RT_COMMAND_UNMUTE, channel, 0);
+    }
+    else if (strcmp( address, "solo") == 0) {
+        int channel = osc_int( args, count, 0, -1);
+        if (channel < 0 || channel > 16) return 1;
+        osc_send( RT_COMMAND_SOLO, channel, 0);
+    }
+    else return 1;
+
+    return 0;
+}
+
+/* A packet is a message or a bundle of packets. */
+int osc_packet( const unsigned char* buf, int len)
+{
+    int pos = 16;   // "#bundle\0" and the time tag
+
+    if (len < 8 || memcmp( buf, "#bundle", 8) != 0) return osc_message( buf, len);
+
+    while (pos + 4 <= len) {
+        uint32_t size = osc_word( buf, pos);
+        pos += 4;
+        if (size > (uint32_t)(len - pos)) return 1;
+        osc_packet( buf + pos, size);
+        pos += size;
+    }
+    return 0;
+}
+
+static void* osc_main( void* arg)
+{
+    static unsigned char buf[OSC_MAX_PACKET];
+    struct pollfd fds[2];
+
+    fds[0].fd = sock;
+    fds[0].events = POLLIN;
+    fds[1].fd = wake_fd;
+    fds[1].events = POLLIN;
+
+    for (;;) {
+        if (poll( fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror( "osc: poll");
+            break;
+        }
+        if (fds[1].revents) break;   // osc_stop()
+
+        ssize_t len = recv( sock, buf, sizeof(buf), 0);
+        if (len < 0) {
+            if (errno != EINTR && errno != EAGAIN) perror( "osc: recv");
+            continue;
+        }
+        if (osc_packet( buf, (int)len))
+            fprintf( stderr, "osc: ignored invalid or unknown message\n");
+    }
+    return NULL;
+}
+
+/** Start receiving OSC messages on the given UDP port. */
+int osc_start( int port)
+{
+    struct sockaddr_in sin;
+
+    if (!main_is_jack_client()) {
+        fprintf( stderr, "osc: needs the jack client\n");
+        return 1;
+    }
+
+    sock = socket( AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        perror( "osc: socket");
+        return 1;
+    }
+
+    memset( &sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl( INADDR_ANY);
+    sin.sin_port = htons( port);
+    if (bind( sock, (struct sockaddr*)&sin, sizeof(sin)) < 0) {
+        perror( "osc: bind");
+        close( sock);
+        return 1;
+    }
+
+    wake_fd = eventfd( 0, 0);
+    if (wake_fd < 0 || pthread_create( &thread, NULL, osc_main, NULL)) {
+        fprintf( stderr, "cannot start osc thread\n");
+        if (wake_fd >= 0) close( wake_fd);
+        close( sock);
+        return 1;
+    }
+
+    running = 1;
+    printf("OSC listening on UDP port %d\n", port);
+    return 0;
+}
+
+/** Stop the OSC thread. */
+void osc_stop()
+{
+    uint64_t one = 1;
+
+    if (!running) return;
+    if (write( wake_fd, &one, sizeof(one)) < 0) perror( "osc: write");
+    pthread_join( thread, NULL);
+    close( wake_fd);
+    close( sock);
+    running = 0;
+}
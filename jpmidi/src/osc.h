@@ -0,0 +1,45 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+#ifndef __osc_h__
+#define __osc_h__
+
+/* Definitions generated by autotools. */
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Start receiving OSC messages on the given UDP port in a thread of
+ * its own.  Returns non-zero on failure.
+ */
+int osc_start( int port);
+
+/** Stop the OSC thread, if running. */
+void osc_stop();
+
+/** Decode a packet, a message or a bundle of them, and queue the
+ * commands it holds.  Nothing is read outside the len bytes at buf.
+ * Returns non-zero if the packet is malformed or the message unknown.
+ */
+int osc_packet( const unsigned char* buf, int len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __osc_h__ */
@@ -0,0 +1,236 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+
+/* Messages for the TCP server's push subscriptions.  Each timer tick
+ * takes one snapshot of the state the process thread publishes, and
+ * every stream is encoded at most once per tick however many clients
+ * subscribe to it.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+
+#include "publish.h"
+#include "jackclient.h"
+#include "jpmidi.h"
+#include "json.h"
+#include "main.h"
+#include "reclaim.h"
+
+/* Meter levels fall by this factor every tick, about 20dB a second. */
+#define METER_DECAY 0.977f
+
+static const char* stream_names[PUBLISH_STREAMS] = { "position", "notes", "text", "meters" };
+
+static struct {
+    GString* message;   /* last encoded message */
+    uint32_t version;   /* bumped when the message changes */
+    uint32_t tick;      /* tick the message was encoded in */
+    int empty;          /* nothing to send this tick */
+} streams[PUBLISH_STREAMS];
+
+static uint32_t tick = 0;
+static jackclient_snapshot_t snapshot;
+
+/* Next text to report, -1 to look it up again. */
+static int text_cursor = -1;
+static uint32_t text_seek_count = 0;
+static int text_first = 0;     /* texts passed during this tick */
+static int text_last = 0;
+static jpmidi_root_t* text_root = NULL;  /* song the text indexes refer to */
+
+static float levels[16];
+
+/** Returns the stream with the given name, or -1. */
+int publish_stream_by_name( const char* name)
+{
+    int i;
+    for (i = 0; i < PUBLISH_STREAMS; i++)
+        if (strcmp( name, stream_names[i]) == 0) return i;
+    return -1;
+}
+
+/** Returns the name of a stream. */
+const char* publish_stream_name( int stream)
+{
+    return stream_names[stream];
+}
+
+/* Work out which texts the transport passed since the previous tick. */
+static void publish_update_texts()
+{
+    jpmidi_root_t* root = main_get_jpmidi_root();
+
+    text_first = text_last = 0;
+
+    if (snapshot.state != JackTransportRolling || text_cursor < 0 || snapshot.seek_count != text_seek_count ||
+        root != text_root) {
+        // Stopped, jumped or reloaded, nothing was passed.  Pick up from here.
+        text_root = root;
+        text_cursor = jpmidi_find_text( root, snapshot.frame);
+        text_seek_count = snapshot.seek_count;
+        return;
+    }
+
+    text_first = text_cursor;
+    while (text_cursor < jpmidi_get_text_count( root) && jpmidi_get_text( root, text_cursor)->frame <= snapshot.frame)
+        text_cursor++;
+    text_last = text_cursor;
+}
+
+/* Fold the peaks of the last tick into the decaying meter levels. */
+static void publish_update_meters()
+{
+    uint8_t peaks[16];
+    int i;
+
+    jackclient_take_peaks( peaks);
+    for (i = 0; i < 16; i++) {
+        levels[i] *= METER_DECAY;
+        if (peaks[i] > levels[i]) levels[i] = peaks[i];
+    }
+}
+
+/** Take a new snapshot of the playback state. */
+void publish_tick( const int* wanted)
+{
+    tick++;
+    reclaim_enter( RECLAIM_PUBLISH);
+
+    if (main_is_jack_client()) jackclient_get_snapshot( &snapshot);
+    else memset( &snapshot, 0, sizeof(snapshot));
+
+    if (wanted[PUBLISH_TEXT]) publish_update_texts();
+    else {
+        text_cursor = -1;
+        text_root = NULL;
+    }
+
+    if (wanted[PUBLISH_METERS] && main_is_jack_client()) publish_update_meters();
+}
+
+static const char* state_name( jack_transport_state_t state)
+{
+    switch (state) {
+    case JackTransportStopped:  return "stopped";
+    case JackTransportRolling:  return "rolling";
+    case JackTransportLooping:  return "looping";
+    case JackTransportStarting: return "starting";
+    default:                    return "unknown";
+    }
+}
+
+static void encode_position( GString* json)
+{
+    g_string_append_printf( json, "{\"event\":\"position\",\"state\":\"%s\",\"frame\":%llu",
+                            state_name( snapshot.state), (unsigned long long)snapshot.frame);
+    if (snapshot.bbt_valid)
+        g_string_append_printf( json, ",\"bar\":%d,\"beat\":%d,\"tick\":%d,\"beats_per_bar\":%g,\"bpm\":%g",
+                                snapshot.bar, snapshot.beat, snapshot.tick,
+                                snapshot.beats_per_bar, snapshot.beats_per_minute);
+    g_string_append( json, "}\n");
+}
+
+static void encode_notes( GString* json)
+{
+    int channel, note;
+    int first_channel = 1;
+
+    g_string_append( json, "{\"event\":\"notes\",\"channels\":{");
+    for (channel = 0; channel < 16; channel++) {
+        const uint32_t* bits = snapshot.notes[channel];
+        if ((bits[0] | bits[1] | bits[2] | bits[3]) == 0) continue;
+
+        g_string_append_printf( json, "%s\"%d\":[", first_channel ? "" : ",", channel + 1);
+        first_channel = 0;
+
+        int first_note = 1;
+        for (note = 0; note < 128; note++) {
+            if (!(bits[note >> 5] & (1u << (note & 31)))) continue;
+            g_string_append_printf( json, first_note ? "%d" : ",%d", note);
+            first_note = 0;
+        }
+        g_string_append_c( json, ']');
+    }
+    g_string_append( json, "}}\n");
+}
+
+static void encode_text( GString* json)
+{
+    jpmidi_root_t* root = text_root;
+    int i;
+
+    g_string_append( json, "{\"event\":\"text\",\"items\":[");
+    for (i = text_first; i < text_last; i++) {
+        jpmidi_text_t* text = jpmidi_get_text( root, i);
+        g_string_append_printf( json, "%s{\"type\":\"%s\",\"frame\":%llu,\"text\":",
+                                i == text_first ? "" : ",", jpmidi_text_type_name( text->type),
+                                (unsigned long long)text->frame);
+        json_append_string( json, text->text);
+        g_string_append_c( json, '}');
+    }
+    g_string_append( json, "]}\n");
+}
+
+static void encode_meters( GString* json)
+{
+    int i;
+
+    g_string_append( json, "{\"event\":\"meters\",\"levels\":[");
+    for (i = 0; i < 16; i++)
+        g_string_append_printf( json, i ? ",%d" : "%d", (int)levels[i]);
+    g_string_append( json, "]}\n");
+}
+
+/** Let go of the song read during the tick. */
+void publish_end_tick()
+{
+    reclaim_leave( RECLAIM_PUBLISH);
+}
+
+/** Returns the message of a stream for the current tick. */
+const char* publish_get( int stream, uint32_t* version)
+{
+    if (streams[stream].message == NULL) streams[stream].message = g_string_sized_new( 256);
+
+    if (streams[stream].tick != tick) {
+        GString* json = g_string_sized_new( 256);
+
+        streams[stream].tick = tick;
+        streams[stream].empty = 0;
+
+        switch (stream) {
+        case PUBLISH_POSITION: encode_position( json); break;
+        case PUBLISH_NOTES:    encode_notes( json); break;
+        case PUBLISH_TEXT:
+            if (text_last > text_first) encode_text( json);
+            else streams[stream].empty = 1;
+            break;
+        case PUBLISH_METERS:   encode_meters( json); break;
+        }
+
+        // The text stream reports each batch once, even if it repeats.
+        if (!streams[stream].empty &&
+            (stream == PUBLISH_TEXT || strcmp( json->str, streams[stream].message->str) != 0)) {
+            g_string_assign( streams[stream].message, json->str);
+            streams[stream].version++;
+        }
+        g_string_free( json, TRUE);
+    }
+
+    *version = streams[stream].version;
+    return streams[stream].empty ? NULL : streams[stream].message->str;
+}
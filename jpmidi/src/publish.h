@@ -0,0 +1,71 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+#ifndef __publish_h__
+#define __publish_h__
+
+/* Definitions generated by autotools. */
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/** Streams TCP clients can subscribe to. */
+typedef enum publish_stream
+{
+    PUBLISH_POSITION,   ///< Transport state, frame and bar/beat/tick.
+    PUBLISH_NOTES,      ///< Notes sounding on each channel.
+    PUBLISH_TEXT,       ///< Markers, lyrics, cues and texts as they pass.
+    PUBLISH_METERS,     ///< Per channel note-on level, decaying.
+    PUBLISH_STREAMS
+} publish_stream_t;
+
+/** Rate of publish_tick() calls, the highest rate a stream can have. */
+#define PUBLISH_TICK_HZ 100
+
+/** Returns the stream with the given name, or -1. */
+int publish_stream_by_name( const char* name);
+
+/** Returns the name of a stream. */
+const char* publish_stream_name( int stream);
+
+/** Take a new snapshot of the playback state.  wanted[stream] is non
+ * zero for the streams that have subscribers; the others are not kept
+ * up to date.
+ */
+void publish_tick( const int* wanted);
+
+/** Called after the messages of a tick have been taken with
+ * publish_get(), so a replaced song can be freed.
+ */
+void publish_end_tick();
+
+/** Returns the message of a stream for the current tick as one line of
+ * JSON, encoded the first time it is asked for in a tick and shared by
+ * all subscribers.  *version changes whenever the content does.
+ * Returns NULL if there is nothing to send, the text stream only has
+ * a message when texts were passed.
+ */
+const char* publish_get( int stream, uint32_t* version);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __publish_h__ */
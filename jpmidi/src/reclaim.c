@@ -0,0 +1,67 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+
+/* Freeing replaced songs.  A thread that replaces a song cannot tell
+ * whether the process thread, the lookahead worker or the publisher
+ * is still reading it, so each of them marks the epoch it entered
+ * before looking a song up, and clears the mark when it holds none.
+ * reclaim_synchronize() starts a new epoch and waits until no reader
+ * is still in an older one; a reader that entered later can only have
+ * found the new song.  Epochs are odd, so 0 means outside.
+ */
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include "reclaim.h"
+
+/* Time between looks at the readers while waiting for them. */
+#define RECLAIM_POLL_USECS 1000
+
+static uint32_t epoch = 1;
+static uint32_t entered[RECLAIM_READERS];
+
+uint32_t reclaim_enter( reclaim_reader_t reader)
+{
+    uint32_t e = __atomic_load_n( &epoch, __ATOMIC_ACQUIRE);
+
+    __atomic_store_n( &entered[reader], e, __ATOMIC_RELAXED);
+    // The mark must be visible before the song is looked up, see reclaim_synchronize().
+    __atomic_thread_fence( __ATOMIC_SEQ_CST);
+    return e;
+}
+
+void reclaim_leave( reclaim_reader_t reader)
+{
+    __atomic_store_n( &entered[reader], 0, __ATOMIC_RELEASE);
+}
+
+void reclaim_synchronize()
+{
+    uint32_t e = __atomic_add_fetch( &epoch, 2, __ATOMIC_SEQ_CST);
+    int reader;
+
+    // Pairs with the fence in reclaim_enter(): either the reader's mark
+    // is seen here, or the reader sees the song that replaced the old one.
+    __atomic_thread_fence( __ATOMIC_SEQ_CST);
+
+    for (reader = 0; reader < RECLAIM_READERS; reader++) {
+        for (;;) {
+            uint32_t mark = __atomic_load_n( &entered[reader], __ATOMIC_ACQUIRE);
+            if (mark == 0 || (int32_t)(mark - e) >= 0) break;
+            usleep( RECLAIM_POLL_USECS);
+        }
+    }
+}
@@ -0,0 +1,59 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+
+#ifndef __reclaim_h__
+#define __reclaim_h__
+
+/* Definitions generated by autotools. */
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** The threads that read songs without holding the dispatch lock. */
+typedef enum
+{
+    RECLAIM_PROCESS,    ///< The jack process thread, for one cycle.
+    RECLAIM_LOOKAHEAD,  ///< The lookahead worker, while it runs.
+    RECLAIM_PUBLISH,    ///< The publisher, for one tick.
+    RECLAIM_READERS
+} reclaim_reader_t;
+
+/** Called by reader before it looks up a song: songs replaced before
+ * this call may be freed, those it finds from here on stay until it
+ * calls reclaim_enter() again or reclaim_leave().  Real-time safe.
+ * Returns the epoch entered.
+ */
+uint32_t reclaim_enter( reclaim_reader_t reader);
+
+/** Called by reader when it holds no song any more.  Real-time safe. */
+void reclaim_leave( reclaim_reader_t reader);
+
+/** Wait until every reader has let go of the songs it could have
+ * found before this call.  Call it after a song has been replaced,
+ * and free the song when it returns.  Not for the process thread.
+ */
+void reclaim_synchronize();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __reclaim_h__ */
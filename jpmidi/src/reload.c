@@ -0,0 +1,297 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+
+/* Reloading the song when its file changes.  The directory of the
+ * file is watched with inotify, since editors often save by writing a
+ * new file and renaming it over the old one.  Once the file has been
+ * quiet for a moment the 'reload' command runs: the file is read again
+ * reusing the parsed tracks whose chunks did not change, see
+ * midi_read_tracks(), and the process thread switches to the new song
+ * at the start of a cycle.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <glib.h>
+
+#include "reload.h"
+#include "jpmidi.h"
+#include "jackclient.h"
+#include "commands.h"
+#include "except.h"
+#include "main.h"
+#include "midi.h"
+#include "reclaim.h"
+
+/* Quiet time after the last change before the file is read. */
+#define RELOAD_SETTLE_MSECS 150
+
+typedef struct reload_load
+{
+    jpmidi_root_t* old;
+    jpmidi_root_t* root;
+} reload_load_t;
+
+static int watch_fd = -1;
+static int watch_wd = -1;
+static int wake_fd = -1;
+static char* watch_name = NULL;
+static pthread_t thread;
+static int running = 0;
+
+/* File to watch from now on, see reload_watch(), and whether the
+ * thread is to stop.  Both are guarded by watch_lock.
+ */
+static char* next_name = NULL;
+static int stopping = 0;
+static pthread_mutex_t watch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** except_catch() function reading the new version of the file. */
+static void reload_load( void* arg)
+{
+    reload_load_t* load = (reload_load_t*)arg;
+    load->root = jpmidi_reload( load->old);
+}
+
+int reload_song()
+{
+    reload_load_t load = { main_get_jpmidi_root(), NULL };
+    struct except* e;
+    char message[256];
+    struct timespec start, end;
+    jpmidi_scene_t scene;
+
+    if (strcmp( load.old->filename, "-") == 0) {
+        cmd_error("Standard input cannot be reloaded\n");
+        return 1;
+    }
+
+    clock_gettime( CLOCK_MONOTONIC, &start);
+    e = except_catch( reload_load, &load, message, sizeof( message));
+    clock_gettime( CLOCK_MONOTONIC, &end);
+
+    if (e != NULL || load.root == NULL) {
+        cmd_error("Failed to reload %s: %s\n", load.old->filename, e ? message : "could not read file");
+        return 1;
+    }
+
+    if (main_is_jack_client()) {
+        switch (jackclient_switch_song( load.old, load.root)) {
+        case 0:
+            break;
+        case 2:
+            jpmidi_root_release( load.root, load.old);
+            cmd_error("The song changed while %s was read, not reloaded\n", load.old->filename);
+            return 1;
+        default:
+            jpmidi_root_release( load.root, load.old);
+            cmd_error("The process thread did not take the new version of %s, not reloaded\n", load.old->filename);
+            return 1;
+        }
+    }
+    else {
+        jpmidi_scene_get( load.old, &scene);
+        jpmidi_scene_set( load.root, &scene);
+        main_set_jpmidi_root( load.root);
+    }
+
+    // The lookahead worker and the publisher may still be reading it.
+    reclaim_synchronize();
+    jpmidi_root_release( load.old, load.root);
+
+    long msecs = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+    if (load.root->tracks)
+        cmd_printf("Reloaded %s, parsed %d of %u tracks in %ld ms\n", load.root->filename,
+                   load.root->tracks->parsed, load.root->tracks->chunks->len, msecs);
+    else
+        cmd_printf("Reloaded %s in %ld ms\n", load.root->filename, msecs);
+    return 0;
+}
+
+/* Returns 1 if the inotify events in buf name the watched file. */
+static int reload_names_file( const char* buf, ssize_t len)
+{
+    const struct inotify_event* event;
+    ssize_t pos;
+
+    for (pos = 0; pos < len; pos += sizeof(*event) + event->len) {
+        event = (const struct inotify_event*)(buf + pos);
+        if (event->wd == watch_wd && event->len > 0 && strcmp( event->name, watch_name) == 0) return 1;
+    }
+    return 0;
+}
+
+/* Watch the directory of filename instead of the one watched so far.
+ * Returns non-zero on failure, the old watch is kept then.
+ */
+static int reload_add_watch( const char* filename)
+{
+    gchar* dir = g_path_get_dirname( filename);
+    int wd = inotify_add_watch( watch_fd, dir, IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE);
+
+    if (wd < 0) {
+        fprintf( stderr, "reload: cannot watch %s: %s\n", dir, strerror( errno));
+        g_free( dir);
+        return 1;
+    }
+    g_free( dir);
+
+    // Another file in the same directory keeps the same watch.
+    if (watch_wd >= 0 && watch_wd != wd) inotify_rm_watch( watch_fd, watch_wd);
+    watch_wd = wd;
+    g_free( watch_name);
+    watch_name = g_path_get_basename( filename);
+    return 0;
+}
+
+/* Act on reload_watch() or reload_stop().  Returns 1 to stop. */
+static int reload_woken()
+{
+    uint64_t count;
+    char* filename;
+    int stop;
+
+    if (read( wake_fd, &count, sizeof(count)) < 0 && errno != EINTR && errno != EAGAIN)
+        perror( "reload: read");
+
+    pthread_mutex_lock( &watch_lock);
+    stop = stopping;
+    filename = next_name;
+    next_name = NULL;
+    pthread_mutex_unlock( &watch_lock);
+
+    if (filename != NULL) {
+        if (!stop && reload_add_watch( filename) == 0) printf("Watching %s for changes\n", filename);
+        g_free( filename);
+    }
+    return stop;
+}
+
+static void* reload_main( void* arg)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd fds[2];
+    int changed = 0;
+
+    fds[0].fd = watch_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = wake_fd;
+    fds[1].events = POLLIN;
+
+    for (;;) {
+        // While a change is settling, time out once the file is quiet.
+        int ready = poll( fds, 2, changed ? RELOAD_SETTLE_MSECS : -1);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            perror( "reload: poll");
+            break;
+        }
+        if (fds[1].revents) {
+            if (reload_woken()) break;   // reload_stop()
+            changed = 0;
+            continue;
+        }
+
+        if (ready == 0) {
+            char line[] = "reload";
+            changed = 0;
+            execute_command( line);
+            continue;
+        }
+
+        ssize_t len = read( watch_fd, buf, sizeof(buf));
+        if (len < 0) {
+            if (errno != EINTR && errno != EAGAIN) perror( "reload: read");
+            continue;
+        }
+        if (reload_names_file( buf, len)) changed = 1;
+    }
+    return NULL;
+}
+
+int reload_start( const char* filename)
+{
+    if (strcmp( filename, "-") == 0) {
+        fprintf( stderr, "reload: cannot watch standard input\n");
+        return 1;
+    }
+
+    watch_fd = inotify_init1( IN_CLOEXEC);
+    if (watch_fd < 0) {
+        perror( "reload: inotify_init1");
+        return 1;
+    }
+
+    if (reload_add_watch( filename)) {
+        close( watch_fd);
+        return 1;
+    }
+
+    stopping = 0;
+    wake_fd = eventfd( 0, 0);
+    if (wake_fd < 0 || pthread_create( &thread, NULL, reload_main, NULL)) {
+        fprintf( stderr, "cannot start reload thread\n");
+        if (wake_fd >= 0) close( wake_fd);
+        close( watch_fd);
+        g_free( watch_name);
+        watch_name = NULL;
+        watch_wd = -1;
+        return 1;
+    }
+
+    running = 1;
+    printf("Watching %s for changes\n", filename);
+    return 0;
+}
+
+void reload_stop()
+{
+    uint64_t one = 1;
+
+    if (!running) return;
+    pthread_mutex_lock( &watch_lock);
+    stopping = 1;
+    pthread_mutex_unlock( &watch_lock);
+    if (write( wake_fd, &one, sizeof(one)) < 0) perror( "reload: write");
+    pthread_join( thread, NULL);
+    close( wake_fd);
+    close( watch_fd);
+    g_free( watch_name);
+    g_free( next_name);
+    watch_name = next_name = NULL;
+    watch_wd = -1;
+    running = 0;
+}
+
+void reload_watch( const char* filename)
+{
+    uint64_t one = 1;
+
+    if (!running || strcmp( filename, "-") == 0) return;
+
+    pthread_mutex_lock( &watch_lock);
+    g_free( next_name);
+    next_name = g_strdup( filename);
+    pthread_mutex_unlock( &watch_lock);
+    if (write( wake_fd, &one, sizeof(one)) < 0) perror( "reload: write");
+}
@@ -0,0 +1,53 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+
+#ifndef __reload_h__
+#define __reload_h__
+
+/* Definitions generated by autotools. */
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Load the file of the playing song again and switch to the new
+ * version at a cycle boundary, keeping the transport position and the
+ * scene.  Only the tracks whose bytes changed are parsed.  Reports
+ * through the command output, so it runs as (or within) a command.
+ * Returns 0 on success.
+ */
+int reload_song();
+
+/** Watch filename and run the 'reload' command whenever it has been
+ * written, in a thread of its own.  Returns non-zero on failure.
+ */
+int reload_start( const char* filename);
+
+/** Watch filename instead, when another song starts playing.  Does
+ * nothing unless reload_start() was called.
+ */
+void reload_watch( const char* filename);
+
+/** Stop watching, if started. */
+void reload_stop();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __reload_h__ */
@@ -0,0 +1,169 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+
+/* Named scenes: complete mute/solo/sysex/transpose states that are
+ * stored, recalled and applied as a unit.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "scene.h"
+#include "jackclient.h"
+#include "main.h"
+
+static GHashTable* scenes = NULL;   /* name -> jpmidi_scene_t* */
+
+/** Store a copy of scene under name. */
+void scene_store( const char* name, const jpmidi_scene_t* scene)
+{
+    jpmidi_scene_t* copy = g_new( jpmidi_scene_t, 1);
+    *copy = *scene;
+
+    if (scenes == NULL) scenes = g_hash_table_new_full( g_str_hash, g_str_equal, g_free, g_free);
+    g_hash_table_replace( scenes, g_strdup( name), copy);
+}
+
+/** Returns the scene stored under name, or NULL. */
+const jpmidi_scene_t* scene_lookup( const char* name)
+{
+    if (scenes == NULL) return NULL;
+    return g_hash_table_lookup( scenes, name);
+}
+
+/** Forget a stored scene. */
+int scene_delete( const char* name)
+{
+    if (scenes == NULL) return 1;
+    return !g_hash_table_remove( scenes, name);
+}
+
+static void scene_add_name( gpointer key, gpointer value, gpointer data)
+{
+    GList** names = (GList**)data;
+    *names = g_list_insert_sorted( *names, key, (GCompareFunc)strcmp);
+}
+
+/** Returns the names of the stored scenes, sorted. */
+GList* scene_names()
+{
+    GList* names = NULL;
+    if (scenes) g_hash_table_foreach( scenes, scene_add_name, &names);
+    return names;
+}
+
+/* Parse a channel number 1-16 at *p, advancing past it. */
+static int parse_channel( char** p)
+{
+    char* end;
+    long channel = strtol( *p, &end, 10);
+    if (end == *p || channel < 1 || channel > 16) return -1;
+    *p = end;
+    return (int)channel;
+}
+
+/** Change scene according to space separated settings. */
+int scene_parse( char* settings, jpmidi_scene_t* scene)
+{
+    char* saveptr = NULL;
+    char* setting;
+
+    for (setting = strtok_r( settings, " \t", &saveptr); setting; setting = strtok_r( NULL, " \t", &saveptr))
+    {
+        char* value = strchr( setting, '=');
+        char* end;
+        if (value == NULL) return 1;
+        *value++ = '\0';
+
+        if (strcmp( setting, "mute") == 0) {
+            int i;
+            for (i = 0; i < 16; i++) scene->muted[i] = 0;
+            if (strcmp( value, "none") == 0 || *value == '\0') continue;
+            for (;;) {
+                int channel = parse_channel( &value);
+                if (channel < 0) return 1;
+                scene->muted[channel-1] = 1;
+                if (*value == '\0') break;
+                if (*value++ != ',') return 1;
+            }
+        }
+        else if (strcmp( setting, "solo") == 0) {
+            long channel = strtol( value, &end, 10);
+            if (end == value || *end || channel < 0 || channel > 16) return 1;
+            scene->solo_channel = channel - 1;
+        }
+        else if (strcmp( setting, "sysex") == 0) {
+            long enable = strtol( value, &end, 10);
+            if (end == value || *end) return 1;
+            scene->send_sysex = enable != 0;
+        }
+        else if (strcmp( setting, "transpose") == 0) {
+            if (strchr( value, ':') == NULL) {
+                int i;
+                long semitones = strtol( value, &end, 10);
+                if (end == value || *end || semitones < -127 || semitones > 127) return 1;
+                for (i = 0; i < 16; i++) scene->transpose[i] = semitones;
+                continue;
+            }
+            for (;;) {
+                int channel = parse_channel( &value);
+                if (channel < 0 || *value++ != ':') return 1;
+                long semitones = strtol( value, &end, 10);
+                if (end == value || semitones < -127 || semitones > 127) return 1;
+                scene->transpose[channel-1] = semitones;
+                value = end;
+                if (*value == '\0') break;
+                if (*value++ != ',') return 1;
+            }
+        }
+        else return 1;
+    }
+    return 0;
+}
+
+/** Print a scene in the form scene_parse() reads. */
+void scene_print( FILE* out, const jpmidi_scene_t* scene)
+{
+    int i;
+    int first = 1;
+
+    fprintf( out, "mute=");
+    for (i = 0; i < 16; i++) {
+        if (!scene->muted[i]) continue;
+        fprintf( out, first ? "%d" : ",%d", i + 1);
+        first = 0;
+    }
+    if (first) fprintf( out, "none");
+
+    fprintf( out, " solo=%d sysex=%d transpose=", scene->solo_channel + 1, scene->send_sysex);
+    first = 1;
+    for (i = 0; i < 16; i++) {
+        if (scene->transpose[i] == 0) continue;
+        fprintf( out, first ? "%d:%d" : ",%d:%d", i + 1, scene->transpose[i]);
+        first = 0;
+    }
+    if (first) fprintf( out, "0");
+}
+
+/** Make scene the current state of the song. */
+int scene_apply( const jpmidi_scene_t* scene)
+{
+    if (main_is_jack_client()) return jackclient_apply_scene( scene);
+
+    jpmidi_scene_set( main_get_jpmidi_root(), scene);
+    return 0;
+}
@@ -0,0 +1,68 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+#ifndef __scene_h__
+#define __scene_h__
+
+/* Definitions generated by autotools. */
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include "jpmidi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Store a copy of scene under name, replacing any scene of that name. */
+void scene_store( const char* name, const jpmidi_scene_t* scene);
+
+/** Returns the scene stored under name, or NULL. */
+const jpmidi_scene_t* scene_lookup( const char* name);
+
+/** Forget a stored scene.  Returns 1 if there is none of that name. */
+int scene_delete( const char* name);
+
+/** Returns the names of the stored scenes, sorted.  Free the list with
+ * g_list_free(), not the names.
+ */
+GList* scene_names();
+
+/** Change scene according to space separated settings:
+ *
+ *   mute=<channel,...|none>     the channels muted, all others unmuted
+ *   solo=<channel|0>            0 for no solo
+ *   sysex=<0|1>
+ *   transpose=<semitones>       all channels
+ *   transpose=<channel>:<semitones>,...
+ *
+ * Returns 0 on success, 1 if a setting is invalid.
+ */
+int scene_parse( char* settings, jpmidi_scene_t* scene);
+
+/** Print a scene in the form scene_parse() reads. */
+void scene_print( FILE* out, const jpmidi_scene_t* scene);
+
+/** Make scene the current state of the song, atomically when playing
+ * through jack.  Returns 0 when it has been applied.
+ */
+int scene_apply( const jpmidi_scene_t* scene);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __scene_h__ */
@@ -0,0 +1,398 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+
+/* Setlist playback.  The songs are played in order from one jack
+ * client: the song that follows the playing one is loaded in a thread
+ * of its own while the other plays, and offered to the process thread
+ * with jackclient_set_next_song().  With auto advance the process
+ * thread starts it within the cycle the playing song ends in,
+ * otherwise it starts on 'setlist next'.  Either way only pointers
+ * change hands in the process thread.  The song replaced is freed
+ * here once the other threads have let go of it.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <glib.h>
+
+#include "setlist.h"
+#include "jpmidi.h"
+#include "jackclient.h"
+#include "commands.h"
+#include "except.h"
+#include "json.h"
+#include "main.h"
+#include "reclaim.h"
+#include "reload.h"
+
+/* How often the thread looks for a song to free or load when nothing
+ * wakes it.
+ */
+#define SETLIST_POLL_MSECS 50
+
+typedef struct setlist_load
+{
+    char* filename;
+    jpmidi_root_t* root;
+} setlist_load_t;
+
+/* The state below is guarded by lock.  The playing song is current,
+ * armed follows it, preload_index is the song offered to the process
+ * thread and failed_index an armed song that did not load, not tried
+ * again until another is armed.
+ */
+static GPtrArray* files = NULL;
+static int current = 0;
+static int armed = -1;
+static int preload_index = -1;
+static int failed_index = -1;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static jack_nframes_t sample_rate = 44100;
+static sem_t wakeup;
+static pthread_t thread;
+static int running = 0;
+
+/* Called with lock held: the song at index started playing. */
+static void setlist_playing( int index)
+{
+    current = index;
+    reload_watch( g_ptr_array_index( files, index));
+}
+
+/* Called with lock held: the process thread took the song offered. */
+static void setlist_taken()
+{
+    setlist_playing( preload_index);
+    preload_index = -1;
+    armed = current + 1 < files->len ? current + 1 : -1;
+    failed_index = -1;
+}
+
+/* Called with lock held: offer root, the song at index, or withdraw
+ * the offer with NULL.
+ */
+static void setlist_offer( jpmidi_root_t* root, int index)
+{
+    jpmidi_root_t* old = jackclient_set_next_song( root);
+
+    if (old != NULL) jpmidi_root_free( old);
+    else if (preload_index >= 0) setlist_playing( preload_index);   // taken meanwhile
+    preload_index = root ? index : -1;
+}
+
+/** except_catch() function loading a song. */
+static void setlist_load( void* arg)
+{
+    setlist_load_t* load = (setlist_load_t*)arg;
+    load->root = jpmidi_loadfile( load->filename, sample_rate);
+}
+
+/* Load a song, NULL with the reason in message if it fails. */
+static jpmidi_root_t* setlist_load_song( const char* filename, char* message, int size)
+{
+    setlist_load_t load = { g_strdup( filename), NULL };
+    struct except* e = except_catch( setlist_load, &load, message, size);
+
+    g_free( load.filename);
+    if (e != NULL) return NULL;
+    if (load.root == NULL) g_strlcpy( message, "could not read file", size);
+    return load.root;
+}
+
+void setlist_add( const char* filename)
+{
+    pthread_mutex_lock( &lock);
+    if (files == NULL) files = g_ptr_array_new();
+    g_ptr_array_add( files, g_strdup( filename));
+    if (armed < 0 && current + 1 == files->len - 1) armed = current + 1;
+    pthread_mutex_unlock( &lock);
+    if (running) sem_post( &wakeup);
+}
+
+int setlist_read( const char* filename)
+{
+    gchar* contents;
+    gchar** lines;
+    gchar* dir;
+    int i;
+
+    if (!g_file_get_contents( filename, &contents, NULL, NULL)) return 1;
+
+    dir = g_path_get_dirname( filename);
+    lines = g_strsplit( contents, "\n", 0);
+    for (i = 0; lines[i]; i++) {
+        gchar* line = g_strstrip( lines[i]);
+        if (*line == '\0' || *line == '#') continue;
+        if (g_path_is_absolute( line)) setlist_add( line);
+        else {
+            gchar* path = g_build_filename( dir, line, NULL);
+            setlist_add( path);
+            g_free( path);
+        }
+    }
+    g_strfreev( lines);
+    g_free( dir);
+    g_free( contents);
+    return 0;
+}
+
+int setlist_count()
+{
+    int count;
+
+    pthread_mutex_lock( &lock);
+    count = files ? files->len : 0;
+    pthread_mutex_unlock( &lock);
+    return count;
+}
+
+const char* setlist_get( int index)
+{
+    const char* filename = NULL;
+
+    pthread_mutex_lock( &lock);
+    if (files && index >= 0 && index < files->len) filename = g_ptr_array_index( files, index);
+    pthread_mutex_unlock( &lock);
+    return filename;
+}
+
+/** execute_locked() function freeing a replaced song. */
+static void setlist_free_song( void* root)
+{
+    jpmidi_root_free( (jpmidi_root_t*)root);
+}
+
+/* Free the song the process thread replaced, if any, once the other
+ * threads reading songs have let go of it.  Commands may be using it,
+ * so it is freed while none runs.
+ */
+static void setlist_collect()
+{
+    jpmidi_root_t* old = jackclient_take_finished_song();
+
+    if (old == NULL) return;
+
+    pthread_mutex_lock( &lock);
+    if (jackclient_get_next_song() == NULL && preload_index >= 0) setlist_taken();
+    pthread_mutex_unlock( &lock);
+
+    reclaim_synchronize();
+    execute_locked( setlist_free_song, old);
+}
+
+/* Load the armed song, unless it is loaded already. */
+static void setlist_preload()
+{
+    jpmidi_root_t* root;
+    char message[256];
+    char* filename;
+    int index;
+
+    pthread_mutex_lock( &lock);
+    index = armed;
+    if (index < 0 || index == preload_index || index == failed_index) {
+        pthread_mutex_unlock( &lock);
+        return;
+    }
+    filename = g_strdup( g_ptr_array_index( files, index));
+    pthread_mutex_unlock( &lock);
+
+    root = setlist_load_song( filename, message, sizeof( message));
+
+    pthread_mutex_lock( &lock);
+    if (root == NULL) {
+        if (armed == index) failed_index = index;
+        fprintf( stderr, "setlist: cannot load %s: %s\n", filename, message);
+    }
+    else if (armed == index && preload_index != index) setlist_offer( root, index);
+    else jpmidi_root_free( root);
+    pthread_mutex_unlock( &lock);
+
+    g_free( filename);
+}
+
+static void* setlist_main( void* arg)
+{
+    struct timespec ts;
+
+    while (__atomic_load_n( &running, __ATOMIC_ACQUIRE))
+    {
+        clock_gettime( CLOCK_REALTIME, &ts);
+        ts.tv_nsec += SETLIST_POLL_MSECS * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec += 1;
+            ts.tv_nsec -= 1000000000L;
+        }
+        while (sem_timedwait( &wakeup, &ts) == -1 && errno == EINTR)
+            ;
+        if (!__atomic_load_n( &running, __ATOMIC_ACQUIRE)) break;
+
+        setlist_collect();
+        setlist_preload();
+    }
+    return NULL;
+}
+
+int setlist_start( jack_nframes_t rate)
+{
+    sample_rate = rate;
+    sem_init( &wakeup, 0, 0);
+    __atomic_store_n( &running, 1, __ATOMIC_RELEASE);
+    if (pthread_create( &thread, NULL, setlist_main, NULL)) {
+        fprintf( stderr, "cannot start setlist thread\n");
+        running = 0;
+        sem_destroy( &wakeup);
+        return 1;
+    }
+    return 0;
+}
+
+void setlist_stop()
+{
+    jpmidi_root_t* root;
+
+    if (!running) return;
+    __atomic_store_n( &running, 0, __ATOMIC_RELEASE);
+    sem_post( &wakeup);
+    pthread_join( thread, NULL);
+    sem_destroy( &wakeup);
+
+    if ((root = jackclient_set_next_song( NULL)) != NULL) jpmidi_root_free( root);
+}
+
+int setlist_next()
+{
+    int index;
+
+    pthread_mutex_lock( &lock);
+    index = armed;
+    pthread_mutex_unlock( &lock);
+
+    if (index < 0) {
+        cmd_error("No next song\n");
+        return 1;
+    }
+    return setlist_goto( index);
+}
+
+int setlist_goto( int index)
+{
+    jpmidi_root_t* root = NULL;
+    char message[256];
+    char* filename;
+    int ready;
+
+    pthread_mutex_lock( &lock);
+    if (files == NULL || index < 0 || index >= files->len) {
+        pthread_mutex_unlock( &lock);
+        cmd_error("No song %d in the setlist\n", index + 1);
+        return 1;
+    }
+    armed = index;
+    failed_index = -1;
+    ready = preload_index == index;
+    filename = g_strdup( g_ptr_array_index( files, index));
+    pthread_mutex_unlock( &lock);
+
+    // Not loaded ahead, load it now.
+    if (!ready) {
+        root = setlist_load_song( filename, message, sizeof( message));
+        if (root == NULL) {
+            cmd_error("Failed to load %s: %s\n", filename, message);
+            g_free( filename);
+            return 1;
+        }
+        pthread_mutex_lock( &lock);
+        if (preload_index == index) jpmidi_root_free( root);   // loaded ahead meanwhile
+        else setlist_offer( root, index);
+        pthread_mutex_unlock( &lock);
+    }
+
+    if (main_is_jack_client()) {
+        if (jackclient_advance()) {
+            cmd_error("%s not started, the song before is still being freed or jack is not running\n", filename);
+            g_free( filename);
+            return 1;
+        }
+    }
+    else {
+        jpmidi_root_t* old = main_get_jpmidi_root();
+        root = jackclient_set_next_song( NULL);
+        jpmidi_transform_replace( root, &old->transform);
+        main_set_jpmidi_root( root);
+        reclaim_synchronize();
+        jpmidi_root_free( old);
+    }
+
+    pthread_mutex_lock( &lock);
+    if (jackclient_get_next_song() == NULL && preload_index >= 0) setlist_taken();
+    pthread_mutex_unlock( &lock);
+    if (running) sem_post( &wakeup);
+
+    cmd_printf("Playing %d: %s\n", index + 1, filename);
+    g_free( filename);
+    return 0;
+}
+
+int setlist_arm( int index)
+{
+    pthread_mutex_lock( &lock);
+    if (files == NULL || index < 0 || index >= files->len) {
+        pthread_mutex_unlock( &lock);
+        return 1;
+    }
+    armed = index;
+    failed_index = -1;
+    if (preload_index != index) setlist_offer( NULL, -1);
+    pthread_mutex_unlock( &lock);
+
+    if (running) sem_post( &wakeup);
+    return 0;
+}
+
+void setlist_set_auto( int enabled)
+{
+    jackclient_set_auto_advance( enabled);
+}
+
+void setlist_print()
+{
+    GString* json = g_string_new( "{\"songs\":[");
+    int i;
+
+    pthread_mutex_lock( &lock);
+    for (i = 0; files && i < files->len; i++) {
+        const char* filename = g_ptr_array_index( files, i);
+        cmd_printf("%c%3d  %s%s\n", i == current ? '>' : i == armed ? '*' : ' ', i + 1, filename,
+                   i == armed && i == preload_index ? "  (loaded)" :
+                   i == armed && i == failed_index ? "  (failed to load)" : "");
+        if (i > 0) g_string_append_c( json, ',');
+        json_append_string( json, filename);
+    }
+    g_string_append_printf( json, "],\"current\":%d,\"next\":%d,\"loaded\":%s,\"auto\":%s}",
+                            current + 1, armed + 1, armed >= 0 && armed == preload_index ? "true" : "false",
+                            jackclient_get_auto_advance() ? "true" : "false");
+    pthread_mutex_unlock( &lock);
+
+    cmd_printf("Auto advance %s\n", jackclient_get_auto_advance() ? "on" : "off");
+    cmd_data( "%s", json->str);
+    g_string_free( json, TRUE);
+}
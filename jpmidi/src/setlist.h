@@ -0,0 +1,83 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+
+#ifndef __setlist_h__
+#define __setlist_h__
+
+/* Definitions generated by autotools. */
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <jack/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Add a file to the end of the setlist.  The first file added is the
+ * one playing when jpmidi starts.
+ */
+void setlist_add( const char* filename);
+
+/** Add the files named in a list file, one per line.  Blank lines and
+ * lines starting with # are skipped, relative paths are taken from the
+ * directory of the list.  Returns non-zero if it cannot be read.
+ */
+int setlist_read( const char* filename);
+
+/** Returns the number of songs in the setlist. */
+int setlist_count();
+
+/** Returns the path of a song (0 based), NULL if there is none. */
+const char* setlist_get( int index);
+
+/** Start the thread loading the song that follows ahead of time, at
+ * the given sample rate.  Returns non-zero on failure.
+ */
+int setlist_start( jack_nframes_t sample_rate);
+
+/** Stop the loading thread, if started. */
+void setlist_stop();
+
+/** Start the next song now, at a cycle boundary.  Reports through the
+ * command output.  Returns 0 on success.
+ */
+int setlist_next();
+
+/** Start a song (0 based) now, loading it first if it is not the one
+ * loaded ahead.  Reports through the command output.  Returns 0 on
+ * success.
+ */
+int setlist_goto( int index);
+
+/** Make a song (0 based) the one that follows the playing one.
+ * Returns non-zero if there is no such song.
+ */
+int setlist_arm( int index);
+
+/** When enabled the next song starts when the playing one ends. */
+void setlist_set_auto( int enabled);
+
+/** Print the setlist to the command output, with the playing and the
+ * next song marked.
+ */
+void setlist_print();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __setlist_h__ */
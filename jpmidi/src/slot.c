@@ -0,0 +1,231 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+
+/* Songs played next to the main one from the same jack client.  Each
+ * slot has its own song, with its own mute/solo state, its own output
+ * port and an offset on the transport.  The process thread renders
+ * them after the main song with a plain cursor per slot; they follow
+ * the transport but not the lookahead worker, scheduled commands or
+ * the setlist, which belong to the main song.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <jack/midiport.h>
+#include <glib.h>
+
+#include "slot.h"
+#include "jackclient.h"
+#include "commands.h"
+#include "except.h"
+#include "main.h"
+#include "reclaim.h"
+
+typedef struct slot_load
+{
+    char* filename;
+    jack_nframes_t sample_rate;
+    jpmidi_root_t* root;
+} slot_load_t;
+
+/* Slot n is slots[n - 2].  Only commands change the table, the process
+ * thread reads it.
+ */
+static slot_t* slots[SLOT_MAX];
+
+/** except_catch() function loading a slot's song. */
+static void slot_load_song( void* arg)
+{
+    slot_load_t* load = (slot_load_t*)arg;
+    load->root = jpmidi_loadfile( load->filename, load->sample_rate);
+}
+
+int slot_load( const char* filename, int64_t offset)
+{
+    slot_load_t load = { g_strdup( filename), main_get_jpmidi_root()->sample_rate, NULL };
+    char message[256];
+    char name[32];
+    struct except* e;
+    slot_t* slot;
+    int i;
+
+    if (!main_is_jack_client()) {
+        cmd_error("Slots need the jack client\n");
+        g_free( load.filename);
+        return 0;
+    }
+    for (i = 0; i < SLOT_MAX && slots[i]; i++)
+        ;
+    if (i == SLOT_MAX) {
+        cmd_error("All %d slots are in use\n", SLOT_MAX);
+        g_free( load.filename);
+        return 0;
+    }
+
+    e = except_catch( slot_load_song, &load, message, sizeof( message));
+    g_free( load.filename);
+    if (e != NULL || load.root == NULL) {
+        cmd_error("Failed to load %s: %s\n", filename, e ? message : "could not read file");
+        return 0;
+    }
+
+    snprintf( name, sizeof( name), "slot-%d", i + 2);
+    slot = g_new0( slot_t, 1);
+    slot->root = load.root;
+    slot->offset = offset;
+    slot->expected = INT64_MIN;
+    slot->port = jack_port_register( jackclient_get_client(), name, JACK_DEFAULT_MIDI_TYPE, JackPortIsOutput, 0);
+    if (slot->port == NULL) {
+        cmd_error("Failed to create port %s\n", name);
+        jpmidi_root_free( slot->root);
+        g_free( slot);
+        return 0;
+    }
+
+    __atomic_store_n( &slots[i], slot, __ATOMIC_RELEASE);
+    return i + 2;
+}
+
+int slot_unload( int number)
+{
+    slot_t* slot = slot_get( number);
+
+    if (slot == NULL) return 1;
+
+    // Once the process thread has been through a cycle without it the
+    // port and the song are no longer used.
+    __atomic_store_n( &slots[number - 2], NULL, __ATOMIC_RELEASE);
+    reclaim_synchronize();
+
+    jack_port_unregister( jackclient_get_client(), slot->port);
+    jpmidi_root_free( slot->root);
+    g_free( slot);
+    return 0;
+}
+
+slot_t* slot_get( int number)
+{
+    if (number < 2 || number >= SLOT_MAX + 2) return NULL;
+    return __atomic_load_n( &slots[number - 2], __ATOMIC_ACQUIRE);
+}
+
+void slot_set_offset( slot_t* slot, int64_t offset)
+{
+    __atomic_store_n( &slot->offset, offset, __ATOMIC_RELAXED);
+}
+
+int slot_set_mute( slot_t* slot, int channel, int mute)
+{
+    uint32_t silenced = 0;
+    int i;
+
+    if (mute >= 0) {
+        if (channel < 1 || channel > 16) return 1;
+        if (mute) jpmidi_mute_channel( slot->root, channel);
+        else jpmidi_unmute_channel( slot->root, channel);
+        if (mute) silenced = 1u << jpmidi_channel_get_output( slot->root, channel - 1);
+    }
+    else {
+        if (jpmidi_solo_channel( slot->root, channel)) return 1;
+        for (i = 0; channel > 0 && i < 16; i++)
+            if (i != channel - 1) silenced |= 1u << jpmidi_channel_get_output( slot->root, i);
+    }
+
+    __atomic_fetch_or( &slot->release, silenced, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Point a slot's cursor at the first time record at or after frame. */
+static void slot_seek( slot_t* slot, jpmidi_frame_t frame)
+{
+    slot->current_time = jpmidi_lookup_entrypoint( slot->root, frame);
+    while (slot->current_time && jpmidi_time_get_frame( slot->current_time) < frame)
+        slot->current_time = jpmidi_time_get_next( slot->current_time);
+}
+
+/* Write a message to a slot's port, counting it if the buffer is full. */
+static void slot_write( slot_t* slot, void* port_buf, jack_nframes_t time_in_cycle, unsigned char* data, int len)
+{
+    if (jack_midi_event_write( port_buf, time_in_cycle, data, len) == 0) return;
+
+    __atomic_store_n( &slot->dropped, slot->dropped + 1, __ATOMIC_RELAXED);
+    jackclient_count_dropped( 1);
+}
+
+/* Render one slot for a cycle. */
+static void slot_render( slot_t* slot, jack_nframes_t nframes, jack_transport_state_t state, int64_t transport_frame,
+                         int64_t compensation)
+{
+    void* port_buf = jack_port_get_buffer( slot->port, nframes);
+    uint32_t release = __atomic_exchange_n( &slot->release, 0, __ATOMIC_ACQUIRE);
+    int channel, i;
+
+    jack_midi_clear_buffer( port_buf);
+
+    if (slot->rolling && state != JackTransportRolling) release = 0xFFFF;
+    slot->rolling = (state == JackTransportRolling);
+
+    for (channel = 0; channel < 16; channel++) {
+        unsigned char sound_off[3] = { 0xB0 | channel, 120, 0 };
+        if (release & (1u << channel)) slot_write( slot, port_buf, 0, sound_off, 3);
+    }
+
+    if (!slot->rolling) return;
+
+    // Song frames of this slot played in this cycle.
+    int64_t window_start = transport_frame - __atomic_load_n( &slot->offset, __ATOMIC_RELAXED) + compensation;
+    int64_t window_end = window_start + nframes;
+
+    if (window_start != slot->expected) slot_seek( slot, window_start > 0 ? (jpmidi_frame_t)window_start : 0);
+    slot->expected = window_end;
+
+    while (slot->current_time && (int64_t)jpmidi_time_get_frame( slot->current_time) < window_end)
+    {
+        int64_t frame = jpmidi_time_get_frame( slot->current_time);
+        jack_nframes_t time_in_cycle = frame > window_start ? frame - window_start : 0;
+
+        for (i = 0; i < jpmidi_time_get_event_count( slot->current_time); i++)
+        {
+            jpmidi_event_t* event = jpmidi_time_get_event( slot->current_time, i);
+
+            if (!jpmidi_event_should_send( slot->root, event)) continue;
+
+            int len = jpmidi_event_get_data_length( event);
+            unsigned char* data = jpmidi_event_get_data( event);
+            unsigned char message[3];
+            if (len <= 3) {
+                memcpy( message, data, len);
+                if (!jpmidi_message_transform( slot->root, message, len)) continue;
+                data = message;
+            }
+            slot_write( slot, port_buf, time_in_cycle, data, len);
+        }
+        slot->current_time = jpmidi_time_get_next( slot->current_time);
+    }
+}
+
+void slot_process( jack_nframes_t nframes, jack_transport_state_t state, int64_t transport_frame,
+                   int64_t compensation, const transform_table_t* transform)
+{
+    int i;
+
+    for (i = 0; i < SLOT_MAX; i++) {
+        slot_t* slot = __atomic_load_n( &slots[i], __ATOMIC_ACQUIRE);
+        if (slot == NULL) continue;
+        if (transform) jpmidi_transform_replace( slot->root, transform);
+        slot_render( slot, nframes, state, transport_frame, compensation);
+    }
+}
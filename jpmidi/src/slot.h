@@ -0,0 +1,89 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+
+#ifndef __slot_h__
+#define __slot_h__
+
+/* Definitions generated by autotools. */
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <jack/jack.h>
+#include <jack/types.h>
+
+#include "jpmidi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Most songs played next to the main one. */
+#define SLOT_MAX 15
+
+/** A song played next to the main one, on an output port of its own.
+ *  Slots are numbered from 2, the main song is slot 1.
+ */
+typedef struct slot
+{
+    jpmidi_root_t* root;            /**< The song, with its own mute/solo/sysex/transpose. */
+    jack_port_t* port;              /**< Output port, jpmidi:slot-<n>. */
+    int64_t offset;                 /**< Transport frame the song starts at. */
+    uint32_t release;               /**< Channels to send all sound off on, one bit each. */
+    uint64_t dropped;               /**< Events lost to a full port buffer. */
+
+    // Process thread only.
+    jpmidi_time_t* current_time;    /**< Next time record to play. */
+    int64_t expected;               /**< Song frame the next cycle starts at unless something jumps. */
+    int rolling;                    /**< The transport rolled in the previous cycle. */
+} slot_t;
+
+/** Load a file into a new slot starting at transport frame offset and
+ *  register its output port.  Returns the slot number (2 and up), or 0
+ *  after reporting the error through the command output.
+ */
+int slot_load( const char* filename, int64_t offset);
+
+/** Stop playing a slot and free it.  Returns non-zero if there is no
+ *  such slot.
+ */
+int slot_unload( int number);
+
+/** Returns a slot (2 and up), NULL if it is not loaded. */
+slot_t* slot_get( int number);
+
+/** Change the transport frame a slot's song starts at. */
+void slot_set_offset( slot_t* slot, int64_t offset);
+
+/** Mute (1) or unmute (0) a channel (1-16) of a slot, or solo it with
+ *  mute -1 (channel 0 ends solo).  Notes sounding on the channels that
+ *  fall silent are released in the next cycle.  Returns non-zero for
+ *  an invalid channel.
+ */
+int slot_set_mute( slot_t* slot, int channel, int mute);
+
+/** Render the events of every slot for one cycle.  Called from the
+ *  process thread with the extended transport frame of the cycle, the
+ *  latency compensation and the transforms replaced in this cycle, if
+ *  any.
+ */
+void slot_process( jack_nframes_t nframes, jack_transport_state_t state, int64_t transport_frame,
+                   int64_t compensation, const transform_table_t* transform);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __slot_h__ */
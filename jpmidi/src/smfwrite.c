@@ -0,0 +1,260 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+
+/* Standard MIDI file writer.  Each track is encoded into memory with
+ * running status, then the header and all tracks go out in one
+ * vectored write.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "smfwrite.h"
+#include "midi.h"
+
+#define SMF_TRACKS 18               /* tempo track, 16 channels, sysex */
+#define SMF_SYSEX_TRACK 17
+
+/** A track being encoded. */
+typedef struct smf_track
+{
+    GByteArray* data;
+    uint32_t tick;                  ///< Time of the last event written.
+    unsigned char status;           ///< Running status, 0 if there is none.
+    unsigned char header[8];        ///< "MTrk" and the length.
+} smf_track_t;
+
+/** Position in the tempo, time signature and text lists. */
+typedef struct smf_conductor
+{
+    guint tempo;
+    guint meter;
+    guint text;
+} smf_conductor_t;
+
+static void smf_put_var( GByteArray* data, uint32_t value)
+{
+    unsigned char bytes[5];
+    int n = 0;
+
+    bytes[n++] = value & 0x7F;
+    while (value >>= 7) bytes[n++] = 0x80 | (value & 0x7F);
+    while (n--) g_byte_array_append( data, &bytes[n], 1);
+}
+
+static void smf_put_be( unsigned char* p, uint32_t value, int bytes)
+{
+    while (bytes--) p[bytes] = value & 0xFF, value >>= 8;
+}
+
+static void smf_delta( smf_track_t* track, uint32_t tick)
+{
+    smf_put_var( track->data, tick - track->tick);
+    track->tick = tick;
+}
+
+static void smf_meta( smf_track_t* track, uint32_t tick, unsigned char type, const unsigned char* data, int len)
+{
+    unsigned char prefix[2] = { 0xFF, type };
+
+    smf_delta( track, tick);
+    g_byte_array_append( track->data, prefix, 2);
+    smf_put_var( track->data, len);
+    g_byte_array_append( track->data, data, len);
+    // Meta events and sysex cancel running status.
+    track->status = 0;
+}
+
+static void smf_message( smf_track_t* track, uint32_t tick, const unsigned char* data, int len)
+{
+    smf_delta( track, tick);
+
+    if (data[0] == 0xF0) {
+        g_byte_array_append( track->data, data, 1);
+        smf_put_var( track->data, len - 1);
+        g_byte_array_append( track->data, data + 1, len - 1);
+        track->status = 0;
+        return;
+    }
+
+    if (data[0] != track->status) g_byte_array_append( track->data, data, 1);
+    track->status = data[0];
+    g_byte_array_append( track->data, data + 1, len - 1);
+}
+
+/* Write the tempo changes, time signatures and texts due up to and
+ * including tick into track.
+ */
+static void smf_conductor( jpmidi_root_t* root, smf_track_t* track, smf_conductor_t* pos, uint32_t tick)
+{
+    unsigned char buf[4];
+
+    for (;;)
+    {
+        uint32_t next = UINT32_MAX;
+        int which = -1;
+
+        if (pos->tempo < root->tempos->len &&
+            g_array_index( root->tempos, jpmidi_tempo_t, pos->tempo).smf_time < next) {
+            next = g_array_index( root->tempos, jpmidi_tempo_t, pos->tempo).smf_time;
+            which = 0;
+        }
+        if (pos->meter < root->meters->len &&
+            g_array_index( root->meters, jpmidi_meter_t, pos->meter).smf_time < next) {
+            next = g_array_index( root->meters, jpmidi_meter_t, pos->meter).smf_time;
+            which = 1;
+        }
+        if (pos->text < root->texts->len &&
+            g_array_index( root->texts, jpmidi_text_t, pos->text).smf_time < next) {
+            next = g_array_index( root->texts, jpmidi_text_t, pos->text).smf_time;
+            which = 2;
+        }
+        if (which < 0 || next > tick) return;
+
+        if (which == 0) {
+            jpmidi_tempo_t* tempo = &g_array_index( root->tempos, jpmidi_tempo_t, pos->tempo++);
+            smf_put_be( buf, tempo->tempo_mpq, 3);
+            smf_meta( track, next, MIDI_META_TEMPO, buf, 3);
+        }
+        else if (which == 1) {
+            jpmidi_meter_t* meter = &g_array_index( root->meters, jpmidi_meter_t, pos->meter++);
+            int power = 0;
+            while ((1 << power) < meter->denominator) power++;
+            buf[0] = meter->numerator;
+            buf[1] = power;
+            buf[2] = 24;        // MIDI clocks per metronome click
+            buf[3] = 8;         // 32nd notes per quarter note
+            smf_meta( track, next, MIDI_META_TIME, buf, 4);
+        }
+        else {
+            jpmidi_text_t* text = &g_array_index( root->texts, jpmidi_text_t, pos->text++);
+            smf_meta( track, next, text->type, (unsigned char*)text->text, strlen( text->text));
+        }
+    }
+}
+
+static void smf_track_end( smf_track_t* track)
+{
+    smf_meta( track, track->tick, MIDI_META_EOT, NULL, 0);
+    memcpy( track->header, "MTrk", 4);
+    smf_put_be( track->header + 4, track->data->len, 4);
+}
+
+/* Write all of the vectors to fd. */
+static int smf_writev( int fd, struct iovec* iov, int count)
+{
+    while (count > 0)
+    {
+        ssize_t n = writev( fd, iov, count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return 1;
+        }
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+int smfwrite_song( jpmidi_root_t* root, const char* filename, int format)
+{
+    smf_track_t tracks[SMF_TRACKS];
+    smf_conductor_t conductor = { 0, 0, 0 };
+    struct iovec iov[1 + 2 * SMF_TRACKS];
+    unsigned char header[14];
+    jpmidi_time_t* time;
+    int i, count, fd, result;
+
+    if (format != 0 && format != 1) {
+        errno = EINVAL;
+        return 1;
+    }
+
+    memset( tracks, 0, sizeof(tracks));
+    tracks[0].data = g_byte_array_new();
+
+    for (time = jpmidi_get_time_head( root); time; time = jpmidi_time_get_next( time))
+    {
+        uint32_t tick = jpmidi_time_get_smf_time( time);
+
+        if (jpmidi_time_get_event_count( time) == 0) continue;
+        if (format == 0) smf_conductor( root, &tracks[0], &conductor, tick);
+
+        for (i = 0; i < jpmidi_time_get_event_count( time); i++)
+        {
+            jpmidi_event_t* event = jpmidi_time_get_event( time, i);
+            int len = jpmidi_event_get_data_length( event);
+            unsigned char* data = jpmidi_event_get_data( event);
+            unsigned char message[3];
+            smf_track_t* track;
+
+            // The song as it is heard now.
+            if (len == 0 || !jpmidi_event_should_send( root, event)) continue;
+            if (len <= 3) {
+                memcpy( message, data, len);
+                if (!jpmidi_message_transform( root, message, len)) continue;
+                data = message;
+            }
+
+            if (format == 0) track = &tracks[0];
+            else if (data[0] == 0xF0) track = &tracks[SMF_SYSEX_TRACK];
+            else track = &tracks[1 + (data[0] & 0x0F)];
+            if (track->data == NULL) track->data = g_byte_array_new();
+
+            smf_message( track, tick, data, len);
+        }
+    }
+    smf_conductor( root, &tracks[0], &conductor, UINT32_MAX);
+
+    // Header, then each track that has data.
+    count = 0;
+    iov[count].iov_base = header;
+    iov[count++].iov_len = sizeof(header);
+    for (i = 0; i < SMF_TRACKS; i++) {
+        if (tracks[i].data == NULL) continue;
+        smf_track_end( &tracks[i]);
+        iov[count].iov_base = tracks[i].header;
+        iov[count++].iov_len = sizeof(tracks[i].header);
+        iov[count].iov_base = tracks[i].data->data;
+        iov[count++].iov_len = tracks[i].data->len;
+    }
+
+    memcpy( header, "MThd", 4);
+    smf_put_be( header + 4, 6, 4);
+    smf_put_be( header + 8, format, 2);
+    smf_put_be( header + 10, (count - 1) / 2, 2);
+    smf_put_be( header + 12, jpmidi_get_smf_timebase( root), 2);
+
+    result = 1;
+    if ((fd = open( filename, O_WRONLY | O_CREAT | O_TRUNC, 0644)) >= 0) {
+        result = smf_writev( fd, iov, count);
+        if (close( fd)) result = 1;
+    }
+
+    for (i = 0; i < SMF_TRACKS; i++)
+        if (tracks[i].data) g_byte_array_free( tracks[i].data, TRUE);
+    return result;
+}
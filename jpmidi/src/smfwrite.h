@@ -0,0 +1,42 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+#ifndef __smfwrite_h__
+#define __smfwrite_h__
+
+/* Definitions generated by autotools. */
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include "jpmidi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Write the song as a standard MIDI file of format 0 (a single track)
+ * or 1 (a tempo track, then a track per channel and one for sysex).
+ * Events go through the current mute/solo/sysex filters and transpose
+ * just as they are played.  Tempo and time signature changes, markers
+ * and texts are kept.  Returns 0 on success, 1 with errno set
+ * otherwise.
+ */
+int smfwrite_song( jpmidi_root_t* root, const char* filename, int format);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __smfwrite_h__ */
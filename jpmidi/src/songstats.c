@@ -0,0 +1,257 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+
+/* Song statistics.  The loader collects them in one pass over the
+ * events so commands can report them without walking the song.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "songstats.h"
+
+/* JACK MIDI port buffers are as large as the audio buffers of the
+ * same period.  Each event takes a header in the buffer, data beyond a
+ * few bytes is stored separately.
+ */
+#define PORT_BUFFER_BYTES_PER_FRAME 4
+#define PORT_BUFFER_HEADER 32
+#define PORT_EVENT_HEADER 12
+
+static const char* type_names[8] = {
+    "note_off", "note_on", "key_pressure", "controller",
+    "program", "channel_pressure", "pitch_wheel", "system"
+};
+
+int songstats_period_frames( int i)
+{
+    return 64 << i;
+}
+
+void songstats_collect( jpmidi_root_t* root)
+{
+    jpmidi_stats_t* stats = &root->stats;
+    jpmidi_time_t* time;
+    jpmidi_frame_t period_index[JPMIDI_STATS_PERIODS];
+    uint32_t period_count[JPMIDI_STATS_PERIODS];
+    int i, p;
+
+    memset( stats, 0, sizeof(*stats));
+    stats->note_low = stats->note_high = -1;
+    for (i = 0; i < 16; i++) stats->channel_note_low[i] = stats->channel_note_high[i] = -1;
+    for (p = 0; p < JPMIDI_STATS_PERIODS; p++) period_index[p] = period_count[p] = 0;
+
+    for (time = jpmidi_get_time_head( root); time; time = jpmidi_time_get_next( time))
+    {
+        int count = jpmidi_time_get_event_count( time);
+        jpmidi_frame_t frame = jpmidi_time_get_frame( time);
+
+        if (count == 0) continue;
+        stats->time_records++;
+        stats->events += count;
+        stats->duration_ticks = jpmidi_time_get_smf_time( time);
+        stats->duration_frames = frame;
+
+        // Events due in the same period, counting periods from frame 0.
+        for (p = 0; p < JPMIDI_STATS_PERIODS; p++) {
+            jpmidi_frame_t index = frame / songstats_period_frames( p);
+            if (index != period_index[p]) {
+                period_index[p] = index;
+                period_count[p] = 0;
+            }
+            period_count[p] += count;
+            if (period_count[p] > stats->peak_events[p]) stats->peak_events[p] = period_count[p];
+        }
+
+        for (i = 0; i < count; i++)
+        {
+            jpmidi_event_t* event = jpmidi_time_get_event( time, i);
+            int len = jpmidi_event_get_data_length( event);
+            unsigned char* data = jpmidi_event_get_data( event);
+            unsigned char status = jpmidi_event_get_status( event);
+            int port = event->port;
+
+            stats->bytes += len;
+            stats->type_events[(status >> 4) - 8]++;
+            stats->port_events[port < JPMIDI_STATS_PORTS ? port : JPMIDI_STATS_PORTS - 1]++;
+
+            if (status == 0xF0) {
+                stats->sysex_bytes += len;
+                continue;
+            }
+
+            int channel = jpmidi_event_get_channel( event);
+            stats->channel_events[channel]++;
+
+            if (status == 0x90 && len >= 3 && data[2] > 0) {
+                int note = data[1];
+                if (stats->note_low < 0 || note < stats->note_low) stats->note_low = note;
+                if (note > stats->note_high) stats->note_high = note;
+                if (stats->channel_note_low[channel] < 0 || note < stats->channel_note_low[channel])
+                    stats->channel_note_low[channel] = note;
+                if (note > stats->channel_note_high[channel]) stats->channel_note_high[channel] = note;
+            }
+        }
+    }
+
+    for (i = 0; i < (int)root->tempos->len; i++) {
+        double bpm = 60000000.0 / g_array_index( root->tempos, jpmidi_tempo_t, i).tempo_mpq;
+        if (i == 0 || bpm < stats->tempo_min) stats->tempo_min = bpm;
+        if (i == 0 || bpm > stats->tempo_max) stats->tempo_max = bpm;
+    }
+    stats->tempo_changes = root->tempos->len > 0 ? root->tempos->len - 1 : 0;
+    stats->meter_changes = root->meters->len > 0 ? root->meters->len - 1 : 0;
+    stats->texts = root->texts->len;
+    stats->markers = root->markers->len;
+}
+
+void songstats_print( FILE* out, const jpmidi_root_t* root, const char* indent)
+{
+    const jpmidi_stats_t* stats = &root->stats;
+    int i;
+
+    fprintf( out, "%s%u events, %u time records, %llu bytes (%llu sysex)\n", indent,
+             stats->events, stats->time_records,
+             (unsigned long long)stats->bytes, (unsigned long long)stats->sysex_bytes);
+    fprintf( out, "%sduration: %u ticks, %llu frames, %.3f seconds\n", indent,
+             stats->duration_ticks, (unsigned long long)stats->duration_frames,
+             root->sample_rate ? (double)stats->duration_frames / root->sample_rate : 0.0);
+    fprintf( out, "%stempo: %.2f-%.2f bpm, %u tempo changes, %u time signature changes\n", indent,
+             stats->tempo_min, stats->tempo_max, stats->tempo_changes, stats->meter_changes);
+    fprintf( out, "%snotes: ", indent);
+    if (stats->note_low < 0) fprintf( out, "none\n");
+    else fprintf( out, "%d-%d\n", stats->note_low, stats->note_high);
+
+    fprintf( out, "%sevent types:", indent);
+    for (i = 0; i < 8; i++)
+        if (stats->type_events[i]) fprintf( out, " %s %u", type_names[i], stats->type_events[i]);
+    fprintf( out, "\n");
+
+    fprintf( out, "%sports:", indent);
+    for (i = 0; i < JPMIDI_STATS_PORTS; i++)
+        if (stats->port_events[i]) fprintf( out, " %d: %u", i, stats->port_events[i]);
+    fprintf( out, "\n");
+
+    fprintf( out, "%speak events per period:", indent);
+    for (i = 0; i < JPMIDI_STATS_PERIODS; i++)
+        fprintf( out, " %d: %u", songstats_period_frames( i), stats->peak_events[i]);
+    fprintf( out, "\n");
+
+    fprintf( out, "%s%u texts, %u markers\n", indent, stats->texts, stats->markers);
+}
+
+void songstats_json( GString* json, const jpmidi_root_t* root)
+{
+    const jpmidi_stats_t* stats = &root->stats;
+    int i;
+
+    g_string_append_printf( json, "{\"events\":%u,\"time_records\":%u,\"bytes\":%llu,\"sysex_bytes\":%llu,"
+                            "\"duration_ticks\":%u,\"duration_frames\":%llu,\"sample_rate\":%u,\"time_base\":%u,"
+                            "\"tempo_min\":%.2f,\"tempo_max\":%.2f,\"tempo_changes\":%u,\"meter_changes\":%u,"
+                            "\"note_low\":%d,\"note_high\":%d,\"texts\":%u,\"markers\":%u",
+                            stats->events, stats->time_records,
+                            (unsigned long long)stats->bytes, (unsigned long long)stats->sysex_bytes,
+                            stats->duration_ticks, (unsigned long long)stats->duration_frames, root->sample_rate, root->time_base,
+                            stats->tempo_min, stats->tempo_max, stats->tempo_changes, stats->meter_changes,
+                            stats->note_low, stats->note_high, stats->texts, stats->markers);
+
+    g_string_append( json, ",\"types\":{");
+    for (i = 0; i < 8; i++)
+        g_string_append_printf( json, "%s\"%s\":%u", i ? "," : "", type_names[i], stats->type_events[i]);
+
+    g_string_append( json, "},\"channels\":[");
+    for (i = 0; i < 16; i++)
+        g_string_append_printf( json, "%s{\"channel\":%d,\"events\":%u,\"note_low\":%d,\"note_high\":%d}",
+                                i ? "," : "", i + 1, stats->channel_events[i],
+                                stats->channel_note_low[i], stats->channel_note_high[i]);
+
+    g_string_append( json, "],\"ports\":[");
+    for (i = 0; i < JPMIDI_STATS_PORTS; i++)
+        g_string_append_printf( json, "%s%u", i ? "," : "", stats->port_events[i]);
+
+    g_string_append( json, "],\"peak_events\":{");
+    for (i = 0; i < JPMIDI_STATS_PERIODS; i++)
+        g_string_append_printf( json, "%s\"%d\":%u", i ? "," : "", songstats_period_frames( i), stats->peak_events[i]);
+    g_string_append( json, "}}");
+}
+
+/* Buffer space needed by a window's events, counting a header and all
+ * of the data of each event.  The most events and the most bytes may
+ * fall in different windows, so this is an upper bound.
+ */
+static uint32_t songstats_buffer_need( uint32_t events, uint32_t bytes)
+{
+    return PORT_BUFFER_HEADER + events * PORT_EVENT_HEADER + bytes;
+}
+
+void songstats_analyze( jpmidi_root_t* root, songstats_window_t* windows)
+{
+    jpmidi_time_t* tail[SONGSTATS_WINDOWS];
+    uint32_t events[SONGSTATS_WINDOWS];
+    uint32_t bytes[SONGSTATS_WINDOWS];
+    jpmidi_time_t* head;
+    int w, i;
+
+    for (w = 0; w < SONGSTATS_WINDOWS; w++) {
+        memset( &windows[w], 0, sizeof(windows[w]));
+        windows[w].frames = 64 << w;
+        windows[w].buffer_size = windows[w].frames * PORT_BUFFER_BYTES_PER_FRAME;
+        tail[w] = jpmidi_get_time_head( root);
+        events[w] = bytes[w] = 0;
+    }
+
+    // Each window ends at the head record and starts at its tail, the
+    // first record less than a window's length before the head.  Heads
+    // and tails only move forward, so this is one pass per window size.
+    for (head = jpmidi_get_time_head( root); head; head = jpmidi_time_get_next( head))
+    {
+        int count = jpmidi_time_get_event_count( head);
+        jpmidi_frame_t frame = jpmidi_time_get_frame( head);
+        uint32_t head_bytes = 0;
+
+        if (count == 0) continue;
+        for (i = 0; i < count; i++)
+            head_bytes += jpmidi_event_get_data_length( jpmidi_time_get_event( head, i));
+
+        for (w = 0; w < SONGSTATS_WINDOWS; w++)
+        {
+            events[w] += count;
+            bytes[w] += head_bytes;
+
+            while (jpmidi_time_get_frame( tail[w]) + windows[w].frames <= frame) {
+                int n = jpmidi_time_get_event_count( tail[w]);
+                events[w] -= n;
+                for (i = 0; i < n; i++)
+                    bytes[w] -= jpmidi_event_get_data_length( jpmidi_time_get_event( tail[w], i));
+                tail[w] = jpmidi_time_get_next( tail[w]);
+            }
+
+            // Skip entry point records so the location is a real event.
+            while (jpmidi_time_get_event_count( tail[w]) == 0) tail[w] = jpmidi_time_get_next( tail[w]);
+
+            if (events[w] > windows[w].events) {
+                windows[w].events = events[w];
+                windows[w].events_at = jpmidi_time_get_frame( tail[w]);
+            }
+            if (bytes[w] > windows[w].bytes) {
+                windows[w].bytes = bytes[w];
+                windows[w].bytes_at = jpmidi_time_get_frame( tail[w]);
+            }
+        }
+    }
+
+    for (w = 0; w < SONGSTATS_WINDOWS; w++)
+        windows[w].buffer_need = windows[w].events ? songstats_buffer_need( windows[w].events, windows[w].bytes) : 0;
+}
@@ -0,0 +1,71 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+#ifndef __songstats_h__
+#define __songstats_h__
+
+/* Definitions generated by autotools. */
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <glib.h>
+#include "jpmidi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Fill in root->stats from the loaded song.  Called once by the
+ *  loader, after the time records are linked.
+ */
+void songstats_collect( jpmidi_root_t* root);
+
+/** Returns the number of frames in period i of the peak_events counts. */
+int songstats_period_frames( int i);
+
+/** Print the statistics as text, each line starting with indent. */
+void songstats_print( FILE* out, const jpmidi_root_t* root, const char* indent);
+
+/** Append the statistics to a JSON document as an object. */
+void songstats_json( GString* json, const jpmidi_root_t* root);
+
+#define SONGSTATS_WINDOWS 7         /**< Window sizes analysed, 64 to 4096 frames. */
+
+/** Worst case found by songstats_analyze() for one window size. */
+typedef struct songstats_window
+{
+    int frames;                     /**< Window size. */
+    uint32_t events;                /**< Most events due within any window of this size. */
+    jpmidi_frame_t events_at;       /**< Frame of the first of those events. */
+    uint32_t bytes;                 /**< Most MIDI bytes due within any window of this size. */
+    jpmidi_frame_t bytes_at;
+    uint32_t buffer_need;           /**< Estimated port buffer space for the worst window, in bytes. */
+    uint32_t buffer_size;           /**< Port buffer size for a period of this size, in bytes. */
+} songstats_window_t;
+
+/** Slide windows of 64 to 4096 frames over the song, in a single pass
+ *  over the time records, and find where the most events and bytes
+ *  fall within one window.  The windows start anywhere, not only on
+ *  period boundaries, so the results hold wherever the transport is
+ *  started.
+ */
+void songstats_analyze( jpmidi_root_t* root, songstats_window_t* windows);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __songstats_h__ */
@@ -22,235 +22,575 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
-#include <ctype.h> /* isalpla */
+#include <glib.h>
 #include "commands.h"
 #include "cmdline.h"
+#include "json.h"
+#include "publish.h"
 
 /* includes for server mode */
 #include <sys/types.h> 
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <unistd.h> /* close */
-#include <netdb.h> /* gethostbyname */
+#include <pthread.h>
  
 #define INVALID_SOCKET -1
 #define SOCKET_ERROR -1
 #define closesocket(s) close(s)
-#define CRLF		"\r\n"
-#define MAX_CLIENTS 	100
-#define BUF_SIZE	1024
+#define BACKLOG		128
+#define MAX_EVENTS	64
+#define BUF_SIZE	4096		/* read size and longest accepted command line */
+#define MAX_OUTPUT	(1024 * 1024)	/* a client further behind than this is dropped */
+#define MAX_ID		64		/* longest request ID */
+#define ID_CHARS	"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789._-"
 
 typedef int SOCKET;
 typedef struct sockaddr_in SOCKADDR_IN;
 typedef struct sockaddr SOCKADDR;
 typedef struct in_addr IN_ADDR;
+
+/* One connection.  Input is split into lines, output is queued until
+ * the socket can take it so a slow client never blocks the server.
+ */
 typedef struct
 {
    SOCKET sock;
-   char name[BUF_SIZE];
+   char name[INET_ADDRSTRLEN + 8];
+   GByteArray *in;		/* received bytes not yet forming a complete line */
+   GByteArray *out;		/* bytes waiting to be sent */
+   int discarding;		/* skipping the rest of an over long line */
+   uint32_t events;		/* epoll events currently registered */
+   int closing;			/* to be dropped at the end of the event batch */
+   int hangup;			/* close once the output is flushed */
+   int interval[PUBLISH_STREAMS];	/* subscriptions, in timer ticks, 0 if none */
+   int countdown[PUBLISH_STREAMS];	/* ticks until the next message is due */
+   uint32_t version[PUBLISH_STREAMS];	/* version of the last message sent */
 }Client;
 
-static void app(int tcp_port);
+static int epfd = INVALID_SOCKET;
+static SOCKET listen_sock = INVALID_SOCKET;
+static int wake_fd = INVALID_SOCKET;	/* eventfd, signalled by tcpserver_stop() */
+static int timer_fd = INVALID_SOCKET;	/* ticks for the subscriptions, armed while there are any */
+static int timer_armed = 0;
+static pthread_t server_thread;
+static int server_thread_running = 0;
+static GPtrArray *clients = NULL;	/* Client* */
+
+static void app(void);
 static int init_connection(int tcp_port);
 static void end_connection(int sock);
-static int read_client(SOCKET sock, char *buffer);
-static void write_client(SOCKET sock, const char *buffer);
-static void send_message_to_all_clients(Client *clients, Client client, int actual, const char *buffer, char from_server);
-static void remove_client(Client *clients, int to_remove, int *actual);
-static void clear_clients(Client *clients, int actual);
-
-/**** do_command()
- There is a separate instance of this function for each client connection.
+static void close_wake_fd(void);
+static void accept_clients(SOCKET sock);
+static int read_client(Client *client);
+static int flush_client(Client *client);
+static void write_client(Client *client, const char *buffer);
+static void send_message_to_all_clients(const char *buffer);
+static void remove_client(Client *client);
+static void clear_clients(void);
+static int set_nonblocking(SOCKET sock);
+static void update_events(Client *client);
+static void remove_closing_clients(void);
+static void update_timer(void);
+static void publish_to_clients(void);
+
+/**** cleanup_string()
+ Replace control characters with spaces and strip the line.
+ Everything printable, including punctuation used by command
+ arguments, is kept.
  ****************/
 void cleanup_string(char *buffer)
 {
    char *cmd;
-   int len = strlen(buffer);
-
-   if (len > 0) {
-	int cur = 0;
-	while(cur <= len) {
-		if(isalnum(buffer[cur])==0) {
-			/*replace non alphanumeric character with space*/
-			buffer[cur] = ' ';
-		}
-		cur++;
-	}
-	buffer[len+1]='\0';
+   char *p;
+
+   for(p = buffer; *p; p++)
+   {
+      if((unsigned char)*p < ' ' || *p == 0x7f)
+      {
+         *p = ' ';
+      }
    }
 
    /* Remove leading and trailing whitespace from the line. */
    cmd = stripwhite(buffer);
-   strcpy(buffer,cmd);
+   memmove(buffer, cmd, strlen(cmd) + 1);
 }
 
-unsigned char do_command (char *buffer)
+/* Queue one reply line:
+ {"id":<id>,"ok":<bool>,"output":"<text>","data":<json>}
+ id is null when the request had none, data is left out when the
+ command did not produce any. */
+static void send_reply(Client *client, const char *id, int ok, const char *output, const char *data)
 {
+   GString *json = g_string_sized_new(128);
+   const char *p;
+
+   g_string_append(json, "{\"id\":");
+   if(id == NULL)
+      g_string_append(json, "null");
+   else
+   {
+      /* numeric IDs are echoed as numbers, as long as they are valid
+       JSON numbers: not empty and no leading zero */
+      for(p = id; *p >= '0' && *p <= '9'; p++);
+      if(*p == '\0' && p > id && p - id < 16 && (id[0] != '0' || id[1] == '\0'))
+         g_string_append(json, id);
+      else
+         json_append_string(json, id);
+   }
+   g_string_append(json, ok ? ",\"ok\":true,\"output\":" : ",\"ok\":false,\"output\":");
+   json_append_string(json, output ? output : "");
+   if(data)
+   {
+      g_string_append(json, ",\"data\":");
+      g_string_append(json, data);
+   }
+   g_string_append(json, "}\n");
+
+   write_client(client, json->str);
+   g_string_free(json, TRUE);
+}
+
+/**** subscribe()
+ "subscribe <stream> [rate]": push the stream to this client rate
+ times a second, 10 by default.  Position and notes are only sent when
+ they change, texts whenever one is passed.
+ ****************/
+static void subscribe(Client *client, const char *id, char *arg)
+{
+   char name[32];
+   int rate = 10;
+   int stream;
+
+   if(sscanf(arg, "%31s %d", name, &rate) < 1 || (stream = publish_stream_by_name(name)) < 0 || rate < 1)
+   {
+      send_reply(client, id, 0, "Usage: subscribe <position | notes | text | meters> [rate]\n", NULL);
+      return;
+   }
+   if(rate > PUBLISH_TICK_HZ) rate = PUBLISH_TICK_HZ;
+
+   client->interval[stream] = PUBLISH_TICK_HZ / rate;
+   client->countdown[stream] = 1;
+   client->version[stream] = 0;
+   update_timer();
+   send_reply(client, id, 1, "", NULL);
+}
+
+/**** unsubscribe()
+ "unsubscribe [stream]": stop pushing the stream, or all of them.
+ ****************/
+static void unsubscribe(Client *client, const char *id, char *arg)
+{
+   int stream;
+
+   if(*arg == '\0')
+   {
+      for(stream = 0; stream < PUBLISH_STREAMS; stream++)
+         client->interval[stream] = 0;
+   }
+   else if((stream = publish_stream_by_name(arg)) >= 0)
+   {
+      client->interval[stream] = 0;
+   }
+   else
+   {
+      send_reply(client, id, 0, "Usage: unsubscribe [position | notes | text | meters]\n", NULL);
+      return;
+   }
+   update_timer();
+   send_reply(client, id, 1, "", NULL);
+}
+
+/**** do_command()
+ Execute one complete request line received from a client and queue
+ its reply.  A request may start with an ID, "#<id> <command>", which
+ is echoed in the reply so a client can send many requests without
+ waiting and still match every reply to its request.  Replies are sent
+ in the order requests arrive.
+ Returns 1 if the server should shut down.
+ ****************/
+unsigned char do_command (Client *client, char *buffer)
+{
+   char *id = NULL;
 
    cleanup_string(buffer);
-   /* If anything left, add to history and execute it. */
-   if (*buffer) {
-	/* execute command */
-	printf("Received command: -- %s --\n",buffer);
-	if(strcmp(buffer,"shutdown")==0) {
-		return 1;
-	}
-	else {
-		execute_command(buffer);
+
+   if (*buffer == '#') {
+	/* request ID, letters, digits, '.', '-' and '_' only */
+	id = buffer + 1;
+	buffer = id + strcspn(id, " \t");
+	if (*buffer) *buffer++ = '\0';
+	buffer = stripwhite(buffer);
+	if (*id == '\0' || strlen(id) > MAX_ID || id[strspn(id, ID_CHARS)] != '\0') {
+		send_reply(client, NULL, 0, "Invalid request ID\n", NULL);
+		return 0;
 	}
    }
+
+   /* Empty requests still get their reply. */
+   if (*buffer == '\0') {
+	send_reply(client, id, 1, "", NULL);
+	return 0;
+   }
+
+   /* execute command */
+   printf("Received command from %s: -- %s --\n", client->name, buffer);
+   if(strncmp(buffer,"subscribe",9)==0 && (buffer[9]==' ' || buffer[9]=='\0')) {
+	subscribe(client, id, stripwhite(buffer + 9));
+	return 0;
+   }
+   if(strncmp(buffer,"unsubscribe",11)==0 && (buffer[11]==' ' || buffer[11]=='\0')) {
+	unsubscribe(client, id, stripwhite(buffer + 11));
+	return 0;
+   }
+   if(strcmp(buffer,"shutdown")==0) {
+	send_reply(client, id, 1, "jpmidi server shutdown\n", NULL);
+	return 1;
+   }
+
+   command_result_t result;
+   if(execute_command_captured(buffer, &result)) {
+	/* exit or quit ends this connection, not the program */
+	client->hangup = 1;
+   }
+   send_reply(client, id, result.ok, result.output, result.data);
+   command_result_free(&result);
+
    return 0;
 }
 
-void send_ack(int sock)
+/* The wake eventfd outlives the server loop, so tcpserver_stop() can
+ signal it until the thread has been joined. */
+static void close_wake_fd(void)
+{
+   if(wake_fd == INVALID_SOCKET) return;
+   closesocket(wake_fd);
+   wake_fd = INVALID_SOCKET;
+}
+
+static void* server_main(void* arg)
+{
+  app();
+  /* a client asked for a shutdown, take the console down with us */
+  cmdline_quit();
+  return NULL;
+}
+
+int tcpserver_start(int tcp_port)
+{
+  init_connection(tcp_port);
+  if (pthread_create(&server_thread, NULL, server_main, NULL)) {
+    perror("pthread_create()");
+    end_connection(listen_sock);
+    close_wake_fd();
+    return 1;
+  }
+  server_thread_running = 1;
+  return 0;
+}
+
+void tcpserver_wait()
 {
-  /* send ack */
-   if ( (write(sock,"ack",3)) < 0) perror("ERROR writing to socket");
+  if (!server_thread_running) return;
+  pthread_join(server_thread, NULL);
+  server_thread_running = 0;
+  close_wake_fd();
 }
 
-void tcpserver(int tcp_port)
+void tcpserver_stop()
 {
-  app(tcp_port);
+  uint64_t one = 1;
+  if (!server_thread_running) return;
+  /* the thread may have ended already, after a client asked for a shutdown */
+  if (wake_fd != INVALID_SOCKET && write(wake_fd, &one, sizeof one) < 0) perror("write()");
+  tcpserver_wait();
 }
 
 /*------------------------------------------*/
 
-static void app(int tcp_port)
+static void app(void)
 {
-   SOCKET sock = init_connection(tcp_port);
-   char buffer[BUF_SIZE];
-   /* the index for the array */
-   int actual = 0;
-   int max = sock;
-   /* an array for all clients */
-   Client clients[MAX_CLIENTS];
-   Client client;
-   
+   SOCKET sock = listen_sock;
+   struct epoll_event events[MAX_EVENTS];
    unsigned char running = 1; // server needs to run until exit
 
-   fd_set rdfs;
+   clients = g_ptr_array_new();
 
    while(running)
    {
-      int i = 0;
-      FD_ZERO(&rdfs);
-
-      /* add the connection socket */
-      FD_SET(sock, &rdfs);
-
-      /* add socket of each client */
-      for(i = 0; i < actual; i++)
-      {
-         FD_SET(clients[i].sock, &rdfs);
-      }
-
-      if(select(max + 1, &rdfs, NULL, NULL, NULL) == -1)
+      int i;
+      int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+      if(n == -1)
       {
-         perror("select()");
+         if(errno == EINTR) continue;
+         perror("epoll_wait()");
          exit(errno);
       }
 
-      if(FD_ISSET(sock, &rdfs))
+      for(i = 0; i < n && running; i++)
       {
-         /* new client */
-         SOCKADDR_IN csin = { 0 };
-         socklen_t sinsize = sizeof csin;
-         int csock = accept(sock, (SOCKADDR *)&csin, &sinsize);
-         if(csock == SOCKET_ERROR)
+         if(events[i].data.ptr == &wake_fd)
          {
-            perror("accept()");
+            /* tcpserver_stop() */
+            running = 0;
+            break;
+         }
+
+         if(events[i].data.ptr == &timer_fd)
+         {
+            uint64_t expirations;
+            if(read(timer_fd, &expirations, sizeof expirations) == sizeof expirations)
+               publish_to_clients();
             continue;
          }
 
-	      printf("New client connection on socket %d \n",csock);
+         if(events[i].data.ptr == NULL)
+         {
+            /* new clients on the listening socket */
+            accept_clients(sock);
+            continue;
+         }
 
-         /* what is the new maximum fd ? */
-         max = csock > max ? csock : max;
+         Client *client = events[i].data.ptr;
 
-         FD_SET(csock, &rdfs);
+         if(events[i].events & (EPOLLERR | EPOLLHUP))
+         {
+            client->closing = 1;
+            continue;
+         }
 
-         Client c = { csock };
-         strncpy(c.name, buffer, BUF_SIZE - 1);
-         clients[actual] = c;
-         actual++;
-      }
-      else
-      {
-         int i = 0;
-         for(i = 0; i < actual; i++)
+         if(events[i].events & EPOLLOUT)
          {
-            /* a client is talking */
-            if(FD_ISSET(clients[i].sock, &rdfs))
+            flush_client(client);
+         }
+
+         if(!client->closing && (events[i].events & EPOLLIN))
+         {
+            int status = read_client(client);
+            if(status < 0)
             {
-               client = clients[i];
-               int c = read_client(clients[i].sock, buffer);
-               if(c == 0)
-               {
-                  /* client disconnected */
-                  closesocket(clients[i].sock);
-                  remove_client(clients, i, &actual);
-                  // strncpy(buffer, client.name, BUF_SIZE - 1);
-                  strncat(buffer, "\n client disconnected !\n", BUF_SIZE - strlen(buffer) - 1);
-                  printf("%s",buffer);
-                  strcpy(buffer,"");
-               }
-               else
-               {
-                  /* DOSTUFF*/
-		             printf("received buffer: %s \n",buffer);
-		             if(do_command((char*)&buffer))
-			            running=0;
-               }
-               break;
+               /* client disconnected */
+               printf("Client %s disconnected\n", client->name);
+               client->closing = 1;
+            }
+            else if(status > 0)
+            {
+               running = 0;
             }
          }
       }
+
+      remove_closing_clients();
+      update_timer();
    }
 
-   send_message_to_all_clients(clients, client, actual, "jpmidi server shutdown", 0);
+   send_message_to_all_clients("{\"event\":\"shutdown\"}\n");
    printf("jpmidi server shutdown\n");
-   clear_clients(clients, actual);
+   clear_clients();
    end_connection(sock);
 }
 
-static void clear_clients(Client *clients, int actual)
+/* Accept every pending connection on the listening socket. */
+static void accept_clients(SOCKET sock)
+{
+   for(;;)
+   {
+      SOCKADDR_IN csin = { 0 };
+      socklen_t sinsize = sizeof csin;
+      SOCKET csock = accept(sock, (SOCKADDR *)&csin, &sinsize);
+      if(csock == SOCKET_ERROR)
+      {
+         if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            perror("accept()");
+         return;
+      }
+
+      if(set_nonblocking(csock))
+      {
+         closesocket(csock);
+         continue;
+      }
+
+      int one = 1;
+      setsockopt(csock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+      Client *c = g_new0(Client, 1);
+      c->sock = csock;
+      c->in = g_byte_array_new();
+      c->out = g_byte_array_new();
+      c->events = EPOLLIN;
+      char addr[INET_ADDRSTRLEN] = "?";
+      inet_ntop(AF_INET, &csin.sin_addr, addr, sizeof addr);
+      snprintf(c->name, sizeof c->name, "%s:%d", addr, ntohs(csin.sin_port));
+
+      struct epoll_event ev = { 0 };
+      ev.events = EPOLLIN;
+      ev.data.ptr = c;
+      if(epoll_ctl(epfd, EPOLL_CTL_ADD, csock, &ev) == -1)
+      {
+         perror("epoll_ctl()");
+         closesocket(csock);
+         g_byte_array_free(c->in, TRUE);
+         g_byte_array_free(c->out, TRUE);
+         g_free(c);
+         continue;
+      }
+
+      g_ptr_array_add(clients, c);
+      printf("New client connection from %s on socket %d\n", c->name, csock);
+   }
+}
+
+static void clear_clients(void)
 {
-   int i = 0;
-   for(i = 0; i < actual; i++)
+   while(clients->len > 0)
    {
-      closesocket(clients[i].sock);
+      Client *c = g_ptr_array_index(clients, clients->len - 1);
+      flush_client(c);
+      remove_client(c);
    }
+   g_ptr_array_free(clients, TRUE);
+   clients = NULL;
    printf("Clients list cleared\n");
 }
 
-static void remove_client(Client *clients, int to_remove, int *actual)
+static void remove_client(Client *client)
+{
+   epoll_ctl(epfd, EPOLL_CTL_DEL, client->sock, NULL);
+   closesocket(client->sock);
+
+   guint i;
+   for(i = 0; i < clients->len; i++)
+   {
+      if(g_ptr_array_index(clients, i) == client)
+      {
+         g_ptr_array_remove_index_fast(clients, i);
+         break;
+      }
+   }
+
+   g_byte_array_free(client->in, TRUE);
+   g_byte_array_free(client->out, TRUE);
+   g_free(client);
+}
+
+/* Clients are only freed here, after a whole batch of events has been
+ handled, so no event still refers to them. */
+static void remove_closing_clients(void)
 {
-   /* we remove the client in the array */
-   memmove(clients + to_remove, clients + to_remove + 1, (*actual - to_remove - 1) * sizeof(Client));
-   /* number client - 1 */
-   (*actual)--;
+   guint i = 0;
+   while(i < clients->len)
+   {
+      Client *c = g_ptr_array_index(clients, i);
+      if(c->closing)
+      {
+         remove_client(c);
+      }
+      else
+      {
+         i++;
+      }
+   }
 }
 
-static void send_message_to_all_clients(Client *clients, Client sender, int actual, const char *buffer, char from_server)
+/* Run the subscription timer only while someone is subscribed. */
+static void update_timer(void)
 {
-   int i = 0;
-   char message[BUF_SIZE];
-   message[0] = 0;
-   for(i = 0; i < actual; i++)
+   guint i;
+   int stream;
+   int wanted = 0;
+
+   for(i = 0; i < clients->len && !wanted; i++)
+   {
+      Client *c = g_ptr_array_index(clients, i);
+      for(stream = 0; stream < PUBLISH_STREAMS; stream++)
+         if(c->interval[stream] && !c->closing) wanted = 1;
+   }
+   if(wanted == timer_armed) return;
+
+   struct itimerspec spec = { { 0, 0 }, { 0, 0 } };
+   if(wanted)
+   {
+      spec.it_interval.tv_nsec = 1000000000 / PUBLISH_TICK_HZ;
+      spec.it_value = spec.it_interval;
+   }
+   if(timerfd_settime(timer_fd, 0, &spec, NULL) == -1)
+   {
+      perror("timerfd_settime()");
+      return;
+   }
+   timer_armed = wanted;
+}
+
+/* One timer tick: take a snapshot and send every subscriber the
+ messages that are due.  Each message is encoded once and the same
+ bytes are queued for all clients. */
+static void publish_to_clients(void)
+{
+   int wanted[PUBLISH_STREAMS] = { 0 };
+   guint i;
+   int stream;
+
+   for(i = 0; i < clients->len; i++)
+   {
+      Client *c = g_ptr_array_index(clients, i);
+      for(stream = 0; stream < PUBLISH_STREAMS; stream++)
+         if(c->interval[stream]) wanted[stream] = 1;
+   }
+
+   publish_tick(wanted);
+
+   for(i = 0; i < clients->len; i++)
    {
-      /* we don't send message to the sender */
-      if(sender.sock != clients[i].sock)
+      Client *c = g_ptr_array_index(clients, i);
+      for(stream = 0; stream < PUBLISH_STREAMS; stream++)
       {
-         if(from_server == 0)
-         {
-            strncpy(message, sender.name, BUF_SIZE - 1);
-            strncat(message, " : ", sizeof message - strlen(message) - 1);
-         }
-         strncat(message, buffer, sizeof message - strlen(message) - 1);
-         write_client(clients[i].sock, message);
+         uint32_t version;
+         const char *message;
+
+         if(c->interval[stream] == 0 || c->closing) continue;
+
+         /* texts are not rate limited, a batch is only there for one tick */
+         if(stream != PUBLISH_TEXT && --c->countdown[stream] > 0) continue;
+         c->countdown[stream] = c->interval[stream];
+
+         message = publish_get(stream, &version);
+         if(message == NULL) continue;
+         if(version == c->version[stream]) continue;
+
+         c->version[stream] = version;
+         write_client(c, message);
       }
    }
+
+   publish_end_tick();
+}
+
+static void send_message_to_all_clients(const char *buffer)
+{
+   guint i;
+   for(i = 0; i < clients->len; i++)
+   {
+      write_client(g_ptr_array_index(clients, i), buffer);
+   }
+}
+
+static int set_nonblocking(SOCKET sock)
+{
+   int flags = fcntl(sock, F_GETFL, 0);
+   if(flags == -1 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) == -1)
+   {
+      perror("fcntl()");
+      return 1;
+   }
+   return 0;
 }
 
 static int init_connection(int tcp_port)
@@ -264,6 +604,9 @@ static int init_connection(int tcp_port)
       exit(errno);
    }
 
+   int one = 1;
+   setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+
    sin.sin_addr.s_addr = htonl(INADDR_ANY);
    sin.sin_port = htons(tcp_port);
    sin.sin_family = AF_INET;
@@ -274,12 +617,63 @@ static int init_connection(int tcp_port)
       exit(errno);
    }
 
-   if(listen(sock, MAX_CLIENTS) == SOCKET_ERROR)
+   if(listen(sock, BACKLOG) == SOCKET_ERROR)
    {
       perror("listen()");
       exit(errno);
    }
 
+   if(set_nonblocking(sock))
+   {
+      exit(errno);
+   }
+
+   epfd = epoll_create1(0);
+   if(epfd == -1)
+   {
+      perror("epoll_create1()");
+      exit(errno);
+   }
+
+   /* the listening socket is the only one with a NULL pointer */
+   struct epoll_event ev = { 0 };
+   ev.events = EPOLLIN;
+   ev.data.ptr = NULL;
+   if(epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &ev) == -1)
+   {
+      perror("epoll_ctl()");
+      exit(errno);
+   }
+
+   wake_fd = eventfd(0, EFD_NONBLOCK);
+   if(wake_fd == -1)
+   {
+      perror("eventfd()");
+      exit(errno);
+   }
+   ev.events = EPOLLIN;
+   ev.data.ptr = &wake_fd;
+   if(epoll_ctl(epfd, EPOLL_CTL_ADD, wake_fd, &ev) == -1)
+   {
+      perror("epoll_ctl()");
+      exit(errno);
+   }
+
+   timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+   if(timer_fd == -1)
+   {
+      perror("timerfd_create()");
+      exit(errno);
+   }
+   ev.events = EPOLLIN;
+   ev.data.ptr = &timer_fd;
+   if(epoll_ctl(epfd, EPOLL_CTL_ADD, timer_fd, &ev) == -1)
+   {
+      perror("epoll_ctl()");
+      exit(errno);
+   }
+
+   listen_sock = sock;
    printf("Server listening on port %d\n",tcp_port);
 
    return sock;
@@ -288,30 +682,139 @@ static int init_connection(int tcp_port)
 static void end_connection(int sock)
 {
    closesocket(sock);
+   closesocket(epfd);
+   closesocket(timer_fd);
+   epfd = INVALID_SOCKET;
+   timer_fd = INVALID_SOCKET;
+   timer_armed = 0;
+   listen_sock = INVALID_SOCKET;
    printf("Socket %d closed\n",sock);
 }
 
-static int read_client(SOCKET sock, char *buffer)
+/* Read everything available and run each complete line as a command.
+ Returns -1 if the client went away, 1 if it asked for a shutdown,
+ 0 otherwise. */
+static int read_client(Client *client)
 {
-   int n = 0;
+   char buffer[BUF_SIZE];
 
-   if((n = recv(sock, buffer, BUF_SIZE - 1, 0)) < 0)
+   for(;;)
    {
-      perror("recv()");
-      /* if recv error we disonnect the client */
-      n = 0;
+      ssize_t n = recv(client->sock, buffer, sizeof buffer, 0);
+      if(n == 0)
+         return -1;
+      if(n < 0)
+      {
+         if(errno == EINTR) continue;
+         if(errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+         perror("recv()");
+         /* if recv error we disonnect the client */
+         return -1;
+      }
+
+      ssize_t start = 0;
+      ssize_t i;
+      for(i = 0; i < n; i++)
+      {
+         if(buffer[i] != '\n') continue;
+
+         if(client->discarding)
+         {
+            client->discarding = 0;
+         }
+         else if(client->in->len + (i - start) > BUF_SIZE)
+         {
+            /* the tail of earlier reads and this chunk make it too long */
+            fprintf(stderr, "Command line from %s too long, discarded\n", client->name);
+            g_byte_array_set_size(client->in, 0);
+         }
+         else
+         {
+            /* complete line, partial data from earlier reads first */
+            g_byte_array_append(client->in, (guint8 *)buffer + start, i - start);
+            g_byte_array_append(client->in, (guint8 *)"", 1);
+            char *line = g_strdup((char *)client->in->data);
+            g_byte_array_set_size(client->in, 0);
+
+            int shutdown = do_command(client, line);
+            g_free(line);
+            if(shutdown) return 1;
+            /* nothing after exit or quit is run */
+            if(client->hangup) return 0;
+         }
+         start = i + 1;
+      }
+
+      /* keep the unterminated tail for the next read */
+      if(!client->discarding && start < n)
+      {
+         if(client->in->len + (n - start) > BUF_SIZE)
+         {
+            fprintf(stderr, "Command line from %s too long, discarded\n", client->name);
+            g_byte_array_set_size(client->in, 0);
+            client->discarding = 1;
+         }
+         else
+            g_byte_array_append(client->in, (guint8 *)buffer + start, n - start);
+      }
+   }
+}
+
+/* Send as much queued output as the socket takes.  On error the client
+ is marked for closing and 1 is returned. */
+static int flush_client(Client *client)
+{
+   while(client->out->len > 0)
+   {
+      ssize_t n = send(client->sock, client->out->data, client->out->len, MSG_NOSIGNAL);
+      if(n < 0)
+      {
+         if(errno == EINTR) continue;
+         if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+         perror("send()");
+         client->closing = 1;
+         return 1;
+      }
+      g_byte_array_remove_range(client->out, 0, n);
    }
 
-   buffer[n] = 0;
+   if(client->hangup && client->out->len == 0)
+      client->closing = 1;
 
-   return n;
+   update_events(client);
+   return 0;
 }
 
-static void write_client(SOCKET sock, const char *buffer)
+/* Watch for writability only while there is output waiting. */
+static void update_events(Client *client)
 {
-   if(send(sock, buffer, strlen(buffer), 0) < 0)
+   /* no more requests are read from a client that is hanging up */
+   uint32_t events = (client->hangup ? 0 : EPOLLIN) | (client->out->len > 0 ? EPOLLOUT : 0);
+   if(events == client->events) return;
+
+   struct epoll_event ev = { 0 };
+   ev.events = events;
+   ev.data.ptr = client;
+   epoll_ctl(epfd, EPOLL_CTL_MOD, client->sock, &ev);
+   client->events = events;
+}
+
+static void write_client(Client *client, const char *buffer)
+{
+   if(client->closing)
+      return;
+
+   if(client->out->len + strlen(buffer) > MAX_OUTPUT)
    {
-      perror("send()");
-      exit(errno);
+      /* too far behind, drop it rather than buffer without limit */
+      fprintf(stderr, "Client %s is not reading, disconnecting\n", client->name);
+      client->closing = 1;
+      return;
+   }
+
+   g_byte_array_append(client->out, (const guint8 *)buffer, strlen(buffer));
+   if(!(client->events & EPOLLOUT))
+   {
+      flush_client(client);
    }
 }
@@ -27,7 +27,17 @@
 extern "C" {
 #endif
 
-void tcpserver(int tcp_port);
+/** Serve commands on tcp_port from a thread of its own, next to the
+ * interactive command line.  When a client sends "shutdown" the
+ * command line is asked to quit too.  Returns non-zero on failure.
+ */
+int tcpserver_start(int tcp_port);
+
+/** Wait for the server thread to finish. */
+void tcpserver_wait();
+
+/** Shut the server thread down and wait for it. */
+void tcpserver_stop();
     
 #ifdef __cplusplus
 }
@@ -0,0 +1,290 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+
+/* Tempo and time signature map of the loaded song.  Each lookup is a
+ * binary search over the changes recorded by the loader.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tempomap.h"
+#include "memstats.h"
+
+void tempomap_add_tempo( jpmidi_root_t* root)
+{
+    jpmidi_tempo_t tempo;
+    GArray* tempos = root->tempos;
+
+    tempo.smf_time = root->xtempo_tick;
+    tempo.frame = root->xtempo_frame;
+    tempo.tempo_mpq = root->tempo_mpq;
+    tempo.samples_per_tick = root->samples_per_tick;
+
+    /* A later change at the same tick replaces the earlier one. */
+    if (tempos->len > 0 && g_array_index( tempos, jpmidi_tempo_t, tempos->len - 1).smf_time == tempo.smf_time)
+        g_array_index( tempos, jpmidi_tempo_t, tempos->len - 1) = tempo;
+    else {
+        g_array_append_val( tempos, tempo);
+        memstats_resize( MEMSTATS_MAPS, sizeof(tempo));
+    }
+}
+
+static uint32_t tempomap_ticks_per_beat( jpmidi_root_t* root, const jpmidi_meter_t* meter)
+{
+    uint32_t ticks = (uint32_t)root->time_base * 4 / meter->denominator;
+    return ticks > 0 ? ticks : 1;
+}
+
+static uint32_t tempomap_ticks_per_bar( jpmidi_root_t* root, const jpmidi_meter_t* meter)
+{
+    return tempomap_ticks_per_beat( root, meter) * meter->numerator;
+}
+
+void tempomap_add_meter( jpmidi_root_t* root, uint32_t smf_time, int numerator, int denominator)
+{
+    jpmidi_meter_t meter;
+    GArray* meters = root->meters;
+
+    if (numerator <= 0 || denominator <= 0) return;
+
+    meter.smf_time = smf_time;
+    meter.bar = 0;
+    meter.numerator = numerator;
+    meter.denominator = denominator;
+
+    if (meters->len > 0) {
+        jpmidi_meter_t* last = &g_array_index( meters, jpmidi_meter_t, meters->len - 1);
+        if (last->smf_time == smf_time) {
+            meter.bar = last->bar;
+            *last = meter;
+            return;
+        }
+        /* A change in the middle of a bar starts a new one. */
+        uint32_t per_bar = tempomap_ticks_per_bar( root, last);
+        meter.bar = last->bar + (smf_time - last->smf_time + per_bar - 1) / per_bar;
+    }
+    g_array_append_val( meters, meter);
+    memstats_resize( MEMSTATS_MAPS, sizeof(meter));
+}
+
+/* The last tempo starting at or before smf_time. */
+static const jpmidi_tempo_t* tempomap_tempo_at_tick( jpmidi_root_t* root, uint32_t smf_time)
+{
+    int low = 0;
+    int high = root->tempos->len;
+
+    if (high == 0) return NULL;
+    while (high - low > 1) {
+        int mid = (low + high) / 2;
+        if (g_array_index( root->tempos, jpmidi_tempo_t, mid).smf_time <= smf_time) low = mid;
+        else high = mid;
+    }
+    return &g_array_index( root->tempos, jpmidi_tempo_t, low);
+}
+
+static const jpmidi_tempo_t* tempomap_tempo_at_frame( jpmidi_root_t* root, jpmidi_frame_t frame)
+{
+    int low = 0;
+    int high = root->tempos->len;
+
+    if (high == 0) return NULL;
+    while (high - low > 1) {
+        int mid = (low + high) / 2;
+        if (g_array_index( root->tempos, jpmidi_tempo_t, mid).frame <= frame) low = mid;
+        else high = mid;
+    }
+    return &g_array_index( root->tempos, jpmidi_tempo_t, low);
+}
+
+/* Index of the last meter starting at or before smf_time, -1 if none. */
+static int tempomap_meter_index( jpmidi_root_t* root, uint32_t smf_time)
+{
+    int low = 0;
+    int high = root->meters->len;
+
+    if (high == 0) return -1;
+    while (high - low > 1) {
+        int mid = (low + high) / 2;
+        if (g_array_index( root->meters, jpmidi_meter_t, mid).smf_time <= smf_time) low = mid;
+        else high = mid;
+    }
+    return low;
+}
+
+jpmidi_frame_t tempomap_tick_to_frame( jpmidi_root_t* root, uint32_t smf_time)
+{
+    const jpmidi_tempo_t* tempo = tempomap_tempo_at_tick( root, smf_time);
+
+    if (tempo == NULL) return (jpmidi_frame_t)(root->samples_per_tick * smf_time);
+    return tempo->frame + (jpmidi_frame_t)(tempo->samples_per_tick * (smf_time - tempo->smf_time));
+}
+
+uint32_t tempomap_frame_to_tick( jpmidi_root_t* root, jpmidi_frame_t frame)
+{
+    const jpmidi_tempo_t* tempo = tempomap_tempo_at_frame( root, frame);
+    uint32_t smf_time;
+
+    if (tempo == NULL) {
+        if (root->samples_per_tick <= 0) return 0;
+        return (uint32_t)(frame / root->samples_per_tick);
+    }
+    smf_time = tempo->smf_time + (uint32_t)((frame - tempo->frame) / tempo->samples_per_tick);
+
+    /* Step back over rounding so the tick is never after frame. */
+    while (smf_time > tempo->smf_time && tempomap_tick_to_frame( root, smf_time) > frame)
+        smf_time--;
+    return smf_time;
+}
+
+void tempomap_tick_to_bbt( jpmidi_root_t* root, uint32_t smf_time, int* bar, int* beat, int* tick)
+{
+    int index = tempomap_meter_index( root, smf_time);
+    jpmidi_meter_t four_four = { 0, 0, 4, 4 };
+    const jpmidi_meter_t* meter = index < 0 ? &four_four : &g_array_index( root->meters, jpmidi_meter_t, index);
+    uint32_t per_beat = tempomap_ticks_per_beat( root, meter);
+    uint32_t per_bar = per_beat * meter->numerator;
+    uint32_t offset = smf_time - meter->smf_time;
+
+    *bar = meter->bar + offset / per_bar + 1;
+    *beat = (offset % per_bar) / per_beat + 1;
+    *tick = offset % per_beat;
+}
+
+int tempomap_bbt_to_tick( jpmidi_root_t* root, int bar, int beat, int tick, uint32_t* smf_time)
+{
+    jpmidi_meter_t four_four = { 0, 0, 4, 4 };
+    const jpmidi_meter_t* meter = &four_four;
+    int low = 0;
+    int high = root->meters->len;
+    uint32_t per_beat;
+
+    if (bar < 1 || beat < 1 || tick < 0) return 1;
+
+    /* Last meter starting at or before the bar. */
+    if (high > 0) {
+        while (high - low > 1) {
+            int mid = (low + high) / 2;
+            if (g_array_index( root->meters, jpmidi_meter_t, mid).bar <= (uint32_t)(bar - 1)) low = mid;
+            else high = mid;
+        }
+        meter = &g_array_index( root->meters, jpmidi_meter_t, low);
+    }
+
+    per_beat = tempomap_ticks_per_beat( root, meter);
+    if (beat > meter->numerator || (uint32_t)tick >= per_beat) return 1;
+
+    *smf_time = meter->smf_time
+        + (uint32_t)(bar - 1 - meter->bar) * per_beat * meter->numerator
+        + (uint32_t)(beat - 1) * per_beat
+        + tick;
+    return 0;
+}
+
+/* Returns the next beat or bar line after smf_time, counting from the
+ * start of the meter in effect, but no later than the next meter
+ * change, which always falls on a bar line.
+ */
+static uint32_t tempomap_next_grid( jpmidi_root_t* root, uint32_t smf_time, int bars)
+{
+    int index = tempomap_meter_index( root, smf_time);
+    jpmidi_meter_t four_four = { 0, 0, 4, 4 };
+    const jpmidi_meter_t* meter = index < 0 ? &four_four : &g_array_index( root->meters, jpmidi_meter_t, index);
+    uint32_t step = bars ? tempomap_ticks_per_bar( root, meter) : tempomap_ticks_per_beat( root, meter);
+    uint32_t next = meter->smf_time + ((smf_time - meter->smf_time) / step + 1) * step;
+
+    if (index >= 0 && index + 1 < (int)root->meters->len) {
+        uint32_t change = g_array_index( root->meters, jpmidi_meter_t, index + 1).smf_time;
+        if (change < next) next = change;
+    }
+    return next;
+}
+
+uint32_t tempomap_next_beat( jpmidi_root_t* root, uint32_t smf_time)
+{
+    return tempomap_next_grid( root, smf_time, 0);
+}
+
+uint32_t tempomap_next_bar( jpmidi_root_t* root, uint32_t smf_time)
+{
+    return tempomap_next_grid( root, smf_time, 1);
+}
+
+/* Convert seconds to a frame, rejecting negative and huge values. */
+static int tempomap_seconds_to_frame( jpmidi_root_t* root, double seconds, jpmidi_frame_t* frame)
+{
+    double frames = seconds * root->sample_rate + 0.5;
+
+    if (seconds < 0 || frames >= (double)INT64_MAX) return 1;
+    *frame = (jpmidi_frame_t)frames;
+    return 0;
+}
+
+int tempomap_parse_position( jpmidi_root_t* root, const char* text, jpmidi_frame_t* frame)
+{
+    unsigned int hours = 0, minutes = 0, number;
+    unsigned long long frame_number;
+    int bar, beat, tick = 0;
+    double seconds;
+    int end = 0;
+    int len = strlen( text);
+    uint32_t smf_time;
+
+    if (len == 0) return 1;
+
+    if (text[0] == '@') {
+        jpmidi_text_t* marker = jpmidi_find_marker( root, text + 1);
+        if (marker == NULL) return 1;
+        *frame = marker->frame;
+        return 0;
+    }
+
+    if (strchr( text, '|')) {
+        if (!(sscanf( text, "%d|%d|%d%n", &bar, &beat, &tick, &end) == 3 && end == len) &&
+            !(sscanf( text, "%d|%d%n", &bar, &beat, &end) == 2 && end == len))
+            return 1;
+        if (tempomap_bbt_to_tick( root, bar, beat, tick, &smf_time)) return 1;
+        *frame = tempomap_tick_to_frame( root, smf_time);
+        return 0;
+    }
+
+    if (strchr( text, ':')) {
+        if (sscanf( text, "%u:%u:%lf%n", &hours, &minutes, &seconds, &end) == 3 && end == len) {
+            if (minutes >= 60) return 1;
+        }
+        else {
+            hours = 0;
+            if (!(sscanf( text, "%u:%lf%n", &minutes, &seconds, &end) == 2 && end == len)) return 1;
+        }
+        if (seconds >= 60) return 1;
+        return tempomap_seconds_to_frame( root, hours * 3600.0 + minutes * 60.0 + seconds, frame);
+    }
+
+    if (text[len - 1] == 's') {
+        if (!(sscanf( text, "%lf%n", &seconds, &end) == 1 && end == len - 1)) return 1;
+        return tempomap_seconds_to_frame( root, seconds, frame);
+    }
+
+    if (text[len - 1] == 't') {
+        if (!(sscanf( text, "%u%n", &number, &end) == 1 && end == len - 1) || text[0] == '-') return 1;
+        *frame = tempomap_tick_to_frame( root, number);
+        return 0;
+    }
+
+    if (!(sscanf( text, "%llu%n", &frame_number, &end) == 1 && end == len) || text[0] == '-') return 1;
+    *frame = frame_number;
+    return 0;
+}
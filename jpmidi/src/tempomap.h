@@ -0,0 +1,74 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+#ifndef __tempomap_h__
+#define __tempomap_h__
+
+/* Definitions generated by autotools. */
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include "jpmidi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Record the loader's current tempo as starting at root->xtempo_tick.
+ *  Called by the loader at the header and at each tempo change.
+ */
+void tempomap_add_tempo( jpmidi_root_t* root);
+
+/** Record a time signature change at smf_time.  Called by the loader,
+ *  in time order.
+ */
+void tempomap_add_meter( jpmidi_root_t* root, uint32_t smf_time, int numerator, int denominator);
+
+/** Returns the frame of an SMF tick, the same frame the loader gives
+ *  events at that tick.
+ */
+jpmidi_frame_t tempomap_tick_to_frame( jpmidi_root_t* root, uint32_t smf_time);
+
+/** Returns the SMF tick at or just before frame. */
+uint32_t tempomap_frame_to_tick( jpmidi_root_t* root, jpmidi_frame_t frame);
+
+/** Convert an SMF tick to a 1-based bar and beat and a tick within the
+ *  beat.
+ */
+void tempomap_tick_to_bbt( jpmidi_root_t* root, uint32_t smf_time, int* bar, int* beat, int* tick);
+
+/** Convert a 1-based bar and beat and a tick within the beat to an SMF
+ *  tick.  Returns 1 if the beat or tick does not exist in that bar.
+ */
+int tempomap_bbt_to_tick( jpmidi_root_t* root, int bar, int beat, int tick, uint32_t* smf_time);
+
+/** Returns the tick of the first beat strictly after smf_time. */
+uint32_t tempomap_next_beat( jpmidi_root_t* root, uint32_t smf_time);
+
+/** Returns the tick of the first bar line strictly after smf_time. */
+uint32_t tempomap_next_bar( jpmidi_root_t* root, uint32_t smf_time);
+
+/** Parse a song position into a frame.  Accepted forms are a frame
+ *  number, <n>t for an SMF tick, <bar>|<beat>[|<tick>], <n>s for
+ *  seconds, [hh:]mm:ss[.ms] and @<marker or cue name>.  Returns 1 if
+ *  the text is not a position in this song.
+ */
+int tempomap_parse_position( jpmidi_root_t* root, const char* text, jpmidi_frame_t* frame);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __tempomap_h__ */
@@ -0,0 +1,246 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+
+/* Tests of export_song(): the binary format reads back to the events
+ * of the song, long sysex messages included, and the threaded export
+ * writes the same bytes as the single threaded one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include "export.h"
+#include "jpmidi.h"
+#include "jackclient.h"
+#include "main.h"
+#include "testutil.h"
+
+#define NOTES 2000
+#define SYSEX_LENGTH 70000
+#define SAMPLE_RATE 48000
+
+jpmidi_root_t* main_get_jpmidi_root()
+{
+    return NULL;
+}
+
+int main_is_jack_client()
+{
+    return 0;
+}
+
+int jackclient_apply_transform( const transform_settings_t* settings)
+{
+    return 0;
+}
+
+/* Append a variable length number. */
+static void put_var( GByteArray* track, guint32 value)
+{
+    guint8 bytes[5];
+    int n = 0;
+
+    bytes[n++] = value & 0x7F;
+    while (value >>= 7) bytes[n++] = 0x80 | (value & 0x7F);
+    while (n) g_byte_array_append( track, &bytes[--n], 1);
+}
+
+/* A song at 120 bpm with NOTES notes a sixteenth apart on channel 4,
+ * and a sysex message of SYSEX_LENGTH bytes after a beat.
+ */
+static char* write_song()
+{
+    static const unsigned char tempo[] = { 0x00, 0xFF, 0x51, 0x03, 0x07, 0xA1, 0x20 };
+    GByteArray* smf = testutil_smf_new( 1, 96);
+    GByteArray* track = g_byte_array_new();
+    guint8 event[3];
+    int i;
+
+    testutil_smf_track( smf, tempo, sizeof(tempo));
+
+    for (i = 0; i < NOTES; i++) {
+        put_var( track, i ? 12 : 0);
+        event[0] = 0x93;
+        event[1] = 36 + i % 48;
+        event[2] = 100;
+        g_byte_array_append( track, event, 3);
+        put_var( track, 12);
+        event[0] = 0x83;
+        event[2] = 0;
+        g_byte_array_append( track, event, 3);
+    }
+    testutil_smf_track( smf, track->data, track->len);
+
+    g_byte_array_set_size( track, 0);
+    put_var( track, 96);
+    event[0] = 0xF0;
+    g_byte_array_append( track, event, 1);
+    put_var( track, SYSEX_LENGTH);
+    for (i = 0; i < SYSEX_LENGTH - 1; i++) {
+        event[0] = i & 0x7F;
+        g_byte_array_append( track, event, 1);
+    }
+    event[0] = 0xF7;
+    g_byte_array_append( track, event, 1);
+    testutil_smf_track( smf, track->data, track->len);
+
+    g_byte_array_free( track, TRUE);
+    return testutil_smf_write( smf, "test_export");
+}
+
+/* Export in format with threads, returns the file's bytes. */
+static GByteArray* export_to( jpmidi_root_t* root, export_format_t format, int threads, uint64_t* count)
+{
+    char* name = g_strdup_printf( "test_export-%d.out", (int)getpid());
+    GByteArray* bytes = NULL;
+    gchar* contents;
+    gsize length;
+
+    CHECK(export_song( root, name, format, threads, count) == 0);
+    if (g_file_get_contents( name, &contents, &length, NULL)) {
+        bytes = g_byte_array_new();
+        g_byte_array_append( bytes, (guint8*)contents, length);
+        g_free( contents);
+    }
+    unlink( name);
+    g_free( name);
+    CHECK(bytes != NULL);
+    return bytes;
+}
+
+static uint64_t get_le( const guint8* p, int bytes)
+{
+    uint64_t value = 0;
+    while (bytes--) value = value << 8 | p[bytes];
+    return value;
+}
+
+static int count_lines( GByteArray* bytes)
+{
+    int i, lines = 0;
+    for (i = 0; i < bytes->len; i++)
+        if (bytes->data[i] == '\n') lines++;
+    return lines;
+}
+
+/* Read the binary export back and compare it with the song. */
+static void check_binary( GByteArray* bytes, uint64_t count)
+{
+    const guint8* p = bytes->data;
+    const guint8* end = bytes->data + bytes->len;
+    uint64_t records = 0;
+    uint32_t last_tick = 0;
+    int notes = 0, sysex = 0;
+
+    CHECK(bytes->len >= 32);
+    if (bytes->len < 32) return;
+    CHECK(memcmp( p, "JPMIDIEV", 8) == 0);
+    CHECK(get_le( p + 8, 4) == 3);
+    CHECK(get_le( p + 12, 4) == SAMPLE_RATE);
+    CHECK(get_le( p + 16, 2) == 96);
+    CHECK(get_le( p + 20, 8) == count);
+    p += 32;
+
+    while (end - p >= 18) {
+        uint32_t tick = get_le( p, 4);
+        uint64_t frame = get_le( p + 4, 8);
+        int channel = p[12];
+        int status = p[13];
+        uint32_t len = get_le( p + 14, 4);
+        const guint8* data = p + 18;
+
+        if (len > (uint64_t)(end - data)) break;
+        CHECK(tick >= last_tick);
+        CHECK(frame == (uint64_t)tick * SAMPLE_RATE / 192);
+        last_tick = tick;
+
+        if (status == 0x90 && data[2] != 0) {
+            CHECK(channel == 3);
+            CHECK(len == 3 && data[0] == 0x93);
+            CHECK(tick == notes * 24);
+            CHECK(data[1] == 36 + notes % 48);
+            notes++;
+        }
+        if (status == 0xF0) {
+            CHECK(channel == 0xFF);
+            CHECK(tick == 96);
+            CHECK(len == SYSEX_LENGTH + 1);
+            CHECK(data[0] == 0xF0 && data[len - 1] == 0xF7);
+            CHECK(data[1] == 0 && data[len - 2] == ((SYSEX_LENGTH - 2) & 0x7F));
+            sysex++;
+        }
+        records++;
+        p = data + len;
+    }
+
+    CHECK(p == end);
+    CHECK(records == count);
+    CHECK(notes == NOTES);
+    CHECK(sysex == 1);
+}
+
+static void test_formats( jpmidi_root_t* root)
+{
+    GByteArray* single;
+    GByteArray* threaded;
+    uint64_t count, threaded_count;
+
+    single = export_to( root, EXPORT_BINARY, 1, &count);
+    CHECK(count >= 2 * NOTES + 1);
+    if (single) check_binary( single, count);
+
+    // Ranges formatted apart are written back in order.
+    threaded = export_to( root, EXPORT_BINARY, 4, &threaded_count);
+    CHECK(threaded_count == count);
+    CHECK(single && threaded && single->len == threaded->len
+          && memcmp( single->data, threaded->data, single->len) == 0);
+    if (single) g_byte_array_free( single, TRUE);
+    if (threaded) g_byte_array_free( threaded, TRUE);
+
+    single = export_to( root, EXPORT_CSV, 1, &count);
+    threaded = export_to( root, EXPORT_CSV, 4, &threaded_count);
+    CHECK(single && count_lines( single) == count + 1);
+    CHECK(single && memcmp( single->data, "tick,frame,channel,status,length,data\n", 38) == 0);
+    CHECK(single && threaded && single->len == threaded->len
+          && memcmp( single->data, threaded->data, single->len) == 0);
+    if (single) g_byte_array_free( single, TRUE);
+    if (threaded) g_byte_array_free( threaded, TRUE);
+
+    single = export_to( root, EXPORT_JSONL, 4, &count);
+    CHECK(single && count_lines( single) == count);
+    CHECK(single && memcmp( single->data, "{\"tick\":0,\"frame\":0,", 20) == 0);
+    if (single) g_byte_array_free( single, TRUE);
+}
+
+int main( int argc, char** argv)
+{
+    jpmidi_root_t* root;
+    char* name;
+
+    jpmidi_init();
+    name = write_song();
+    root = jpmidi_loadfile( name, SAMPLE_RATE);
+    CHECK(root != NULL);
+    if (root != NULL) {
+        test_formats( root);
+        jpmidi_root_free( root);
+    }
+    unlink( name);
+    g_free( name);
+    return testutil_result( "test_export");
+}
@@ -0,0 +1,229 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+
+/* Tests of midi_read_tracks(): reading a file again reuses the tracks
+ * whose chunks did not change, the previous tree can be detached and
+ * freed while the new one lives on, and bad files raise an exception.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include "elements.h"
+#include "except.h"
+#include "midi.h"
+#include "testutil.h"
+
+/* Tempo track: 120 bpm. */
+static const unsigned char tempo_events[] = {
+    0x00, 0xFF, 0x51, 0x03, 0x07, 0xA1, 0x20,
+};
+
+/* A note on channel 1. */
+static const unsigned char first_events[] = {
+    0x00, 0x90, 60, 100,
+    0x60, 0x80, 60, 0,
+};
+
+/* A note on channel 2, the note number is changed between reads. */
+static unsigned char second_events[] = {
+    0x00, 0x91, 64, 100,
+    0x60, 0x81, 64, 0,
+};
+
+/* Arguments and result of an except_catch()'d read. */
+typedef struct read_args
+{
+    char* name;
+    struct midiTracks* previous;
+    struct midiTracks* tracks;
+    struct rootElement* root;
+} read_args_t;
+
+static void read_file( void* arg)
+{
+    read_args_t* args = (read_args_t*)arg;
+    args->root = midi_read_tracks( args->name, args->previous, &args->tracks);
+}
+
+/* Write the song with the second track playing note, less the last
+ * cut bytes.
+ */
+static char* write_song( int note, int cut)
+{
+    GByteArray* smf = testutil_smf_new( 1, 96);
+
+    second_events[2] = second_events[6] = note;
+    testutil_smf_track( smf, tempo_events, sizeof(tempo_events));
+    testutil_smf_track( smf, first_events, sizeof(first_events));
+    testutil_smf_track( smf, second_events, sizeof(second_events));
+    g_byte_array_set_size( smf, smf->len - cut);
+    return testutil_smf_write( smf, "test_midiread");
+}
+
+/* Read name, returns NULL on an exception. */
+static struct rootElement* read_song( char* name, struct midiTracks* previous, struct midiTracks** tracks)
+{
+    read_args_t args = { name, previous, NULL, NULL };
+    char message[256];
+
+    if (except_catch( read_file, &args, message, sizeof(message)) != NULL) return NULL;
+    *tracks = args.tracks;
+    return args.root;
+}
+
+static struct element* song_element( struct rootElement* root, int index)
+{
+    return g_ptr_array_index( MD_CONTAINER(root)->elements, index);
+}
+
+/* The note number of the only note of a track, -1 if there is none. */
+static int track_note( struct element* track)
+{
+    GPtrArray* elements = MD_CONTAINER(track)->elements;
+    int i;
+
+    for (i = 0; i < elements->len; i++) {
+        struct element* el = g_ptr_array_index( elements, i);
+        if (el->type == MD_TYPE_NOTE) return MD_NOTE(el)->note;
+    }
+    return -1;
+}
+
+static void test_reuse()
+{
+    struct midiTracks* first_tracks;
+    struct midiTracks* second_tracks;
+    struct midiTracks* third_tracks;
+    struct rootElement* first;
+    struct rootElement* second;
+    struct rootElement* third;
+    char* name;
+
+    name = write_song( 64, 0);
+    first = read_song( name, NULL, &first_tracks);
+    CHECK(first != NULL);
+    if (first == NULL) return;
+    CHECK(first_tracks->parsed == 3);
+    CHECK(MD_CONTAINER(first)->elements->len == 3);
+    CHECK(track_note( song_element( first, 2)) == 64);
+
+    // Only the changed track is parsed, the others are shared.
+    g_free( name);
+    name = write_song( 67, 0);
+    second = read_song( name, first_tracks, &second_tracks);
+    CHECK(second != NULL);
+    if (second == NULL) return;
+    CHECK(second_tracks->parsed == 1);
+    CHECK(song_element( second, 1) == song_element( first, 1));
+    CHECK(song_element( second, 2) != song_element( first, 2));
+    CHECK(track_note( song_element( second, 2)) == 67);
+    CHECK(MD_CONTAINER(song_element( second, 0))->elements->len == 1);
+    CHECK(g_ptr_array_index( MD_CONTAINER(song_element( second, 0))->elements, 0)
+          == g_ptr_array_index( MD_CONTAINER(song_element( first, 0))->elements, 0));
+
+    // Freeing the detached first tree leaves the second one whole.
+    midi_tracks_detach( first, second_tracks);
+    md_free( MD_ELEMENT(first));
+    midi_tracks_free( first_tracks);
+    CHECK(track_note( song_element( second, 1)) == 60);
+    CHECK(MD_TEMPO(g_ptr_array_index( MD_CONTAINER(song_element( second, 0))->elements, 0))->micro_tempo == 500000);
+
+    // An unchanged file parses nothing.
+    third = read_song( name, second_tracks, &third_tracks);
+    CHECK(third != NULL);
+    if (third == NULL) return;
+    CHECK(third_tracks->parsed == 0);
+    CHECK(song_element( third, 2) == song_element( second, 2));
+
+    // A failed read frees what it parsed but not what it shared.
+    unlink( name);
+    g_free( name);
+    name = write_song( 67, 6);
+    CHECK(read_song( name, third_tracks, &first_tracks) == NULL);
+    CHECK(track_note( song_element( third, 1)) == 60);
+    CHECK(MD_CONTAINER(song_element( third, 0))->elements->len == 1);
+
+    midi_tracks_detach( second, third_tracks);
+    md_free( MD_ELEMENT(second));
+    midi_tracks_free( second_tracks);
+    CHECK(track_note( song_element( third, 1)) == 60);
+    CHECK(track_note( song_element( third, 2)) == 67);
+
+    md_free( MD_ELEMENT(third));
+    midi_tracks_free( third_tracks);
+    unlink( name);
+    g_free( name);
+}
+
+static void test_bad_files()
+{
+    struct midiTracks* tracks;
+    struct rootElement* root;
+    GByteArray* smf;
+    char* name;
+    FILE* fp;
+
+    // Cut short in the middle of the last track.
+    name = write_song( 64, 6);
+    CHECK(read_song( name, NULL, &tracks) == NULL);
+    unlink( name);
+    g_free( name);
+
+    // A track length past the end of the file.
+    smf = testutil_smf_new( 0, 96);
+    testutil_smf_track( smf, first_events, sizeof(first_events));
+    smf->data[18] = 0x7F;
+    name = testutil_smf_write( smf, "test_midiread");
+    CHECK(read_song( name, NULL, &tracks) == NULL);
+    unlink( name);
+    g_free( name);
+
+    // Not a midi file at all, and an empty one.
+    name = g_strdup_printf( "test_midiread-%d.mid", (int)getpid());
+    fp = fopen( name, "wb");
+    CHECK(fp != NULL);
+    if (fp == NULL) return;
+    fputs( "RIFF", fp);
+    fclose( fp);
+    CHECK(read_song( name, NULL, &tracks) == NULL);
+    fp = fopen( name, "wb");
+    fclose( fp);
+    CHECK(read_song( name, NULL, &tracks) == NULL);
+    unlink( name);
+    CHECK(read_song( name, NULL, &tracks) == NULL);
+    g_free( name);
+
+    // A good file still reads after all that.
+    name = write_song( 64, 0);
+    root = read_song( name, NULL, &tracks);
+    CHECK(root != NULL);
+    if (root != NULL) {
+        md_free( MD_ELEMENT(root));
+        midi_tracks_free( tracks);
+    }
+    unlink( name);
+    g_free( name);
+}
+
+int main( int argc, char** argv)
+{
+    test_reuse();
+    test_bad_files();
+    return testutil_result( "test_midiread");
+}
@@ -0,0 +1,229 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+
+/* Tests of the OSC decoder: well formed messages queue their command,
+ * malformed and truncated packets are rejected without reading past
+ * their end.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "osc.h"
+#include "jackclient.h"
+#include "main.h"
+#include "testutil.h"
+
+/* The commands queued by the decoder. */
+static jackclient_rt_command_t sent[16];
+static int sent_count = 0;
+
+int jackclient_rt_command_send( const jackclient_rt_command_t* command)
+{
+    if (sent_count < 16) sent[sent_count] = *command;
+    sent_count++;
+    return 0;
+}
+
+jack_client_t* jackclient_get_client()
+{
+    return NULL;
+}
+
+int main_is_jack_client()
+{
+    return 1;
+}
+
+/* A packet being built, with its length. */
+typedef struct packet
+{
+    unsigned char data[256];
+    int len;
+} packet_t;
+
+static void put_string( packet_t* p, const char* s)
+{
+    int len = strlen( s) + 1;
+    memcpy( p->data + p->len, s, len);
+    p->len += len;
+    while (p->len % 4) p->data[p->len++] = 0;
+}
+
+static void put_word( packet_t* p, uint32_t word)
+{
+    p->data[p->len++] = word >> 24;
+    p->data[p->len++] = word >> 16;
+    p->data[p->len++] = word >> 8;
+    p->data[p->len++] = word;
+}
+
+/* Decode a copy of the packet in a buffer of exactly its length, so a
+ * read past the end is caught by tools such as valgrind.
+ */
+static int decode( const packet_t* p)
+{
+    unsigned char* copy = malloc( p->len ? p->len : 1);
+    int result;
+
+    memcpy( copy, p->data, p->len);
+    sent_count = 0;
+    result = osc_packet( copy, p->len);
+    free( copy);
+    return result;
+}
+
+static void test_messages()
+{
+    packet_t p = { {0}, 0 };
+
+    put_string( &p, "/jpmidi/play");
+    CHECK(decode( &p) == 0);
+    CHECK(sent_count == 1 && sent[0].type == RT_COMMAND_PLAY);
+
+    p.len = 0;
+    put_string( &p, "/jpmidi/mute");
+    put_string( &p, ",ii");
+    put_word( &p, 3);
+    put_word( &p, 1);
+    CHECK(decode( &p) == 0);
+    CHECK(sent_count == 1 && sent[0].type == RT_COMMAND_MUTE && sent[0].channel == 3);
+
+    // A blob and a 64 bit argument before the channel are skipped.
+    p.len = 0;
+    put_string( &p, "/jpmidi/solo");
+    put_string( &p, ",bhi");
+    put_word( &p, 5);
+    put_string( &p, "abcd");
+    put_word( &p, 0);
+    put_word( &p, 0);
+    put_word( &p, 7);
+    CHECK(decode( &p) == 0);
+    CHECK(sent_count == 1 && sent[0].type == RT_COMMAND_SOLO && sent[0].channel == 7);
+
+    p.len = 0;
+    put_string( &p, "/jpmidi/nothing");
+    CHECK(decode( &p) != 0);
+    CHECK(sent_count == 0);
+}
+
+static void test_malformed()
+{
+    packet_t p = { {0}, 0 };
+
+    // Address without its terminating zero.
+    memcpy( p.data, "/jpmidi/play", 12);
+    p.len = 12;
+    CHECK(decode( &p) != 0);
+
+    // Blob sizes near 2^32 must not wrap the position.
+    p.len = 0;
+    put_string( &p, "/jpmidi/mute");
+    put_string( &p, ",bi");
+    put_word( &p, 0xFFFFFFFE);
+    put_word( &p, 3);
+    CHECK(decode( &p) != 0);
+    CHECK(sent_count == 0);
+
+    // A blob one byte longer than the packet.
+    p.len = 0;
+    put_string( &p, "/jpmidi/mute");
+    put_string( &p, ",b");
+    put_word( &p, 5);
+    put_word( &p, 0);
+    CHECK(decode( &p) != 0);
+
+    // Blob size word cut off.
+    p.len = 0;
+    put_string( &p, "/jpmidi/mute");
+    put_string( &p, ",b");
+    p.data[p.len++] = 0;
+    CHECK(decode( &p) != 0);
+
+    // 64 bit arguments with only 4 bytes left.
+    p.len = 0;
+    put_string( &p, "/jpmidi/mute");
+    put_string( &p, ",hi");
+    put_word( &p, 3);
+    CHECK(decode( &p) != 0);
+    CHECK(sent_count == 0);
+
+    // Integer argument cut off.
+    p.len = 0;
+    put_string( &p, "/jpmidi/mute");
+    put_string( &p, ",i");
+    p.data[p.len++] = 0;
+    p.data[p.len++] = 3;
+    CHECK(decode( &p) != 0);
+    CHECK(sent_count == 0);
+
+    // String argument without its terminating zero.
+    p.len = 0;
+    put_string( &p, "/jpmidi/mute");
+    put_string( &p, ",s");
+    memcpy( p.data + p.len, "abcd", 4);
+    p.len += 4;
+    CHECK(decode( &p) != 0);
+
+    // Type tags without their terminating zero.
+    p.len = 0;
+    put_string( &p, "/jpmidi/mute");
+    memcpy( p.data + p.len, ",iii", 4);
+    p.len += 4;
+    CHECK(decode( &p) != 0);
+}
+
+static void test_bundles()
+{
+    packet_t p = { {0}, 0 };
+    packet_t message = { {0}, 0 };
+
+    put_string( &message, "/jpmidi/stop");
+
+    put_string( &p, "#bundle");
+    put_word( &p, 0);
+    put_word( &p, 1);
+    put_word( &p, message.len);
+    memcpy( p.data + p.len, message.data, message.len);
+    p.len += message.len;
+    CHECK(decode( &p) == 0);
+    CHECK(sent_count == 1 && sent[0].type == RT_COMMAND_STOP);
+
+    // An element larger than what is left of the bundle.
+    p.len = 0;
+    put_string( &p, "#bundle");
+    put_word( &p, 0);
+    put_word( &p, 1);
+    put_word( &p, 0xFFFFFFF0);
+    memcpy( p.data + p.len, message.data, message.len);
+    p.len += message.len;
+    CHECK(decode( &p) != 0);
+    CHECK(sent_count == 0);
+
+    // Bundle header cut off within the time tag.
+    p.len = 0;
+    put_string( &p, "#bundle");
+    put_word( &p, 0);
+    CHECK(decode( &p) == 0);
+    CHECK(sent_count == 0);
+}
+
+int main( int argc, char** argv)
+{
+    test_messages();
+    test_malformed();
+    test_bundles();
+    return testutil_result( "test_osc");
+}
@@ -0,0 +1,84 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+
+/* Helpers shared by the test programs run by 'make check'. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "testutil.h"
+
+int testutil_failures = 0;
+
+int testutil_result( const char* name)
+{
+    if (testutil_failures) {
+        fprintf( stderr, "%s: %d checks failed\n", name, testutil_failures);
+        return 1;
+    }
+    printf( "%s: all checks passed\n", name);
+    return 0;
+}
+
+/* Append a big endian number of the given size. */
+static void testutil_put( GByteArray* smf, guint32 value, int bytes)
+{
+    guint8 byte;
+    while (bytes-- > 0) {
+        byte = (value >> (8 * bytes)) & 0xFF;
+        g_byte_array_append( smf, &byte, 1);
+    }
+}
+
+GByteArray* testutil_smf_new( int format, int time_base)
+{
+    GByteArray* smf = g_byte_array_new();
+
+    g_byte_array_append( smf, (const guint8*)"MThd", 4);
+    testutil_put( smf, 6, 4);
+    testutil_put( smf, format, 2);
+    testutil_put( smf, 0, 2);
+    testutil_put( smf, time_base, 2);
+    return smf;
+}
+
+void testutil_smf_track( GByteArray* smf, const unsigned char* events, int len)
+{
+    static const guint8 end_of_track[] = { 0x00, 0xFF, 0x2F, 0x00 };
+    int tracks = (smf->data[10] << 8 | smf->data[11]) + 1;
+
+    g_byte_array_append( smf, (const guint8*)"MTrk", 4);
+    testutil_put( smf, len + sizeof(end_of_track), 4);
+    g_byte_array_append( smf, events, len);
+    g_byte_array_append( smf, end_of_track, sizeof(end_of_track));
+
+    smf->data[10] = tracks >> 8;
+    smf->data[11] = tracks & 0xFF;
+}
+
+char* testutil_smf_write( GByteArray* smf, const char* name)
+{
+    char* filename = g_strdup_printf( "%s-%d.mid", name, (int)getpid());
+    FILE* fp = fopen( filename, "wb");
+
+    if (fp == NULL || fwrite( smf->data, 1, smf->len, fp) != smf->len) {
+        perror( filename);
+        exit( 1);
+    }
+    fclose( fp);
+    g_byte_array_free( smf, TRUE);
+    return filename;
+}
@@ -0,0 +1,65 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+
+#ifndef __testutil_h__
+#define __testutil_h__
+
+/* Definitions generated by autotools. */
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <glib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Number of failed checks so far. */
+extern int testutil_failures;
+
+/** Report a failed check with where it is, and carry on. */
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf( stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            testutil_failures++; \
+        } \
+    } while (0)
+
+/** Exit status for the test program: 0 when every check passed. */
+int testutil_result( const char* name);
+
+/** Start building a standard MIDI file of the given format and time
+ *  base.  Tracks are added with testutil_smf_track().
+ */
+GByteArray* testutil_smf_new( int format, int time_base);
+
+/** Add a track chunk holding len bytes of events, without the end of
+ *  track event, which is appended.  Updates the track count.
+ */
+void testutil_smf_track( GByteArray* smf, const unsigned char* events, int len);
+
+/** Write smf to a new temporary file and free it.  Returns the file
+ *  name, g_free() it after unlinking the file.
+ */
+char* testutil_smf_write( GByteArray* smf, const char* name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __testutil_h__ */
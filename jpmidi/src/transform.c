@@ -0,0 +1,268 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+
+/* Per channel transforms: velocity scaling and curve, channel remap,
+ * controller remap, a note range and the note-off filter.  They are
+ * compiled into lookup tables with the channel transposes whenever one
+ * of them changes, which leaves a handful of table loads per message
+ * in the process thread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "transform.h"
+#include "jackclient.h"
+#include "jpmidi.h"
+#include "main.h"
+
+/* The current transforms, guarded by settings_lock.  Commands change
+ * them while songs are loaded in the background.
+ */
+static transform_settings_t settings;
+static pthread_mutex_t settings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void transform_channel_default( transform_channel_t* transform, int channel)
+{
+    int i;
+
+    transform->velocity = 100;
+    transform->curve = 1.0;
+    transform->channel = channel;
+    transform->note_low = 0;
+    transform->note_high = 127;
+    transform->note_off = (channel != 9);
+    for (i = 0; i < 128; i++) transform->cc[i] = i;
+}
+
+void transform_init()
+{
+    int i;
+    for (i = 0; i < 16; i++) transform_channel_default( &settings.channel[i], i);
+}
+
+void transform_get( transform_settings_t* copy)
+{
+    pthread_mutex_lock( &settings_lock);
+    *copy = settings;
+    pthread_mutex_unlock( &settings_lock);
+}
+
+void transform_set( const transform_settings_t* copy)
+{
+    pthread_mutex_lock( &settings_lock);
+    settings = *copy;
+    pthread_mutex_unlock( &settings_lock);
+}
+
+void transform_compile_notes( transform_table_t* table, const int* transpose)
+{
+    int channel, i;
+
+    for (channel = 0; channel < 16; channel++)
+    {
+        for (i = 0; i < 128; i++) {
+            int note = i + transpose[channel];
+            table->note[channel][i] = note & 0x7F;
+            table->note_pass[channel][i] = note >= 0 && note <= 127 &&
+                note >= table->note_low[channel] && note <= table->note_high[channel];
+        }
+    }
+}
+
+void transform_compile( transform_table_t* table, const transform_settings_t* settings, const int* transpose)
+{
+    int status, channel, i;
+
+    // Messages without a channel pass unchanged.
+    for (status = 0; status < 256; status++) {
+        table->status[status] = status;
+        table->pass[status] = 1;
+    }
+
+    for (channel = 0; channel < 16; channel++)
+    {
+        const transform_channel_t* t = &settings->channel[channel];
+
+        for (status = 0x80; status < 0xF0; status += 0x10)
+            table->status[status | channel] = status | t->channel;
+        table->pass[0x80 | channel] = t->note_off != 0;
+
+        // Velocity 0 is a note-off and stays one, others stay above it.
+        table->velocity[channel][0] = 0;
+        for (i = 1; i < 128; i++) {
+            int velocity = (int)(pow( i / 127.0, t->curve) * 127.0 * t->velocity / 100.0 + 0.5);
+            table->velocity[channel][i] = velocity < 1 ? 1 : velocity > 127 ? 127 : velocity;
+        }
+
+        for (i = 0; i < 128; i++) {
+            table->cc[channel][i] = t->cc[i] < 0 ? i : t->cc[i];
+            table->cc_pass[channel][i] = t->cc[i] >= 0;
+        }
+
+        table->note_low[channel] = t->note_low;
+        table->note_high[channel] = t->note_high;
+    }
+    transform_compile_notes( table, transpose);
+}
+
+int transform_apply( const transform_table_t* table, unsigned char* data, int len)
+{
+    int status = data[0];
+    int channel = status & 0x0F;
+    int pass = table->pass[status];
+
+    if (len == 3) {
+        int d1 = data[1] & 0x7F;
+        switch (status & 0xF0) {
+        case 0x90:
+            data[2] = table->velocity[channel][data[2] & 0x7F];
+            // fall through, the note too
+        case 0x80:
+        case 0xA0:
+            pass &= table->note_pass[channel][d1];
+            data[1] = table->note[channel][d1];
+            break;
+        case 0xB0:
+            pass &= table->cc_pass[channel][d1];
+            data[1] = table->cc[channel][d1];
+            break;
+        }
+    }
+    data[0] = table->status[status];
+    return pass;
+}
+
+/* Parse a number in min-max at *p, advancing past it.  Returns -1 if
+ * there is none.
+ */
+static int parse_number( char** p, int min, int max)
+{
+    char* end;
+    long n = strtol( *p, &end, 10);
+    if (end == *p || n < min || n > max) return -1;
+    *p = end;
+    return (int)n;
+}
+
+int transform_parse( char* text, transform_channel_t* transform)
+{
+    char* saveptr = NULL;
+    char* setting;
+
+    for (setting = strtok_r( text, " \t", &saveptr); setting; setting = strtok_r( NULL, " \t", &saveptr))
+    {
+        char* value = strchr( setting, '=');
+        char* end;
+        if (value == NULL) return 1;
+        *value++ = '\0';
+
+        if (strcmp( setting, "velocity") == 0) {
+            int percent = parse_number( &value, 1, 1000);
+            if (percent < 0 || *value) return 1;
+            transform->velocity = percent;
+        }
+        else if (strcmp( setting, "curve") == 0) {
+            double curve = strtod( value, &end);
+            if (end == value || *end || curve < 0.1 || curve > 10.0) return 1;
+            transform->curve = curve;
+        }
+        else if (strcmp( setting, "channel") == 0) {
+            int channel = parse_number( &value, 1, 16);
+            if (channel < 0 || *value) return 1;
+            transform->channel = channel - 1;
+        }
+        else if (strcmp( setting, "notes") == 0) {
+            int low = parse_number( &value, 0, 127);
+            if (low < 0 || *value++ != '-') return 1;
+            int high = parse_number( &value, low, 127);
+            if (high < 0 || *value) return 1;
+            transform->note_low = low;
+            transform->note_high = high;
+        }
+        else if (strcmp( setting, "noteoff") == 0) {
+            long enable = strtol( value, &end, 10);
+            if (end == value || *end) return 1;
+            transform->note_off = enable != 0;
+        }
+        else if (strcmp( setting, "cc") == 0) {
+            if (strcmp( value, "none") == 0) {
+                int i;
+                for (i = 0; i < 128; i++) transform->cc[i] = i;
+                continue;
+            }
+            for (;;) {
+                int from = parse_number( &value, 0, 127);
+                if (from < 0 || *value++ != ':') return 1;
+                if (strncmp( value, "off", 3) == 0) {
+                    transform->cc[from] = -1;
+                    value += 3;
+                }
+                else {
+                    int to = parse_number( &value, 0, 127);
+                    if (to < 0) return 1;
+                    transform->cc[from] = to;
+                }
+                if (*value == '\0') break;
+                if (*value++ != ',') return 1;
+            }
+        }
+        else return 1;
+    }
+    return 0;
+}
+
+int transform_channel_equal( const transform_channel_t* a, const transform_channel_t* b)
+{
+    return a->velocity == b->velocity && a->curve == b->curve && a->channel == b->channel &&
+        a->note_low == b->note_low && a->note_high == b->note_high && a->note_off == b->note_off &&
+        memcmp( a->cc, b->cc, sizeof(a->cc)) == 0;
+}
+
+int transform_is_default( const transform_channel_t* transform, int channel)
+{
+    transform_channel_t initial;
+    transform_channel_default( &initial, channel);
+    return transform_channel_equal( transform, &initial);
+}
+
+void transform_print( FILE* out, const transform_channel_t* transform)
+{
+    int i;
+    int first = 1;
+
+    fprintf( out, "velocity=%d curve=%g channel=%d notes=%d-%d noteoff=%d cc=",
+             transform->velocity, transform->curve, transform->channel + 1,
+             transform->note_low, transform->note_high, transform->note_off);
+    for (i = 0; i < 128; i++) {
+        if (transform->cc[i] == i) continue;
+        if (transform->cc[i] < 0) fprintf( out, first ? "%d:off" : ",%d:off", i);
+        else fprintf( out, first ? "%d:%d" : ",%d:%d", i, transform->cc[i]);
+        first = 0;
+    }
+    if (first) fprintf( out, "none");
+}
+
+int transform_apply_settings( const transform_settings_t* copy)
+{
+    if (main_is_jack_client()) return jackclient_apply_transform( copy);
+
+    transform_set( copy);
+    jpmidi_transform_update( main_get_jpmidi_root());
+    return 0;
+}
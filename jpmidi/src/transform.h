@@ -0,0 +1,131 @@
+/*
+ * 
+ * Copyright (C) 2007 Ken Ellinwood.
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ */
+
+#ifndef __transform_h__
+#define __transform_h__
+
+/* Definitions generated by autotools. */
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** How the messages of one channel are adapted on their way out. */
+typedef struct transform_channel
+{
+    int velocity;           /**< Percent note-on velocities are scaled by. */
+    double curve;           /**< Exponent of the velocity curve, 1 is linear. */
+    int channel;            /**< Channel 0-15 the messages go out on. */
+    int note_low;           /**< Notes outside low-high after transposing are dropped. */
+    int note_high;
+    int note_off;           /**< 0 drops note-off messages, the notes end with velocity 0 note-ons. */
+    int16_t cc[128];        /**< Controller each controller goes out as, -1 drops it. */
+} transform_channel_t;
+
+/** The transforms of all 16 channels. */
+typedef struct transform_settings
+{
+    transform_channel_t channel[16];
+} transform_settings_t;
+
+/** Transforms compiled into lookup tables together with the transpose
+ *  of each channel, so a message is adapted with a few loads and no
+ *  decisions depending on the settings.
+ */
+typedef struct transform_table
+{
+    uint8_t status[256];        /**< Status byte sent for each status byte. */
+    uint8_t pass[256];          /**< 0 drops messages with the status byte. */
+    uint8_t note[16][128];      /**< Note sent for each note. */
+    uint8_t note_pass[16][128]; /**< 0 drops the note. */
+    uint8_t velocity[16][128];  /**< Note-on velocity sent for each velocity. */
+    uint8_t cc[16][128];        /**< Controller sent for each controller. */
+    uint8_t note_low[16];       /**< The note range of each channel, kept for transform_compile_notes(). */
+    uint8_t note_high[16];
+    uint8_t cc_pass[16][128];   /**< 0 drops the controller. */
+} transform_table_t;
+
+/** Set up the default transforms.  Note-offs on channel 10 are dropped
+ *  by default, a workaround for fluidsynth.
+ */
+void transform_init();
+
+/** Reset the transform of a channel (0-15) to its default. */
+void transform_channel_default( transform_channel_t* transform, int channel);
+
+/** Copy the current transforms into settings.  Not for the process
+ *  thread, which only sees them compiled.
+ */
+void transform_get( transform_settings_t* settings);
+
+/** Make settings the current transforms.  Tables compiled before keep
+ *  the old ones until they are compiled again.  Not for the process
+ *  thread.
+ */
+void transform_set( const transform_settings_t* settings);
+
+/** Compile transforms and the transpose of each channel into table. */
+void transform_compile( transform_table_t* table, const transform_settings_t* settings, const int* transpose);
+
+/** Compile only the note tables again, for a change of transpose,
+ *  keeping the note ranges table was compiled with.  Cheap enough for
+ *  the process thread.
+ */
+void transform_compile_notes( transform_table_t* table, const int* transpose);
+
+/** Adapt a channel message of at most 3 bytes in place.  Returns 0 if
+ *  the message is dropped.
+ */
+int transform_apply( const transform_table_t* table, unsigned char* data, int len);
+
+/** Change the transform of a channel (0-15) according to space
+ *  separated settings:
+ *
+ *   velocity=<percent>          scale note-on velocities
+ *   curve=<exponent>            velocity curve, below 1 lifts soft notes
+ *   channel=<1-16>              send on another channel
+ *   notes=<low>-<high>          drop notes outside the range
+ *   noteoff=<0|1>               0 drops note-off messages
+ *   cc=<from>:<to|off>,...      send a controller as another or drop it
+ *
+ * Returns 0 on success, 1 if a setting is invalid.
+ */
+int transform_parse( char* settings, transform_channel_t* transform);
+
+/** Returns 1 if two channel transforms are the same. */
+int transform_channel_equal( const transform_channel_t* a, const transform_channel_t* b);
+
+/** Returns 1 if a channel's transform is its default. */
+int transform_is_default( const transform_channel_t* transform, int channel);
+
+/** Print a channel's transform in the form transform_parse() reads. */
+void transform_print( FILE* out, const transform_channel_t* transform);
+
+/** Make settings the current transforms of the song, atomically when
+ * playing through jack.  Returns 0 when they have been applied.
+ */
+int transform_apply_settings( const transform_settings_t* settings);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __transform_h__ */